@@ -0,0 +1,147 @@
+/**
+ * @file crossfade_mixer.h
+ *
+ * @brief Two input PCM mixer that fades the end of one track into the start
+ * of the next. Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef crossfade_mixer_h
+#define crossfade_mixer_h
+
+#define CROSSFADE_INPUTS       2
+#define CROSSFADE_MAX_CHANNELS 2
+#define CROSSFADE_TABLE_SIZE   256       /* Steps in the equal power gain curve */
+#define CROSSFADE_FIFO_SIZE    1024 * 64 /* PCM held per input while fading, in PSRAM */
+#define CROSSFADE_MIX_FRAMES   256       /* Frames mixed per pass */
+#define CROSSFADE_GAIN_SHIFT   12        /* Input gains are Q12, so they can go above unity */
+
+/* The fade is abandoned for a hard cut if decoding both inputs takes more than this share of real time.  It
+isn't judged until this much audio has been mixed, so the first frames of the incoming decoder don't trip it. */
+#define CROSSFADE_CPU_BUDGET_PERCENT 80
+#define CROSSFADE_BUDGET_GRACE_MS    250
+
+#include <Arduino.h>
+#include <atomic>
+#include <audio/ring_buffer.h>
+
+namespace Audio {
+
+/**
+ * Each decoder writes into one of the inputs.  Normally only the active input is wired
+ * through and everything it writes goes straight to the output.  During a fade, both
+ * inputs are held in FIFOs and mix() writes out as many frames as both can supply, with
+ * the outgoing input on a falling gain and the incoming one on a rising gain.  When the
+ * fade completes, the incoming input becomes the active one.
+ *
+ * Each input also has a gain of its own, for loudness normalisation, which changes exactly
+ * where the mixer moves from one input to the other.  An input at unity is passed through
+ * untouched.
+ *
+ * Only the audio task may call into the mixer, except for setGain().
+ */
+class CrossfadeMixer
+{
+  public:
+    CrossfadeMixer();
+    CrossfadeMixer(CrossfadeMixer const&) = delete;
+
+    void begin(Print& output, uint32_t sample_rate = 44100, uint8_t channels = 2); /* Output is 16 bit PCM */
+    void setSampleRate(uint32_t sample_rate) { this->sample_rate = sample_rate; } /* For when the output changes rate */
+    Print& input(uint8_t index) { return inputs[index]; }
+
+    void setActive(uint8_t index); /* Wires an input straight through, ending any fade without mixing */
+    uint8_t getActive() { return active; }
+
+    /* Fades from the active input to the incoming one over the given time.  Returns false if the FIFOs
+    couldn't be allocated, in which case the caller should cut over instead. */
+    bool start(uint8_t incoming, uint32_t duration_ms);
+    void abort(); /* Drops the incoming input and carries on with the outgoing one */
+    void cut();   /* Switches to the incoming input immediately */
+    void endOutgoing() { outgoing_done = true; } /* The outgoing input has nothing more, mix against silence */
+    bool isOutgoingDone() { return outgoing_done; }
+    bool isFading() { return fading; }
+
+    size_t room(uint8_t index); /* Free space in an input FIFO, so the caller knows whether to decode more */
+
+    /* Writes out as much mixed audio as the FIFOs allow.  Returns true once the fade has completed. */
+    bool mix();
+
+    /* Adds time spent decoding for the fade, cutting over if the budget is exceeded */
+    void account(uint32_t busy_us);
+    uint32_t getCuts() { return cuts; }
+
+    /* Bytes of an input that have gone out to the output, mixed or not.  Anything still queued in a FIFO
+    isn't counted, so this follows what's being heard rather than what's been decoded. */
+    uint64_t getDelivered(uint8_t index) { return delivered[index]; }
+    void resetDelivered(uint8_t index) { delivered[index] = 0; }
+
+    /* Brings the active input up from silence over the given time, for when the output has been idle */
+    void rampUp(uint32_t duration_ms);
+
+    /* Sets the gain of an input, safe from any task.  Set it before the input's track starts. */
+    void setGain(uint8_t index, float gain_db);
+
+  private:
+    class Input : public Print
+    {
+      public:
+        CrossfadeMixer* mixer = nullptr;
+        uint8_t index = 0;
+        size_t write(uint8_t data) override { return write(&data, 1); }
+        size_t write(const uint8_t* data, size_t length) override { return mixer->accept(index, data, length); }
+    } inputs[CROSSFADE_INPUTS];
+
+    size_t accept(uint8_t index, const uint8_t* data, size_t length);
+    void complete(); /* Makes the incoming input the active one and passes through whatever it has queued */
+    void drain(uint8_t index);
+    size_t pass(const uint8_t* data, size_t length);  /* Passes the active input through at its gain */
+    size_t scale(const uint8_t* data, size_t length); /* pass() for when the gain isn't unity or is ramping */
+
+    Print* output = nullptr;
+    RingBuffer* fifos[CROSSFADE_INPUTS] = {};
+    int16_t gain_table[CROSSFADE_TABLE_SIZE + 1]; /* sin(0..pi/2) in Q15, the falling gain reads it backwards */
+
+    /* Mixing scratch, kept off the stack of the audio task which the decoders already lean on */
+    int16_t outgoing_samples[CROSSFADE_MIX_FRAMES * CROSSFADE_MAX_CHANNELS];
+    int16_t incoming_samples[CROSSFADE_MIX_FRAMES * CROSSFADE_MAX_CHANNELS];
+    int16_t mixed_samples[CROSSFADE_MIX_FRAMES * CROSSFADE_MAX_CHANNELS];
+
+    uint32_t sample_rate = 44100;
+    uint8_t channels = 2;
+    uint8_t active = 0;
+    uint8_t incoming = 0;
+    bool fading = false;
+    bool outgoing_done = false;
+    uint32_t fade_frames = 0;
+    uint32_t fade_position = 0;
+    uint64_t delivered[CROSSFADE_INPUTS] = {};
+    uint32_t ramp_frames = 0;
+    uint32_t ramp_position = 0;
+    std::atomic<int32_t> gains[CROSSFADE_INPUTS];
+
+    /* Decode time accounting for the current fade */
+    uint64_t busy_us = 0;
+    uint64_t mixed_frames = 0;
+    uint32_t cuts = 0;
+};
+
+} // namespace Audio
+
+#endif
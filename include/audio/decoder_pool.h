@@ -0,0 +1,101 @@
+/**
+ * @file decoder_pool.h
+ *
+ * @brief Owns one pre-initialized instance of every supported decoder and
+ * picks the right one for a file type or a block of stream data. Part of
+ * the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef decoder_pool_h
+#define decoder_pool_h
+
+/* Number of bytes needed by detect() to make a reliable guess */
+#define DECODER_DETECT_BYTES 12
+
+#include <AudioTools.h>
+#include <AudioTools/AudioCodecs/AudioCodecs.h>
+#include <AudioTools/AudioCodecs/CodecFLAC.h>
+#include <AudioTools/AudioCodecs/CodecMP3Helix.h>
+#include <AudioTools/AudioCodecs/CodecOpusOgg.h>
+#include <AudioTools/AudioCodecs/CodecWAV.h>
+#include <audio/subband_spectrum.h>
+#include <atomic>
+
+namespace Audio {
+
+/**
+ * The decoders of one deck.  A decoder carries the state of the stream it was last given, the format
+ * libFLAC took from STREAMINFO or the serial and OpusHead of an Ogg stream, so each one is restarted
+ * before it takes a new stream.  end() and begin() free and allocate codec state, which the audio task
+ * mustn't wait on.  So the audio task retires a decoder it's done with, and the main loop restarts it
+ * with recycle().  A decoder isn't ready again until it has been recycled.
+ */
+class DecoderPool
+{
+  public:
+    /* Points every decoder at the output and starts them.  Call this once at boot, never from the audio task. */
+    void begin(Print& output);
+
+    /* Hands each frame the MP3 decoder writes to the spectrum on its way out, marked as coming from this deck.
+    Does nothing unless SPECTRUM_MP3_SUBBANDS is set. */
+    void setSpectrum(SubbandSpectrum* spectrum, uint8_t deck);
+
+    /* Returns the decoder for one of the FILETYPE_* values, or nullptr if the type can't be decoded */
+    audio_tools::AudioDecoder* get(uint8_t type);
+
+    /* Restarts a decoder straight away so it can take the start of a new stream.  Never from the audio task. */
+    void rearm(audio_tools::AudioDecoder* decoder);
+
+    /* Pushes out whatever the decoder is still holding once the last byte of a stream has been
+    written, then retires it.  Called from the audio task at a gapless splice or the end of a fade. */
+    void finish(audio_tools::AudioDecoder* decoder);
+
+    /* The decoder's stream has been dropped, by a seek or a new file, so it's left for recycle() to restart
+    without flushing.  Safe from the audio task, and does nothing for a decoder from another pool. */
+    void retire(audio_tools::AudioDecoder* decoder);
+
+    /* Restarts every retired decoder, so each starts its next stream with none of the old one's state.  Called
+    from the main loop, it does nothing if there's nothing to restart. */
+    void recycle();
+
+    /* False while the decoder is waiting for recycle(), the audio task holds off writing to it until then */
+    bool isReady(audio_tools::AudioDecoder* decoder) { return !(retired.load() & bitOf(decoder)); }
+
+    /* Sniffs the first bytes of a stream and returns the matching FILETYPE_* value,
+    or FILETYPE_UNKNOWN if nothing matched */
+    static uint8_t detect(const uint8_t* data, size_t length);
+
+  private:
+    uint8_t bitOf(audio_tools::AudioDecoder* decoder); /* The decoder's bit in retired, 0 if it isn't ours */
+    std::atomic<uint8_t> retired{ 0 };                  /* Decoders waiting for recycle() */
+
+#if SPECTRUM_MP3_SUBBANDS
+    SubbandMp3Decoder mp3_decoder;
+#else
+    audio_tools::MP3DecoderHelix mp3_decoder;
+#endif
+    audio_tools::OpusOggDecoder opus_decoder;
+    audio_tools::WAVDecoder wav_decoder;
+    audio_tools::FLACDecoder flac_decoder;
+};
+
+} // namespace Audio
+
+#endif
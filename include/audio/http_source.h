@@ -0,0 +1,146 @@
+/**
+ * @file http_source.h
+ *
+ * @brief HTTP stream that keeps track of its byte offset, so it can be reopened
+ * where it left off or anywhere else in a file.  Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef http_source_h
+#define http_source_h
+
+#define HTTP_DNS_CACHE_SIZE   4
+#define HTTP_DNS_CACHE_TTL_MS 1000 * 60 * 10 /* The Arduino resolver doesn't tell us the record's own TTL */
+#define HTTP_HOST_MAX         64             /* Longer host names aren't cached, and their connections aren't kept */
+#define HTTP_ROOTS_PATH       "/certs/roots.pem" /* Root certificates on the card that HTTPS servers are checked against */
+#define HTTP_ROOTS_MAX        1024 * 256         /* The whole Mozilla bundle is a little over 200 KB */
+
+#include <Arduino.h>
+#include <AudioTools.h>
+#include <WiFi.h>
+#include <audio/icy_demuxer.h>
+#include <audio/tls_client.h>
+
+namespace Audio {
+
+/**
+ * Every request goes out with Range: bytes=N- and Icy-MetaData: 1.  A server that answers with a
+ * Content-Range can be reopened at any offset, which is how a paused file resumes, how a dropped
+ * connection picks up again and how a seek gets to its byte.  A server that ignores the range
+ * sends the file from the start, and the bytes before the offset are read and thrown away.
+ * Radio streams, which have ICY metadata or no length, are live and are reopened wherever the
+ * station has got to.
+ *
+ * The offset is that of the next byte read() will return, in the file.  ICY metadata is taken
+ * out by the demuxer and never counts, though only live streams have any.
+ *
+ * Connections go through a client that looks the host up in a small DNS cache, so replaying
+ * from the same server doesn't wait on a lookup, and HTTPS runs over it on a TlsClient that
+ * resumes the last session it had with the host.  A reply that was read to the end leaves its
+ * connection open if the server allows it, and the next request to the same host goes out on
+ * it without a new handshake of either kind.
+ *
+ * HTTPS servers are authenticated against the root certificates in HTTP_ROOTS_PATH on the card,
+ * which are read the first time an HTTPS stream is opened.  Without that file there's nothing to
+ * check a server against, so certificate validation is off and any server is accepted.
+ *
+ * open() blocks while it connects, so it's called from the network worker.  The rest is for
+ * the task reading the stream.
+ */
+class HttpSource
+{
+  public:
+    struct stats_t
+    {
+        uint32_t requests;      /* Requests that got a reply */
+        uint32_t reused;        /* Of those, how many went out on a kept connection */
+        uint32_t dns_hits;
+        uint32_t dns_misses;
+        uint32_t dns_ms;        /* Time taken by the last lookup that missed the cache */
+        uint32_t connect_ms;    /* Time taken by the last TCP connect, after the lookup */
+        uint32_t first_byte_ms; /* Time from sending the last request to having the reply */
+        uint32_t tls_handshakes;
+        uint32_t tls_resumed;      /* Handshakes that resumed a kept session */
+        uint32_t tls_handshake_ms; /* Time taken by the last handshake */
+    };
+
+    HttpSource();
+    HttpSource(HttpSource const&) = delete;
+
+    bool open(const char* url, uint32_t offset = 0);
+    void close();
+
+    /* Reads up to length bytes of audio, never waiting for the network.  Returns 0 while there's nothing
+    to read, or while the bytes ahead of the offset are being skipped. */
+    size_t read(uint8_t* data, size_t length);
+    int available() { return stream.available(); }
+
+    uint32_t getOffset() { return offset; }
+    uint32_t getLength() { return length; } /* Size of the whole file, 0 if the server didn't say */
+    bool isSeekable() { return seekable; }  /* The server took a range on the last open and the stream isn't live */
+
+    void onTitle(std::function<void(const char* title)> callback) { icy.onTitle(callback); }
+    audio_tools::URLStream& getStream() { return stream; }
+    stats_t getStats();
+
+  private:
+    void loadRoots(); /* Hands the card's root certificates to the TLS client, the first time we need them */
+
+    /* Connects by way of the DNS cache, and times the lookup and the connect */
+    class CachedClient : public WiFiClient
+    {
+      public:
+        HttpSource* source = nullptr;
+        int connect(const char* host, uint16_t port) override { return connect(host, port, _timeout); }
+        int connect(const char* host, uint16_t port, int32_t timeout_ms) override;
+        using WiFiClient::connect;
+    } client, tls_transport;
+    TlsClient secure_client{ tls_transport };
+
+    struct dns_entry_t
+    {
+        char host[HTTP_HOST_MAX];
+        IPAddress ip;
+        uint32_t resolved_at;
+    };
+    bool resolve(const char* host, IPAddress& ip);
+    void forget(const char* host);
+    dns_entry_t dns_cache[HTTP_DNS_CACHE_SIZE] = {};
+
+    audio_tools::URLStream stream;
+    IcyDemuxer icy;
+    uint32_t offset = 0;
+    uint32_t skip = 0; /* Bytes still to throw away when the server ignored the range */
+    uint32_t length = 0;
+    bool seekable = false;
+
+    /* The connection left open by the last reply, if it can carry another request */
+    char kept_origin[HTTP_HOST_MAX] = ""; /* Scheme, host and port of the last request */
+    bool keep_alive = false;              /* The server didn't ask to close the connection */
+    bool kept = false;
+
+    bool roots_loaded = false; /* Tried already, whether or not the card had any */
+
+    stats_t stats = {};
+    uint32_t open_connect_ms = 0; /* Lookup, connect and handshake time within the current open() */
+};
+
+} // namespace Audio
+
+#endif
@@ -0,0 +1,76 @@
+/**
+ * @file icy_demuxer.h
+ *
+ * @brief Separates the ICY metadata blocks of an internet radio stream from the
+ * audio as it's read off the network.  Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef icy_demuxer_h
+#define icy_demuxer_h
+
+#define ICY_METADATA_MAX 4080 /* 255 times 16, the most a length byte can announce */
+
+#include <Arduino.h>
+#include <functional>
+
+namespace Audio {
+
+/**
+ * A SHOUTcast or Icecast server asked for metadata puts a block after every icy-metaint bytes
+ * of audio, a length byte counting 16 byte units and then that many units of text such as
+ * StreamTitle='Artist - Title';, padded with nulls.
+ *
+ * read() never lets a block reach the caller's buffer, rather than taking it out afterwards.
+ * It stops each read of audio at the next block, and reads the block itself into a buffer of
+ * its own on the next call, so the audio goes from the stream to where the caller wants it
+ * and is never moved.  Once a block is complete, a StreamTitle in it goes to the title
+ * callback before any of the audio that follows the block has been handed over.
+ *
+ * read() never waits for the stream, and a block that's only partly arrived is picked up
+ * where it left off on the next call.
+ */
+class IcyDemuxer
+{
+  public:
+    /* Starts a new stream.  0 is for a server that didn't give an interval, whose stream is all audio. */
+    void begin(uint32_t metaint);
+    bool isActive() { return metaint > 0; }
+
+    void onTitle(std::function<void(const char* title)> callback) { title_callback = callback; }
+
+    /* Reads up to length bytes of audio into data, going through a metadata block first if one
+    is due.  Returns the bytes of audio read, which may be none while a block is coming in. */
+    size_t read(Stream& stream, uint8_t* data, size_t length);
+
+  private:
+    bool readMetadata(Stream& stream); /* Returns true once the block is complete */
+    void parse();
+
+    uint32_t metaint = 0;
+    uint32_t audio_left = 0;      /* Bytes of audio before the next block */
+    int32_t metadata_length = -1; /* Size of the block being read, -1 until its length byte arrives */
+    uint16_t metadata_read = 0;
+    char metadata[ICY_METADATA_MAX + 1];
+    std::function<void(const char* title)> title_callback;
+};
+
+} // namespace Audio
+
+#endif
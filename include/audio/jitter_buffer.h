@@ -0,0 +1,87 @@
+/**
+ * @file jitter_buffer.h
+ *
+ * @brief Large PSRAM ring for network streams that holds playback back
+ * until enough data has arrived to ride out WiFi hiccups, and adapts its
+ * depth to the jitter it sees. Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef jitter_buffer_h
+#define jitter_buffer_h
+
+/* Total size of the network buffer in bytes, allocated from PSRAM */
+#define NETWORK_BUFFER_SIZE 1024 * 384
+
+/* Bytes that must be buffered before a new stream starts playing.  At 128 kbps this is about four seconds. */
+#define NETWORK_BUFFER_PREROLL     1024 * 64
+#define NETWORK_BUFFER_MIN_PREROLL 1024 * 32
+#define NETWORK_BUFFER_MAX_PREROLL (NETWORK_BUFFER_SIZE / 4) * 3
+
+/* After an underrun, playback resumes once the buffer is this much deeper than the pre-roll */
+#define NETWORK_BUFFER_RESUME_PERCENT 150
+
+/* The pre-roll grows by this much after every underrun, and shrinks by the same amount after
+a quiet period in which the buffer never dipped below half the pre-roll */
+#define NETWORK_BUFFER_ADAPT_STEP   1024 * 16
+#define NETWORK_BUFFER_QUIET_PERIOD 1000 * 60
+
+#include <audio/ring_buffer.h>
+
+namespace Audio {
+
+class JitterBuffer : public RingBuffer
+{
+  public:
+    struct stats_t
+    {
+        uint32_t underruns; /* Times the buffer ran dry while playing */
+        size_t min_fill;    /* Lowest fill level seen in the current quiet period */
+        size_t avg_fill;    /* Running average of the fill level while playing */
+        size_t preroll;     /* Current pre-roll depth */
+    };
+
+    JitterBuffer(size_t size = NETWORK_BUFFER_SIZE, size_t preroll = NETWORK_BUFFER_PREROLL);
+
+    void reset(); /* Call at the start of every stream, holds playback until the pre-roll is reached */
+
+    /* Called by the producer after each fill.  Releases the consumer once the buffer is deep enough
+    and holds it again on an underrun.  Returns true while the consumer is released. */
+    bool update();
+
+    bool isReleased() { return released.load(); } /* The consumer must not drain the buffer unless this is true */
+    void finish(); /* The stream has ended, releases the consumer to play out whatever is left */
+
+    void setPreroll(size_t preroll);
+    size_t getPreroll() { return preroll; }
+    stats_t getStats() { return stats; }
+
+  private:
+    void adapt();
+
+    std::atomic<bool> released{ false };
+    bool rebuffering = false; /* True after an underrun, when we wait for the resume level instead of the pre-roll */
+    size_t preroll;
+    uint32_t quiet_since = 0;
+    stats_t stats = {};
+};
+
+} // namespace Audio
+
+#endif
@@ -0,0 +1,102 @@
+/**
+ * @file level_meter.h
+ *
+ * @brief Peak and RMS level of each output channel, gathered by the output stage.
+ * Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef level_meter_h
+#define level_meter_h
+
+#define LEVEL_METER_MAX_CHANNELS 2
+#define LEVEL_METER_WINDOW_FRAMES 1024 /* Least audio in each reading, about 23 ms at 44.1 kHz */
+
+#include <Arduino.h>
+#include <atomic>
+
+namespace Audio {
+
+/**
+ * A VU style meter for builds that don't want a spectrum.  The output stage already reads and
+ * writes every sample, so it keeps the peak and the sum of squares of each channel as it goes
+ * and hands them over with add() at the end of each block.  Once a window's worth of frames has
+ * built up and the reader has taken the last reading, commit() hands the totals over through a
+ * triple buffer.  Until the reader takes one the totals keep building, so no peak goes unseen
+ * however slowly the meter is read.
+ *
+ * read() turns the totals into dB relative to full scale, a full scale sine reading 0 dB RMS
+ * and 0 dB peak, the same reference as the spectrum.
+ *
+ * Only the task writing the output may call add() and commit(), and only one task may call read().
+ */
+class LevelMeter
+{
+  public:
+    typedef struct
+    {
+        uint8_t channels;
+        float peak[LEVEL_METER_MAX_CHANNELS]; /* dB */
+        float rms[LEVEL_METER_MAX_CHANNELS];  /* dB */
+    } levels_t;
+
+    LevelMeter() = default;
+    LevelMeter(LevelMeter const&) = delete;
+
+    void begin(uint8_t channels = 2);
+
+    /* Audio task side, add() for each channel of a block and then commit() with its length */
+    void add(uint8_t channel, int32_t peak, uint64_t squares)
+    {
+        if (peak > peaks[channel]) {
+            peaks[channel] = peak;
+        }
+        this->squares[channel] += squares;
+    }
+    void commit(uint32_t frames);
+
+    /* Returns false if there's no new reading since the last call, in which case levels is left alone */
+    bool read(levels_t& levels);
+
+  private:
+    typedef struct
+    {
+        uint16_t peak[LEVEL_METER_MAX_CHANNELS];
+        float mean_square[LEVEL_METER_MAX_CHANNELS];
+    } reading_t;
+
+    /* Audio task side */
+    uint8_t channels = 2;
+    int32_t peaks[LEVEL_METER_MAX_CHANNELS] = {};
+    uint64_t squares[LEVEL_METER_MAX_CHANNELS] = {};
+    uint32_t frames = 0;
+    uint8_t back = 2;
+
+    /* Triple buffer, the middle index has METER_FRESH set when it holds a reading the reader hasn't seen */
+    static const uint8_t METER_FRESH = 0x80;
+    reading_t sets[3];
+    std::atomic<uint8_t> middle{ 1 };
+
+    /* Reader side */
+    uint8_t front = 0;
+};
+
+} // namespace Audio
+
+#endif
@@ -0,0 +1,90 @@
+/**
+ * @file loudness_meter.h
+ *
+ * @brief Integrated loudness of a track, measured the EBU R128 way.
+ * Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef loudness_meter_h
+#define loudness_meter_h
+
+#define LOUDNESS_MAX_CHANNELS   2
+#define LOUDNESS_ABSOLUTE_GATE  -70 /* LUFS, blocks quieter than this are silence */
+#define LOUDNESS_RELATIVE_GATE  -10 /* LU below the level of the blocks past the absolute gate */
+#define LOUDNESS_HISTOGRAM_TOP  5   /* LUFS, louder blocks are counted in the top bin */
+#define LOUDNESS_HISTOGRAM_STEP 10  /* Bins per LU */
+#define LOUDNESS_HISTOGRAM_BINS ((LOUDNESS_HISTOGRAM_TOP - LOUDNESS_ABSOLUTE_GATE) * LOUDNESS_HISTOGRAM_STEP)
+
+#include <Arduino.h>
+
+namespace Audio {
+
+/**
+ * The audio is K-weighted, a high shelf for the head followed by a high pass, and its power
+ * is measured over 400 ms blocks that overlap by 75%.  The integrated loudness is the level
+ * of the blocks left after gating out silence and then everything 10 LU below the rest, per
+ * ITU-R BS.1770.  Rather than keep every block, each one is counted in a histogram bin a tenth
+ * of an LU wide, which puts the result within 0.05 LU of the exact figure in a few KB.
+ *
+ * write() takes 16 bit PCM in whole frames, anything left over is dropped.  It's a sink, nothing
+ * is passed on.
+ */
+class LoudnessMeter : public Print
+{
+  public:
+    LoudnessMeter() = default;
+    LoudnessMeter(LoudnessMeter const&) = delete;
+
+    void begin(uint32_t sample_rate = 44100, uint8_t channels = 2); /* Also starts a new measurement */
+    void reset();                                                   /* Starts a new measurement in the same format */
+    uint32_t getSampleRate() { return sample_rate; }
+    uint8_t getChannels() { return channels; }
+
+    size_t write(const uint8_t* data, size_t length) override;
+    size_t write(uint8_t byte) override { return write(&byte, 1); }
+    int availableForWrite() override { return 1024; }
+
+    float getIntegrated(); /* LUFS, NAN if nothing got past the gates */
+    float getPeak() { return peak / 32768.0f; } /* Largest sample, 1 is full scale */
+
+  private:
+    void endStep(); /* Closes a 100 ms step, and the block it completes */
+
+    uint32_t sample_rate = 44100;
+    uint8_t channels = 2;
+
+    /* K-weighting, two biquads per channel in transposed direct form II */
+    float coefficients[2][5]; /* b0 b1 b2 a1 a2 for each stage */
+    float state[LOUDNESS_MAX_CHANNELS][2][2] = {};
+
+    /* The power of each of the last four steps, a block is their average */
+    uint32_t step_frames = 4410;
+    uint32_t step_position = 0;
+    float step_power = 0;
+    float steps[4] = {};
+    uint32_t step_count = 0;
+
+    uint32_t histogram[LOUDNESS_HISTOGRAM_BINS] = {};
+    int32_t peak = 0;
+};
+
+} // namespace Audio
+
+#endif
@@ -0,0 +1,117 @@
+/**
+ * @file loudness_scanner.h
+ *
+ * @brief Background pass that measures the loudness of the files in a directory.
+ * Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef loudness_scanner_h
+#define loudness_scanner_h
+
+#define LOUDNESS_TARGET_LUFS -18   /* The ReplayGain 2 reference level, tracks are brought to this */
+#define LOUDNESS_MAX_GAIN_DB 12    /* Gains are clamped to this either way */
+#define LOUDNESS_SCAN_CHUNK  2048  /* Bytes read from the card and decoded at a time */
+#define LOUDNESS_SCAN_STACK  12288 /* SQLite and the decoders both need the room */
+
+#include <Arduino.h>
+#include <AudioTools/Concurrency/Mutex.h>
+#include <atomic>
+#include <functional>
+#include <audio/decoder_pool.h>
+#include <audio/loudness_meter.h>
+#include <audio/tag_reader.h>
+#include <string>
+#include <vector>
+
+namespace Audio {
+
+/**
+ * Works through the files table of a directory's .index.db and fills in the gain column of every
+ * track that doesn't have one yet, so the transport can look it up when it loads the track instead
+ * of measuring it.  A track with ReplayGain tags gets the gain from them.  Anything else is decoded
+ * from start to finish into a LoudnessMeter, with decoders of its own that only exist while a
+ * directory is being scanned.  A track the decoder makes nothing of gets a gain of 0 dB so it isn't
+ * tried again, while one that couldn't be read is left without a gain for the next scan to retry.
+ * The gains go with the index, so a directory whose index is regenerated is scanned again.
+ *
+ * The scan runs in a task of its own at idle priority on the second core, so it only gets the time
+ * the transport and UI leave over.  It holds the SD card mutex only while it reads a chunk.  Other
+ * reads and writes of an index that shouldn't hold up the task they come from are run on it as well,
+ * in between chunks of a scan.
+ */
+class LoudnessScanner
+{
+  public:
+    LoudnessScanner() = default;
+    LoudnessScanner(LoudnessScanner const&) = delete;
+
+    void begin(); /* Starts the task, at boot */
+
+    /* Scans the directory, dropping whatever directory was being scanned.  Safe from any task. */
+    void scan(const char* directory);
+
+    /* Stops the scan without starting another, before an index is rebuilt from under it.  Safe from any task. */
+    void cancel();
+
+    /* Runs a read or write of an index on the scan task, as soon as it's between chunks.  Safe from any task. */
+    void defer(std::function<void()> write);
+
+    /* The gain stored for a file, false if the directory has no index or the file hasn't been scanned */
+    static bool lookup(const char* directory, const char* filename, float* gain_db);
+
+    /* The ReplayGain gain of a file from its tags, NAN if it hasn't got one */
+    static float fromTags(const tags_t& tags);
+
+  private:
+    /* Hands the decoder's output to the meter, starting the meter again if the format changes */
+    class Feed : public Print
+    {
+      public:
+        LoudnessMeter meter;
+        audio_tools::AudioDecoder* decoder = nullptr;
+        size_t write(const uint8_t* data, size_t length) override;
+        size_t write(uint8_t byte) override { return write(&byte, 1); }
+        int availableForWrite() override { return LOUDNESS_SCAN_CHUNK * 8; }
+    };
+
+    static void task(void* scanner);
+    void run(const std::string& directory);
+    void runDeferred();
+    bool next(const std::string& db_path, int64_t* id, std::string* filename, uint8_t* type); /* The next file after id */
+    bool store(const std::string& db_path, const std::string& filename, float gain_db);
+    bool measure(const std::string& path, uint8_t type, float* gain_db); /* False if the file couldn't be read */
+    static float limit(float gain_db, float peak); /* Keeps the gain in range, and the peak below full scale */
+
+    TaskHandle_t handle = nullptr;
+    audio_tools::Mutex request_mutex;
+    std::string request;              /* Directory to scan next, empty for none, guarded by request_mutex */
+    std::atomic<bool> pending{ false }; /* A new request has come in, the current scan gives up */
+    std::vector<std::function<void()>> deferred; /* Guarded by request_mutex */
+    std::atomic<bool> deferred_pending{ false };
+
+    /* Only touched by the task */
+    DecoderPool* decoders = nullptr;
+    Feed feed;
+    uint8_t buffer[LOUDNESS_SCAN_CHUNK];
+};
+
+} // namespace Audio
+
+#endif
@@ -0,0 +1,92 @@
+/**
+ * @file network_worker.h
+ *
+ * @brief Long-lived task that opens and closes network streams for the
+ * transport.  Part of the audio library.
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef network_worker_h
+#define network_worker_h
+
+#define NETWORK_WORKER_STACK 8192
+
+#include <Arduino.h>
+#include <AudioTools/Concurrency/Mutex.h>
+#include <atomic>
+#include <audio/http_source.h>
+#include <functional>
+#include <string>
+
+namespace Audio {
+
+/**
+ * Connecting blocks for as long as the lookup, the handshake and the server's reply take, so it's done
+ * here rather than in the transport's loop.  The task is started once at boot and sleeps until it's
+ * given a command.  Only the latest command matters: an open replaces one that hasn't started, and a
+ * close cancels it, so a burst of seeks ends up as a single connection.  open() on the source drops
+ * the previous connection itself, so nothing is lost when a close is replaced by an open.
+ *
+ * The result of an open is reported through the callback, from the worker's task, unless another
+ * command has come in since.  Reading the stream is left to the transport, which must not read while
+ * a command is outstanding.
+ */
+class NetworkWorker
+{
+  public:
+    NetworkWorker(HttpSource& source)
+      : source(source)
+    {
+    }
+    NetworkWorker(NetworkWorker const&) = delete;
+
+    void begin(); /* Starts the task, at boot */
+
+    /* Both are safe from any task and return straight away */
+    void open(const char* url, uint32_t offset = 0);
+    void close();
+
+    void onOpened(std::function<void(bool opened)> callback) { opened = callback; }
+
+  private:
+    enum command_type_t : uint8_t
+    {
+        COMMAND_NONE,
+        COMMAND_OPEN,
+        COMMAND_CLOSE
+    };
+
+    static void task(void* worker);
+    void post(uint8_t type, const char* url, uint32_t offset);
+
+    HttpSource& source;
+    TaskHandle_t handle = nullptr;
+    std::function<void(bool opened)> opened;
+
+    /* The next command, guarded by command_mutex */
+    audio_tools::Mutex command_mutex;
+    uint8_t command = COMMAND_NONE;
+    std::string command_url;
+    uint32_t command_offset = 0;
+    std::atomic<uint32_t> command_id{ 0 }; /* Goes up with every command, so a result can tell if it's stale */
+};
+
+} // namespace Audio
+
+#endif
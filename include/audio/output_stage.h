@@ -0,0 +1,102 @@
+/**
+ * @file output_stage.h
+ *
+ * @brief EQ, volume and limiter applied to the output in a single pass.
+ * Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef output_stage_h
+#define output_stage_h
+
+/* Which parts of the stage are built in.  Anything left out costs nothing per sample, with the EQ out the
+controls still work but have no effect, and with the limiter out the output is hard clipped. */
+#ifndef OUTPUT_STAGE_EQ
+#define OUTPUT_STAGE_EQ 1
+#endif
+#ifndef OUTPUT_STAGE_VOLUME
+#define OUTPUT_STAGE_VOLUME 1
+#endif
+#ifndef OUTPUT_STAGE_LIMITER
+#define OUTPUT_STAGE_LIMITER 1
+#endif
+
+/* Builds in the level meter.  The status screen shows it in place of the spectrum, which is then left out. */
+#ifndef OUTPUT_STAGE_METER
+#define OUTPUT_STAGE_METER 0
+#endif
+
+#define OUTPUT_STAGE_MAX_CHANNELS 2
+#define OUTPUT_STAGE_BLOCK_FRAMES 256   /* Frames processed per pass, the volume ramps over one */
+#define OUTPUT_LIMITER_KNEE       29491 /* About -0.9 dBFS, samples above it are bent smoothly towards full scale */
+
+#include <Arduino.h>
+#include <atomic>
+#include <audio/level_meter.h>
+#include <audio/parametric_eq.h>
+
+namespace Audio {
+
+/**
+ * The last processing the audio gets before the UI sounds and I2S.  Each sample is read once,
+ * run through the EQ, scaled by the volume and put through a soft knee limiter, and written
+ * once into the block that goes to the output, so there's no copy or pass per stage.  The
+ * volume and the EQ's headroom are folded into a single gain on the way in.
+ *
+ * A change of volume is a store to an atomic, so setVolume() is safe from any task.  The new
+ * volume is reached over the next block rather than in a step.  The tap, if set, gets the
+ * audio as it came in, for the spectrum analyzer.  The meter, if built in and set, is given
+ * the peak and power of each channel as it goes out.  Only the task writing the output may
+ * call write().
+ */
+class OutputStage : public Print
+{
+  public:
+    OutputStage() = default;
+    OutputStage(OutputStage const&) = delete;
+
+    /* Output is 16 bit PCM.  The EQ is optional, and is left to whoever owns it to begin() and set up. */
+    void begin(Print& output, ParametricEQ* eq = nullptr, uint8_t channels = 2);
+    void setTap(Print* tap) { this->tap = tap; }
+    void setMeter(LevelMeter* meter) { this->meter = meter; }
+    void setVolume(float volume); /* 0 to 1 */
+
+    size_t write(const uint8_t* data, size_t length) override;
+    size_t write(uint8_t byte) override { return write(&byte, 1); }
+    int availableForWrite() override { return output ? output->availableForWrite() : 0; }
+
+  private:
+    void process(const int16_t* in, size_t frames);
+
+    Print* output = nullptr;
+    Print* tap = nullptr;
+    LevelMeter* meter = nullptr;
+    ParametricEQ* eq = nullptr;
+    uint8_t channels = 2;
+
+    std::atomic<int32_t> volume_request{ 0 }; /* Q15, with 32768 as unity so full volume is bit exact */
+
+    /* Only touched by the task writing the output */
+    int32_t volume = 0;
+    int16_t samples[OUTPUT_STAGE_BLOCK_FRAMES * OUTPUT_STAGE_MAX_CHANNELS];
+};
+
+} // namespace Audio
+
+#endif
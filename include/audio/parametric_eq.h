@@ -0,0 +1,143 @@
+/**
+ * @file parametric_eq.h
+ *
+ * @brief Fixed point cascade of parametric biquad filters for the equalizer.
+ * Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef parametric_eq_h
+#define parametric_eq_h
+
+#define EQ_MAX_BANDS    10
+#define EQ_MAX_CHANNELS 2
+#define EQ_MAX_GAIN_DB  15  /* Band gains are clamped to this, which keeps the coefficients inside Q4.28 */
+#define EQ_COEFF_SHIFT  28  /* Coefficients are Q4.28 */
+#define EQ_SIGNAL_SHIFT 8   /* Extra fractional bits the samples carry through the cascade */
+#define EQ_STATE_SIZE   5   /* x1 x2 y1 y2 and the rounding error, per row */
+
+#include <Arduino.h>
+#include <AudioTools/Concurrency/Mutex.h>
+#include <atomic>
+
+namespace Audio {
+
+/**
+ * A cascade of up to EQ_MAX_BANDS biquads in direct form I, run in 32 bit fixed point
+ * with 64 bit accumulators.  Samples carry EQ_SIGNAL_SHIFT bits below the 16 bit LSB
+ * between stages, and each row carries the bits its output drops over into its next
+ * accumulator, which moves the rounding noise up away from DC.  The poles of a low shelf
+ * sit so close to DC that they would otherwise build it up to several LSB of rumble.
+ * The input should be attenuated by the headroom of the set so the cascade can't clip.
+ *
+ * The EQ doesn't touch the stream itself, the output stage runs each sample through
+ * run() along with everything else it does to it.  Bands at 0 dB are left out of the
+ * cascade.  Coefficients are worked out in float by setBand() on the control side and
+ * handed to the audio task through a triple buffer, which it picks up with acquire() at
+ * the start of a block, so a change never lands part way through one.  begin(), setBand()
+ * and setEnabled() hold a mutex, since the transport redesigns the set for a new output
+ * rate from its own task while the menus change the bands from theirs.  acquire() and
+ * run() may only be called from the task writing the output.
+ */
+class ParametricEQ
+{
+  public:
+    enum band_type_t : uint8_t
+    {
+        BAND_OFF,
+        BAND_PEAK,
+        BAND_LOW_SHELF,
+        BAND_HIGH_SHELF
+    };
+
+    struct coefficients_t
+    {
+        uint8_t count = 0;             /* Bands in the cascade */
+        uint8_t bands[EQ_MAX_BANDS];   /* The band each row belongs to, which picks its filter state */
+        int32_t rows[EQ_MAX_BANDS][5]; /* b0 b1 b2 a1 a2, normalised by a0 */
+        int32_t headroom = 32767;      /* Q15 input gain */
+    };
+
+    ParametricEQ() = default;
+    ParametricEQ(ParametricEQ const&) = delete;
+
+    void begin(uint32_t sample_rate = 44100);
+    void setBand(uint8_t band, band_type_t type, float frequency, float gain_db, float q = 0.707f);
+    void setEnabled(bool enabled);
+    bool isEnabled() { return enabled; }
+
+    /* Audio task.  Picks up any new coefficients, carrying the filter state of each band over to its
+    new row.  Bands that have just come into the cascade start from rest. */
+    const coefficients_t& acquire();
+
+    /* Filter state of a channel, one row per row of the set last acquired */
+    int32_t (*getState(uint8_t channel))[EQ_STATE_SIZE] { return state[channel]; }
+
+    /* Runs a sample through the cascade, with EQ_SIGNAL_SHIFT fractional bits in and out.  The caller holds
+    the state pointer for the block so the loop over samples doesn't go back through the EQ for it. */
+    static int32_t run(const coefficients_t& set, int32_t (*state)[EQ_STATE_SIZE], int32_t x)
+    {
+        for (uint8_t row = 0; row < set.count; row++) {
+            const int32_t* c = set.rows[row];
+            int32_t* s = state[row];
+            int64_t acc = (int64_t) s[4] + (int64_t) c[0] * x + (int64_t) c[1] * s[0] + (int64_t) c[2] * s[1] - (int64_t) c[3] * s[2] - (int64_t) c[4] * s[3];
+            int32_t y = (int32_t) (acc >> EQ_COEFF_SHIFT);
+            s[4] = (int32_t) acc & ((1 << EQ_COEFF_SHIFT) - 1);
+            s[1] = s[0];
+            s[0] = x;
+            s[3] = s[2];
+            s[2] = y;
+            x = y;
+        }
+        return x;
+    }
+
+  private:
+    struct band_t
+    {
+        band_type_t type = BAND_OFF;
+        float frequency = 1000;
+        float gain_db = 0;
+        float q = 0.707f;
+    };
+
+    void publish(); /* Works out the coefficients from the settings and hands them to the audio task, with control_mutex held */
+
+    uint32_t sample_rate = 44100;
+
+    /* Control side, guarded by control_mutex */
+    audio_tools::Mutex control_mutex;
+    band_t settings[EQ_MAX_BANDS];
+    bool enabled = true;
+    uint8_t back = 2;
+
+    /* Triple buffer, the middle index has EQ_FRESH set when it holds a set the audio task hasn't seen */
+    static const uint8_t EQ_FRESH = 0x80;
+    coefficients_t sets[3];
+    std::atomic<uint8_t> middle{ 1 };
+
+    /* Audio task side */
+    uint8_t front = 0;
+    int32_t state[EQ_MAX_CHANNELS][EQ_MAX_BANDS][EQ_STATE_SIZE] = {}; /* x1 x2 y1 y2 error, by row */
+};
+
+} // namespace Audio
+
+#endif
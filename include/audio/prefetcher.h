@@ -0,0 +1,119 @@
+/**
+ * @file prefetcher.h
+ *
+ * @brief Reads the loaded file from the SD card in large, sector aligned
+ * blocks on its own task so the main loop never waits on the card. Part of
+ * the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef prefetcher_h
+#define prefetcher_h
+
+/* Block size in bytes, must be a multiple of the 512 byte sector size.  Anything from 16K to 64K
+keeps the card in multi-sector reads, bigger blocks mean fewer trips through the bus lock. */
+#define PREFETCH_BLOCK_SIZE  1024 * 32
+#define PREFETCH_BLOCK_COUNT 3 /* Triple buffered, one draining, one filling, one spare */
+#define PREFETCH_SECTOR_SIZE 512
+#define PREFETCH_TASK_STACK  4096
+
+#include <Arduino.h>
+#include <SdFat.h>
+#include <atomic>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+namespace Audio {
+
+/**
+ * The prefetch task fills blocks and the reader drains them, one block at a time in
+ * order.  Handing a block over is a single atomic counter.  The task holds the fill lock
+ * for the length of one block read, and read() holds the drain lock while it copies.
+ * Only open(), seek() and close() take both, so the reader never waits on the card.
+ */
+class Prefetcher
+{
+  public:
+    struct stats_t
+    {
+        uint32_t bytes;   /* Bytes read from the card */
+        uint32_t reads;   /* Number of block reads */
+        uint32_t read_us; /* Time spent in block reads, including waiting on the bus */
+        uint32_t stalls;  /* Times read() found no block ready before the end of the file */
+    };
+
+    Prefetcher();
+    ~Prefetcher();
+    Prefetcher(Prefetcher const&) = delete;
+
+    void begin();                 /* Allocates the blocks and starts the prefetch task */
+    bool open(const char* path);  /* Opens a file and starts prefetching from the beginning */
+    void close();
+    bool seek(uint32_t position); /* Moves the read position, anything already prefetched is discarded */
+
+    size_t read(uint8_t* data, size_t length); /* Copies out prefetched data, returns 0 if none is ready yet */
+    bool isOpen() { return _open; }
+    bool eof() { return _open && _position >= _size; }
+    bool error() { return _error.load(); }
+    uint32_t size() { return _size; }         /* Cached when the file is opened, the size won't change during playback */
+    uint32_t position() { return _position; } /* Offset of the next byte read() will return */
+
+    void setReaderTask(TaskHandle_t task) { reader_task.store(task); } /* Woken when a block becomes ready */
+
+    stats_t getStats() { return stats; }
+    uint32_t getThroughput(); /* Average card throughput in bytes per second */
+    void resetStats() { stats = {}; }
+
+  private:
+    static void task(void* arg);
+    bool fill(); /* Reads the next block, called from the prefetch task with the fill lock held */
+    void reset(uint32_t position);
+
+    struct block_t
+    {
+        uint8_t* data;
+        size_t length; /* Bytes of valid data in the block */
+        size_t offset; /* Read position within the block */
+    };
+    block_t blocks[PREFETCH_BLOCK_COUNT];
+
+    FsFile file;
+    SemaphoreHandle_t lock = nullptr;       /* Fill side: the file handle and fill_* */
+    SemaphoreHandle_t drain_lock = nullptr; /* Drain side: drain_index and the block offsets */
+    TaskHandle_t task_handle = nullptr;
+    std::atomic<TaskHandle_t> reader_task{ nullptr };
+
+    bool _open = false;
+    uint32_t _size = 0;
+    uint32_t _position = 0;     /* Reader side file position */
+    uint32_t fill_position = 0; /* Prefetch side file position, always sector aligned */
+    uint32_t skip = 0;          /* Bytes to skip in the first block after an unaligned seek */
+    uint8_t fill_index = 0;     /* Next block the task fills */
+    uint8_t drain_index = 0;    /* Next block read() drains */
+    std::atomic<uint8_t> ready{ 0 }; /* Number of filled blocks waiting to be drained */
+    std::atomic<bool> _error{ false };
+
+    stats_t stats = {};
+};
+
+} // namespace Audio
+
+#endif
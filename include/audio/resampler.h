@@ -0,0 +1,149 @@
+/**
+ * @file resampler.h
+ *
+ * @brief Converts decoded PCM to the output sample rate and channel count.
+ * Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef resampler_h
+#define resampler_h
+
+#define RESAMPLER_TAPS         32 /* Filter length in input frames */
+#define RESAMPLER_PHASE_BITS   6
+#define RESAMPLER_PHASES       (1 << RESAMPLER_PHASE_BITS) /* Filter phases per input frame, in between two are interpolated */
+#define RESAMPLER_COEFF_SHIFT  14  /* Q14, so a whole window of full scale samples can't overflow 32 bits */
+#define RESAMPLER_MAX_CHANNELS 2
+#define RESAMPLER_MAX_INPUT_CHANNELS 8 /* Streams with more than this are passed through */
+#define RESAMPLER_BLOCK_FRAMES 256 /* Frames converted per write to the output */
+
+/* The cutoff is this fraction of the lower of the two Nyquist frequencies, the window decides how far
+down the stopband is and how wide the transition */
+#define RESAMPLER_PASSBAND    0.90
+#define RESAMPLER_KAISER_BETA 7.0
+
+#include <Arduino.h>
+#include <AudioTools.h>
+#include <atomic>
+#include <functional>
+
+namespace Audio {
+
+/**
+ * Sits between a decoder and the mixer and brings whatever the decoder puts out to the output's
+ * sample rate and channel count.  Mono is copied to both channels and anything past the second
+ * channel is dropped.  A different rate goes through a polyphase windowed sinc filter in fixed
+ * point.  The filter table is worked out whenever the pair of rates changes, which is once a
+ * track at most, so all that happens per sample is integer multiply and accumulate.  With the
+ * formats matching, write() is a straight pass through.
+ *
+ * The decoder's format is checked on every write, so a change is caught before any of its
+ * samples go through.  The rate change callback is called first and may change the output rate
+ * from inside it, which is how the transport lets the output follow the track instead.
+ *
+ * Only 16 bit PCM is converted, anything else is passed through as it is.
+ *
+ * The encoder delay and padding around an MP3 can be trimmed off as the decoder writes, so one
+ * track runs straight into the next at a gapless splice.
+ *
+ * Only the task the decoder writes from may call into the resampler, apart from setTrim().
+ */
+class Resampler : public Print
+{
+  public:
+    Resampler() = default;
+    Resampler(Resampler const&) = delete;
+
+    void begin(Print& output, uint32_t output_rate = 44100, uint8_t channels = 2); /* Output is 16 bit PCM */
+
+    /* Starts a new stream from this decoder, forgetting anything held over from the last one */
+    void setSource(audio_tools::AudioDecoder* decoder);
+
+    /* Drops the first start frames of the next stream setSource() starts, and everything after the length frames
+    that follow them.  A length of 0 keeps the rest of the stream.  Any task may call this, as long as it's done
+    before the stream is handed over to the audio task. */
+    void setTrim(uint32_t start, uint32_t length);
+
+    /* Called from write() when the decoder reports a new sample rate, before its first samples are converted */
+    void onRateChange(std::function<void(uint32_t sample_rate)> callback) { rate_callback = callback; }
+
+    void setOutputRate(uint32_t sample_rate);
+    uint32_t getOutputRate() { return output_rate; }
+
+    /* Sets the format of what's written, for when there's no decoder to take it from */
+    void setInputFormat(uint32_t sample_rate, uint8_t channels);
+    uint32_t getInputRate() { return input_rate; }
+    bool isResampling() { return resampling; }
+
+    /* Pushes out the frames still held in the filter, at the end of a stream */
+    void flush();
+
+    size_t write(const uint8_t* data, size_t length) override;
+    size_t write(uint8_t byte) override { return write(&byte, 1); }
+    int availableForWrite() override { return output ? output->availableForWrite() : 0; }
+
+  private:
+    void configure(); /* Works out what has to be done to get from the input format to the output */
+    void design();    /* Fills the filter table for the current pair of rates */
+    void reset();     /* Clears the filter history */
+    void convert(const uint8_t* data, size_t frames);
+    void emit(); /* Writes out the frames converted so far */
+
+    Print* output = nullptr;
+    audio_tools::AudioDecoder* decoder = nullptr;
+    std::function<void(uint32_t sample_rate)> rate_callback;
+    uint32_t output_rate = 44100;
+    uint8_t channels = 2;
+    uint32_t input_rate = 0; /* 0 until the format is known, everything passes through until then */
+    uint8_t input_channels = 0;
+    bool converting = false; /* The formats differ */
+    bool resampling = false; /* The rates differ */
+
+    /* Phase p holds the taps for an output p / RESAMPLER_PHASES of the way from the middle of the window
+    to the next input frame.  The extra phase is the first one a frame on, for the interpolation. */
+    int16_t coefficients[RESAMPLER_PHASES + 1][RESAMPLER_TAPS];
+    uint32_t table_input_rate = 0;
+    uint32_t table_output_rate = 0;
+
+    /* Each channel's window is stored twice over so it can always be read as one run, oldest frame first */
+    int16_t history[RESAMPLER_MAX_CHANNELS][RESAMPLER_TAPS * 2];
+    uint8_t head = 0;
+    uint8_t priming = 0; /* Input frames still to come before the first one reaches the middle of the window */
+    uint64_t step = 0;   /* Input frames per output frame, Q32 */
+    uint64_t phase = 0;  /* Position of the next output past the middle of the window, Q32 */
+
+    int16_t block[RESAMPLER_BLOCK_FRAMES * RESAMPLER_MAX_CHANNELS];
+    size_t block_frames = 0;
+    uint8_t carry[RESAMPLER_MAX_INPUT_CHANNELS * sizeof(int16_t)]; /* A frame split across two writes */
+    size_t carry_length = 0;
+
+    /* Trim for the next stream, then what's left of it for this one in bytes, worked out on the first write */
+    std::atomic<uint32_t> next_trim_start{ 0 };
+    std::atomic<uint32_t> next_trim_length{ 0 };
+    uint32_t trim_start = 0;
+    uint32_t trim_length = 0;
+    bool trim_pending = false;
+    uint64_t skip_bytes = 0;
+    uint64_t keep_bytes = 0; /* Only counts down if trim_length isn't 0 */
+};
+
+} // namespace Audio
+
+#endif
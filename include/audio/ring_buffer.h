@@ -0,0 +1,124 @@
+/**
+ * @file ring_buffer.h
+ *
+ * @brief Lock-free single producer/single consumer byte ring used to move
+ * audio data between tasks. Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ring_buffer_h
+#define ring_buffer_h
+
+#define AUDIO_CACHE_LINE_SIZE 64
+
+#include <Arduino.h>
+#include <atomic>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+namespace Audio {
+
+/**
+ * Exactly one task may write and exactly one task may read.  The head index is only
+ * ever stored by the producer and the tail index only by the consumer, so neither
+ * side takes a lock or waits on the other.  The indices run freely and are masked on
+ * access, which is why the size is always rounded up to a power of two.
+ *
+ * clear() is the one call that may come from any task.  It only raises a flag: writes
+ * are refused until the consumer sees the flag and drops everything up to the head.
+ * A clear that lands while the producer is filling a span would otherwise let the old
+ * stream's bytes through after it, so commitWrite() drops a span whose clear generation
+ * has moved on, and the consumer holds off servicing a clear until the span in flight
+ * has been committed.  Every writeSpan() must be followed by a commitWrite(), with 0 if
+ * nothing was written.
+ *
+ * Both sides can sleep on a FreeRTOS task notification instead of polling.  The producer
+ * is woken when the fill level drops to the low water mark, and the consumer is woken
+ * when it rises to the high water mark or when the producer calls flush() at the end
+ * of a stream that is shorter than the high water mark.
+ */
+class RingBuffer
+{
+  public:
+    RingBuffer(size_t size, uint32_t caps = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    ~RingBuffer();
+    RingBuffer(RingBuffer const&) = delete;
+
+    /* Producer side */
+    size_t write(const uint8_t* data, size_t length); /* Copies in as much as fits, returns the number of bytes written */
+    size_t writeSpan(uint8_t** data);                 /* Returns the contiguous free region starting at the head */
+    void commitWrite(size_t length);                  /* Publishes bytes filled in through writeSpan(), unless cleared since */
+    size_t availableForWrite();
+    size_t writePosition() { return head.load(std::memory_order_relaxed); } /* Total bytes ever committed, wraps with size_t */
+
+    /* Consumer side */
+    size_t read(uint8_t* data, size_t length); /* Copies out up to length bytes, returns the number read */
+    size_t readSpan(const uint8_t** data);     /* Returns the contiguous filled region starting at the tail */
+    size_t peek(uint8_t* data, size_t length); /* Like read() but leaves the data in the buffer */
+    void commitRead(size_t length);            /* Releases bytes consumed through readSpan() */
+    size_t available();
+    size_t readPosition() { return tail.load(std::memory_order_relaxed); } /* Comparable with writePosition() */
+
+    /* Any task */
+    void clear();
+    size_t size() { return _size; }
+    size_t fill() { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+    bool isValid() { return buffer != nullptr; }
+
+    /* Wakeups */
+    void setProducerTask(TaskHandle_t task) { producer_task.store(task); }
+    void setConsumerTask(TaskHandle_t task) { consumer_task.store(task); }
+    void setWatermarks(size_t low, size_t high)
+    {
+        low_water = low;
+        high_water = high;
+    }
+    void flush() { notify(consumer_task.load()); } /* Wake the consumer even though the high water mark wasn't reached */
+
+  private:
+    void serviceClear(); /* Consumer side half of clear() */
+    static void notify(TaskHandle_t task)
+    {
+        if (task) {
+            xTaskNotifyGive(task);
+        }
+    }
+
+    size_t low_water = 0;
+    size_t high_water = 1;
+    std::atomic<TaskHandle_t> producer_task{ nullptr };
+    std::atomic<TaskHandle_t> consumer_task{ nullptr };
+
+    uint8_t* buffer = nullptr;
+    size_t _size = 0;
+    size_t _mask = 0;
+
+    /* Keep the indices on their own cache lines so the two cores don't fight over them */
+    alignas(AUDIO_CACHE_LINE_SIZE) std::atomic<size_t> head{ 0 }; /* Stored by the producer only */
+    alignas(AUDIO_CACHE_LINE_SIZE) std::atomic<size_t> tail{ 0 }; /* Stored by the consumer only */
+    alignas(AUDIO_CACHE_LINE_SIZE) std::atomic<bool> clear_requested{ false };
+    std::atomic<uint32_t> clear_generation{ 0 }; /* Goes up with every clear() */
+    std::atomic<bool> writing{ false };          /* The producer has a span it hasn't committed */
+    uint32_t span_generation = 0;                /* Producer only, the generation its span was taken in */
+};
+
+} // namespace Audio
+
+#endif
@@ -0,0 +1,199 @@
+/**
+ * @file seek_index.h
+ *
+ * @brief Maps a play position to a byte offset in MP3, FLAC and WAV files
+ * from their own seek tables, or from a frame index built while the file
+ * plays. Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef seek_index_h
+#define seek_index_h
+
+#define SEEK_INDEX_INTERVAL_MS 1000     /* Spacing of the points in a frame index built during playback */
+#define SEEK_INDEX_PROBE_SIZE  1024 * 4 /* Bytes read from the start of the audio to find the first frame */
+#define SEEK_INDEX_MAX_POINTS  1024 * 8 /* Caps the index at a little over two hours at the default spacing */
+#define SEEK_HEADER_MAX        80       /* Largest stream header header() will write */
+#define SEEK_SCAN_TAIL         16       /* Longest frame header, MP3 needs 4 bytes and FLAC up to 16 */
+#define SEEK_MP3_DECODER_DELAY 529      /* Samples an MP3 decoder's output lags what the encoder was given */
+
+#include <Arduino.h>
+#include <SdFat.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Audio {
+
+/**
+ * open() reads the headers of a file and picks the cheapest way to seek in it:
+ *
+ *  - WAV is plain arithmetic on the block alignment.
+ *  - VBR MP3 uses the 100 entry TOC in a Xing/Info frame, or the table in a VBRI frame.
+ *  - FLAC uses its SEEKTABLE block.
+ *
+ * When a file has none of these, observe() follows the frame headers as the file plays
+ * and records a point every SEEK_INDEX_INTERVAL_MS.  Once it has seen the whole file the
+ * index is stored in the .index.db of the file's directory, so the scan only happens the
+ * first time a file is played.  open() and finish() hand back the read and the write of the
+ * cache rather than doing them, so the SQLite work happens on a background task instead of
+ * the one feeding the audio buffer.  The scan starts straight away and a cached index
+ * replaces it once the read is done.  Until then, positions past the end of the index are
+ * estimated from the average byte rate and the decoder resyncs on the next frame.
+ *
+ * Lookups are a binary search over the points, interpolating between the two either side
+ * of the position, or a direct calculation for WAV and Xing files.  Landing between frames
+ * is fine, the MP3 and FLAC decoders both resync on the next frame header.  Only the task
+ * that feeds the audio buffer may call observe(), finish(), locate() and getDuration().
+ */
+class SeekIndex
+{
+  public:
+    struct point_t
+    {
+        uint32_t sample; /* First sample of the frame */
+        uint32_t offset; /* File offset of the frame header */
+    };
+
+    /* Parses the headers of a file.  The directory holds the .index.db the frame index is cached in.  If the file
+    has no table of its own, load is set to the read of the cache, which may be run from any task. */
+    bool open(const char* path, const char* directory, const char* filename, uint8_t type, std::function<void()>* load);
+    void close();
+
+    /* Finds the file offset to restart decoding from for a position.  The position that offset
+    corresponds to is returned in actual_ms, WAV offsets are rounded down to a whole sample. */
+    bool locate(uint32_t ms, uint32_t* offset, uint32_t* actual_ms);
+
+    /* Writes out a stream header the decoder can be restarted with before data from offset.  Returns 0 for
+    formats that don't need one. */
+    size_t header(uint8_t* buffer, size_t size, uint32_t offset);
+
+    void observe(const uint8_t* data, size_t length, uint32_t position); /* Feeds the frame scan */
+
+    /* The file has been read to the end.  If the scan indexed all of it, store is set to the write that caches
+    the index, which works on a copy of the points and may be run from any task. */
+    void finish(std::function<void()>* store);
+
+    bool isSeekable() { return mode != MODE_NONE; }
+    uint32_t getDuration(); /* Total play time in milliseconds, or 0 if it isn't known */
+    uint32_t getSampleRate() { return sample_rate; }
+
+    /* Samples of decoder output to drop before the first real one, and how many real ones follow, worked out from
+    the encoder delay and padding in the LAME tag of an MP3.  Both are 0 if the file doesn't have one. */
+    uint32_t getTrimStart() { return trim_start; }
+    uint32_t getTrimLength() { return trim_length; }
+
+  private:
+    enum mode_t : uint8_t
+    {
+        MODE_NONE,
+        MODE_WAV,    /* Block aligned arithmetic */
+        MODE_TOC,    /* Xing TOC, percent of the play time to 1/256ths of the stream */
+        MODE_POINTS, /* Sorted table of frame offsets, from VBRI, SEEKTABLE, the cache or the scan */
+    };
+
+    enum format_t : uint8_t
+    {
+        FORMAT_NONE,
+        FORMAT_MP3,
+        FORMAT_FLAC,
+        FORMAT_WAV
+    };
+
+    struct mp3_frame_t
+    {
+        uint32_t sample_rate;
+        uint32_t bitrate;  /* Kilobits per second */
+        uint16_t samples;  /* Samples per channel in the frame */
+        uint16_t length;   /* Bytes, including the header */
+        uint8_t side_info; /* Bytes of side information following the header */
+    };
+
+    uint32_t skipID3(FsFile& file); /* Returns the offset just past any ID3v2 tags */
+    bool parseMP3(FsFile& file);
+    bool parseFLAC(FsFile& file);
+    bool parseWAV(FsFile& file);
+    static bool parseMP3Frame(const uint8_t* header, mp3_frame_t* frame);
+    bool parseFLACFrame(uint32_t offset, uint32_t* sample, uint32_t* frame_samples);
+
+    /* Frame scan */
+    uint8_t byteAt(uint32_t offset);
+    void scanMP3();
+    void scanFLAC();
+    void addPoint(uint32_t sample, uint32_t offset);
+
+    /* Cache in the directory's .index.db.  A load fills in a cached_t that the index picks up on its own task. */
+    struct cached_t
+    {
+        std::atomic<bool> done{ false };
+        std::vector<point_t> points; /* Empty if the file isn't in the cache */
+        uint64_t samples = 0;
+    };
+    static void loadPoints(const std::string& db_path, const std::string& filename, uint32_t size, cached_t* cached);
+    void adopt(); /* Swaps in a cached index that has finished loading */
+    std::shared_ptr<cached_t> cached; /* Load in flight for the open file, dropped by close() */
+    static void storePoints(const std::string& db_path, const std::string& filename, uint32_t size, uint64_t samples, const std::vector<point_t>& points);
+
+    std::string db_path;
+    std::string filename;
+    format_t format = FORMAT_NONE;
+    mode_t mode = MODE_NONE;
+    uint32_t size = 0;          /* File size */
+    uint32_t audio_start = 0;   /* Offset of the first frame, or of the WAV sample data */
+    uint32_t audio_end = 0;     /* End of the audio, before any trailing tags or chunks */
+    uint32_t sample_rate = 0;
+    uint64_t total_samples = 0; /* 0 if the headers don't say */
+    uint32_t bitrate = 0;       /* Kilobits per second of the first MP3 frame, for estimates */
+    uint32_t trim_start = 0;
+    uint32_t trim_length = 0;
+
+    std::vector<point_t> points;
+    uint8_t toc[100];
+    uint32_t toc_bytes = 0;
+
+    /* WAV */
+    uint8_t fmt_chunk[40];
+    uint8_t fmt_length = 0;
+    uint16_t block_align = 0;
+
+    /* FLAC */
+    uint8_t streaminfo[34];
+    uint16_t block_size = 0;     /* Fixed block size, 0 for variable block size streams */
+    uint16_t max_block_size = 0;
+    uint32_t min_frame_size = 0; /* Smallest frame in the stream, the scan skips this far past each header */
+    uint32_t next_sample = 0;    /* Sample the next frame is expected to start at */
+
+    /* Frame scan, the chunk being scanned and the last bytes of the one before it */
+    bool scanning = false;
+    bool synced = true;         /* Cleared if the scan loses track of the frames, the rest is estimated */
+    uint32_t scan_end = 0;      /* Every byte before this has been scanned */
+    uint32_t scan_position = 0; /* Where the scan expects or searches for the next frame header */
+    uint32_t scan_samples = 0;
+    uint32_t next_point = 0;    /* Sample at which the next point is due */
+    const uint8_t* chunk = nullptr;
+    uint32_t chunk_start = 0;
+    uint32_t chunk_end = 0;
+    uint8_t tail[SEEK_SCAN_TAIL];
+};
+
+} // namespace Audio
+
+#endif
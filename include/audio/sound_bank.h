@@ -0,0 +1,110 @@
+/**
+ * @file sound_bank.h
+ *
+ * @brief Short sounds decoded once into PCM and mixed over the output.
+ * Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef sound_bank_h
+#define sound_bank_h
+
+#define SOUND_BANK_MAX_SOUNDS   8
+#define SOUND_BANK_MAX_CHANNELS 2
+#define SOUND_BANK_MIX_FRAMES   256 /* Frames mixed per pass */
+#define SOUND_BANK_DECODE_CHUNK 512 /* Bytes of MP3 fed to the decoder at a time while loading */
+
+#include <Arduino.h>
+#include <atomic>
+
+namespace Audio {
+
+/**
+ * add() decodes an MP3 at boot and keeps it as mono 16 bit PCM at the sample rate given to
+ * begin(), in PSRAM.  The bank sits in the output chain as a Print and passes everything written to
+ * it through, adding the sound that's playing on top of it.  Starting a sound is a store to
+ * an atomic that the next write() picks up, so play() is safe from any task and never
+ * touches the stream underneath.  With nothing playing, write() is a straight pass through.
+ *
+ * Only the task writing the output may call write().
+ */
+class SoundBank : public Print
+{
+  public:
+    SoundBank() = default;
+    SoundBank(SoundBank const&) = delete;
+
+    void begin(Print& output, uint32_t sample_rate = 44100, uint8_t channels = 2); /* Output is 16 bit PCM */
+    bool add(uint8_t id, const uint8_t* mp3, size_t length); /* Decodes a sound into the bank, at boot only */
+
+    /* The sounds stay at the rate given to begin(), and are stepped through to keep their pitch when the
+    output runs at another.  Only for the task writing the output. */
+    void setOutputRate(uint32_t sample_rate);
+
+    /* Starts a sound from the beginning, cutting off any sound already playing.  The gain is
+    Q15, 32767 is full scale. */
+    void play(uint8_t id, int16_t gain);
+
+    size_t write(const uint8_t* data, size_t length) override;
+    size_t write(uint8_t byte) override { return write(&byte, 1); }
+    int availableForWrite() override { return output ? output->availableForWrite() : 0; }
+    bool isPlaying() { return current || sound_request.load(); } /* Only for the task writing the output */
+
+  private:
+    struct sound_t
+    {
+        int16_t* samples = nullptr; /* Mono, at the bank's sample rate */
+        uint32_t frames = 0;
+    };
+
+    /* Collects the decoder's output in PSRAM while a sound is loading */
+    class Capture : public Print
+    {
+      public:
+        ~Capture();
+        size_t write(const uint8_t* data, size_t length) override;
+        size_t write(uint8_t byte) override { return write(&byte, 1); }
+        uint8_t* data = nullptr;
+        size_t length = 0;
+        size_t capacity = 0;
+        bool failed = false;
+    };
+
+    Print* output = nullptr;
+    uint32_t sample_rate = 44100;
+    uint8_t channels = 2;
+    sound_t sounds[SOUND_BANK_MAX_SOUNDS];
+
+    /* Handed over by play(), the gain is stored first */
+    std::atomic<uint8_t> sound_request{ 0 }; /* Sound id + 1, 0 when there's nothing new */
+    std::atomic<int16_t> gain_request{ 0 };
+
+    /* Only touched by the task writing the output */
+    sound_t* current = nullptr;
+    uint32_t position = 0;
+    uint32_t fraction = 0;       /* Q16, between position and the frame after */
+    uint32_t step = 1 << 16;     /* Sound frames per output frame, Q16 */
+    int32_t gain = 0;
+    int16_t mixed_samples[SOUND_BANK_MIX_FRAMES * SOUND_BANK_MAX_CHANNELS];
+};
+
+} // namespace Audio
+
+#endif
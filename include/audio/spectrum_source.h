@@ -0,0 +1,53 @@
+/**
+ * @file spectrum_source.h
+ *
+ * @brief Interface the spectrum analyzer reads its band levels through.  Part of
+ * the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef spectrum_source_h
+#define spectrum_source_h
+
+#define SPECTRUM_BANDS     7  /* Octave bands on the analyzer */
+#define SPECTRUM_BOTTOM_HZ 43 /* Lower edge of the lowest band, so the bands are centred from about 64 Hz up to 4 kHz */
+
+namespace Audio {
+
+/**
+ * Something the spectrum analyzer can take band levels from.  Each source works the levels out
+ * in its own way, from a tap on the output or from work a decoder has already done, but they all
+ * report the same octave bands on the same scale, so the display can switch between them.
+ */
+class SpectrumSource
+{
+  public:
+    virtual ~SpectrumSource() = default;
+
+    /* Fills in SPECTRUM_BANDS levels in dB relative to a full scale sine, lowest octave first.  Returns
+    false if there's nothing new since the last call, in which case the levels are left alone. */
+    virtual bool analyze(float* levels) = 0;
+
+    /* Whether the source has anything to say about what's playing right now */
+    virtual bool isActive() { return true; }
+};
+
+} // namespace Audio
+
+#endif
@@ -0,0 +1,98 @@
+/**
+ * @file spectrum_tap.h
+ *
+ * @brief Decimated mono tap off the output, and the FFT that turns it into
+ * octave band levels.  Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef spectrum_tap_h
+#define spectrum_tap_h
+
+#define SPECTRUM_FFT_BITS     8
+#define SPECTRUM_FFT_SIZE     (1 << SPECTRUM_FFT_BITS) /* Points per analysis, about 23 ms at the tap's rate */
+#define SPECTRUM_TAP_RATE     11025                    /* Roughly what the tap decimates to, the bands assume it */
+#define SPECTRUM_TAP_HISTORY  512                      /* Decimated samples kept for the reader, a power of two */
+#define SPECTRUM_MAX_CHANNELS 2
+
+#include <Arduino.h>
+#include <atomic>
+#include <audio/spectrum_source.h>
+
+namespace Audio {
+
+/**
+ * Gives the spectrum analyzer its own copy of the audio without putting an FFT on the audio
+ * task.  write() mixes the output down to mono and brings it down to about 11 kHz through a
+ * second order CIC decimator, which is two adds per frame, and drops the result into a ring
+ * that always holds the newest samples.
+ * The only thing shared between the two sides is the count of samples written.
+ *
+ * analyze() runs on whatever task draws the spectrum, as often as it likes.  It copies the
+ * newest SPECTRUM_FFT_SIZE samples out of the ring, trying again if the audio task lapped it
+ * while it copied, applies a Hann window and does the FFT in place.  The power of each bin is
+ * summed into octave bands, so no square roots are taken, and each band comes back in dB
+ * relative to a full scale sine.
+ *
+ * Only the task writing the output may call write() and setSampleRate(), and only one task
+ * may call analyze().
+ */
+class SpectrumTap : public Print, public SpectrumSource
+{
+  public:
+    SpectrumTap() = default;
+    SpectrumTap(SpectrumTap const&) = delete;
+
+    void begin(uint32_t sample_rate = 44100, uint8_t channels = 2); /* Input is 16 bit PCM */
+    void setSampleRate(uint32_t sample_rate);
+
+    size_t write(const uint8_t* data, size_t length) override;
+    size_t write(uint8_t byte) override { return write(&byte, 1); }
+    int availableForWrite() override { return SPECTRUM_TAP_HISTORY * SPECTRUM_MAX_CHANNELS * sizeof(int16_t); }
+
+    bool analyze(float* levels) override;
+
+  private:
+    void transform(); /* In place radix 2 FFT of real and imaginary */
+
+    /* Written by the audio task */
+    uint8_t channels = 2;
+    uint16_t decimation = 4; /* Input frames to each decimated sample */
+    uint16_t pending = 0;    /* Frames since the last decimated sample */
+
+    /* The decimator works in wrapping unsigned arithmetic, the combs take out whatever the integrators overflow by */
+    uint32_t integrators[2] = {};
+    uint32_t combs[2] = {};
+    int16_t history[SPECTRUM_TAP_HISTORY];
+    std::atomic<uint32_t> written{ 0 };
+
+    /* Only touched by the task calling analyze() */
+    uint32_t analyzed = 0;
+    float full_scale = 1; /* Power a full scale sine puts in the bins, the 0 dB reference */
+    float window[SPECTRUM_FFT_SIZE];
+    float cosines[SPECTRUM_FFT_SIZE / 2];
+    float sines[SPECTRUM_FFT_SIZE / 2];
+    float real[SPECTRUM_FFT_SIZE];
+    float imaginary[SPECTRUM_FFT_SIZE];
+};
+
+} // namespace Audio
+
+#endif
@@ -0,0 +1,77 @@
+/**
+ * @file splicer.h
+ *
+ * @brief Switches the audio task from one deck to the next exactly where the
+ * next track starts in the audio buffer. Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef splicer_h
+#define splicer_h
+
+#include <Arduino.h>
+#include <AudioTools.h>
+#include <atomic>
+#include <audio/resampler.h>
+#include <functional>
+
+namespace Audio {
+
+/**
+ * Gapless playback puts the next track's bytes in the audio buffer straight after the last of the current
+ * one's.  Once they're in, the main loop arms the splice with the buffer position where the next track starts
+ * and the decoder waiting for it on the other deck.  The audio task passes every read through cut(), which stops
+ * it short of that position.  When the read position gets there, the old decoder is finished, so the frame it
+ * was holding back comes out, and its resampler's filter is flushed.  The next deck's resampler then starts on
+ * the new decoder and the read carries straight on into it.
+ *
+ * arm() and cancel() are for the main loop and cut() for the audio task, isPending() for either.
+ */
+class Splicer
+{
+  public:
+    /* Flushes the last of a track out of its decoder, once the splice is done with it */
+    using finish_t = std::function<void(uint8_t deck, audio_tools::AudioDecoder* decoder)>;
+
+    /* Each deck's resampler, indexed by deck */
+    void begin(Resampler* resamplers, finish_t finish);
+
+    /* Main loop side */
+    void arm(size_t at, uint8_t deck, audio_tools::AudioDecoder* decoder); /* at is a RingBuffer::writePosition() */
+    void cancel() { pending.store(false, std::memory_order_release); }
+
+    /* Audio task side.  Shortens a read of length bytes at read_position so it doesn't cross the splice.  At the
+    splice, switches deck and decoder over to the next track's and returns true. */
+    bool cut(size_t read_position, size_t* length, uint8_t* deck, audio_tools::AudioDecoder** decoder);
+
+    /* False once the audio task has reached the next track, or the splice was cancelled */
+    bool isPending() { return pending.load(std::memory_order_acquire); }
+
+  private:
+    Resampler* resamplers = nullptr;
+    finish_t finish;
+    std::atomic<bool> pending{ false };
+    std::atomic<size_t> at{ 0 };   /* Read position where the next track starts */
+    std::atomic<uint8_t> deck{ 0 }; /* Deck the next track plays on */
+    std::atomic<audio_tools::AudioDecoder*> decoder{ nullptr };
+};
+
+} // namespace Audio
+
+#endif
@@ -0,0 +1,145 @@
+/**
+ * @file subband_spectrum.h
+ *
+ * @brief Octave band levels read out of the MP3 decoder's own filterbank, so MP3
+ * playback needs no FFT.  Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef subband_spectrum_h
+#define subband_spectrum_h
+
+/* Reading the bands out of the decoder means reaching into Helix's internal state, so the mode is
+built in on request.  Without it the source never becomes active and MP3 goes through the FFT, and the
+decoder pools use AudioTools' own MP3 decoder. */
+#ifndef SPECTRUM_MP3_SUBBANDS
+#define SPECTRUM_MP3_SUBBANDS 0
+#endif
+
+#define SUBBAND_SPECTRUM_LINES      576 /* Frequency lines in a granule, 18 for each of the 32 subbands */
+#define SUBBAND_SPECTRUM_TIMEOUT_MS 100 /* It stops being the source this long after the last MP3 frame */
+
+#include <Arduino.h>
+#include <AudioTools.h>
+#include <AudioTools/AudioCodecs/CodecMP3Helix.h>
+#include <atomic>
+#include <audio/spectrum_source.h>
+#if SPECTRUM_MP3_SUBBANDS
+#include <MP3DecoderHelix.h>
+#endif
+
+namespace Audio {
+
+/**
+ * Helix has already split each granule into 32 polyphase subbands and then into 18 frequency
+ * lines per subband by the time it synthesises the PCM, and the lines are still sitting in its
+ * buffer once a frame has been written out.  capture() sums their energy into the analyzer's
+ * octave bands, around a thousand multiply adds a frame where the FFT path would need a tap and
+ * a transform.  The 32 subbands alone are 689 Hz wide at 44.1 kHz, which would put the bottom
+ * four octaves in the first one, so the lines are used rather than the subbands.
+ *
+ * The lines are scaled however the decoder left them, so each band is taken as its share of the
+ * granule's energy and set against the power of the PCM the frame came out as.  That puts the
+ * levels on the same scale as the FFT, a full scale sine reading 0 dB.
+ *
+ * Only the audio task may call capture() and setDeck(), and only one task may call analyze().
+ * Both decks' decoders capture, but only frames from the deck that's playing are kept, so the
+ * bars don't flick between two tracks while the next one is primed or faded in.
+ */
+class SubbandSpectrum : public SpectrumSource
+{
+  public:
+    SubbandSpectrum() = default;
+    SubbandSpectrum(SubbandSpectrum const&) = delete;
+
+#if SPECTRUM_MP3_SUBBANDS
+    /* Called with each frame of PCM the decoder writes, before it goes any further */
+    void capture(uint8_t deck, HMP3Decoder helix, const int16_t* pcm, size_t samples);
+#endif
+
+    /* The deck whose frames are captured, the one the audio task is playing */
+    void setDeck(uint8_t deck) { this->deck = deck; }
+
+    bool analyze(float* levels) override;
+    bool isActive() override;
+
+  private:
+    /* Audio task side */
+    uint8_t deck = 0;
+    int sample_rate = 0;
+    uint16_t edges[SPECTRUM_BANDS + 1]; /* First line of each band and the end of the last, for sample_rate */
+    uint8_t back = 2;
+
+    /* Triple buffer, the middle index has SUBBAND_FRESH set when it holds levels the reader hasn't seen */
+    static const uint8_t SUBBAND_FRESH = 0x80;
+    float sets[3][SPECTRUM_BANDS];
+    std::atomic<uint8_t> middle{ 1 };
+    std::atomic<uint32_t> captured_at{ 0 };
+    std::atomic<bool> captured{ false };
+
+    /* Reader side */
+    uint8_t front = 0;
+};
+
+#if SPECTRUM_MP3_SUBBANDS
+/**
+ * Helix driven directly rather than through AudioTools' wrapper, which keeps the Helix decoder to
+ * itself.  Helix keeps its handle to subclasses, so a subclass hands it to the spectrum along with
+ * each frame as it's decoded.  The decoder pools use this in place of audio_tools::MP3DecoderHelix
+ * when SPECTRUM_MP3_SUBBANDS is set.
+ */
+class SubbandMp3Decoder : public audio_tools::AudioDecoder
+{
+  public:
+    SubbandMp3Decoder();
+    SubbandMp3Decoder(SubbandMp3Decoder const&) = delete;
+
+    void setSpectrum(SubbandSpectrum* spectrum, uint8_t deck)
+    {
+        this->spectrum = spectrum;
+        this->deck = deck;
+    }
+
+    void setOutput(Print& output) override;
+    audio_tools::AudioInfo audioInfo() override { return format; }
+    bool begin() override;
+    void end() override;
+    void flush() override;
+    size_t write(const uint8_t* data, size_t length) override;
+    operator bool() override { return active; }
+
+  private:
+    class Helix : public libhelix::MP3DecoderHelix
+    {
+      public:
+        HMP3Decoder handle() { return decoder; }
+    } helix;
+    static void decoded(MP3FrameInfo& info, short* pcm, size_t samples, void* ref); /* Helix's data callback */
+
+    Print* pcm_output = nullptr;
+    audio_tools::AudioInfo format; /* Of the last frame decoded */
+    SubbandSpectrum* spectrum = nullptr;
+    uint8_t deck = 0;
+    bool active = false;
+};
+#endif
+
+} // namespace Audio
+
+#endif
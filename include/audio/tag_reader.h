@@ -0,0 +1,111 @@
+/**
+ * @file tag_reader.h
+ *
+ * @brief Reads the title, artist, album, genre and year out of ID3, FLAC and
+ * Ogg tags once when a file is loaded. Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef tag_reader_h
+#define tag_reader_h
+
+#define TAG_FIELD_SIZE 255 /* Bytes per field, including the terminator */
+#define TAG_FRAME_MAX  512 /* Most of a text frame or comment that is read, the rest is skipped */
+
+#include <Arduino.h>
+#include <SdFat.h>
+
+namespace Audio {
+
+struct tags_t
+{
+    char title[TAG_FIELD_SIZE];
+    char artist[TAG_FIELD_SIZE];
+    char album[TAG_FIELD_SIZE];
+    char genre[TAG_FIELD_SIZE];
+    char year[TAG_FIELD_SIZE];
+    float gain_db; /* ReplayGain track gain, against -18 LUFS.  NAN if the file doesn't have one. */
+    float peak;    /* ReplayGain track peak, 1 is full scale.  0 if the file doesn't have one. */
+};
+
+/**
+ * read() goes straight to wherever a format keeps its tags, and steps over everything
+ * else by seeking rather than reading, so cover art and padding cost nothing:
+ *
+ *  - MP3 reads the ID3v2.2, 2.3 or 2.4 tag at the start and fills any gaps from an
+ *    ID3v1 tag in the last 128 bytes.
+ *  - FLAC walks the metadata blocks to the VORBIS_COMMENT block.
+ *  - Ogg follows the comment packet of an Opus or Vorbis stream across the pages it
+ *    spans, from the second page on.
+ *
+ * ReplayGain comes from TXXX frames or REPLAYGAIN_* comments, and an Opus R128_TRACK_GAIN
+ * is moved over to the ReplayGain reference level.  The text is converted to UTF-8, and the
+ * first value of a field wins.  The reader holds the SD card mutex for the duration of the call.
+ */
+class TagReader
+{
+  public:
+    /* Clears the tags, then fills in what the file has.  Returns false if the file couldn't be opened. */
+    bool read(const char* path, uint8_t type, tags_t* tags);
+
+    static void clear(tags_t* tags);
+
+  private:
+    bool readAt(uint32_t offset, uint8_t* data, size_t length);
+
+    /* ID3 */
+    uint32_t parseID3v2(uint32_t offset); /* Returns the offset past the tag, or the offset given if there isn't one */
+    void parseID3v1();
+    void parseID3Frame(const char* id, uint8_t* data, size_t length);
+    void parseUserText(uint8_t* data, size_t length); /* TXXX, a description and a value */
+    static const char* genreName(uint8_t genre);
+
+    /* Vorbis comments, read through a span of the file that's either the FLAC block or an Ogg packet */
+    bool parseFLAC(uint32_t offset);
+    bool parseOgg();
+    void parseComments();
+    void parseComment(char* comment, size_t length);
+    void parseGain(const char* key, size_t key_length, const char* value, size_t value_length);
+    bool nextSpan();
+    size_t readComments(uint8_t* data, size_t length);
+    bool skipComments(uint32_t length);
+
+    /* Text */
+    static void setField(char* field, const char* value, size_t length); /* Only fills empty fields */
+    static size_t decodeText(uint8_t encoding, const uint8_t* text, size_t length, char* out, size_t size); /* ID3 text */
+    static size_t latin1ToUTF8(const uint8_t* text, size_t length, char* out, size_t size);
+    static size_t utf16ToUTF8(const uint8_t* text, size_t length, bool big_endian, char* out, size_t size);
+
+    FsFile file;
+    uint32_t size = 0;
+    tags_t* tags = nullptr;
+    uint8_t buffer[TAG_FRAME_MAX + 1];
+
+    /* Where the comments are being read from.  A span is a run of the packet's bytes that's contiguous in the file. */
+    bool ogg = false;
+    uint32_t span_offset = 0;
+    uint32_t span_left = 0;
+    uint32_t page_offset = 0; /* Next Ogg page */
+    bool last_span = false;   /* The packet ends with the current span */
+};
+
+} // namespace Audio
+
+#endif
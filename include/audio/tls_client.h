@@ -0,0 +1,124 @@
+/**
+ * @file tls_client.h
+ *
+ * @brief TLS client that keeps sessions to resume, so reconnecting to a
+ * host skips the full handshake.  Part of the audio library.
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef tls_client_h
+#define tls_client_h
+
+#define TLS_SESSION_CACHE_SIZE   4
+#define TLS_HOST_MAX             64
+#define TLS_HANDSHAKE_TIMEOUT_MS 1000 * 15
+
+#include <Arduino.h>
+#include <Client.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/x509_crt.h>
+
+namespace Audio {
+
+/**
+ * WiFiClientSecure sets up a new TLS context for every connection and always does the full
+ * handshake, which costs the ESP32 a second or more of public key arithmetic.  This client sets
+ * up its configuration, random generator and root certificates once and keeps them, and after
+ * each handshake it keeps the session, keyed by host and port.  The next connection to the same
+ * place offers the session back, with its ticket if the server issued one, and a server that
+ * still has it resumes with a short handshake that involves no certificates at all.  A server
+ * that has forgotten it does the full handshake and we keep the new session instead.
+ *
+ * Roots given to setCACert() are required to verify every server.  Without them the server isn't
+ * authenticated at all, which is what WiFiClientSecure's setInsecure() did.  The certificate
+ * chain is still checked, so a handshake that didn't look at one is known to have been resumed.
+ *
+ * The TLS records go over another client, which does the lookup and the TCP connection.  Only
+ * one connection is open at a time.
+ */
+class TlsClient : public Client
+{
+  public:
+    struct stats_t
+    {
+        uint32_t handshakes;   /* Handshakes that completed */
+        uint32_t resumed;      /* Of those, how many resumed a kept session */
+        uint32_t handshake_ms; /* Time taken by the last handshake */
+    };
+
+    TlsClient(Client& transport);
+    ~TlsClient();
+    TlsClient(TlsClient const&) = delete;
+
+    /* Parses the PEM root certificates, which then have to verify every server.  Call before connecting. */
+    bool setCACert(const char* pem);
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char* host, uint16_t port) override;
+    size_t write(uint8_t data) override { return write(&data, 1); }
+    size_t write(const uint8_t* data, size_t length) override;
+    int available() override;
+    int read() override;
+    int read(uint8_t* data, size_t length) override;
+    int peek() override;
+    void flush() override {}
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override { return connected(); }
+
+    stats_t getStats() { return stats; }
+
+  private:
+    struct session_entry_t
+    {
+        char host[TLS_HOST_MAX];
+        uint16_t port;
+        uint32_t used_at;
+        mbedtls_ssl_session session;
+    };
+
+    bool setup(); /* Sets up the parts that are kept between connections, the first time we connect */
+    session_entry_t* find(const char* host, uint16_t port);
+    void keep(const char* host, uint16_t port);
+    int fill(); /* Decrypts the next record if nothing is waiting, returns the bytes ready to read */
+    static int send(void* client, const unsigned char* data, size_t length);
+    static int receive(void* client, unsigned char* data, size_t length);
+    static int verify(void* client, mbedtls_x509_crt* certificate, int depth, uint32_t* flags);
+
+    Client& transport;
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context drbg;
+    mbedtls_ssl_config config;
+    mbedtls_x509_crt ca_chain;
+    mbedtls_ssl_context ssl;
+    bool ready = false;
+    bool ca_loaded = false;
+
+    bool open = false;
+    bool verified = false; /* The server's certificate was checked during the handshake */
+    int peeked = -1;
+    session_entry_t sessions[TLS_SESSION_CACHE_SIZE];
+    stats_t stats = {};
+};
+
+} // namespace Audio
+
+#endif
@@ -31,6 +31,7 @@
 #define SD_CS_PIN             38
 #define SD_CONFIG             SdSpiConfig(SD_CS_PIN, SHARED_SPI, SD_SCK_MHZ(20), &SPI)
 
+#include <AudioTools/Concurrency/Mutex.h>
 #include <SdFat.h>
 #include <transport.h>
 
@@ -47,6 +48,14 @@ class Card_Manager : public SdFs
     bool isReady();
     void end() { return SdFs::end(); }
     bool check_card_detect();
+
+    /* Everything that touches the card, the VFS layer and the audio prefetcher alike, must hold this */
+    audio_tools::Mutex& mutex() { return _mutex; }
+
+    /* Held while writing a directory's .index.db, so an index rebuild, the gain scan and the seek point cache
+    take turns.  Take it before mutex(), never while holding it, since SQLite's file calls take that one. */
+    audio_tools::Mutex& index_mutex() { return _index_mutex; }
+
     static Card_Manager* get_handle()
     {
         if (!_handle) {
@@ -71,7 +80,8 @@ class Card_Manager : public SdFs
     uint32_t lastInsertionCheck = 0;
     uint32_t lastRemovalCheck = 0;
     static Card_Manager* _handle;
-    SemaphoreHandle_t _mutex;
+    audio_tools::Mutex _mutex;
+    audio_tools::Mutex _index_mutex;
 };
 
 #endif
\ No newline at end of file
@@ -201,9 +201,10 @@ enum items : int32_t
     MID,
     TREBLE,
     SYSVOL,
+    CROSSFADE,
     SIZE
 };
-const char* const menu[] PROGMEM = { "Bass", "Mid", "Treble", "UI Volume" };
+const char* const menu[] PROGMEM = { "Bass", "Mid", "Treble", "UI Volume", "Crossfade" };
 }
 
 /* Screen saver menu */
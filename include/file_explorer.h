@@ -173,7 +173,9 @@ class File_Explorer
     std::vector<MediaData> directory_stack;
     bool ready;
     bool is_root_dir(MediaData& mediadata);
+    error_t write_index(MediaData& mediadata, std::function<void(uint32_t, uint32_t)> status_callback); /* generate_index() with the index held */
     error_t create_db(sqlite3* db);
+    error_t upgrade_db(sqlite3* db); /* Brings an index from an older version up to the current schema */
     uint8_t _sort_order = SORT_ASCENDING;
     uint8_t _sort_type = SORT_NAME;
     
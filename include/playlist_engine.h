@@ -76,6 +76,11 @@ class PlaylistEngine
     bool load(MediaData playlist);
     bool next();
     bool previous();
+
+    /* Used by the transport for gapless playback.  peekNext() returns the track after the current one while the
+    playlist is playing, and advance() moves on to it without touching the transport. */
+    MediaData peekNext();
+    void advance();
     MediaData* getLoadedMedia()
     {
         if (isLoaded())
@@ -347,6 +347,13 @@ class Config_Manager
     }
     uint8_t getTreble() { return eq_treble; }
 
+    void setCrossfade(uint8_t seconds)
+    {
+        crossfade = seconds;
+        preferences->putInt("crossfade", seconds);
+    }
+    uint8_t getCrossfade() { return crossfade; }
+
     bool isWifiEnabled();
     bool isDHCPEnabled();
 
@@ -402,6 +409,7 @@ class Config_Manager
     uint8_t eq_bass;
     uint8_t eq_mid;
     uint8_t eq_treble;
+    uint8_t crossfade;
     uint8_t zipcode;
     bool screensaver_enabled;
     uint8_t screensaver_timeout;
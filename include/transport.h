@@ -23,26 +23,89 @@
 
 #ifndef transport_h
 #define transport_h
-#define CONNECTION_TIMEOUT_MS       4000
-#define PLAYTIME_UPDATE_INTERVAL_MS 1000
+#define CONNECTION_TIMEOUT_MS 4000
 
 /* Audio buffer size in bytes. Decrease this if you have memory issues, increase if you have audio issues. This
-buffer is used to transfer audio data from one task to another. We use mutexes to prevent data corruption. */
+buffer is used to transfer audio data from one task to another. It is a lock-free ring with a single writer
+(Transport::loop) and a single reader (the audio task), so neither side ever waits on the other. */
 #define AUDIO_BUFFER_SIZE        1024 * 32
 #define AUDIO_BUFFER_WRITE_CHUNK 1024 * 2 /* Chunks written from the main loop */
 #define AUDIO_BUFFER_READ_CHUNK  1024 * 3 /* Chunks read by the audio task into the audio chain */
 
+/* Fill levels that drive the two tasks.  The main loop is woken to refill the buffer once it drains to the low
+water mark, and the audio task is woken once the buffer fills to the high water mark.  The waits are bounded so
+the main loop still services everything else. */
+#define AUDIO_BUFFER_LOW_WATER     AUDIO_BUFFER_SIZE / 2
+#define AUDIO_BUFFER_HIGH_WATER    AUDIO_BUFFER_READ_CHUNK
+#define AUDIO_PRODUCER_MAX_WAIT_MS 20
+#define AUDIO_CONSUMER_MAX_WAIT_MS 10
+
+/* Once the audio task has had nothing to play for longer than the I2S DMA buffers take to play out, it stops
+writing to the output chain altogether and the driver's auto clear holds the DAC at zero.  The EQ and FFT get
+nothing to chew on, and the task only wakes when a buffer or a UI sound needs it, or to check in now and then.
+Playback coming back out of idle is ramped up so it doesn't start with a click. */
+#define AUDIO_IDLE_AFTER_MS    80
+#define AUDIO_IDLE_MAX_WAIT_MS 250
+#define AUDIO_IDLE_CHUNK       512 /* Silence a UI sound is mixed into while idle, written straight to the sound bank */
+#define AUDIO_FADE_IN_MS       20
+
+/* The output follows the sample rate of the track that's playing, so the I2S clock, the EQ and the UI sounds are
+retuned whenever a track starts at a new rate.  A track faded in at a different rate can't take the output with
+it, that one is resampled to the rate of the track it's fading from until it ends.  With AUDIO_RESAMPLE set, the
+output stays at AUDIO_OUTPUT_RATE and every track is resampled to it instead. */
+#define AUDIO_OUTPUT_RATE     44100
+#define AUDIO_OUTPUT_CHANNELS 2
+#ifndef AUDIO_RESAMPLE
+#define AUDIO_RESAMPLE 0
+#endif
+
+/* The next playlist track is opened on the idle deck once the current file has this many bytes left to read,
+so it can be spliced onto the end of the current track without a gap */
+#define GAPLESS_PRELOAD_BYTES 1024 * 256
+#define TRANSPORT_DECKS       2
+
+/* While crossfading, both decoders are fed in small chunks and only when their side of the mixer has room for
+everything a chunk could decode to.  The next track is opened this long before the fade is due to start. */
+#define CROSSFADE_DECODE_CHUNK      512
+#define CROSSFADE_DECODE_ROOM       1024 * 24
+#define CROSSFADE_PRELOAD_MARGIN_MS 5000
+
+/* A remote file is seeked by byte rate, measured over this much playback from a mark taken once the play
+position has moved past where the stream was opened, so an ID3 tag at the start isn't counted */
+#define STREAM_RATE_MARK_MS    500
+#define STREAM_RATE_MEASURE_MS 2000
+
+/* A stream that drops keeps playing from the network buffer while it's reconnected, first after STREAM_RETRY_MIN_MS
+and then with the wait doubling up to STREAM_RETRY_MAX_MS.  Playback stops if it's still down after STREAM_OUTAGE_MAX_MS. */
+#define STREAM_RETRY_MIN_MS  250
+#define STREAM_RETRY_MAX_MS  8000
+#define STREAM_OUTAGE_MAX_MS 60000
+
 #include <AudioTools.h>
-#include <AudioTools/AudioCodecs/AudioCodecs.h>
-#include <AudioTools/AudioCodecs/CodecFLAC.h>
-#include <AudioTools/AudioCodecs/CodecMP3Helix.h>
-#include <AudioTools/AudioCodecs/CodecOpusOgg.h>
-#include <AudioTools/AudioCodecs/CodecWAV.h>
-#include <AudioTools/AudioLibs/AudioRealFFT.h>
 #include <AudioTools/Concurrency/Mutex.h>
 #include <AudioTools/CoreAudio/MusicalNotes.h>
 #include <FS.h>
 #include <WiFi.h>
+#include <atomic>
+#include <audio/crossfade_mixer.h>
+#include <audio/decoder_pool.h>
+#include <audio/http_source.h>
+#include <audio/jitter_buffer.h>
+#include <audio/level_meter.h>
+#include <audio/loudness_scanner.h>
+#include <audio/network_worker.h>
+#include <audio/output_stage.h>
+#include <audio/parametric_eq.h>
+#include <audio/prefetcher.h>
+#include <audio/resampler.h>
+#include <audio/ring_buffer.h>
+#include <audio/seek_index.h>
+#include <audio/sound_bank.h>
+#include <audio/splicer.h>
+#include <audio/spectrum_tap.h>
+#include <audio/subband_spectrum.h>
+#include <audio/tag_reader.h>
+#include <functional>
 #include <system.h>
 #include <timer.h>
 
@@ -56,10 +119,22 @@ enum transport_status : uint8_t
     TRANSPORT_CONNECTING
 };
 
+/* Sounds in the UI sound bank, loaded from ui_sounds.h at boot */
+enum ui_sound : uint8_t
+{
+    UI_SOUND_CLICK,
+    UI_SOUND_FOLDER_CLOSE,
+    UI_SOUND_FOLDER_OPEN,
+    UI_SOUND_LOAD_ITEM,
+    UI_SOUND_SELECT_ITEM
+};
+
 enum spectrum_analyzer
 {
-    SPECTRUM_ANALYZER_NUM_BANDS = 7,
-    SPECTRUM_ANALYZER_UPDATE_INTERVAL_MS = 30,
+    SPECTRUM_ANALYZER_NUM_BANDS = SPECTRUM_BANDS,
+    SPECTRUM_ANALYZER_UPDATE_INTERVAL_MS = 30, /* How often the source is read */
+    SPECTRUM_ANALYZER_FLOOR_DB = -48,          /* Band level that shows as an empty bar, 0 dB is a full scale sine */
+    SPECTRUM_ANALYZER_FULL_SCALE = 2048,       /* Value of a full bar */
     SPECTRUM_ANALYZER_PEAK_DECAY_MS = 500,
     SPECTRUM_ANALYZER_PEAK_DECAY_RATE_MS = 50,
     SPECTRUM_ANALYZER_PEAK_VISBILITY_TIMEOUT_MS = 5000
@@ -80,6 +155,9 @@ enum filter_constants
     TRANSPORT_TREBLE_CENTER_FREQ = 8000,
     TRANSPORT_MIN_TREBLE = 0,
     TRANSPORT_MAX_TREBLE = 100,
+    TRANSPORT_EQ_RANGE_DB = 12, /* The ends of the bass, mid and treble controls, the middle is flat */
+    TRANSPORT_MIN_CROSSFADE = 0,
+    TRANSPORT_MAX_CROSSFADE = 10,
     TRANSPORT_CONTROL_STEP_SIZE = 2
 };
 
@@ -105,11 +183,20 @@ class Transport
     void begin(); /* Starts the stream and audio objects */
     bool load(MediaData media);
     bool play();
-    void playUIsound(const unsigned char* uiSound, size_t length);
+    void playUIsound(ui_sound sound); /* Mixed over whatever is playing, at the system volume */
     void pause();
     void stop();
     void eject();
 
+    /* Moves playback of the loaded file to a position in seconds.  Returns false for streams and for files
+    that can't be seeked in.  The move itself happens on the next pass of Transport::loop(). */
+    bool seek(uint32_t seconds);
+
+    /* Lets the transport follow a track with the next one in the playlist without stopping.  peekNext returns
+    the track after the current one without moving the playlist, and advance moves the playlist on once that
+    track has started playing. */
+    void setPlaylistCallbacks(std::function<MediaData()> peekNext, std::function<void()> advance);
+
     std::string getLoadedFileName();
     std::string getLoadedURL();
     std::string getLoadedTitle();
@@ -138,11 +225,26 @@ class Transport
     uint8_t getMinSystemVolume();         /* Returns the minimum system volume level */
     uint8_t getMaxSystemVolume();         /* Returns the maximum system volume level */
 
-    /* Return the play time of the currently loaded media */
-    size_t getPlayTime();
+    void crossfadeUp();                       /* Lengthens the crossfade between playlist tracks by a second */
+    void crossfadeDown();                     /* Shortens the crossfade by a second, 0 plays the tracks gaplessly */
+    uint8_t getCrossfade();                   /* Returns the crossfade length in seconds */
+    void setCrossfade(uint8_t seconds);       /* Sets the crossfade length in seconds */
+    uint8_t getMinCrossfade();
+    uint8_t getMaxCrossfade();
+
+    /* Play position of the loaded media in milliseconds, counted from the PCM frames that have been played */
+    uint32_t getPlayTime();
     void clearPlayTime();
+    uint32_t getDuration(); /* Length of the loaded file in milliseconds from its headers, 0 if it isn't known */
+
+    /* Newest reading of the level meter, false if there isn't one since the last call.  Only builds with
+    OUTPUT_STAGE_METER feed it, and there it takes the place of the spectrum analyzer. */
+    bool getLevels(Audio::LevelMeter::levels_t& levels) { return level_meter.read(levels); }
 
     static void audio_writer(Transport* _transport);
+    TaskHandle_t audio_task = nullptr;
+    std::atomic<bool> output_idle{ false }; /* The audio task has stopped feeding the output chain */
+    bool spectrum_idle = false;              /* The spectrum analyzer has been cleared for idle, only touched by Transport::loop() */
 
     Timer debugTimer;
 
@@ -150,9 +252,10 @@ class Transport
     class SpectrumAnalyzer
     {
       public:
-        SpectrumAnalyzer(audio_tools::AudioRealFFT* fft, uint16_t bands, uint16_t decayTime_ms, uint16_t decayRate_ms);
+        SpectrumAnalyzer(Audio::SpectrumSource* source, uint16_t bands, uint16_t decayTime_ms, uint16_t decayRate_ms);
         ~SpectrumAnalyzer();
-        audio_tools::AudioRealFFT* _fft;
+        Audio::SpectrumSource* _source;
+        void setSource(Audio::SpectrumSource* source) { _source = source; }
         uint16_t _bands;
         float* values;
         float* peak;
@@ -173,33 +276,27 @@ class Transport
         void decayPeaks();
         bool isPeakVisible(uint8_t band);
     }* spectrumAnalyzer = nullptr;
-    static const uint16_t spectrum_analyzer_refresh_interval = 5;
 
-    class EqualizerController : public audio_tools::Equalizer3Bands
+    /* Bass is a low shelf, mid a peak and treble a high shelf, at the TRANSPORT_*_CENTER_FREQ frequencies */
+    class EqualizerController : public Audio::ParametricEQ
     {
       private:
-        bool eq_enabled = false;
         uint8_t control_step = 2;
         uint8_t _bass = 0;
         uint8_t _mid = 0;
         uint8_t _treble = 0;
 
-        ConfigEqualizer3Bands cfg;
-
       public:
-        EqualizerController(audio_tools::AudioStream& out)
-          : audio_tools::Equalizer3Bands(out)
+        enum eq_band
         {
-            cfg.sample_rate = 44100;
-            cfg.bits_per_sample = 16;
-            cfg.channels = 2;
-            cfg.gain_low = 0.5;
-            cfg.gain_medium = 0.5;
-            cfg.gain_high = 0.5;
-            this->begin(cfg);
-        }
+            BAND_BASS,
+            BAND_MID,
+            BAND_TREBLE
+        };
+
+        /* Converts a control value to a gain in dB.  Use MAX and MIN constants to get the range */
+        static float toGain(uint8_t value, uint8_t max) { return ((float) value * 2 / max - 1) * TRANSPORT_EQ_RANGE_DB; }
 
-        /* Convert to a 0.0-0.1 float value to set the EQ.  Use MAX and MIN constants to get the range */
         void setBass(uint8_t bass);
         void setMid(uint8_t mid);
         void setTreble(uint8_t treble);
@@ -258,68 +355,204 @@ class Transport
         uint8_t getMinTreble() { return TRANSPORT_MIN_TREBLE; }
         uint8_t getMaxTreble() { return TRANSPORT_MAX_TREBLE; }
 
-        void setEnabled(bool enabled) { eq_enabled = enabled; }
-        bool isEnabled() { return eq_enabled; }
-
     }* eq = nullptr;
 
-    audio_tools::URLStream* getURLStream() { return &url_stream; }
+    audio_tools::URLStream* getURLStream() { return &http_source.getStream(); }
+    Audio::Prefetcher* getPrefetcher() { return &prefetchers[deck]; } /* For the read throughput and stall counters */
+    Audio::JitterBuffer* getNetworkBuffer() { return &network_buffer; } /* For the pre-roll depth and underrun counters */
+    Audio::LoudnessScanner* getLoudnessScanner() { return &loudness_scanner; } /* Fills in the gains of a directory once it's indexed */
+
+    struct stream_stats_t
+    {
+        uint32_t outages;           /* Times a stream has dropped */
+        uint32_t reconnects;        /* Attempts made to reconnect */
+        uint32_t last_outage_ms;    /* How long the last outage that recovered lasted */
+        uint32_t longest_outage_ms;
+        uint32_t total_outage_ms;
+    };
+    stream_stats_t getStreamStats() { return stream_stats; }
+    Audio::HttpSource::stats_t getNetworkStats() { return http_source.getStats(); } /* Connection reuse and latency */
+
+    /* The network has gone, so the stream is about to stall.  Safe from any task, the WiFi events call it. */
+    void networkLost() { network_lost.store(true); }
 
   private:
-    /* Decoders */
-    audio_tools::MP3DecoderHelix mp3_decoder;
-    audio_tools::OpusOggDecoder opus_decoder;
-    audio_tools::WAVDecoder wav_decoder;
-    audio_tools::FLACDecoder flac_decoder;
+    /* Playback runs on two decks, each with its own prefetcher and set of decoders.  One deck plays while the
+    other opens the next track, so the two can be spliced together in the audio buffer.  Decoders are all
+    started once in begin(), changing formats only swaps the decoder pointer.  The audio task retires the
+    decoder of every stream it drops and Transport::loop() restarts it, so no stream starts on another's state. */
+    Audio::DecoderPool decoder_pools[TRANSPORT_DECKS];
+    audio_tools::AudioDecoder* decoder = nullptr; /* The decoder in use, only touched by the audio task */
+    std::atomic<bool> decoder_switch{ false };    /* Set when the audio task should pick up pending_type */
+    std::atomic<uint8_t> pending_type{ 0 };      /* FILETYPE_* of the next stream, read once decoder_switch is set */
+    std::atomic<uint8_t> pending_deck{ 0 };      /* Deck whose decoders the next stream uses */
+    std::atomic<uint32_t> pending_position{ 0 }; /* Milliseconds into the file the next stream starts at */
+    void selectDecoder(uint8_t type, uint32_t position_ms = 0); /* Pass FILETYPE_UNKNOWN to detect the format from the stream */
+    uint8_t deck = 0;                 /* The deck feeding the audio buffer, only touched by Transport::loop() */
+
+    /* Gapless playback.  When the playing deck reaches the end of its file, the position in the audio buffer
+    where the next track starts is armed on the splicer.  The audio task finishes the old decoder exactly
+    there and carries on with the next deck's decoder, which was primed when the track was opened. */
+    std::function<MediaData()> peekNextCallback;
+    std::function<void()> advanceCallback;
+    MediaData* nextMedia = nullptr; /* The track open on the idle deck */
+    bool next_checked = false;      /* The playlist has been asked for the next track */
+    bool next_loaded = false;       /* The next track is open on the idle deck */
+    bool awaiting_splice = false;   /* The next track is in the buffer but the audio task hasn't reached it yet */
+    Audio::Splicer splicer;
+    void preloadNext();
+    void spliceNext();
+    void commitSplice(); /* Makes the next track the loaded one once the audio task has reached it */
+    void cancelNext();
+
+    /* Crossfading.  The incoming track gets its own audio buffer, so for the length of the fade Transport::loop()
+    feeds both decks and the audio task decodes both into the mixer.  The two buffers swap roles on every fade. */
+    Audio::CrossfadeMixer mixer;
+    Audio::RingBuffer fade_buffer;
+    Audio::RingBuffer* play_buffer = &ringBuffer; /* Buffer the playing deck writes to, only touched by Transport::loop() */
+    uint8_t crossfade = 0;                        /* Fade length in seconds, 0 splices the tracks instead */
+    bool fading = false;                          /* Main loop side: both decks are being fed */
+    uint8_t fade_out_deck = 0;
+    Audio::RingBuffer* fade_out_buffer = nullptr;
+    bool fade_out_done = false; /* Every byte of the outgoing track is in its buffer */
+    std::atomic<bool> fade_request{ false };  /* Set by the main loop to start the fade */
+    std::atomic<bool> fade_complete{ false }; /* Set by the audio task once the incoming track has taken over */
+    std::atomic<bool> outgoing_ended{ false };
+    std::atomic<Audio::RingBuffer*> fade_source{ nullptr }; /* Buffer of the incoming track, cleared to cancel */
+    std::atomic<uint8_t> fade_deck{ 0 };
+    std::atomic<uint8_t> fade_type{ 0 };
+    std::atomic<uint32_t> fade_ms{ 0 };
+    audio_tools::AudioDecoder* fade_decoder = nullptr; /* Decoder of the incoming track, only touched by the audio task */
+    void startFade();
+    void commitFade();
+    uint32_t remainingMs(); /* Estimated play time left in the current file, from the rate it has played at so far */
+    void fillFrom(uint8_t from_deck, Audio::RingBuffer* buffer);
+
+    /* Seeking.  Each deck has an index of the file it has open.  A seek restarts the decoder, so for formats
+    that only describe themselves at the start of the file a copy of the header goes into the audio buffer
+    ahead of the data from the new position. */
+    Audio::SeekIndex seek_indexes[TRANSPORT_DECKS];
+    void openSeekIndex(uint8_t index, MediaData& media); /* Reading a cached index is left to the scan task */
+    std::atomic<bool> seek_pending{ false };
+    std::atomic<uint32_t> seek_ms{ 0 };
+    uint8_t seek_header[SEEK_HEADER_MAX];
+    size_t seek_header_length = 0; /* Header bytes still to go into the audio buffer */
+    void applySeek();
+
+    /* Audio task side of the crossfade */
+    void startMix();
+    void mixStep();
+    void completeMix(Audio::RingBuffer* incoming);
+    size_t decodeFrom(Audio::RingBuffer* buffer, audio_tools::AudioDecoder* decoder, size_t length);
 
     /* Audio objects */
     audio_tools::I2SStream out_i2s;
-    audio_tools::VolumeStream volume_stream;
-    audio_tools::AudioRealFFT fft;
-    audio_tools::MultiOutput output;
-    audio_tools::MemoryStream memory_stream = MemoryStream(0, 0);
-
-    /* Metadata */
-    static void metadataCallback(MetaDataType type, const char* str, int len);
-    MetaDataOutput metadata_output;
-    static char loadedAlbum[255];
-    static char loadedArtist[255];
-    static char loadedTitle[255];
-    static char loadedGenre[255];
-    static char loadedYear[255];
+    Audio::LevelMeter level_meter; /* Fed by the output stage when it's built with the meter, read by the status screen */
+#if !OUTPUT_STAGE_METER
+    Audio::SpectrumTap spectrum_tap;           /* Tapped off the output stage ahead of the EQ and volume, analyzed by Transport::loop() */
+    Audio::SubbandSpectrum subband_spectrum; /* Fed by the MP3 decoders, takes over from the tap while it's active */
+#endif
+    Audio::OutputStage output_stage;
+    Audio::SoundBank sound_bank; /* UI sounds, mixed in after the output stage */
+
+    /* Each deck's decoders write into the mixer through a resampler, which brings them to the output's format */
+    Audio::Resampler resamplers[TRANSPORT_DECKS];
+    std::atomic<uint32_t> output_rate{ AUDIO_OUTPUT_RATE }; /* Only changed by the audio task */
+    uint32_t eq_rate = AUDIO_OUTPUT_RATE;                   /* Rate the EQ was designed for, only touched by Transport::loop() */
+    void followRate(uint8_t index, uint32_t sample_rate);   /* Audio task, when a deck's decoder reports a new rate */
+    void setOutputRate(uint32_t sample_rate);               /* Audio task */
+
+    /* Metadata, read from the file's tags when it's loaded.  The next track's are held back until it starts playing. */
+    Audio::tags_t loaded_tags;
+    Audio::tags_t next_tags;
+
+    /* Loudness normalisation.  Each deck's side of the mixer is set to the gain of the track it has open,
+    from its ReplayGain tags or else the gain the scanner stored in the directory's index. */
+    Audio::LoudnessScanner loudness_scanner;
+    float trackGain(MediaData& media, const Audio::tags_t& tags);
 
     Timer spectrumAnalyzerPeakDecayTimer;
     Timer SpectrumAnalyzerUpdateTimer;
 
-    audio_tools::URLStream url_stream;
-    // ICYStream url_stream;
+    /* Remote files and radio streams.  The audio that comes in from an offset in the stream starts at a
+    position in the network buffer, so the offset of what the audio task has reached can be worked out
+    to reopen the stream there after a pause. */
+    Audio::HttpSource http_source;
+    uint32_t stream_base_offset = 0;
+    size_t stream_base_position = 0;
+    uint32_t resume_offset = 0;                              /* Where a paused stream picks up, 0 to start over */
+    std::atomic<uint8_t> stream_type{ FILETYPE_UNKNOWN };    /* Set by the audio task once it has identified the stream */
+    void connect(uint32_t offset, uint32_t position_ms, bool retry = false); /* Opens the stream on the network worker */
+    uint32_t streamOffset();      /* 0 if the stream can't be reopened where the audio task is */
+    uint32_t streamWriteOffset(); /* Offset of the next byte to go into the network buffer */
+    void seekStream(uint32_t ms);
+    void measureStreamRate();
+    uint32_t stream_opened_ms = 0;
+    uint32_t stream_mark_ms = 0;
+    uint32_t stream_mark_offset = 0;
+    bool stream_marked = false;
+    float stream_rate = 0; /* Bytes per second, 0 until it's been measured */
+
+    /* Reconnecting.  A retry opens the stream without touching the status, so playback carries on from the
+    buffer, and the network worker reports back through stream_state.  A file picks up from the next byte
+    the buffer needs and a radio stream rejoins wherever the station has got to. */
+    enum stream_link_t : uint8_t
+    {
+        STREAM_CONNECTED,
+        STREAM_RETRY_WAIT,
+        STREAM_RETRYING
+    };
+    std::atomic<uint8_t> stream_state{ STREAM_CONNECTED };
+    std::atomic<bool> network_lost{ false };
+    bool in_outage = false;
+    uint32_t outage_started = 0;
+    uint32_t retry_at = 0;
+    uint32_t retry_delay_ms = 0;
+    stream_stats_t stream_stats = {};
+    void beginOutage(const char* reason);
+    bool updateReconnect(); /* Returns true once the stream is back */
+    void endOutage();       /* For a stop or a new connection, without counting it as recovered */
+
+    /* Radio streams have their metadata taken out as they're read.  A new title waits until the audio task
+    reaches the audio that followed it in the stream, so it changes when the song does. */
+    char stream_title[TAG_FIELD_SIZE];
+    size_t stream_title_at = 0; /* Position in the network buffer the title takes effect at */
+    bool stream_title_pending = false;
+    void showStreamTitle();
     Timer connection_timeout_timer;
 
-    audio_tools::Task* connection_task = nullptr;
-    
-    int _file_descriptor = -1; /* File descriptor for the currently loaded file */
-
-    uint32_t bytes_read = 0;
+    /* Connects and disconnects streams, so the loop never waits on the network */
+    Audio::NetworkWorker network_worker{ http_source };
+    std::atomic<bool> connect_retry{ false }; /* Whether the last open was a reconnect, for when it completes */
 
-    /* Timer to control the play time display */
-    Timer playTimeUpdateTimer;
+    Audio::Prefetcher prefetchers[TRANSPORT_DECKS]; /* Read the loaded file, and the next one, ahead of playback */
 
-    size_t playTime = 0; /* The current play time of the loaded media */
+    /* Play position.  The audio task counts the bytes each deck has had played out of the mixer, converts
+    them to frames and milliseconds with the format its decoder reports, and adds the position the deck
+    started from. */
+    uint32_t position_base[TRANSPORT_DECKS] = {}; /* Only touched by the audio task */
+    std::atomic<uint32_t> play_position{ 0 };
+    uint32_t duration = 0; /* Length of the loaded file in milliseconds */
+    void updatePosition(); /* Audio task */
 
     MediaData* loadedMedia = nullptr; /* Stores the data of the currently loaded file */
-    transport_status status;          /* The current status of the transport (PLAYING, PAUSED, STOPPED, or IDLE) */
+    /* The current status of the transport (PLAYING, PAUSED, STOPPED, or IDLE).  The network worker only moves it
+    on from CONNECTING, the rest is the loop's. */
+    std::atomic<transport_status> status{ TRANSPORT_IDLE };
 
     uint8_t volume = 2;        /* The current volume level */
     uint8_t system_volume = 2; /* The volume of the menu sounds */
 
-    const unsigned char* uiSound; /* Pointer to a char array to play from for UI sounds */
-    size_t uiSoundLength;         /* The length of the UI sound array */
-    bool playingUISound = false;  /* True if a UI sound is currently playing */
+    /* Only Transport::loop() writes to the audio buffer and only the audio task reads from it.
+    Anything else that needs it emptied must go through clear(), which is safe from any task. */
+    Audio::RingBuffer ringBuffer; /* The audio buffer */
 
-    /* Lock this mutex before accessing the audio buffer, unlock when done.  If you don't,
-    bad things will happen and you won't find the bug for days, don't ask me how I know. */
-    audio_tools::Mutex mutex;
-    audio_tools::RingBuffer<uint8_t> ringBuffer; /* The audio buffer */
+    /* Network streams go through a much deeper buffer in PSRAM that holds playback back until it has filled
+    to the pre-roll level.  The audio task drains whichever buffer source points at. */
+    Audio::JitterBuffer network_buffer;
+    std::atomic<Audio::RingBuffer*> source{ &ringBuffer };
+    bool isReadable(Audio::RingBuffer* buffer); /* True if the audio task may drain the buffer */
+    void updateBuffering(); /* Moves between TRANSPORT_BUFFERING and TRANSPORT_PLAYING from the network buffer level */
 };
 
 #endif
\ No newline at end of file
@@ -35,7 +35,6 @@
 #include <string>
 #include <timer.h>
 #include <transport.h>
-#include <ui_sounds.h>
 #include <card_manager.h>
 #include <vector>
 #include <functional>
@@ -43,14 +43,25 @@ class SpectrumAnalyzer
         }
     }
 
+    /* Draws the bars, or with OUTPUT_STAGE_METER a level meter across the same area.  Width is that of one bar. */
     void draw(uint16_t x, uint16_t y, uint16_t width, uint16_t height);
 
   private:
+    void drawMeter(uint16_t x, uint16_t y, uint16_t width, uint16_t height);
+
     Timer _updateTimer;
     uint8_t bands = 0;
     uint16_t* _currentVal = nullptr;
     uint16_t* _peak = nullptr;
     static const uint16_t refresh_interval = 20;
+
+    /* Level meter, in dB.  The bars jump up to a new reading and fall back at meter_fall_db per refresh,
+    the peak marks hold for SPECTRUM_ANALYZER_PEAK_DECAY_MS before they fall. */
+    uint8_t meter_channels = 2;
+    float meter_rms[LEVEL_METER_MAX_CHANNELS] = { SPECTRUM_ANALYZER_FLOOR_DB, SPECTRUM_ANALYZER_FLOOR_DB };
+    float meter_peak[LEVEL_METER_MAX_CHANNELS] = { SPECTRUM_ANALYZER_FLOOR_DB, SPECTRUM_ANALYZER_FLOOR_DB };
+    uint32_t meter_peak_time[LEVEL_METER_MAX_CHANNELS] = {};
+    static constexpr float meter_fall_db = 1.5f;
 };
 
 } // namespace UI
@@ -50,6 +50,7 @@ class StatusScreen
     StatusScreen();
     ~StatusScreen() { delete _handle; }
     static StatusScreen* _handle;
+    void printTime(uint32_t time); /* Prints a time in seconds as hh:mm:ss */
     uint16_t* spectrumAnalyzerCurrentVal;
     uint16_t* spectrumAnalyzerPeak;
     size_t playTime = 0;
@@ -58,6 +59,7 @@ class StatusScreen
     Marquee* marquee_mediainfo = nullptr;
     Marquee* marquee_datetime = nullptr;
     Marquee* marquee_connectStatus = nullptr;
+    Marquee* marquee_bufferStatus = nullptr;
     SpectrumAnalyzer* spectrumAnalyzer = nullptr;
 };
 
@@ -50,39 +50,46 @@ struct file_descriptor
 };
 
 static std::vector<file_descriptor> file_descriptors;
-static audio_tools::Mutex file_mutex;
+
+/* Shared with anything else that reads the card directly, see Card_Manager::mutex().  Looked up on each call
+rather than bound at static initialisation, which would create the card manager before setup() runs. */
+static audio_tools::Mutex&
+file_mutex()
+{
+    return Card_Manager::get_handle()->mutex();
+}
 
 static FsFile*
 vfs_get_file_handle(int fd)
 {
-    //while (!file_mutex.try_lock()) {
+    //while (!file_mutex().try_lock()) {
         // Wait for the mutex to be available
     //    vTaskDelay(10);
     //}
     for (auto& f : file_descriptors) {
         if (f.fd == fd) {
-            //file_mutex.unlock();
+            //file_mutex().unlock();
             return f.handle;
         }
     }
-    //file_mutex.unlock();
+    //file_mutex().unlock();
     return nullptr;
 }
 
 static ssize_t
 vfs_write(int fd, const void* data, size_t size)
 {
-    file_mutex.lock();
+    file_mutex().lock();
 
     if (!Card_Manager::get_handle()->isReady()) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
     FsFile* file = vfs_get_file_handle(fd);
 
     if (file == nullptr) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
@@ -92,13 +99,13 @@ vfs_write(int fd, const void* data, size_t size)
         if (file->getWriteError()) {
             char filename[PATH_MAX];
             file->getName(filename, PATH_MAX);
-            file_mutex.unlock();
+            file_mutex().unlock();
             return -1;
         }
-        file_mutex.unlock();
+        file_mutex().unlock();
         return ret;
     } else {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 }
@@ -106,26 +113,26 @@ vfs_write(int fd, const void* data, size_t size)
 static ssize_t
 vfs_read(int fd, void* dst, size_t size)
 {
-    file_mutex.lock();
+    file_mutex().lock();
 
     if (!Card_Manager::get_handle()->isReady()) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
     FsFile* file = vfs_get_file_handle(fd);
 
     if (file == nullptr) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
     if (file->isOpen()) {
         size_t ret = file->read(dst, size);
-        file_mutex.unlock();
+        file_mutex().unlock();
         return ret;
     } else {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 }
@@ -133,10 +140,10 @@ vfs_read(int fd, void* dst, size_t size)
 static int
 vfs_open(const char* path, int flags, int mode)
 {
-    file_mutex.lock();
+    file_mutex().lock();
 
     if (!Card_Manager::get_handle()->isReady() || strlen(path) > PATH_MAX) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
@@ -145,7 +152,7 @@ vfs_open(const char* path, int flags, int mode)
 
     if (!file.handle->open(path, O_RDWR | O_CREAT)) {
         delete file.handle;
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
     /* Generate a unique file descriptor that is not already in use */
@@ -160,42 +167,42 @@ vfs_open(const char* path, int flags, int mode)
     file_descriptors.push_back(file);
     strcpy(file.path, path);
 
-    file_mutex.unlock();
+    file_mutex().unlock();
     return fd;
 }
 
 static int
 vfs_close(int fd)
 {
-    file_mutex.lock();
+    file_mutex().lock();
 
     for (auto it = file_descriptors.begin(); it != file_descriptors.end(); ++it) {
         if (it->fd == fd) {
             it->handle->close();
             delete it->handle;
             file_descriptors.erase(it);
-            file_mutex.unlock();
+            file_mutex().unlock();
             return 1;
         }
     }
 
-    file_mutex.unlock();
+    file_mutex().unlock();
     return -1;
 }
 
 static int
 vfs_fstat(int fd, struct stat* st)
 {
-    file_mutex.lock();
+    file_mutex().lock();
     if (!Card_Manager::get_handle()->isReady()) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
     FsFile* file = vfs_get_file_handle(fd);
 
     if (file == nullptr) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
@@ -206,10 +213,10 @@ vfs_fstat(int fd, struct stat* st)
         st->st_mtime = 0;
         st->st_atime = 0;
         st->st_ctime = 0;
-        file_mutex.unlock();
+        file_mutex().unlock();
         return 0;
     } else {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 }
@@ -217,10 +224,10 @@ vfs_fstat(int fd, struct stat* st)
 int
 vfs_stat(const char* path, struct stat* st)
 {
-    file_mutex.lock();
+    file_mutex().lock();
 
     if (!Card_Manager::get_handle()->isReady()) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
@@ -228,7 +235,7 @@ vfs_stat(const char* path, struct stat* st)
     // log_i("Checking file: %s", path);
 
     if (!Card_Manager::get_handle()->exists(path)) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
@@ -243,24 +250,24 @@ vfs_stat(const char* path, struct stat* st)
     // log_i("File size: %d", st->st_size);
     // log_i("File size from SDFat: %d", file.size());
     file.close();
-    file_mutex.unlock();
+    file_mutex().unlock();
     return 0;
 }
 
 static off_t
 vfs_lseek(int fd, off_t offset, int mode)
 {
-    file_mutex.lock();
+    file_mutex().lock();
 
     if (!Card_Manager::get_handle()->isReady()) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
     FsFile* file = vfs_get_file_handle(fd);
 
     if (file == nullptr) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
@@ -269,23 +276,23 @@ vfs_lseek(int fd, off_t offset, int mode)
         switch (mode) {
             case SEEK_SET:
                 ret = file->seekSet(offset);
-                file_mutex.unlock();
+                file_mutex().unlock();
                 return ret;
             case SEEK_CUR:
                 ret = file->seekCur(offset);
-                file_mutex.unlock();
+                file_mutex().unlock();
                 return ret;
             case SEEK_END:
                 ret = file->seekEnd(offset);
-                file_mutex.unlock();
+                file_mutex().unlock();
                 return ret;
             default:
                 ret = -1;
-                file_mutex.unlock();
+                file_mutex().unlock();
                 return ret;
         }
     } else {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 }
@@ -293,24 +300,24 @@ vfs_lseek(int fd, off_t offset, int mode)
 static int
 vfs_link(const char* oldpath, const char* newpath)
 {
-    file_mutex.lock();
+    file_mutex().lock();
 
     if (!Card_Manager::get_handle()->isReady() || strlen(oldpath) > PATH_MAX || strlen(newpath) > PATH_MAX) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
-    file_mutex.unlock();
+    file_mutex().unlock();
     return -1;
 }
 
 static int
 vfs_unlink(const char* path)
 {
-    file_mutex.lock();
+    file_mutex().lock();
 
     if (!Card_Manager::get_handle()->isReady() || strlen(path) > PATH_MAX) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
@@ -325,21 +332,21 @@ vfs_unlink(const char* path)
     }
 
     if (!Card_Manager::get_handle()->remove(path)) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
-    file_mutex.unlock();
+    file_mutex().unlock();
     return 0;
 }
 
 static int
 vfs_rename(const char* oldpath, const char* newpath)
 {
-    file_mutex.lock();
+    file_mutex().lock();
 
     if (!Card_Manager::get_handle()->isReady()) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
@@ -354,59 +361,61 @@ vfs_rename(const char* oldpath, const char* newpath)
     }
 
     if (!Card_Manager::get_handle()->rename(oldpath, newpath)) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
-    file_mutex.unlock();
+    file_mutex().unlock();
     return 1;
 }
 
 static int
 vfs_truncate(const char* path, off_t length)
 {
-    file_mutex.lock();
+    file_mutex().lock();
 
     FsFile file;
 
     if (!Card_Manager::get_handle()->isReady()) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
     if (!Card_Manager::get_handle()->exists(path)) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
     if (!file.open(path, O_RDWR)) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
     if (!file.truncate(length)) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
+    file.close();
+    file_mutex().unlock();
     return 1;
 }
 
 static int
 vfs_access(const char* path, int mode)
 {
-    file_mutex.lock();
+    file_mutex().lock();
 
     if (!Card_Manager::get_handle()->isReady()) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
     if (Card_Manager::get_handle()->exists(path)) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return 0;
     } else {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 }
@@ -414,26 +423,26 @@ vfs_access(const char* path, int mode)
 static int
 vfs_fsync(int fd)
 {
-    file_mutex.lock();
+    file_mutex().lock();
 
     if (!Card_Manager::get_handle()->isReady()) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
     FsFile* file = vfs_get_file_handle(fd);
 
     if (file == nullptr) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
     if (file->isOpen()) {
         file->sync();
-        file_mutex.unlock();
+        file_mutex().unlock();
         return 0;
     } else {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 }
@@ -442,72 +451,72 @@ vfs_fsync(int fd)
 static DIR*
 vfs_opendir(const char* name)
 {
-    file_mutex.lock();
+    file_mutex().lock();
 
     if (!Card_Manager::get_handle()->isReady()) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return nullptr;
     }
     vfs_dir* vdir = new vfs_dir;
     if (!vdir->dir.open(name, O_RDONLY)) {
         delete vdir;
-        file_mutex.unlock();
+        file_mutex().unlock();
         return nullptr;
     }
-    file_mutex.unlock();
+    file_mutex().unlock();
     return reinterpret_cast<DIR*>(vdir);
 }
 
 static struct dirent*
 vfs_readdir(DIR* pdir)
 {
-    file_mutex.lock();
+    file_mutex().lock();
 
     if (!Card_Manager::get_handle()->isReady()) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return nullptr;
     }
     vfs_dir* vdir = reinterpret_cast<vfs_dir*>(pdir);
     // FIXME:
     if (!vdir->file.openNext(&vdir->dir, O_RDONLY)) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return nullptr;
     }
     vdir->file.getName(vdir->entry.d_name, sizeof(vdir->entry.d_name));
     vdir->entry.d_type = vdir->file.isDir() ? DT_DIR : DT_REG;
-    file_mutex.unlock();
+    file_mutex().unlock();
     return &vdir->entry;
 }
 
 static int
 vfs_closedir(DIR* pdir)
 {
-    file_mutex.lock();
+    file_mutex().lock();
 
     vfs_dir* vdir = reinterpret_cast<vfs_dir*>(pdir);
     vdir->dir.close();
     vdir->file.close();
     delete vdir;
-    file_mutex.unlock();
+    file_mutex().unlock();
     return 0;
 }
 
 static int
 vfs_mkdir(const char* path, mode_t mode)
 {
-    file_mutex.lock();
+    file_mutex().lock();
 
     if (!Card_Manager::get_handle()->isReady()) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
     if (!Card_Manager::get_handle()->mkdir(path)) {
-        file_mutex.unlock();
+        file_mutex().unlock();
         return -1;
     }
 
-    file_mutex.unlock();
+    file_mutex().unlock();
     return 0;
 }
 
@@ -0,0 +1,336 @@
+/**
+ * @file crossfade_mixer.cpp
+ *
+ * @brief Two input PCM mixer that fades the end of one track into the start
+ * of the next. Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <audio/crossfade_mixer.h>
+
+Audio::CrossfadeMixer::CrossfadeMixer()
+{
+    for (uint8_t i = 0; i < CROSSFADE_INPUTS; i++) {
+        inputs[i].mixer = this;
+        inputs[i].index = i;
+        gains[i].store(1 << CROSSFADE_GAIN_SHIFT);
+    }
+}
+
+void
+Audio::CrossfadeMixer::begin(Print& output, uint32_t sample_rate, uint8_t channels)
+{
+    this->output = &output;
+    this->sample_rate = sample_rate;
+    this->channels = channels > CROSSFADE_MAX_CHANNELS ? CROSSFADE_MAX_CHANNELS : channels;
+
+    /* Equal power curve, the two gains always square to one so the level holds steady through the fade */
+    for (uint16_t i = 0; i <= CROSSFADE_TABLE_SIZE; i++) {
+        gain_table[i] = (int16_t) lroundf(sinf((float) i / CROSSFADE_TABLE_SIZE * (float) PI / 2) * 32767);
+    }
+
+    /* The FIFOs only fill during a fade, so they can live in PSRAM */
+    for (uint8_t i = 0; i < CROSSFADE_INPUTS; i++) {
+        if (!fifos[i]) {
+            fifos[i] = new RingBuffer(CROSSFADE_FIFO_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        }
+    }
+}
+
+size_t
+Audio::CrossfadeMixer::accept(uint8_t index, const uint8_t* data, size_t length)
+{
+    if (fading && (index == active || index == incoming)) {
+        return fifos[index]->write(data, length);
+    }
+    if (index == active && output) {
+        size_t written = pass(data, length);
+        delivered[index] += written;
+        return written;
+    }
+
+    /* Inputs that aren't wired up swallow whatever they're given */
+    return length;
+}
+
+void
+Audio::CrossfadeMixer::drain(uint8_t index)
+{
+    /* We're both ends of the FIFO, so the clear is serviced straight away */
+    fifos[index]->clear();
+    fifos[index]->available();
+}
+
+void
+Audio::CrossfadeMixer::setActive(uint8_t index)
+{
+    if (fading) {
+        drain(active);
+        drain(incoming);
+    }
+    fading = false;
+    outgoing_done = false;
+    active = index;
+}
+
+bool
+Audio::CrossfadeMixer::start(uint8_t incoming, uint32_t duration_ms)
+{
+    uint32_t frames = ((uint64_t) duration_ms * sample_rate) / 1000;
+    if (incoming == active || frames == 0 || !output) {
+        return false;
+    }
+    for (uint8_t i = 0; i < CROSSFADE_INPUTS; i++) {
+        if (!fifos[i] || !fifos[i]->isValid()) {
+            return false;
+        }
+    }
+
+    drain(active);
+    drain(incoming);
+    this->incoming = incoming;
+    fade_frames = frames;
+    fade_position = 0;
+    outgoing_done = false;
+    busy_us = 0;
+    mixed_frames = 0;
+    fading = true;
+    return true;
+}
+
+void
+Audio::CrossfadeMixer::abort()
+{
+    if (!fading) {
+        return;
+    }
+
+    /* Don't lose what the outgoing decoder already queued */
+    fading = false;
+    const uint8_t* data;
+    size_t length;
+    while ((length = fifos[active]->readSpan(&data)) > 0) {
+        pass(data, length);
+        fifos[active]->commitRead(length);
+        delivered[active] += length;
+    }
+    drain(incoming);
+    outgoing_done = false;
+}
+
+void
+Audio::CrossfadeMixer::cut()
+{
+    if (!fading) {
+        return;
+    }
+    cuts++;
+    complete();
+}
+
+void
+Audio::CrossfadeMixer::complete()
+{
+    uint8_t outgoing = active;
+    active = incoming;
+    fading = false;
+    outgoing_done = false;
+    drain(outgoing);
+
+    /* The incoming decoder may have got ahead of the mix, pass that through before it writes anything new */
+    const uint8_t* data;
+    size_t length;
+    while ((length = fifos[active]->readSpan(&data)) > 0) {
+        pass(data, length);
+        fifos[active]->commitRead(length);
+        delivered[active] += length;
+    }
+}
+
+void
+Audio::CrossfadeMixer::rampUp(uint32_t duration_ms)
+{
+    ramp_frames = ((uint64_t) duration_ms * sample_rate) / 1000;
+    ramp_position = 0;
+}
+
+void
+Audio::CrossfadeMixer::setGain(uint8_t index, float gain_db)
+{
+    gains[index].store(lroundf(powf(10.0f, gain_db / 20) * (1 << CROSSFADE_GAIN_SHIFT)));
+}
+
+size_t
+Audio::CrossfadeMixer::pass(const uint8_t* data, size_t length)
+{
+    if (ramp_position < ramp_frames || gains[active].load() != 1 << CROSSFADE_GAIN_SHIFT) {
+        return scale(data, length);
+    }
+    return output->write(data, length);
+}
+
+size_t
+Audio::CrossfadeMixer::scale(const uint8_t* data, size_t length)
+{
+    const size_t frame_bytes = channels * sizeof(int16_t);
+    const int32_t input_gain = gains[active].load();
+    size_t written = 0;
+    while (length - written >= frame_bytes) {
+        size_t frames = (length - written) / frame_bytes;
+        if (frames > CROSSFADE_MIX_FRAMES) {
+            frames = CROSSFADE_MIX_FRAMES;
+        }
+        bool ramping = ramp_position < ramp_frames;
+        if (ramping && frames > ramp_frames - ramp_position) {
+            frames = ramp_frames - ramp_position;
+        }
+
+        /* A ramp follows the same curve as the incoming side of a fade */
+        size_t bytes = frames * frame_bytes;
+        memcpy(mixed_samples, data + written, bytes);
+        for (size_t frame = 0; frame < frames; frame++) {
+            int32_t gain = input_gain;
+            if (ramping) {
+                gain = (gain_table[((ramp_position + frame) * CROSSFADE_TABLE_SIZE) / ramp_frames] * gain) >> 15;
+            }
+            for (uint8_t channel = 0; channel < channels; channel++) {
+                size_t i = frame * channels + channel;
+                int32_t sample = (mixed_samples[i] * gain) >> CROSSFADE_GAIN_SHIFT;
+                if (sample > INT16_MAX) {
+                    sample = INT16_MAX;
+                } else if (sample < INT16_MIN) {
+                    sample = INT16_MIN;
+                }
+                mixed_samples[i] = (int16_t) sample;
+            }
+        }
+        written += output->write((const uint8_t*) mixed_samples, bytes);
+        if (ramping) {
+            ramp_position += frames;
+        }
+    }
+    if (written < length) {
+        written += output->write(data + written, length - written);
+    }
+    return written;
+}
+
+size_t
+Audio::CrossfadeMixer::room(uint8_t index)
+{
+    if (!fifos[index]) {
+        return 0;
+    }
+    return fifos[index]->availableForWrite();
+}
+
+bool
+Audio::CrossfadeMixer::mix()
+{
+    const size_t frame_bytes = channels * sizeof(int16_t);
+
+    while (fading) {
+        /* Once the outgoing track has ended and its last frames are mixed, it's faded against silence */
+        size_t incoming_frames = fifos[incoming]->available() / frame_bytes;
+        size_t queued_frames = fifos[active]->available() / frame_bytes;
+        bool silent = outgoing_done && queued_frames == 0;
+        size_t outgoing_frames = silent ? CROSSFADE_MIX_FRAMES : queued_frames;
+        size_t frames = incoming_frames < outgoing_frames ? incoming_frames : outgoing_frames;
+        if (frames > CROSSFADE_MIX_FRAMES) {
+            frames = CROSSFADE_MIX_FRAMES;
+        }
+        if (frames > fade_frames - fade_position) {
+            frames = fade_frames - fade_position;
+        }
+
+        /* If the incoming decoder falls behind, keep the outgoing track playing at its current gain
+        and hold the fade where it is rather than let the output run dry */
+        bool hold = false;
+        if (frames == 0) {
+            if (incoming_frames == 0 && (outgoing_done || queued_frames * frame_bytes >= CROSSFADE_FIFO_SIZE / 2) && !silent) {
+                frames = outgoing_frames < CROSSFADE_MIX_FRAMES ? outgoing_frames : CROSSFADE_MIX_FRAMES;
+                hold = true;
+            } else {
+                break;
+            }
+        }
+
+        size_t length = frames * frame_bytes;
+        if (silent) {
+            memset(outgoing_samples, 0, length);
+        } else {
+            fifos[active]->read((uint8_t*) outgoing_samples, length);
+            delivered[active] += length;
+        }
+        if (hold) {
+            memset(incoming_samples, 0, length);
+        } else {
+            fifos[incoming]->read((uint8_t*) incoming_samples, length);
+            delivered[incoming] += length;
+        }
+
+        /* Each side's own gain goes in with the fade's, which can take the sum past 32 bits */
+        const int32_t input_gain_out = gains[active].load();
+        const int32_t input_gain_in = gains[incoming].load();
+        for (size_t frame = 0; frame < frames; frame++) {
+            uint32_t step = ((fade_position + (hold ? 0 : frame)) * CROSSFADE_TABLE_SIZE) / fade_frames;
+            int32_t gain_in = (gain_table[step] * input_gain_in) >> CROSSFADE_GAIN_SHIFT;
+            int32_t gain_out = (gain_table[CROSSFADE_TABLE_SIZE - step] * input_gain_out) >> CROSSFADE_GAIN_SHIFT;
+            for (uint8_t channel = 0; channel < channels; channel++) {
+                size_t i = frame * channels + channel;
+                int32_t sample = ((int64_t) outgoing_samples[i] * gain_out + (int64_t) incoming_samples[i] * gain_in) >> 15;
+                if (sample > INT16_MAX) {
+                    sample = INT16_MAX;
+                } else if (sample < INT16_MIN) {
+                    sample = INT16_MIN;
+                }
+                mixed_samples[i] = (int16_t) sample;
+            }
+        }
+        output->write((const uint8_t*) mixed_samples, length);
+
+        mixed_frames += frames;
+        if (!hold) {
+            fade_position += frames;
+        }
+        if (fade_position >= fade_frames) {
+            complete();
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+Audio::CrossfadeMixer::account(uint32_t busy_us)
+{
+    if (!fading) {
+        return;
+    }
+    this->busy_us += busy_us;
+
+    uint64_t audio_us = (mixed_frames * 1000000) / sample_rate;
+    if (audio_us < CROSSFADE_BUDGET_GRACE_MS * 1000) {
+        return;
+    }
+    if (this->busy_us * 100 > audio_us * CROSSFADE_CPU_BUDGET_PERCENT) {
+        log_w("Crossfade decoding took %d%% of real time, cutting over", (uint32_t) ((this->busy_us * 100) / audio_us));
+        cut();
+    }
+}
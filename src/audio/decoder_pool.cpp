@@ -0,0 +1,167 @@
+/**
+ * @file decoder_pool.cpp
+ *
+ * @brief Owns one pre-initialized instance of every supported decoder and
+ * picks the right one for a file type or a block of stream data. Part of
+ * the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <audio/decoder_pool.h>
+#include <system.h>
+
+void
+Audio::DecoderPool::begin(Print& output)
+{
+    mp3_decoder.setOutput(output);
+    flac_decoder.setOutput(output);
+    wav_decoder.setOutput(output);
+    opus_decoder.setOutput(output);
+    mp3_decoder.begin();
+    flac_decoder.begin();
+    wav_decoder.begin();
+    opus_decoder.begin();
+}
+
+audio_tools::AudioDecoder*
+Audio::DecoderPool::get(uint8_t type)
+{
+    switch (type) {
+        case FILETYPE_MP3:
+            return &mp3_decoder;
+        case FILETYPE_FLAC:
+            return &flac_decoder;
+        case FILETYPE_WAV:
+            return &wav_decoder;
+        case FILETYPE_OGG:
+            return &opus_decoder;
+        default:
+            return nullptr;
+    }
+}
+
+uint8_t
+Audio::DecoderPool::bitOf(audio_tools::AudioDecoder* decoder)
+{
+    if (decoder == &mp3_decoder) {
+        return 1 << 0;
+    }
+    if (decoder == &flac_decoder) {
+        return 1 << 1;
+    }
+    if (decoder == &wav_decoder) {
+        return 1 << 2;
+    }
+    if (decoder == &opus_decoder) {
+        return 1 << 3;
+    }
+    return 0;
+}
+
+void
+Audio::DecoderPool::rearm(audio_tools::AudioDecoder* decoder)
+{
+    if (!bitOf(decoder)) {
+        return;
+    }
+    decoder->end();
+    decoder->begin();
+    retired.fetch_and(~bitOf(decoder));
+}
+
+void
+Audio::DecoderPool::finish(audio_tools::AudioDecoder* decoder)
+{
+    if (!decoder) {
+        return;
+    }
+    /* Decodes the final frame the codecs keep back while they wait for the next sync word */
+    decoder->flush();
+    retire(decoder);
+}
+
+void
+Audio::DecoderPool::retire(audio_tools::AudioDecoder* decoder)
+{
+    retired.fetch_or(bitOf(decoder));
+}
+
+void
+Audio::DecoderPool::recycle()
+{
+    /* The bit only clears once the decoder has restarted, so the audio task can't pick it up half way */
+    audio_tools::AudioDecoder* decoders[] = { &mp3_decoder, &flac_decoder, &wav_decoder, &opus_decoder };
+    uint8_t pending = retired.load();
+    for (audio_tools::AudioDecoder* decoder : decoders) {
+        if (pending & bitOf(decoder)) {
+            decoder->end();
+            decoder->begin();
+            retired.fetch_and(~bitOf(decoder));
+        }
+    }
+}
+
+void
+Audio::DecoderPool::setSpectrum(SubbandSpectrum* spectrum, uint8_t deck)
+{
+#if SPECTRUM_MP3_SUBBANDS
+    mp3_decoder.setSpectrum(spectrum, deck);
+#else
+    (void) spectrum;
+    (void) deck;
+#endif
+}
+
+uint8_t
+Audio::DecoderPool::detect(const uint8_t* data, size_t length)
+{
+    if (!data || length < 4) {
+        return FILETYPE_UNKNOWN;
+    }
+
+    if (memcmp(data, "fLaC", 4) == 0) {
+        return FILETYPE_FLAC;
+    }
+
+    if (memcmp(data, "OggS", 4) == 0) {
+        return FILETYPE_OGG;
+    }
+
+    /* RIFF containers can hold more than audio, so check the form type as well */
+    if (memcmp(data, "RIFF", 4) == 0) {
+        if (length >= DECODER_DETECT_BYTES && memcmp(data + 8, "WAVE", 4) == 0) {
+            return FILETYPE_WAV;
+        }
+        return FILETYPE_UNKNOWN;
+    }
+
+    /* An ID3v2 tag in front of the audio frames */
+    if (memcmp(data, "ID3", 3) == 0) {
+        return FILETYPE_MP3;
+    }
+
+    /* Look for an MPEG audio frame sync (11 set bits) with a valid layer and bitrate */
+    for (size_t i = 0; i + 2 < length; i++) {
+        if (data[i] == 0xFF && (data[i + 1] & 0xE0) == 0xE0 && (data[i + 1] & 0x06) != 0 && (data[i + 2] & 0xF0) != 0xF0) {
+            return FILETYPE_MP3;
+        }
+    }
+
+    return FILETYPE_UNKNOWN;
+}
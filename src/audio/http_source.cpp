@@ -0,0 +1,281 @@
+/**
+ * @file http_source.cpp
+ *
+ * @brief HTTP stream that keeps track of its byte offset, so it can be reopened
+ * where it left off or anywhere else in a file.  Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <audio/http_source.h>
+#include <card_manager.h>
+
+/* Everything up to the path, the part of a URL that decides whether a connection can be reused */
+static void
+url_origin(const char* url, char* origin, size_t size)
+{
+    const char* host = strstr(url, "://");
+    host = host ? host + 3 : url;
+    size_t length = strcspn(host, "/?#") + (host - url);
+    if (length >= size) {
+        length = 0;
+    }
+    memcpy(origin, url, length);
+    origin[length] = '\0';
+}
+
+Audio::HttpSource::HttpSource()
+{
+    client.source = this;
+    tls_transport.source = this;
+}
+
+Audio::HttpSource::stats_t
+Audio::HttpSource::getStats()
+{
+    TlsClient::stats_t tls = secure_client.getStats();
+    stats_t current = stats;
+    current.tls_handshakes = tls.handshakes;
+    current.tls_resumed = tls.resumed;
+    current.tls_handshake_ms = tls.handshake_ms;
+    return current;
+}
+
+/* The TLS client sets itself up on its first connection and keeps what it was given, so this only happens once.  A
+card put in later takes a restart to be read. */
+void
+Audio::HttpSource::loadRoots()
+{
+    if (roots_loaded) {
+        return;
+    }
+    roots_loaded = true;
+
+    FsFile file;
+    Card_Manager::get_handle()->mutex().lock();
+    bool opened = file.open(HTTP_ROOTS_PATH, O_RDONLY);
+    uint32_t size = opened ? file.size() : 0;
+    char* pem = nullptr;
+    if (opened && size > 0 && size <= HTTP_ROOTS_MAX) {
+        pem = (char*) heap_caps_malloc(size + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (pem && file.read(pem, size) != (int) size) {
+            heap_caps_free(pem);
+            pem = nullptr;
+        }
+    }
+    if (opened) {
+        file.close();
+    }
+    Card_Manager::get_handle()->mutex().unlock();
+
+    if (!pem) {
+        log_w("No root certificates in %s, HTTPS servers won't be authenticated", HTTP_ROOTS_PATH);
+        return;
+    }
+    pem[size] = '\0';
+    if (secure_client.setCACert(pem)) {
+        log_i("Loaded root certificates from %s", HTTP_ROOTS_PATH);
+    } else {
+        log_w("Couldn't use the root certificates in %s, HTTPS servers won't be authenticated", HTTP_ROOTS_PATH);
+    }
+    heap_caps_free(pem);
+}
+
+bool
+Audio::HttpSource::open(const char* url, uint32_t offset)
+{
+    /* Only a request to the same place can go out on the connection the last reply left open */
+    char origin[HTTP_HOST_MAX];
+    url_origin(url, origin, sizeof(origin));
+    bool secure = strncmp(url, "https://", 8) == 0;
+    if (secure) {
+        loadRoots();
+    }
+    Client& connection = secure ? (Client&) secure_client : client;
+    bool reuse = kept && origin[0] && strcmp(origin, kept_origin) == 0 && connection.connected();
+    kept = false;
+    strlcpy(kept_origin, origin, sizeof(kept_origin));
+    if (!reuse) {
+        stream.end();
+        stream.setClient(connection);
+    }
+
+    /* A range from 0 is sent as well, a Content-Range in the reply is how we know the server takes them */
+    char range[24];
+    snprintf(range, sizeof(range), "bytes=%lu-", (unsigned long) offset);
+    stream.addRequestHeader("Range", range);
+    stream.addRequestHeader("Icy-MetaData", "1");
+    open_connect_ms = 0;
+    uint32_t handshakes = secure_client.getStats().handshakes;
+    uint32_t started = millis();
+    bool replied = stream.begin(url);
+
+    /* The server may have dropped a kept connection while it sat idle, in which case try a new one */
+    if (!replied && reuse) {
+        log_i("Kept connection to %s has gone, reconnecting", origin);
+        reuse = false;
+        stream.end();
+        open_connect_ms = 0;
+        started = millis();
+        replied = stream.begin(url);
+    }
+    if (!replied) {
+        return false;
+    }
+    stats.requests++;
+    if (reuse) {
+        stats.reused++;
+    }
+    if (secure_client.getStats().handshakes != handshakes) {
+        open_connect_ms += secure_client.getStats().handshake_ms;
+    }
+    stats.first_byte_ms = millis() - started - open_connect_ms;
+
+    /* Content-Range is "bytes first-last/total", the total can be * if the server doesn't know it */
+    const char* content_range = stream.getReplyHeader("Content-Range");
+    const char* content_length = stream.getReplyHeader("Content-Length");
+    const char* metaint = stream.getReplyHeader("icy-metaint");
+    unsigned long first = 0;
+    unsigned long total = 0;
+    if (content_range && sscanf(content_range, "bytes %lu-%*u/%lu", &first, &total) >= 1) {
+        this->offset = first;
+        skip = 0;
+        length = total;
+    } else {
+        this->offset = 0;
+        skip = offset;
+        length = content_length ? strtoul(content_length, nullptr, 10) : 0;
+    }
+    icy.begin(metaint ? atoi(metaint) : 0);
+    seekable = content_range && !icy.isActive();
+    const char* connection_header = stream.getReplyHeader("Connection");
+    keep_alive = !(connection_header && strcasecmp(connection_header, "close") == 0);
+
+    log_i("Opened %s at offset %lu of %lu, %s", url, (unsigned long) (this->offset + skip), (unsigned long) length, seekable ? "seekable" : icy.isActive() ? "live" : "from the start");
+    log_i("%s connection, %lu ms to connect, %lu ms to the reply", reuse ? "Kept" : "New", (unsigned long) open_connect_ms,
+          (unsigned long) stats.first_byte_ms);
+    return true;
+}
+
+void
+Audio::HttpSource::close()
+{
+    /* Unless the reply was read to the end, the rest of it is still on the way and the connection is no use */
+    kept = keep_alive && length > 0 && skip == 0 && offset >= length && !icy.isActive();
+    keep_alive = false;
+    if (!kept) {
+        stream.end();
+    }
+}
+
+int
+Audio::HttpSource::CachedClient::connect(const char* host, uint16_t port, int32_t timeout_ms)
+{
+    uint32_t started = millis();
+    IPAddress ip;
+    if (!source->resolve(host, ip)) {
+        source->open_connect_ms += millis() - started;
+        return 0;
+    }
+
+    /* A host that has moved since it was cached gets one more try at a fresh address */
+    uint32_t resolved = millis();
+    int connected = WiFiClient::connect(ip, port, timeout_ms);
+    if (!connected) {
+        IPAddress cached = ip;
+        source->forget(host);
+        if (source->resolve(host, ip) && ip != cached) {
+            resolved = millis();
+            connected = WiFiClient::connect(ip, port, timeout_ms);
+        }
+    }
+    source->stats.connect_ms = millis() - resolved;
+    source->open_connect_ms += millis() - started;
+    return connected;
+}
+
+bool
+Audio::HttpSource::resolve(const char* host, IPAddress& ip)
+{
+    /* Look for the host, noting the stalest entry in case it has to be replaced */
+    dns_entry_t* slot = &dns_cache[0];
+    for (uint8_t i = 0; i < HTTP_DNS_CACHE_SIZE; i++) {
+        dns_entry_t& entry = dns_cache[i];
+        if (entry.host[0] && strcmp(entry.host, host) == 0) {
+            if (millis() - entry.resolved_at < HTTP_DNS_CACHE_TTL_MS) {
+                ip = entry.ip;
+                stats.dns_hits++;
+                return true;
+            }
+            slot = &entry;
+            break;
+        }
+        if (!entry.host[0] || (slot->host[0] && entry.resolved_at < slot->resolved_at)) {
+            slot = &entry;
+        }
+    }
+
+    stats.dns_misses++;
+    uint32_t started = millis();
+    if (WiFi.hostByName(host, ip) != 1) {
+        log_e("Couldn't resolve %s", host);
+        return false;
+    }
+    stats.dns_ms = millis() - started;
+    if (strlen(host) < HTTP_HOST_MAX) {
+        strlcpy(slot->host, host, sizeof(slot->host));
+        slot->ip = ip;
+        slot->resolved_at = millis();
+    }
+    return true;
+}
+
+void
+Audio::HttpSource::forget(const char* host)
+{
+    for (uint8_t i = 0; i < HTTP_DNS_CACHE_SIZE; i++) {
+        if (strcmp(dns_cache[i].host, host) == 0) {
+            dns_cache[i].host[0] = '\0';
+        }
+    }
+}
+
+size_t
+Audio::HttpSource::read(uint8_t* data, size_t length)
+{
+    /* The skipped bytes go through the caller's buffer, it's free space that isn't committed */
+    while (skip > 0 && stream.available() > 0) {
+        size_t wanted = length < skip ? length : skip;
+        if (wanted > (size_t) stream.available()) {
+            wanted = stream.available();
+        }
+        size_t skipped = stream.readBytes(data, wanted);
+        if (skipped == 0) {
+            return 0;
+        }
+        skip -= skipped;
+        offset += skipped;
+    }
+    if (skip > 0) {
+        return 0;
+    }
+
+    size_t read_bytes = icy.read(stream, data, length);
+    offset += read_bytes;
+    return read_bytes;
+}
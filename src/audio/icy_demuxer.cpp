@@ -0,0 +1,119 @@
+/**
+ * @file icy_demuxer.cpp
+ *
+ * @brief Separates the ICY metadata blocks of an internet radio stream from the
+ * audio as it's read off the network.  Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <audio/icy_demuxer.h>
+
+void
+Audio::IcyDemuxer::begin(uint32_t metaint)
+{
+    this->metaint = metaint;
+    audio_left = metaint;
+    metadata_length = -1;
+    metadata_read = 0;
+}
+
+size_t
+Audio::IcyDemuxer::read(Stream& stream, uint8_t* data, size_t length)
+{
+    if (!metaint) {
+        int available = stream.available();
+        return available > 0 ? stream.readBytes(data, length < (size_t) available ? length : available) : 0;
+    }
+
+    /* The block goes first, so the title is out before the audio that follows it */
+    if (audio_left == 0) {
+        if (!readMetadata(stream)) {
+            return 0;
+        }
+        audio_left = metaint;
+    }
+
+    int available = stream.available();
+    if (available <= 0) {
+        return 0;
+    }
+    if (length > (size_t) available) {
+        length = available;
+    }
+    if (length > audio_left) {
+        length = audio_left;
+    }
+    size_t read_bytes = stream.readBytes(data, length);
+    audio_left -= read_bytes;
+    return read_bytes;
+}
+
+bool
+Audio::IcyDemuxer::readMetadata(Stream& stream)
+{
+    if (metadata_length < 0) {
+        if (stream.available() <= 0) {
+            return false;
+        }
+        metadata_length = stream.read() * 16;
+        metadata_read = 0;
+    }
+
+    /* Most blocks are empty, the text is only sent when it changes */
+    int available = stream.available();
+    size_t wanted = metadata_length - metadata_read;
+    if (wanted > 0 && available > 0) {
+        metadata_read += stream.readBytes((uint8_t*) metadata + metadata_read, wanted < (size_t) available ? wanted : available);
+    }
+    if (metadata_read < metadata_length) {
+        return false;
+    }
+
+    metadata[metadata_length] = '\0';
+    if (metadata_length > 0) {
+        parse();
+    }
+    metadata_length = -1;
+    return true;
+}
+
+/* The value runs to the next "';", since titles can have apostrophes of their own */
+void
+Audio::IcyDemuxer::parse()
+{
+    static const char key[] = "StreamTitle='";
+    char* title = strstr(metadata, key);
+    if (!title) {
+        return;
+    }
+    title += sizeof(key) - 1;
+    char* end = strstr(title, "';");
+    if (!end) {
+        end = strrchr(title, '\'');
+    }
+    if (end) {
+        *end = '\0';
+    }
+
+    /* Some servers send an empty title between tracks, keep showing the last one */
+    if (*title && title_callback) {
+        log_i("Stream title: %s", title);
+        title_callback(title);
+    }
+}
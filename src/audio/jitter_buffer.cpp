@@ -0,0 +1,122 @@
+/**
+ * @file jitter_buffer.cpp
+ *
+ * @brief Large PSRAM ring for network streams that holds playback back
+ * until enough data has arrived to ride out WiFi hiccups, and adapts its
+ * depth to the jitter it sees. Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <audio/jitter_buffer.h>
+
+Audio::JitterBuffer::JitterBuffer(size_t size, size_t preroll)
+  : RingBuffer(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+  , preroll(preroll)
+{
+    stats.preroll = preroll;
+}
+
+void
+Audio::JitterBuffer::reset()
+{
+    released.store(false);
+    rebuffering = false;
+    quiet_since = millis();
+    stats.min_fill = this->size();
+    stats.avg_fill = 0;
+}
+
+void
+Audio::JitterBuffer::setPreroll(size_t preroll)
+{
+    if (preroll < NETWORK_BUFFER_MIN_PREROLL) {
+        preroll = NETWORK_BUFFER_MIN_PREROLL;
+    } else if (preroll > NETWORK_BUFFER_MAX_PREROLL) {
+        preroll = NETWORK_BUFFER_MAX_PREROLL;
+    }
+    this->preroll = preroll;
+    stats.preroll = preroll;
+}
+
+bool
+Audio::JitterBuffer::update()
+{
+    size_t level = fill();
+
+    if (!released.load()) {
+        /* Wait for the pre-roll on a fresh stream, and for a deeper level after an underrun so
+        we don't bounce straight back into buffering */
+        size_t target = rebuffering ? (preroll * NETWORK_BUFFER_RESUME_PERCENT) / 100 : preroll;
+        if (target > NETWORK_BUFFER_MAX_PREROLL) {
+            target = NETWORK_BUFFER_MAX_PREROLL;
+        }
+        if (level >= target) {
+            log_i("Network buffer released at %d bytes", level);
+            released.store(true);
+            quiet_since = millis();
+            stats.min_fill = level;
+
+            /* The consumer is asleep waiting on us */
+            flush();
+        }
+        return released.load();
+    }
+
+    /* The consumer drained everything, hold it until we've rebuilt the buffer */
+    if (level == 0) {
+        released.store(false);
+        rebuffering = true;
+        stats.underruns++;
+        log_w("Network buffer underrun (%d so far)", stats.underruns);
+        setPreroll(preroll + NETWORK_BUFFER_ADAPT_STEP);
+        return false;
+    }
+
+    if (level < stats.min_fill) {
+        stats.min_fill = level;
+    }
+    stats.avg_fill = stats.avg_fill ? (stats.avg_fill * 15 + level) / 16 : level;
+    adapt();
+    return true;
+}
+
+void
+Audio::JitterBuffer::finish()
+{
+    if (!released.load()) {
+        log_i("End of stream, releasing the last %d bytes", fill());
+        released.store(true);
+        flush();
+    }
+}
+
+/* Give back some depth if the connection has been steady for a while */
+void
+Audio::JitterBuffer::adapt()
+{
+    if (millis() - quiet_since < NETWORK_BUFFER_QUIET_PERIOD) {
+        return;
+    }
+    if (stats.min_fill > preroll / 2 && preroll > NETWORK_BUFFER_MIN_PREROLL) {
+        setPreroll(preroll - NETWORK_BUFFER_ADAPT_STEP);
+        log_i("Network buffer pre-roll reduced to %d bytes", preroll);
+    }
+    quiet_since = millis();
+    stats.min_fill = fill();
+}
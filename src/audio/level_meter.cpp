@@ -0,0 +1,68 @@
+/**
+ * @file level_meter.cpp
+ *
+ * @brief Peak and RMS level of each output channel, gathered by the output stage.
+ * Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <audio/level_meter.h>
+
+void
+Audio::LevelMeter::begin(uint8_t channels)
+{
+    this->channels = channels > LEVEL_METER_MAX_CHANNELS ? LEVEL_METER_MAX_CHANNELS : channels;
+}
+
+void
+Audio::LevelMeter::commit(uint32_t frames)
+{
+    this->frames += frames;
+    if (this->frames < LEVEL_METER_WINDOW_FRAMES || (middle.load() & METER_FRESH)) {
+        return;
+    }
+
+    reading_t& reading = sets[back];
+    for (uint8_t channel = 0; channel < channels; channel++) {
+        reading.peak[channel] = peaks[channel];
+        reading.mean_square[channel] = (float) squares[channel] / this->frames;
+        peaks[channel] = 0;
+        squares[channel] = 0;
+    }
+    this->frames = 0;
+    back = middle.exchange(back | METER_FRESH) & ~METER_FRESH;
+}
+
+bool
+Audio::LevelMeter::read(levels_t& levels)
+{
+    if (!(middle.load() & METER_FRESH)) {
+        return false;
+    }
+    front = middle.exchange(front) & ~METER_FRESH;
+
+    /* A full scale sine peaks at 32767 with a mean square of half that squared */
+    const reading_t& reading = sets[front];
+    levels.channels = channels;
+    for (uint8_t channel = 0; channel < channels; channel++) {
+        levels.peak[channel] = 20 * log10f(reading.peak[channel] / 32767.0f + 1e-6f);
+        levels.rms[channel] = 10 * log10f(reading.mean_square[channel] * 2 / (32767.0f * 32767.0f) + 1e-12f);
+    }
+    return true;
+}
@@ -0,0 +1,166 @@
+/**
+ * @file loudness_meter.cpp
+ *
+ * @brief Integrated loudness of a track, measured the EBU R128 way.
+ * Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <audio/loudness_meter.h>
+
+/* Mean square power of a block, summed over the channels, to loudness and back */
+static float
+to_lufs(double power)
+{
+    return -0.691f + 10 * log10f(power);
+}
+
+static double
+to_power(float lufs)
+{
+    return pow(10.0, (lufs + 0.691) / 10);
+}
+
+void
+Audio::LoudnessMeter::begin(uint32_t sample_rate, uint8_t channels)
+{
+    this->sample_rate = sample_rate;
+    this->channels = channels > LOUDNESS_MAX_CHANNELS ? LOUDNESS_MAX_CHANNELS : channels;
+
+    /* BS.1770 gives the coefficients at 48 kHz.  These are the analogue prototypes they came from,
+    so the filters can be made for any rate. */
+    double K = tan(PI * 1681.974450955533 / sample_rate);
+    double Q = 0.7071752369554196;
+    double Vh = pow(10.0, 3.999843853973347 / 20);
+    double Vb = pow(Vh, 0.4996667741545416);
+    double a0 = 1 + K / Q + K * K;
+    coefficients[0][0] = (Vh + Vb * K / Q + K * K) / a0;
+    coefficients[0][1] = 2 * (K * K - Vh) / a0;
+    coefficients[0][2] = (Vh - Vb * K / Q + K * K) / a0;
+    coefficients[0][3] = 2 * (K * K - 1) / a0;
+    coefficients[0][4] = (1 - K / Q + K * K) / a0;
+
+    K = tan(PI * 38.13547087602444 / sample_rate);
+    Q = 0.5003270373238773;
+    a0 = 1 + K / Q + K * K;
+    coefficients[1][0] = 1;
+    coefficients[1][1] = -2;
+    coefficients[1][2] = 1;
+    coefficients[1][3] = 2 * (K * K - 1) / a0;
+    coefficients[1][4] = (1 - K / Q + K * K) / a0;
+
+    step_frames = sample_rate / 10;
+    reset();
+}
+
+void
+Audio::LoudnessMeter::reset()
+{
+    memset(state, 0, sizeof(state));
+    memset(histogram, 0, sizeof(histogram));
+    step_position = 0;
+    step_power = 0;
+    step_count = 0;
+    peak = 0;
+}
+
+size_t
+Audio::LoudnessMeter::write(const uint8_t* data, size_t length)
+{
+    const size_t frame_bytes = channels * sizeof(int16_t);
+    const size_t frames = length / frame_bytes;
+    for (size_t frame = 0; frame < frames; frame++) {
+        for (uint8_t channel = 0; channel < channels; channel++) {
+            int16_t sample;
+            memcpy(&sample, data + frame * frame_bytes + channel * sizeof(int16_t), sizeof(sample));
+            int32_t level = sample < 0 ? -sample : sample;
+            if (level > peak) {
+                peak = level;
+            }
+
+            float x = sample / 32768.0f;
+            for (uint8_t stage = 0; stage < 2; stage++) {
+                const float* c = coefficients[stage];
+                float* s = state[channel][stage];
+                float y = c[0] * x + s[0];
+                s[0] = c[1] * x - c[3] * y + s[1];
+                s[1] = c[2] * x - c[4] * y;
+                x = y;
+            }
+            step_power += x * x;
+        }
+        if (++step_position >= step_frames) {
+            endStep();
+        }
+    }
+    return length;
+}
+
+void
+Audio::LoudnessMeter::endStep()
+{
+    steps[step_count % 4] = step_power / step_frames;
+    step_count++;
+    step_position = 0;
+    step_power = 0;
+    if (step_count < 4) {
+        return;
+    }
+
+    float power = (steps[0] + steps[1] + steps[2] + steps[3]) / 4;
+    if (power <= 0) {
+        return;
+    }
+    float lufs = to_lufs(power);
+    if (lufs < LOUDNESS_ABSOLUTE_GATE) {
+        return;
+    }
+    int32_t bin = (lufs - LOUDNESS_ABSOLUTE_GATE) * LOUDNESS_HISTOGRAM_STEP;
+    histogram[bin < LOUDNESS_HISTOGRAM_BINS ? bin : LOUDNESS_HISTOGRAM_BINS - 1]++;
+}
+
+float
+Audio::LoudnessMeter::getIntegrated()
+{
+    /* Each bin stands for blocks at the loudness of its middle */
+    double total = 0;
+    uint32_t count = 0;
+    for (uint32_t bin = 0; bin < LOUDNESS_HISTOGRAM_BINS; bin++) {
+        if (histogram[bin]) {
+            total += histogram[bin] * to_power(LOUDNESS_ABSOLUTE_GATE + (bin + 0.5f) / LOUDNESS_HISTOGRAM_STEP);
+            count += histogram[bin];
+        }
+    }
+    if (count == 0) {
+        return NAN;
+    }
+
+    float gate = to_lufs(total / count) + LOUDNESS_RELATIVE_GATE;
+    int32_t first = ceilf((gate - LOUDNESS_ABSOLUTE_GATE) * LOUDNESS_HISTOGRAM_STEP - 0.5f);
+    total = 0;
+    count = 0;
+    for (int32_t bin = first > 0 ? first : 0; bin < LOUDNESS_HISTOGRAM_BINS; bin++) {
+        if (histogram[bin]) {
+            total += histogram[bin] * to_power(LOUDNESS_ABSOLUTE_GATE + (bin + 0.5f) / LOUDNESS_HISTOGRAM_STEP);
+            count += histogram[bin];
+        }
+    }
+    return count ? to_lufs(total / count) : NAN;
+}
@@ -0,0 +1,340 @@
+/**
+ * @file loudness_scanner.cpp
+ *
+ * @brief Background pass that measures the loudness of the files in a directory.
+ * Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <audio/loudness_scanner.h>
+#include <card_manager.h>
+#include <file_explorer.h>
+#include <sqlite3.h>
+#include <system.h>
+
+static std::string
+index_path(const std::string& directory)
+{
+    std::string db_path = directory;
+    if (db_path != "/") {
+        db_path += "/";
+    }
+    return db_path + DB_FILE;
+}
+
+void
+Audio::LoudnessScanner::begin()
+{
+    if (handle) {
+        return;
+    }
+    xTaskCreatePinnedToCore(task, "LoudnessScan", LOUDNESS_SCAN_STACK, this, tskIDLE_PRIORITY, &handle, 1);
+}
+
+void
+Audio::LoudnessScanner::scan(const char* directory)
+{
+    request_mutex.lock();
+    request = directory;
+    request_mutex.unlock();
+    pending.store(true);
+    if (handle) {
+        xTaskNotifyGive(handle);
+    }
+}
+
+void
+Audio::LoudnessScanner::cancel()
+{
+    scan("");
+}
+
+void
+Audio::LoudnessScanner::defer(std::function<void()> write)
+{
+    request_mutex.lock();
+    deferred.push_back(std::move(write));
+    request_mutex.unlock();
+    deferred_pending.store(true);
+    if (handle) {
+        xTaskNotifyGive(handle);
+    }
+}
+
+void
+Audio::LoudnessScanner::runDeferred()
+{
+    if (!deferred_pending.exchange(false)) {
+        return;
+    }
+    request_mutex.lock();
+    std::vector<std::function<void()>> writes;
+    writes.swap(deferred);
+    request_mutex.unlock();
+    for (auto& write : writes) {
+        write();
+    }
+}
+
+void
+Audio::LoudnessScanner::task(void* scanner)
+{
+    LoudnessScanner* self = (LoudnessScanner*) scanner;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        self->runDeferred();
+        while (self->pending.exchange(false)) {
+            self->request_mutex.lock();
+            std::string directory = self->request;
+            self->request_mutex.unlock();
+            if (!directory.empty()) {
+                self->run(directory);
+            }
+        }
+    }
+}
+
+void
+Audio::LoudnessScanner::run(const std::string& directory)
+{
+    std::string db_path = index_path(directory);
+    uint32_t scanned = 0;
+    int64_t id = 0;
+    std::string filename;
+    uint8_t type;
+    while (!pending.load() && next(db_path, &id, &filename, &type)) {
+        runDeferred();
+        std::string path = directory != "/" ? directory + "/" + filename : "/" + filename;
+
+        /* Tags first, they cost a few reads rather than a decode of the whole file */
+        tags_t tags;
+        float gain_db = NAN;
+        if (TagReader().read(path.c_str(), type, &tags)) {
+            gain_db = fromTags(tags);
+        }
+        /* A file that couldn't be read this time is left without a gain, and tried again on the next scan */
+        if (isnan(gain_db) && !measure(path, type, &gain_db)) {
+            if (pending.load()) {
+                break;
+            }
+            log_w("Couldn't measure the loudness of %s", path.c_str());
+            continue;
+        }
+        if (!store(db_path, filename, gain_db)) {
+            break;
+        }
+        scanned++;
+    }
+
+    delete decoders;
+    decoders = nullptr;
+    if (scanned > 0) {
+        log_i("Stored the gain of %d files in %s", scanned, directory.c_str());
+    }
+}
+
+bool
+Audio::LoudnessScanner::next(const std::string& db_path, int64_t* id, std::string* filename, uint8_t* type)
+{
+    /* The index is rewritten under the mutex, a read that doesn't take it can see a half written file */
+    Card_Manager::get_handle()->index_mutex().lock();
+    sqlite3* db;
+    if (sqlite3_open_v2(db_path.c_str(), &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+        sqlite3_close(db);
+        Card_Manager::get_handle()->index_mutex().unlock();
+        return false;
+    }
+
+    /* In id order from the last one, so a file left without a gain isn't picked again in the same scan */
+    char sql[160];
+    snprintf(sql,
+             sizeof(sql),
+             "SELECT id, filename, type FROM files WHERE id > ? AND gain IS NULL AND type IN (%d, %d, %d, %d) ORDER BY id LIMIT 1",
+             FILETYPE_MP3,
+             FILETYPE_FLAC,
+             FILETYPE_OGG,
+             FILETYPE_WAV);
+    bool found = false;
+    sqlite3_stmt* statement;
+    if (sqlite3_prepare_v2(db, sql, -1, &statement, NULL) == SQLITE_OK) {
+        sqlite3_bind_int64(statement, 1, *id);
+        if (sqlite3_step(statement) == SQLITE_ROW && sqlite3_column_text(statement, 1)) {
+            *id = sqlite3_column_int64(statement, 0);
+            *filename = (const char*) sqlite3_column_text(statement, 1);
+            *type = sqlite3_column_int(statement, 2);
+            found = true;
+        }
+        sqlite3_finalize(statement);
+    }
+    sqlite3_close(db);
+    Card_Manager::get_handle()->index_mutex().unlock();
+    return found;
+}
+
+bool
+Audio::LoudnessScanner::store(const std::string& db_path, const std::string& filename, float gain_db)
+{
+    /* A rebuild may have started while the file was being measured, in which case the scan has been cancelled
+    and the row goes by its name, which is how lookup() finds it again */
+    Card_Manager::get_handle()->index_mutex().lock();
+    sqlite3* db;
+    if (sqlite3_open_v2(db_path.c_str(), &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK) {
+        log_e("Failed to open database file: %s", db_path.c_str());
+        sqlite3_close(db);
+        Card_Manager::get_handle()->index_mutex().unlock();
+        return false;
+    }
+
+    bool stored = false;
+    sqlite3_stmt* statement;
+    const char* sql = "UPDATE files SET gain = ? WHERE filename = ?";
+    if (sqlite3_prepare_v2(db, sql, -1, &statement, NULL) == SQLITE_OK) {
+        sqlite3_bind_double(statement, 1, gain_db);
+        sqlite3_bind_text(statement, 2, filename.c_str(), -1, SQLITE_STATIC);
+        stored = sqlite3_step(statement) == SQLITE_DONE;
+        sqlite3_finalize(statement);
+    }
+    if (!stored) {
+        log_e("Failed to store a gain in %s", db_path.c_str());
+        log_e("Error: %s", sqlite3_errmsg(db));
+    }
+    sqlite3_close(db);
+    Card_Manager::get_handle()->index_mutex().unlock();
+    return stored;
+}
+
+bool
+Audio::LoudnessScanner::measure(const std::string& path, uint8_t type, float* gain_db)
+{
+    if (!decoders) {
+        decoders = new DecoderPool();
+        decoders->begin(feed);
+    }
+    audio_tools::AudioDecoder* decoder = decoders->get(type);
+    if (!decoder) {
+        return false;
+    }
+
+    FsFile file;
+    Card_Manager::get_handle()->mutex().lock();
+    bool opened = file.open(path.c_str(), O_RDONLY);
+    Card_Manager::get_handle()->mutex().unlock();
+    if (!opened) {
+        return false;
+    }
+
+    decoders->rearm(decoder);
+    feed.decoder = decoder;
+    feed.meter.reset();
+    bool complete = false;
+    while (!pending.load()) {
+        Card_Manager::get_handle()->mutex().lock();
+        int length = file.read(buffer, sizeof(buffer));
+        Card_Manager::get_handle()->mutex().unlock();
+        if (length <= 0) {
+            complete = length == 0;
+            break;
+        }
+        decoder->write(buffer, length);
+        runDeferred();
+    }
+    Card_Manager::get_handle()->mutex().lock();
+    file.close();
+    Card_Manager::get_handle()->mutex().unlock();
+    decoders->finish(decoder);
+    decoders->recycle();
+    feed.decoder = nullptr;
+    if (!complete) {
+        return false;
+    }
+
+    /* Silence, or nothing the decoder could make sense of, is left alone */
+    float lufs = feed.meter.getIntegrated();
+    if (isnan(lufs)) {
+        *gain_db = 0;
+        return true;
+    }
+    *gain_db = limit(LOUDNESS_TARGET_LUFS - lufs, feed.meter.getPeak());
+    log_i("Measured %s at %.1f LUFS, gain %.1f dB", path.c_str(), lufs, *gain_db);
+    return true;
+}
+
+size_t
+Audio::LoudnessScanner::Feed::write(const uint8_t* data, size_t length)
+{
+    audio_tools::AudioInfo info = decoder ? decoder->audioInfo() : audio_tools::AudioInfo();
+    if (info.sample_rate == 0 || info.channels == 0 || info.channels > LOUDNESS_MAX_CHANNELS) {
+        return length;
+    }
+    if (info.sample_rate != meter.getSampleRate() || info.channels != meter.getChannels()) {
+        meter.begin(info.sample_rate, info.channels);
+    }
+    return meter.write(data, length);
+}
+
+bool
+Audio::LoudnessScanner::lookup(const char* directory, const char* filename, float* gain_db)
+{
+    sqlite3* db;
+    std::string db_path = index_path(directory);
+    Card_Manager::get_handle()->index_mutex().lock();
+    if (sqlite3_open_v2(db_path.c_str(), &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+        sqlite3_close(db);
+        Card_Manager::get_handle()->index_mutex().unlock();
+        return false;
+    }
+
+    bool found = false;
+    sqlite3_stmt* statement;
+    if (sqlite3_prepare_v2(db, "SELECT gain FROM files WHERE filename = ?", -1, &statement, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(statement, 1, filename, -1, SQLITE_STATIC);
+        if (sqlite3_step(statement) == SQLITE_ROW && sqlite3_column_type(statement, 0) != SQLITE_NULL) {
+            *gain_db = sqlite3_column_double(statement, 0);
+            found = true;
+        }
+        sqlite3_finalize(statement);
+    }
+    sqlite3_close(db);
+    Card_Manager::get_handle()->index_mutex().unlock();
+    return found;
+}
+
+float
+Audio::LoudnessScanner::fromTags(const tags_t& tags)
+{
+    return isnan(tags.gain_db) ? NAN : limit(tags.gain_db, tags.peak);
+}
+
+float
+Audio::LoudnessScanner::limit(float gain_db, float peak)
+{
+    if (peak > 0) {
+        float headroom = -20 * log10f(peak);
+        if (gain_db > headroom) {
+            gain_db = headroom;
+        }
+    }
+    if (gain_db > LOUDNESS_MAX_GAIN_DB) {
+        gain_db = LOUDNESS_MAX_GAIN_DB;
+    } else if (gain_db < -LOUDNESS_MAX_GAIN_DB) {
+        gain_db = -LOUDNESS_MAX_GAIN_DB;
+    }
+    return gain_db;
+}
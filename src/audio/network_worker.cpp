@@ -0,0 +1,98 @@
+/**
+ * @file network_worker.cpp
+ *
+ * @brief Long-lived task that opens and closes network streams for the
+ * transport.  Part of the audio library.
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <audio/network_worker.h>
+
+void
+Audio::NetworkWorker::begin()
+{
+    if (handle) {
+        return;
+    }
+    xTaskCreatePinnedToCore(task, "NetworkWorker", NETWORK_WORKER_STACK, this, 1, &handle, 1);
+}
+
+void
+Audio::NetworkWorker::open(const char* url, uint32_t offset)
+{
+    post(COMMAND_OPEN, url, offset);
+}
+
+void
+Audio::NetworkWorker::close()
+{
+    post(COMMAND_CLOSE, "", 0);
+}
+
+void
+Audio::NetworkWorker::post(uint8_t type, const char* url, uint32_t offset)
+{
+    command_mutex.lock();
+    command = type;
+    command_url = url;
+    command_offset = offset;
+    command_id++;
+    command_mutex.unlock();
+    if (handle) {
+        xTaskNotifyGive(handle);
+    }
+}
+
+void
+Audio::NetworkWorker::task(void* worker)
+{
+    NetworkWorker* self = (NetworkWorker*) worker;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        for (;;) {
+            self->command_mutex.lock();
+            uint8_t type = self->command;
+            std::string url = self->command_url;
+            uint32_t offset = self->command_offset;
+            uint32_t id = self->command_id.load();
+            self->command = COMMAND_NONE;
+            self->command_mutex.unlock();
+
+            if (type == COMMAND_NONE) {
+                break;
+            }
+            if (type == COMMAND_CLOSE) {
+                self->source.close();
+                continue;
+            }
+
+            log_i("Connecting to stream: %s", url.c_str());
+            bool opened = self->source.open(url.c_str(), offset);
+            if (!opened) {
+                log_e("Error connecting to stream: %s", url.c_str());
+                self->source.close();
+            }
+
+            /* Whoever asked for it has moved on if another command came in while we were connecting */
+            if (id == self->command_id.load() && self->opened) {
+                self->opened(opened);
+            }
+        }
+    }
+}
@@ -0,0 +1,183 @@
+/**
+ * @file output_stage.cpp
+ *
+ * @brief EQ, volume and limiter applied to the output in a single pass.
+ * Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <audio/output_stage.h>
+
+#if OUTPUT_STAGE_EQ
+#define OUTPUT_STAGE_SHIFT EQ_SIGNAL_SHIFT
+#else
+#define OUTPUT_STAGE_SHIFT 0
+#endif
+
+#if OUTPUT_STAGE_LIMITER
+/* Passes everything below the knee untouched, above it the overshoot d is squeezed to d / (1 + d / r), where r
+is the room left above the knee.  The curve starts with a slope of one so there's no corner at the knee, and
+never quite reaches full scale however hard it's driven. */
+static inline int32_t
+limit(int32_t sample)
+{
+    const int32_t room = INT16_MAX - OUTPUT_LIMITER_KNEE;
+    int32_t level = sample < 0 ? -sample : sample;
+    if (level <= OUTPUT_LIMITER_KNEE) {
+        return sample;
+    }
+    int32_t over = level - OUTPUT_LIMITER_KNEE;
+    level = OUTPUT_LIMITER_KNEE + (int32_t) (((int64_t) over * room) / (over + room));
+    return sample < 0 ? -level : level;
+}
+#else
+static inline int32_t
+limit(int32_t sample)
+{
+    if (sample > INT16_MAX) {
+        return INT16_MAX;
+    } else if (sample < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return sample;
+}
+#endif
+
+void
+Audio::OutputStage::begin(Print& output, ParametricEQ* eq, uint8_t channels)
+{
+    this->output = &output;
+    this->eq = eq;
+    this->channels = channels > OUTPUT_STAGE_MAX_CHANNELS ? OUTPUT_STAGE_MAX_CHANNELS : channels;
+}
+
+void
+Audio::OutputStage::setVolume(float volume)
+{
+    if (volume < 0) {
+        volume = 0;
+    } else if (volume > 1) {
+        volume = 1;
+    }
+    volume_request.store(lroundf(volume * 32768));
+}
+
+size_t
+Audio::OutputStage::write(const uint8_t* data, size_t length)
+{
+    if (!output) {
+        return length;
+    }
+    if (tap) {
+        tap->write(data, length);
+    }
+
+    /* Whole frames are processed a block at a time, anything left over goes out as it is */
+    const size_t frame_bytes = channels * sizeof(int16_t);
+    size_t written = 0;
+    while (length - written >= frame_bytes) {
+        size_t frames = (length - written) / frame_bytes;
+        if (frames > OUTPUT_STAGE_BLOCK_FRAMES) {
+            frames = OUTPUT_STAGE_BLOCK_FRAMES;
+        }
+        size_t bytes = frames * frame_bytes;
+
+        /* The samples are read where they are unless they're misaligned */
+        const uint8_t* block = data + written;
+        if ((uintptr_t) block & 1) {
+            memcpy(samples, block, bytes);
+            block = (const uint8_t*) samples;
+        }
+        process((const int16_t*) block, frames);
+        written += output->write((const uint8_t*) samples, bytes);
+    }
+    if (written < length) {
+        written += output->write(data + written, length - written);
+    }
+    return written;
+}
+
+/* Reads the block from in and leaves the result in samples, which in may point to */
+void
+Audio::OutputStage::process(const int16_t* in, size_t frames)
+{
+#if OUTPUT_STAGE_EQ
+    const ParametricEQ::coefficients_t* set = eq ? &eq->acquire() : nullptr;
+    const int32_t headroom = set && set->count ? set->headroom : 1 << 15;
+#else
+    const int32_t headroom = 1 << 15;
+#endif
+
+#if OUTPUT_STAGE_VOLUME
+    /* The volume moves to the new level in equal steps over the block, kept with 12 more bits
+    of fraction so a small change isn't lost to rounding */
+    const int32_t target = volume_request.load();
+    int32_t ramp = volume << 12;
+    const int32_t step = ((target - volume) << 12) / (int32_t) frames;
+    volume = target;
+#endif
+
+    /* A channel at a time, so the filter state stays close at hand through the block */
+    const int32_t round = (1 << OUTPUT_STAGE_SHIFT) >> 1;
+    for (uint8_t channel = 0; channel < channels; channel++) {
+#if OUTPUT_STAGE_EQ
+        int32_t(*state)[EQ_STATE_SIZE] = set ? eq->getState(channel) : nullptr;
+#endif
+#if OUTPUT_STAGE_VOLUME
+        int32_t level = ramp;
+#endif
+#if OUTPUT_STAGE_METER
+        int32_t peak = 0;
+        uint64_t squares = 0;
+#endif
+        for (size_t i = channel; i < frames * channels; i += channels) {
+#if OUTPUT_STAGE_VOLUME
+            level += step;
+            const int32_t gain = ((level >> 12) * headroom) >> 15;
+#else
+            const int32_t gain = headroom;
+#endif
+            int32_t sample = (in[i] * gain) >> (15 - OUTPUT_STAGE_SHIFT);
+#if OUTPUT_STAGE_EQ
+            if (state) {
+                sample = ParametricEQ::run(*set, state, sample);
+            }
+#endif
+            samples[i] = (int16_t) limit((sample + round) >> OUTPUT_STAGE_SHIFT);
+#if OUTPUT_STAGE_METER
+            const int32_t magnitude = samples[i] < 0 ? -samples[i] : samples[i];
+            if (magnitude > peak) {
+                peak = magnitude;
+            }
+            squares += (uint32_t) (magnitude * magnitude);
+#endif
+        }
+#if OUTPUT_STAGE_METER
+        if (meter) {
+            meter->add(channel, peak, squares);
+        }
+#endif
+    }
+#if OUTPUT_STAGE_METER
+    if (meter) {
+        meter->commit(frames);
+    }
+#endif
+}
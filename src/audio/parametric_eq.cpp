@@ -0,0 +1,159 @@
+/**
+ * @file parametric_eq.cpp
+ *
+ * @brief Fixed point cascade of parametric biquad filters for the equalizer.
+ * Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <audio/parametric_eq.h>
+
+static int32_t
+to_fixed(double value)
+{
+    return (int32_t) lround(value * (1 << EQ_COEFF_SHIFT));
+}
+
+void
+Audio::ParametricEQ::begin(uint32_t sample_rate)
+{
+    control_mutex.lock();
+    this->sample_rate = sample_rate;
+    publish();
+    control_mutex.unlock();
+}
+
+void
+Audio::ParametricEQ::setBand(uint8_t band, band_type_t type, float frequency, float gain_db, float q)
+{
+    if (band >= EQ_MAX_BANDS) {
+        return;
+    }
+    if (gain_db > EQ_MAX_GAIN_DB) {
+        gain_db = EQ_MAX_GAIN_DB;
+    } else if (gain_db < -EQ_MAX_GAIN_DB) {
+        gain_db = -EQ_MAX_GAIN_DB;
+    }
+    control_mutex.lock();
+    settings[band].type = type;
+    settings[band].frequency = frequency;
+    settings[band].gain_db = gain_db;
+    settings[band].q = q > 0.1f ? q : 0.1f;
+    publish();
+    control_mutex.unlock();
+}
+
+void
+Audio::ParametricEQ::setEnabled(bool enabled)
+{
+    control_mutex.lock();
+    this->enabled = enabled;
+    publish();
+    control_mutex.unlock();
+}
+
+/* Coefficients from the Audio EQ Cookbook */
+void
+Audio::ParametricEQ::publish()
+{
+    coefficients_t& set = sets[back];
+    set.count = 0;
+    float boost = 0;
+    for (uint8_t band = 0; enabled && band < EQ_MAX_BANDS; band++) {
+        const band_t& setting = settings[band];
+        if (setting.type == BAND_OFF || setting.gain_db == 0 || setting.frequency <= 0 || setting.frequency >= sample_rate / 2) {
+            continue;
+        }
+
+        double A = pow(10.0, setting.gain_db / 40.0);
+        double w0 = 2 * PI * setting.frequency / sample_rate;
+        double cos_w0 = cos(w0);
+        double alpha = sin(w0) / (2 * setting.q);
+        double shelf = 2 * sqrt(A) * alpha;
+        double b0, b1, b2, a0, a1, a2;
+        switch (setting.type) {
+            case BAND_LOW_SHELF:
+                b0 = A * ((A + 1) - (A - 1) * cos_w0 + shelf);
+                b1 = 2 * A * ((A - 1) - (A + 1) * cos_w0);
+                b2 = A * ((A + 1) - (A - 1) * cos_w0 - shelf);
+                a0 = (A + 1) + (A - 1) * cos_w0 + shelf;
+                a1 = -2 * ((A - 1) + (A + 1) * cos_w0);
+                a2 = (A + 1) + (A - 1) * cos_w0 - shelf;
+                break;
+            case BAND_HIGH_SHELF:
+                b0 = A * ((A + 1) + (A - 1) * cos_w0 + shelf);
+                b1 = -2 * A * ((A - 1) + (A + 1) * cos_w0);
+                b2 = A * ((A + 1) + (A - 1) * cos_w0 - shelf);
+                a0 = (A + 1) - (A - 1) * cos_w0 + shelf;
+                a1 = 2 * ((A - 1) - (A + 1) * cos_w0);
+                a2 = (A + 1) - (A - 1) * cos_w0 - shelf;
+                break;
+            default:
+                b0 = 1 + alpha * A;
+                b1 = -2 * cos_w0;
+                b2 = 1 - alpha * A;
+                a0 = 1 + alpha / A;
+                a1 = -2 * cos_w0;
+                a2 = 1 - alpha / A;
+                break;
+        }
+
+        int32_t* row = set.rows[set.count];
+        row[0] = to_fixed(b0 / a0);
+        row[1] = to_fixed(b1 / a0);
+        row[2] = to_fixed(b2 / a0);
+        row[3] = to_fixed(a1 / a0);
+        row[4] = to_fixed(a2 / a0);
+        set.bands[set.count++] = band;
+        if (setting.gain_db > boost) {
+            boost = setting.gain_db;
+        }
+    }
+    set.headroom = (int32_t) lroundf(powf(10.0f, -boost / 20.0f) * 32767);
+
+    back = middle.exchange(back | EQ_FRESH) & ~EQ_FRESH;
+}
+
+const Audio::ParametricEQ::coefficients_t&
+Audio::ParametricEQ::acquire()
+{
+    if (middle.load() & EQ_FRESH) {
+        /* The exchange hands the old set back to the control side, which may start rewriting it straight
+        away, so the rows it had go into locals first */
+        uint8_t previous_count = sets[front].count;
+        uint8_t previous_bands[EQ_MAX_BANDS];
+        memcpy(previous_bands, sets[front].bands, sizeof(previous_bands));
+        int32_t carried[EQ_MAX_BANDS][EQ_STATE_SIZE];
+        front = middle.exchange(front) & ~EQ_FRESH;
+        const coefficients_t& set = sets[front];
+        for (uint8_t channel = 0; channel < EQ_MAX_CHANNELS; channel++) {
+            memcpy(carried, state[channel], sizeof(carried));
+            for (uint8_t row = 0; row < set.count; row++) {
+                memset(state[channel][row], 0, sizeof(state[0][0]));
+                for (uint8_t i = 0; i < previous_count; i++) {
+                    if (previous_bands[i] == set.bands[row]) {
+                        memcpy(state[channel][row], carried[i], sizeof(state[0][0]));
+                    }
+                }
+            }
+        }
+    }
+    return sets[front];
+}
@@ -0,0 +1,262 @@
+/**
+ * @file prefetcher.cpp
+ *
+ * @brief Reads the loaded file from the SD card in large, sector aligned
+ * blocks on its own task so the main loop never waits on the card. Part of
+ * the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <audio/prefetcher.h>
+#include <card_manager.h>
+
+Audio::Prefetcher::Prefetcher()
+{
+    for (uint8_t i = 0; i < PREFETCH_BLOCK_COUNT; i++) {
+        blocks[i] = { nullptr, 0, 0 };
+    }
+}
+
+Audio::Prefetcher::~Prefetcher()
+{
+    close();
+    if (task_handle) {
+        vTaskDelete(task_handle);
+    }
+    for (uint8_t i = 0; i < PREFETCH_BLOCK_COUNT; i++) {
+        if (blocks[i].data) {
+            heap_caps_free(blocks[i].data);
+        }
+    }
+    if (lock) {
+        vSemaphoreDelete(lock);
+    }
+    if (drain_lock) {
+        vSemaphoreDelete(drain_lock);
+    }
+}
+
+void
+Audio::Prefetcher::begin()
+{
+    if (task_handle) {
+        return;
+    }
+
+    /* Blocks live in PSRAM, fall back to internal RAM if there isn't any */
+    for (uint8_t i = 0; i < PREFETCH_BLOCK_COUNT; i++) {
+        blocks[i].data = (uint8_t*) heap_caps_malloc(PREFETCH_BLOCK_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!blocks[i].data) {
+            log_w("No PSRAM for prefetch block %d, using internal RAM", i);
+            blocks[i].data = (uint8_t*) heap_caps_malloc(PREFETCH_BLOCK_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        }
+    }
+
+    lock = xSemaphoreCreateMutex();
+    drain_lock = xSemaphoreCreateMutex();
+    xTaskCreatePinnedToCore(task, "PrefetchTask", PREFETCH_TASK_STACK, this, 1, &task_handle, 1);
+    log_i("Prefetcher started with %d blocks of %d bytes", PREFETCH_BLOCK_COUNT, PREFETCH_BLOCK_SIZE);
+}
+
+bool
+Audio::Prefetcher::open(const char* path)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    xSemaphoreTake(drain_lock, portMAX_DELAY);
+
+    Card_Manager::get_handle()->mutex().lock();
+    if (file.isOpen()) {
+        file.close();
+    }
+    _open = file.open(path, O_RDONLY);
+    _size = _open ? file.size() : 0;
+    Card_Manager::get_handle()->mutex().unlock();
+
+    if (_open) {
+        reset(0);
+    }
+
+    xSemaphoreGive(drain_lock);
+    xSemaphoreGive(lock);
+    xTaskNotifyGive(task_handle);
+    return _open;
+}
+
+void
+Audio::Prefetcher::close()
+{
+    if (!lock) {
+        return;
+    }
+    xSemaphoreTake(lock, portMAX_DELAY);
+    xSemaphoreTake(drain_lock, portMAX_DELAY);
+
+    Card_Manager::get_handle()->mutex().lock();
+    if (file.isOpen()) {
+        file.close();
+    }
+    Card_Manager::get_handle()->mutex().unlock();
+    _open = false;
+    _size = 0;
+    _position = 0;
+    ready.store(0);
+
+    xSemaphoreGive(drain_lock);
+    xSemaphoreGive(lock);
+}
+
+bool
+Audio::Prefetcher::seek(uint32_t position)
+{
+    if (!_open || position > _size) {
+        return false;
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    xSemaphoreTake(drain_lock, portMAX_DELAY);
+    reset(position);
+    xSemaphoreGive(drain_lock);
+    xSemaphoreGive(lock);
+    xTaskNotifyGive(task_handle);
+    return true;
+}
+
+/* Called with both locks held */
+void
+Audio::Prefetcher::reset(uint32_t position)
+{
+    /* The card is only ever read on sector boundaries, the first block skips ahead to the exact position */
+    fill_position = position & ~(PREFETCH_SECTOR_SIZE - 1);
+    skip = position - fill_position;
+    _position = position;
+    fill_index = 0;
+    drain_index = 0;
+    ready.store(0);
+    _error.store(false);
+
+    Card_Manager::get_handle()->mutex().lock();
+    file.seekSet(fill_position);
+    Card_Manager::get_handle()->mutex().unlock();
+}
+
+size_t
+Audio::Prefetcher::read(uint8_t* data, size_t length)
+{
+    size_t total = 0;
+
+    xSemaphoreTake(drain_lock, portMAX_DELAY);
+    while (total < length && ready.load(std::memory_order_acquire) > 0) {
+        block_t& block = blocks[drain_index];
+        size_t count = block.length - block.offset;
+        if (count > length - total) {
+            count = length - total;
+        }
+        memcpy(data + total, block.data + block.offset, count);
+        block.offset += count;
+        total += count;
+        _position += count;
+
+        /* Hand the drained block back to the prefetch task */
+        if (block.offset >= block.length) {
+            drain_index = (drain_index + 1) % PREFETCH_BLOCK_COUNT;
+            ready.fetch_sub(1, std::memory_order_release);
+            xTaskNotifyGive(task_handle);
+        }
+    }
+
+    if (total == 0 && _open && !eof() && !_error.load()) {
+        stats.stalls++;
+    }
+    xSemaphoreGive(drain_lock);
+    return total;
+}
+
+uint32_t
+Audio::Prefetcher::getThroughput()
+{
+    if (stats.read_us == 0) {
+        return 0;
+    }
+    return (uint32_t) (((uint64_t) stats.bytes * 1000000) / stats.read_us);
+}
+
+/****************************************************
+ *
+ * Prefetch task
+ *
+ ****************************************************/
+
+void
+Audio::Prefetcher::task(void* arg)
+{
+    Prefetcher* prefetcher = static_cast<Prefetcher*>(arg);
+    for (;;) {
+        xSemaphoreTake(prefetcher->lock, portMAX_DELAY);
+        bool filled = prefetcher->fill();
+        xSemaphoreGive(prefetcher->lock);
+
+        /* Sleep until a block is drained or a new file is opened */
+        if (!filled) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+    }
+}
+
+bool
+Audio::Prefetcher::fill()
+{
+    if (!_open || _error.load() || fill_position >= _size || ready.load(std::memory_order_acquire) >= PREFETCH_BLOCK_COUNT) {
+        return false;
+    }
+
+    block_t& block = blocks[fill_index];
+    uint32_t start = micros();
+
+    /* The SD card shares its bus with the database, so take turns through the card lock */
+    Card_Manager::get_handle()->mutex().lock();
+    int32_t count = file.read(block.data, PREFETCH_BLOCK_SIZE);
+    Card_Manager::get_handle()->mutex().unlock();
+
+    stats.read_us += micros() - start;
+    stats.reads++;
+
+    if (count <= 0) {
+        log_e("Prefetch read failed at offset %d", fill_position);
+        _error.store(true);
+        TaskHandle_t reader = reader_task.load();
+        if (reader) {
+            xTaskNotifyGive(reader);
+        }
+        return false;
+    }
+
+    stats.bytes += count;
+    block.length = count;
+    block.offset = skip;
+    skip = 0;
+    fill_position += count;
+    fill_index = (fill_index + 1) % PREFETCH_BLOCK_COUNT;
+    ready.fetch_add(1, std::memory_order_release);
+
+    TaskHandle_t reader = reader_task.load();
+    if (reader) {
+        xTaskNotifyGive(reader);
+    }
+    return true;
+}
@@ -0,0 +1,310 @@
+/**
+ * @file resampler.cpp
+ *
+ * @brief Converts decoded PCM to the output sample rate and channel count.
+ * Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <audio/resampler.h>
+
+/* Zeroth order modified Bessel function of the first kind, for the Kaiser window */
+static float
+bessel_i0(float x)
+{
+    float sum = 1;
+    float term = 1;
+    for (uint8_t k = 1; k < 32; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+        if (term < sum * 1e-7f) {
+            break;
+        }
+    }
+    return sum;
+}
+
+void
+Audio::Resampler::begin(Print& output, uint32_t output_rate, uint8_t channels)
+{
+    this->output = &output;
+    this->output_rate = output_rate;
+    this->channels = channels > RESAMPLER_MAX_CHANNELS ? RESAMPLER_MAX_CHANNELS : channels;
+    configure();
+}
+
+void
+Audio::Resampler::setSource(audio_tools::AudioDecoder* decoder)
+{
+    this->decoder = decoder;
+    trim_start = next_trim_start.exchange(0);
+    trim_length = next_trim_length.exchange(0);
+    trim_pending = trim_start || trim_length;
+    skip_bytes = 0;
+    keep_bytes = 0;
+    input_rate = 0;
+    input_channels = 0;
+    configure();
+}
+
+void
+Audio::Resampler::setTrim(uint32_t start, uint32_t length)
+{
+    next_trim_start.store(start);
+    next_trim_length.store(length);
+}
+
+void
+Audio::Resampler::setOutputRate(uint32_t sample_rate)
+{
+    if (sample_rate == output_rate) {
+        return;
+    }
+    output_rate = sample_rate;
+    configure();
+}
+
+void
+Audio::Resampler::setInputFormat(uint32_t sample_rate, uint8_t channels)
+{
+    input_rate = sample_rate;
+    input_channels = channels;
+    configure();
+}
+
+void
+Audio::Resampler::configure()
+{
+    emit();
+    converting = input_rate && input_channels && input_channels <= RESAMPLER_MAX_INPUT_CHANNELS && (input_rate != output_rate || input_channels != channels);
+    resampling = converting && input_rate != output_rate;
+    if (resampling && (input_rate != table_input_rate || output_rate != table_output_rate)) {
+        design();
+    }
+    step = ((uint64_t) input_rate << 32) / output_rate;
+    reset();
+}
+
+/* A Kaiser windowed sinc, cut off below the lower of the two Nyquist frequencies so that going down
+in rate doesn't alias and going up doesn't leave images */
+void
+Audio::Resampler::design()
+{
+    const int half = RESAMPLER_TAPS / 2;
+    float ratio = output_rate < input_rate ? (float) output_rate / input_rate : 1.0f;
+    float cutoff = RESAMPLER_PASSBAND * 0.5f * ratio; /* Cycles per input frame */
+    float window_scale = 1 / bessel_i0(RESAMPLER_KAISER_BETA);
+
+    for (uint16_t p = 0; p <= RESAMPLER_PHASES; p++) {
+        float taps[RESAMPLER_TAPS];
+        float sum = 0;
+        for (uint8_t j = 0; j < RESAMPLER_TAPS; j++) {
+            float t = (float) p / RESAMPLER_PHASES + (half - 1 - j);
+            float x = t / half;
+            float window = x * x < 1 ? bessel_i0(RESAMPLER_KAISER_BETA * sqrtf(1 - x * x)) * window_scale : window_scale;
+            float angle = 2 * (float) PI * cutoff * t;
+            taps[j] = 2 * cutoff * (t == 0 ? 1 : sinf(angle) / angle) * window;
+            sum += taps[j];
+        }
+
+        /* Each phase is scaled to unity gain at DC, whatever rounding leaves over goes on the biggest tap */
+        int32_t total = 0;
+        uint8_t biggest = 0;
+        for (uint8_t j = 0; j < RESAMPLER_TAPS; j++) {
+            coefficients[p][j] = (int16_t) lroundf(taps[j] / sum * (1 << RESAMPLER_COEFF_SHIFT));
+            total += coefficients[p][j];
+            if (abs(coefficients[p][j]) > abs(coefficients[p][biggest])) {
+                biggest = j;
+            }
+        }
+        coefficients[p][biggest] += (1 << RESAMPLER_COEFF_SHIFT) - total;
+    }
+
+    table_input_rate = input_rate;
+    table_output_rate = output_rate;
+}
+
+void
+Audio::Resampler::reset()
+{
+    memset(history, 0, sizeof(history));
+    head = 0;
+    priming = RESAMPLER_TAPS / 2;
+    phase = 0;
+    carry_length = 0;
+}
+
+void
+Audio::Resampler::flush()
+{
+    if (resampling) {
+        /* Enough silence to bring the last frame to the middle of the window */
+        static const uint8_t silence[RESAMPLER_MAX_INPUT_CHANNELS * sizeof(int16_t)] = { 0 };
+        for (uint8_t i = 0; i < RESAMPLER_TAPS / 2; i++) {
+            convert(silence, 1);
+        }
+    }
+    emit();
+    reset();
+}
+
+size_t
+Audio::Resampler::write(const uint8_t* data, size_t length)
+{
+    if (!output) {
+        return length;
+    }
+
+    /* The decoders only know the format once they've parsed the first frame, which is always before they write */
+    if (decoder) {
+        audio_tools::AudioInfo info = decoder->audioInfo();
+        uint32_t sample_rate = info.bits_per_sample == 16 ? info.sample_rate : 0;
+        if (sample_rate != input_rate || info.channels != input_channels) {
+            bool new_rate = sample_rate != input_rate;
+            input_rate = sample_rate;
+            input_channels = info.channels;
+            if (new_rate && input_rate && rate_callback) {
+                rate_callback(input_rate);
+            }
+            configure();
+        }
+    }
+
+    /* The frame size is only known once the decoder has written, so the trim is turned into bytes here */
+    const size_t written = length;
+    if (trim_pending && input_channels) {
+        skip_bytes = (uint64_t) trim_start * input_channels * sizeof(int16_t);
+        keep_bytes = (uint64_t) trim_length * input_channels * sizeof(int16_t);
+        trim_pending = false;
+    }
+    if (skip_bytes) {
+        size_t skipped = skip_bytes < length ? skip_bytes : length;
+        skip_bytes -= skipped;
+        data += skipped;
+        length -= skipped;
+    }
+    if (trim_length && !trim_pending) {
+        if (length > keep_bytes) {
+            length = keep_bytes;
+        }
+        keep_bytes -= length;
+    }
+    if (length == 0) {
+        return written;
+    }
+
+    if (!converting) {
+        return written - length + output->write(data, length);
+    }
+
+    /* Finish off the frame the last write split, then keep back whatever this one splits */
+    const size_t frame_bytes = input_channels * sizeof(int16_t);
+    size_t used = 0;
+    if (carry_length) {
+        used = frame_bytes - carry_length < length ? frame_bytes - carry_length : length;
+        memcpy(carry + carry_length, data, used);
+        carry_length += used;
+        if (carry_length < frame_bytes) {
+            return written;
+        }
+        convert(carry, 1);
+        carry_length = 0;
+    }
+    size_t frames = (length - used) / frame_bytes;
+    convert(data + used, frames);
+    used += frames * frame_bytes;
+    carry_length = length - used;
+    memcpy(carry, data + used, carry_length);
+    emit();
+    return written;
+}
+
+/* Frames are copied out one at a time, so the input needn't be aligned */
+void
+Audio::Resampler::convert(const uint8_t* data, size_t frames)
+{
+    const size_t frame_bytes = input_channels * sizeof(int16_t);
+    int16_t frame[RESAMPLER_MAX_INPUT_CHANNELS];
+    for (size_t f = 0; f < frames; f++) {
+        memcpy(frame, data + f * frame_bytes, frame_bytes);
+
+        if (!resampling) {
+            int16_t* out = &block[block_frames * channels];
+            for (uint8_t channel = 0; channel < channels; channel++) {
+                out[channel] = frame[channel < input_channels ? channel : input_channels - 1];
+            }
+            if (++block_frames == RESAMPLER_BLOCK_FRAMES) {
+                emit();
+            }
+            continue;
+        }
+
+        for (uint8_t channel = 0; channel < channels; channel++) {
+            int16_t sample = frame[channel < input_channels ? channel : input_channels - 1];
+            history[channel][head] = sample;
+            history[channel][head + RESAMPLER_TAPS] = sample;
+        }
+        head = head + 1 == RESAMPLER_TAPS ? 0 : head + 1;
+        if (priming) {
+            priming--;
+            continue;
+        }
+
+        /* Every output that falls between this frame and the next, from the two phases either side of it */
+        while (phase < ((uint64_t) 1 << 32)) {
+            uint32_t position = (uint32_t) phase;
+            const int16_t* row = coefficients[position >> (32 - RESAMPLER_PHASE_BITS)];
+            const int16_t* next = row + RESAMPLER_TAPS;
+            int32_t fraction = (position >> (16 - RESAMPLER_PHASE_BITS)) & 0xFFFF;
+            int16_t* out = &block[block_frames * channels];
+            for (uint8_t channel = 0; channel < channels; channel++) {
+                const int16_t* window = &history[channel][head];
+                int32_t a = 0;
+                int32_t b = 0;
+                for (uint8_t j = 0; j < RESAMPLER_TAPS; j++) {
+                    a += window[j] * row[j];
+                    b += window[j] * next[j];
+                }
+                int32_t sample = a + (int32_t) (((int64_t) (b - a) * fraction) >> 16);
+                sample = (sample + (1 << (RESAMPLER_COEFF_SHIFT - 1))) >> RESAMPLER_COEFF_SHIFT;
+                if (sample > INT16_MAX) {
+                    sample = INT16_MAX;
+                } else if (sample < INT16_MIN) {
+                    sample = INT16_MIN;
+                }
+                out[channel] = (int16_t) sample;
+            }
+            if (++block_frames == RESAMPLER_BLOCK_FRAMES) {
+                emit();
+            }
+            phase += step;
+        }
+        phase -= (uint64_t) 1 << 32;
+    }
+}
+
+void
+Audio::Resampler::emit()
+{
+    if (block_frames && output) {
+        output->write((const uint8_t*) block, block_frames * channels * sizeof(int16_t));
+    }
+    block_frames = 0;
+}
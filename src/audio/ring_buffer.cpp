@@ -0,0 +1,230 @@
+/**
+ * @file ring_buffer.cpp
+ *
+ * @brief Lock-free single producer/single consumer byte ring used to move
+ * audio data between tasks. Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <audio/ring_buffer.h>
+
+Audio::RingBuffer::RingBuffer(size_t size, uint32_t caps)
+{
+    /* Round up to a power of two so the free running indices can simply be masked */
+    _size = 1;
+    while (_size < size) {
+        _size <<= 1;
+    }
+    _mask = _size - 1;
+
+    buffer = (uint8_t*) heap_caps_malloc(_size, caps);
+    if (!buffer) {
+        log_e("Could not allocate %zu bytes for the ring buffer", _size);
+        _size = 0;
+        _mask = 0;
+    }
+}
+
+Audio::RingBuffer::~RingBuffer()
+{
+    if (buffer) {
+        heap_caps_free(buffer);
+    }
+}
+
+/****************************************************
+ *
+ * Producer side
+ *
+ ****************************************************/
+
+size_t
+Audio::RingBuffer::availableForWrite()
+{
+    if (clear_requested.load(std::memory_order_acquire)) {
+        return 0;
+    }
+    return _size - (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire));
+}
+
+size_t
+Audio::RingBuffer::writeSpan(uint8_t** data)
+{
+    /* Flag the span before looking for a clear, so the consumer either sees it or we see the clear.  While
+    a clear is waiting the flag comes straight down again, so a producer that keeps asking can't hold it off. */
+    writing.store(true);
+    span_generation = clear_generation.load();
+    if (clear_requested.load()) {
+        writing.store(false);
+        *data = buffer + (head.load(std::memory_order_relaxed) & _mask);
+        return 0;
+    }
+    size_t free = availableForWrite();
+    size_t offset = head.load(std::memory_order_relaxed) & _mask;
+    size_t contiguous = _size - offset;
+
+    *data = buffer + offset;
+    return free < contiguous ? free : contiguous;
+}
+
+void
+Audio::RingBuffer::commitWrite(size_t length)
+{
+    /* The span was filled with the stream that was cleared */
+    if (clear_generation.load() != span_generation) {
+        length = 0;
+    }
+    if (length == 0) {
+        writing.store(false);
+        return;
+    }
+
+    size_t _head = head.load(std::memory_order_relaxed);
+    size_t before = _head - tail.load(std::memory_order_acquire);
+    head.store(_head + length, std::memory_order_release);
+    writing.store(false);
+
+    /* Only wake the consumer on the way up through the high water mark */
+    if (before < high_water && before + length >= high_water) {
+        notify(consumer_task.load());
+    }
+}
+
+size_t
+Audio::RingBuffer::write(const uint8_t* data, size_t length)
+{
+    size_t written = 0;
+
+    /* At most two passes, one up to the end of the buffer and one from the start */
+    while (written < length) {
+        uint8_t* span;
+        size_t span_length = writeSpan(&span);
+        if (span_length == 0) {
+            commitWrite(0);
+            break;
+        }
+        if (span_length > length - written) {
+            span_length = length - written;
+        }
+        memcpy(span, data + written, span_length);
+        commitWrite(span_length);
+        written += span_length;
+    }
+    return written;
+}
+
+/****************************************************
+ *
+ * Consumer side
+ *
+ ****************************************************/
+
+void
+Audio::RingBuffer::serviceClear()
+{
+    /* A span the producer is still filling might be from before the clear, wait until it's committed */
+    if (clear_requested.load() && !writing.load()) {
+        tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+        clear_requested.store(false, std::memory_order_release);
+        notify(producer_task.load());
+    }
+}
+
+size_t
+Audio::RingBuffer::available()
+{
+    serviceClear();
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+}
+
+size_t
+Audio::RingBuffer::readSpan(const uint8_t** data)
+{
+    size_t filled = available();
+    size_t offset = tail.load(std::memory_order_relaxed) & _mask;
+    size_t contiguous = _size - offset;
+
+    *data = buffer + offset;
+    return filled < contiguous ? filled : contiguous;
+}
+
+void
+Audio::RingBuffer::commitRead(size_t length)
+{
+    size_t _tail = tail.load(std::memory_order_relaxed);
+    size_t before = head.load(std::memory_order_acquire) - _tail;
+    tail.store(_tail + length, std::memory_order_release);
+
+    /* Only wake the producer on the way down through the low water mark */
+    if (before > low_water && before - length <= low_water) {
+        notify(producer_task.load());
+    }
+}
+
+size_t
+Audio::RingBuffer::read(uint8_t* data, size_t length)
+{
+    size_t total = 0;
+
+    while (total < length) {
+        const uint8_t* span;
+        size_t span_length = readSpan(&span);
+        if (span_length == 0) {
+            break;
+        }
+        if (span_length > length - total) {
+            span_length = length - total;
+        }
+        memcpy(data + total, span, span_length);
+        commitRead(span_length);
+        total += span_length;
+    }
+    return total;
+}
+
+size_t
+Audio::RingBuffer::peek(uint8_t* data, size_t length)
+{
+    size_t filled = available();
+    size_t _tail = tail.load(std::memory_order_relaxed);
+
+    if (length > filled) {
+        length = filled;
+    }
+    for (size_t i = 0; i < length; i++) {
+        data[i] = buffer[(_tail + i) & _mask];
+    }
+    return length;
+}
+
+/****************************************************
+ *
+ * Any task
+ *
+ ****************************************************/
+
+void
+Audio::RingBuffer::clear()
+{
+    clear_generation++;
+    clear_requested.store(true);
+
+    /* The consumer does the actual work, so make sure it isn't asleep */
+    notify(consumer_task.load());
+}
@@ -0,0 +1,877 @@
+/**
+ * @file seek_index.cpp
+ *
+ * @brief Maps a play position to a byte offset in MP3, FLAC and WAV files
+ * from their own seek tables, or from a frame index built while the file
+ * plays. Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <audio/seek_index.h>
+#include <card_manager.h>
+#include <file_explorer.h>
+#include <sqlite3.h>
+#include <system.h>
+
+static uint32_t
+read_be32(const uint8_t* data)
+{
+    return ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) | ((uint32_t) data[2] << 8) | data[3];
+}
+
+static uint32_t
+read_le32(const uint8_t* data)
+{
+    return ((uint32_t) data[3] << 24) | ((uint32_t) data[2] << 16) | ((uint32_t) data[1] << 8) | data[0];
+}
+
+static void
+write_le32(uint8_t* data, uint32_t value)
+{
+    data[0] = value;
+    data[1] = value >> 8;
+    data[2] = value >> 16;
+    data[3] = value >> 24;
+}
+
+bool
+Audio::SeekIndex::open(const char* path, const char* directory, const char* filename, uint8_t type, std::function<void()>* load)
+{
+    close();
+    this->filename = filename;
+    db_path = directory;
+    if (db_path != "/") {
+        db_path += "/";
+    }
+    db_path += DB_FILE;
+
+    bool parsed = false;
+    Card_Manager::get_handle()->mutex().lock();
+    FsFile file;
+    if (file.open(path, O_RDONLY)) {
+        size = file.size();
+        audio_end = size;
+        switch (type) {
+            case FILETYPE_MP3:
+                format = FORMAT_MP3;
+                parsed = parseMP3(file);
+                break;
+            case FILETYPE_FLAC:
+                format = FORMAT_FLAC;
+                parsed = parseFLAC(file);
+                break;
+            case FILETYPE_WAV:
+                format = FORMAT_WAV;
+                parsed = parseWAV(file);
+                break;
+        }
+        file.close();
+    }
+    Card_Manager::get_handle()->mutex().unlock();
+
+    if (!parsed || sample_rate == 0) {
+        close();
+        return false;
+    }
+
+    /* No table of its own, so build one as this playback goes until the index from an earlier one has been read */
+    if (mode == MODE_NONE) {
+        mode = MODE_POINTS;
+        scanning = true;
+        synced = true;
+        scan_end = audio_start;
+        scan_position = audio_start;
+        scan_samples = 0;
+        next_sample = 0;
+        next_point = 0;
+        cached = std::make_shared<cached_t>();
+        *load = [db_path = db_path, filename = this->filename, size = size, cached = cached]() {
+            loadPoints(db_path, filename, size, cached.get());
+            cached->done.store(true, std::memory_order_release);
+        };
+    }
+    return true;
+}
+
+void
+Audio::SeekIndex::close()
+{
+    cached.reset();
+    std::vector<point_t>().swap(points);
+    format = FORMAT_NONE;
+    mode = MODE_NONE;
+    size = 0;
+    audio_start = 0;
+    audio_end = 0;
+    sample_rate = 0;
+    total_samples = 0;
+    bitrate = 0;
+    trim_start = 0;
+    trim_length = 0;
+    toc_bytes = 0;
+    fmt_length = 0;
+    block_align = 0;
+    block_size = 0;
+    max_block_size = 0;
+    min_frame_size = 0;
+    scanning = false;
+}
+
+uint32_t
+Audio::SeekIndex::getDuration()
+{
+    adopt();
+    if (sample_rate && total_samples) {
+        return (total_samples * 1000) / sample_rate;
+    }
+    if (format == FORMAT_MP3 && bitrate) {
+        return ((uint64_t) (audio_end - audio_start) * 8) / bitrate;
+    }
+    return 0;
+}
+
+/****************************************************
+ *
+ * Lookups
+ *
+ ****************************************************/
+
+bool
+Audio::SeekIndex::locate(uint32_t ms, uint32_t* offset, uint32_t* actual_ms)
+{
+    adopt();
+    if (mode == MODE_NONE) {
+        return false;
+    }
+    uint64_t sample = ((uint64_t) ms * sample_rate) / 1000;
+    if (total_samples && sample >= total_samples) {
+        return false;
+    }
+
+    uint64_t position;
+    switch (mode) {
+        case MODE_WAV:
+            position = audio_start + sample * block_align;
+            break;
+
+        case MODE_TOC: {
+            /* Each TOC entry is the offset at that percentage of the play time, in 1/256ths of the stream */
+            float percent = (float) sample * 100 / total_samples;
+            uint8_t entry = percent < 99 ? (uint8_t) percent : 99;
+            float from = toc[entry];
+            float to = entry < 99 ? toc[entry + 1] : 256;
+            float fraction = from + (to - from) * (percent - entry);
+            position = audio_start + (uint64_t) (fraction * toc_bytes / 256);
+            break;
+        }
+
+        case MODE_POINTS: {
+            point_t before = { 0, audio_start };
+            auto after = std::upper_bound(points.begin(), points.end(), sample, [](uint64_t value, const point_t& point) {
+                return value < point.sample;
+            });
+            if (after != points.begin()) {
+                before = *(after - 1);
+            }
+
+            /* Between two points, or between the last one and the end of the file if we know how long it is */
+            point_t next;
+            if (after != points.end()) {
+                next = *after;
+            } else if (total_samples > before.sample) {
+                next = { (uint32_t) total_samples, audio_end };
+            } else {
+                next = { 0, 0 };
+            }
+
+            if (next.sample > before.sample) {
+                position = before.offset + ((uint64_t) (next.offset - before.offset) * (sample - before.sample)) / (next.sample - before.sample);
+            }
+
+            /* Past the end of an index that's still being built, carry on at the byte rate so far */
+            else if (before.sample > 0) {
+                position = before.offset + ((uint64_t) (before.offset - audio_start) * (sample - before.sample)) / before.sample;
+            } else if (bitrate) {
+                position = before.offset + ((sample - before.sample) * bitrate * 125) / sample_rate;
+            } else {
+                return false;
+            }
+            break;
+        }
+
+        default:
+            return false;
+    }
+
+    if (position >= audio_end) {
+        return false;
+    }
+    *offset = position;
+    *actual_ms = (sample * 1000) / sample_rate;
+    return true;
+}
+
+size_t
+Audio::SeekIndex::header(uint8_t* buffer, size_t size, uint32_t offset)
+{
+    switch (format) {
+        /* fLaC and a STREAMINFO block marked as the last one */
+        case FORMAT_FLAC:
+            if (size < 42) {
+                return 0;
+            }
+            memcpy(buffer, "fLaC", 4);
+            buffer[4] = 0x80;
+            buffer[5] = 0;
+            buffer[6] = 0;
+            buffer[7] = sizeof(streaminfo);
+            memcpy(buffer + 8, streaminfo, sizeof(streaminfo));
+            return 42;
+
+        /* RIFF header, the original fmt chunk, and a data chunk that runs from the offset to the end */
+        case FORMAT_WAV: {
+            size_t length = 12 + 8 + fmt_length + 8;
+            uint32_t data_length = offset < audio_end ? audio_end - offset : 0;
+            if (size < length) {
+                return 0;
+            }
+            memcpy(buffer, "RIFF", 4);
+            write_le32(buffer + 4, length - 8 + data_length);
+            memcpy(buffer + 8, "WAVEfmt ", 8);
+            write_le32(buffer + 16, fmt_length);
+            memcpy(buffer + 20, fmt_chunk, fmt_length);
+            memcpy(buffer + 20 + fmt_length, "data", 4);
+            write_le32(buffer + 24 + fmt_length, data_length);
+            return length;
+        }
+
+        /* MP3 frames carry everything the decoder needs */
+        default:
+            return 0;
+    }
+}
+
+/****************************************************
+ *
+ * Header parsing, called with the card lock held
+ *
+ ****************************************************/
+
+uint32_t
+Audio::SeekIndex::skipID3(FsFile& file)
+{
+    uint32_t position = 0;
+    uint8_t tag[10];
+    while (file.seek(position) && file.read(tag, sizeof(tag)) == sizeof(tag) && memcmp(tag, "ID3", 3) == 0) {
+        uint32_t length = ((tag[6] & 0x7f) << 21) | ((tag[7] & 0x7f) << 14) | ((tag[8] & 0x7f) << 7) | (tag[9] & 0x7f);
+        position += sizeof(tag) + length + ((tag[5] & 0x10) ? sizeof(tag) : 0); /* Footer */
+    }
+    return position;
+}
+
+bool
+Audio::SeekIndex::parseMP3Frame(const uint8_t* header, mp3_frame_t* frame)
+{
+    /* Kilobits per second, MPEG-1 layers I to III then MPEG-2/2.5 layer I and layers II/III */
+    static const uint16_t bitrates[5][16] = {
+        { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0 },
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 0 },
+        { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 },
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0 },
+        { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 },
+    };
+    static const uint32_t sample_rates[3] = { 44100, 48000, 32000 };
+
+    if (header[0] != 0xFF || (header[1] & 0xE0) != 0xE0) {
+        return false;
+    }
+    uint8_t version = (header[1] >> 3) & 3; /* 0 MPEG-2.5, 2 MPEG-2, 3 MPEG-1 */
+    uint8_t layer = (header[1] >> 1) & 3;   /* 1 layer III, 2 layer II, 3 layer I */
+    uint8_t bitrate_index = header[2] >> 4;
+    uint8_t rate_index = (header[2] >> 2) & 3;
+
+    /* Free format streams have no bitrate to work out the frame length from */
+    if (version == 1 || layer == 0 || bitrate_index == 0 || bitrate_index == 15 || rate_index == 3) {
+        return false;
+    }
+
+    bool mpeg1 = version == 3;
+    bool padding = (header[2] >> 1) & 1;
+    bool mono = (header[3] >> 6) == 3;
+    frame->bitrate = bitrates[mpeg1 ? 3 - layer : (layer == 3 ? 3 : 4)][bitrate_index];
+    frame->sample_rate = sample_rates[rate_index] >> (mpeg1 ? 0 : (version == 2 ? 1 : 2));
+    if (layer == 3) {
+        frame->samples = 384;
+        frame->length = ((12 * frame->bitrate * 1000) / frame->sample_rate + padding) * 4;
+    } else {
+        frame->samples = (layer == 1 && !mpeg1) ? 576 : 1152;
+        frame->length = (frame->samples / 8 * frame->bitrate * 1000) / frame->sample_rate + padding;
+    }
+    frame->side_info = mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17);
+    return true;
+}
+
+bool
+Audio::SeekIndex::parseMP3(FsFile& file)
+{
+    uint32_t start = skipID3(file);
+
+    /* An ID3v1 tag takes up the last 128 bytes */
+    uint8_t tag[3];
+    if (size >= 128 && file.seek(size - 128) && file.read(tag, sizeof(tag)) == sizeof(tag) && memcmp(tag, "TAG", 3) == 0) {
+        audio_end = size - 128;
+    }
+
+    std::vector<uint8_t> probe(SEEK_INDEX_PROBE_SIZE);
+    if (!file.seek(start)) {
+        return false;
+    }
+    int length = file.read(probe.data(), probe.size());
+    if (length < 4) {
+        return false;
+    }
+
+    /* The first frame is the first header that's followed by another one where its length says it should be */
+    mp3_frame_t frame;
+    int i;
+    for (i = 0; i + 4 <= length; i++) {
+        if (probe[i] != 0xFF || !parseMP3Frame(&probe[i], &frame)) {
+            continue;
+        }
+        mp3_frame_t next;
+        if (i + frame.length + 4 > length || parseMP3Frame(&probe[i + frame.length], &next)) {
+            break;
+        }
+    }
+    if (i + 4 > length) {
+        log_w("No MP3 frames found in %s", filename.c_str());
+        return false;
+    }
+    audio_start = start + i;
+    sample_rate = frame.sample_rate;
+    bitrate = frame.bitrate;
+
+    /* A Xing or Info frame sits after the side information of the first frame */
+    const uint8_t* xing = &probe[i + 4 + frame.side_info];
+    if (i + 4 + frame.side_info + 120 <= length && (memcmp(xing, "Xing", 4) == 0 || memcmp(xing, "Info", 4) == 0)) {
+        uint32_t flags = read_be32(xing + 4);
+        const uint8_t* field = xing + 8;
+        uint32_t frames = 0;
+        if (flags & 0x01) {
+            frames = read_be32(field);
+            total_samples = (uint64_t) frames * frame.samples;
+            field += 4;
+        }
+        if (flags & 0x02) {
+            toc_bytes = read_be32(field);
+            field += 4;
+        }
+        if ((flags & 0x04) && frames) {
+            memcpy(toc, field, sizeof(toc));
+            if (!toc_bytes || toc_bytes > audio_end - audio_start) {
+                toc_bytes = audio_end - audio_start;
+            }
+            mode = MODE_TOC;
+        }
+        if (flags & 0x04) {
+            field += sizeof(toc);
+        }
+        if (flags & 0x08) {
+            field += 4; /* VBR quality */
+        }
+
+        /* LAME and the encoders built on it follow the Xing fields with their own tag, which has the encoder
+        delay and padding as two 12 bit values 21 bytes in.  The decoder adds its own delay to the start, and
+        puts out the Xing frame itself as a frame of silence. */
+        const uint8_t* lame = field;
+        if (frames && lame + 24 <= &probe[length] &&
+            (memcmp(lame, "LAME", 4) == 0 || memcmp(lame, "Lavc", 4) == 0 || memcmp(lame, "Lavf", 4) == 0)) {
+            uint32_t delay = (lame[21] << 4) | (lame[22] >> 4);
+            uint32_t padding = ((lame[22] & 0x0f) << 8) | lame[23];
+            if (delay + padding < total_samples) {
+                trim_start = frame.samples + delay + SEEK_MP3_DECODER_DELAY;
+                trim_length = total_samples - delay - padding;
+            }
+        }
+        return true;
+    }
+
+    /* A VBRI frame always has its tag 32 bytes after the header */
+    const uint8_t* vbri = &probe[i + 36];
+    if (i + 36 + 26 <= length && memcmp(vbri, "VBRI", 4) == 0) {
+        uint32_t frames = read_be32(vbri + 14);
+        uint16_t entries = (vbri[18] << 8) | vbri[19];
+        uint16_t scale = (vbri[20] << 8) | vbri[21];
+        uint16_t entry_size = (vbri[22] << 8) | vbri[23];
+        uint16_t frames_per_entry = (vbri[24] << 8) | vbri[25];
+        total_samples = (uint64_t) frames * frame.samples;
+        if (entry_size < 1 || entry_size > 4 || entries > SEEK_INDEX_MAX_POINTS || !file.seek(audio_start + 36 + 26)) {
+            return true;
+        }
+
+        /* Each entry is the size of the next run of frames, counted from the end of the VBRI frame */
+        points.reserve(entries + 1);
+        uint32_t offset = audio_start + frame.length;
+        for (uint16_t entry = 0; entry <= entries && offset < audio_end; entry++) {
+            points.push_back({ (uint32_t) entry * frames_per_entry * frame.samples, offset });
+            uint8_t value[4];
+            if (entry == entries || file.read(value, entry_size) != entry_size) {
+                break;
+            }
+            uint32_t run = 0;
+            for (uint16_t byte = 0; byte < entry_size; byte++) {
+                run = (run << 8) | value[byte];
+            }
+            offset += run * scale;
+        }
+        mode = MODE_POINTS;
+    }
+    return true;
+}
+
+bool
+Audio::SeekIndex::parseFLAC(FsFile& file)
+{
+    uint32_t position = skipID3(file);
+    uint8_t block[4];
+    if (!file.seek(position) || file.read(block, sizeof(block)) != sizeof(block) || memcmp(block, "fLaC", 4) != 0) {
+        return false;
+    }
+    position += sizeof(block);
+
+    /* Walk the metadata blocks, the first frame follows the last of them */
+    bool last = false;
+    bool streaminfo_found = false;
+    uint32_t seektable = 0;
+    uint32_t seektable_length = 0;
+    while (!last) {
+        if (!file.seek(position) || file.read(block, sizeof(block)) != sizeof(block)) {
+            return false;
+        }
+        last = block[0] & 0x80;
+        uint8_t type = block[0] & 0x7f;
+        uint32_t length = (block[1] << 16) | (block[2] << 8) | block[3];
+        position += sizeof(block);
+        if (type == 0 && length >= sizeof(streaminfo)) {
+            streaminfo_found = file.read(streaminfo, sizeof(streaminfo)) == sizeof(streaminfo);
+        } else if (type == 3) {
+            seektable = position;
+            seektable_length = length;
+        }
+        position += length;
+    }
+    if (!streaminfo_found) {
+        return false;
+    }
+    audio_start = position;
+
+    uint16_t min_block_size = (streaminfo[0] << 8) | streaminfo[1];
+    max_block_size = (streaminfo[2] << 8) | streaminfo[3];
+    block_size = min_block_size == max_block_size ? min_block_size : 0;
+    min_frame_size = (streaminfo[4] << 16) | (streaminfo[5] << 8) | streaminfo[6];
+    sample_rate = (streaminfo[10] << 12) | (streaminfo[11] << 4) | (streaminfo[12] >> 4);
+    total_samples = ((uint64_t) (streaminfo[13] & 0x0f) << 32) | read_be32(&streaminfo[14]);
+
+    /* Seek points are 18 bytes each, placeholders have every bit of the sample number set */
+    if (seektable && file.seek(seektable)) {
+        uint32_t count = seektable_length / 18;
+        points.reserve(count < SEEK_INDEX_MAX_POINTS ? count : SEEK_INDEX_MAX_POINTS);
+        for (uint32_t i = 0; i < count && points.size() < SEEK_INDEX_MAX_POINTS; i++) {
+            uint8_t point[18];
+            if (file.read(point, sizeof(point)) != sizeof(point)) {
+                break;
+            }
+            if (read_be32(point) == 0xffffffff && read_be32(point + 4) == 0xffffffff) {
+                continue;
+            }
+            uint64_t sample = ((uint64_t) read_be32(point) << 32) | read_be32(point + 4);
+            uint64_t offset = ((uint64_t) read_be32(point + 8) << 32) | read_be32(point + 12);
+            if (sample > UINT32_MAX || audio_start + offset >= audio_end) {
+                continue;
+            }
+            points.push_back({ (uint32_t) sample, (uint32_t) (audio_start + offset) });
+        }
+        if (!points.empty()) {
+            mode = MODE_POINTS;
+        }
+    }
+    return true;
+}
+
+bool
+Audio::SeekIndex::parseWAV(FsFile& file)
+{
+    uint8_t chunk[12];
+    if (!file.seek(0) || file.read(chunk, sizeof(chunk)) != sizeof(chunk) || memcmp(chunk, "RIFF", 4) != 0 || memcmp(chunk + 8, "WAVE", 4) != 0) {
+        return false;
+    }
+
+    /* Find the format and the start of the sample data, skipping anything else */
+    uint32_t position = sizeof(chunk);
+    while (position + 8 <= size) {
+        if (!file.seek(position) || file.read(chunk, 8) != 8) {
+            return false;
+        }
+        uint32_t length = read_le32(chunk + 4);
+        if (memcmp(chunk, "fmt ", 4) == 0 && length >= 16) {
+            fmt_length = length < sizeof(fmt_chunk) ? length : sizeof(fmt_chunk);
+            if (file.read(fmt_chunk, fmt_length) != fmt_length) {
+                return false;
+            }
+            sample_rate = read_le32(fmt_chunk + 4);
+            block_align = fmt_chunk[12] | (fmt_chunk[13] << 8);
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            audio_start = position + 8;
+            if ((uint64_t) audio_start + length < size) {
+                audio_end = audio_start + length;
+            }
+            break;
+        }
+        position += 8 + length + (length & 1);
+    }
+    if (!fmt_length || !block_align || !audio_start) {
+        return false;
+    }
+    total_samples = (audio_end - audio_start) / block_align;
+    mode = MODE_WAV;
+    return true;
+}
+
+/****************************************************
+ *
+ * Frame scan
+ *
+ ****************************************************/
+
+void
+Audio::SeekIndex::observe(const uint8_t* data, size_t length, uint32_t position)
+{
+    adopt();
+
+    /* Only data that carries on from where the scan got to is any use.  After a seek the scan
+    waits for playback to come back round to it. */
+    if (!scanning || position > scan_end || position + length <= scan_end) {
+        return;
+    }
+    chunk_start = scan_end;
+    chunk = data + (scan_end - position);
+    chunk_end = position + length;
+
+    if (synced) {
+        if (format == FORMAT_MP3) {
+            scanMP3();
+        } else {
+            scanFLAC();
+        }
+    }
+
+    /* Keep the end of the chunk for a header that runs over into the next one */
+    size_t count = chunk_end - chunk_start;
+    if (count >= SEEK_SCAN_TAIL) {
+        memcpy(tail, chunk + count - SEEK_SCAN_TAIL, SEEK_SCAN_TAIL);
+    } else {
+        memmove(tail, tail + count, SEEK_SCAN_TAIL - count);
+        memcpy(tail + SEEK_SCAN_TAIL - count, chunk, count);
+    }
+    scan_end = chunk_end;
+    chunk = nullptr;
+}
+
+void
+Audio::SeekIndex::finish(std::function<void()>* store)
+{
+    adopt();
+    if (!scanning) {
+        return;
+    }
+    scanning = false;
+
+    /* Part of the file was skipped, so the index has gaps */
+    if (scan_end < audio_end) {
+        return;
+    }
+    if (synced && format == FORMAT_MP3) {
+        total_samples = scan_samples;
+    } else if (synced && !total_samples) {
+        total_samples = next_sample;
+    }
+    if (!points.empty()) {
+        *store = [db_path = db_path, filename = filename, size = size, samples = total_samples, points = points]() {
+            storePoints(db_path, filename, size, samples, points);
+        };
+    }
+}
+
+uint8_t
+Audio::SeekIndex::byteAt(uint32_t offset)
+{
+    if (offset >= chunk_start) {
+        return chunk[offset - chunk_start];
+    }
+    if (chunk_start - offset > SEEK_SCAN_TAIL) {
+        return 0;
+    }
+    return tail[SEEK_SCAN_TAIL - (chunk_start - offset)];
+}
+
+void
+Audio::SeekIndex::addPoint(uint32_t sample, uint32_t offset)
+{
+    if (sample < next_point || points.size() >= SEEK_INDEX_MAX_POINTS) {
+        return;
+    }
+    points.push_back({ sample, offset });
+    next_point = sample + (sample_rate * SEEK_INDEX_INTERVAL_MS) / 1000;
+}
+
+/* MP3 frames follow on from each other, so the next header is always where the length of the last one says */
+void
+Audio::SeekIndex::scanMP3()
+{
+    while (scan_position + 4 <= chunk_end && scan_position + 4 <= audio_end) {
+        uint8_t header[4];
+        for (uint8_t i = 0; i < sizeof(header); i++) {
+            header[i] = byteAt(scan_position + i);
+        }
+        mp3_frame_t frame;
+        if (!parseMP3Frame(header, &frame)) {
+            log_w("Lost the frames of %s at %d, seeking past there will be estimated", filename.c_str(), scan_position);
+            synced = false;
+            return;
+        }
+        addPoint(scan_samples, scan_position);
+        scan_samples += frame.samples;
+        scan_position += frame.length;
+    }
+}
+
+/* FLAC frames don't say how long they are, so each one has to be found from its sync code.  A header only
+counts if its CRC checks out and it carries on from the samples of the frame before. */
+void
+Audio::SeekIndex::scanFLAC()
+{
+    if (chunk_end < SEEK_SCAN_TAIL) {
+        return;
+    }
+    uint32_t skip = min_frame_size > SEEK_SCAN_TAIL ? min_frame_size : SEEK_SCAN_TAIL;
+    uint32_t limit = chunk_end - SEEK_SCAN_TAIL;
+    while (scan_position <= limit) {
+        if (scan_position >= chunk_start) {
+            const uint8_t* found = (const uint8_t*) memchr(chunk + (scan_position - chunk_start), 0xFF, limit - scan_position + 1);
+            if (!found) {
+                scan_position = limit + 1;
+                return;
+            }
+            scan_position = chunk_start + (found - chunk);
+        }
+
+        uint32_t sample;
+        uint32_t frame_samples;
+        if (parseFLACFrame(scan_position, &sample, &frame_samples) && sample >= next_sample && sample - next_sample <= 4 * (uint32_t) max_block_size) {
+            addPoint(sample, scan_position);
+            next_sample = sample + frame_samples;
+            scan_position += skip;
+        } else {
+            scan_position++;
+        }
+    }
+}
+
+bool
+Audio::SeekIndex::parseFLACFrame(uint32_t offset, uint32_t* sample, uint32_t* frame_samples)
+{
+    uint8_t header[SEEK_SCAN_TAIL];
+    for (uint8_t i = 0; i < 4; i++) {
+        header[i] = byteAt(offset + i);
+    }
+    if (header[0] != 0xFF || (header[1] & 0xFE) != 0xF8) {
+        return false;
+    }
+    uint8_t size_code = header[2] >> 4;
+    uint8_t rate_code = header[2] & 0x0f;
+    if (size_code == 0 || rate_code == 15 || (header[3] >> 4) > 10 || ((header[3] >> 1) & 7) == 3 || (header[3] & 1)) {
+        return false;
+    }
+
+    /* The frame or sample number is coded like UTF-8, up to 36 bits in 7 bytes */
+    size_t length = 4;
+    uint8_t lead = byteAt(offset + length);
+    header[length++] = lead;
+    uint8_t extra = 0;
+    while (extra < 8 && (lead & (0x80 >> extra))) {
+        extra++;
+    }
+    if (extra == 1 || extra == 8) {
+        return false;
+    }
+    uint64_t number = extra ? lead & (0x7f >> extra) : lead;
+    for (uint8_t i = 1; i < extra; i++) {
+        uint8_t next = byteAt(offset + length);
+        if ((next & 0xc0) != 0x80) {
+            return false;
+        }
+        header[length++] = next;
+        number = (number << 6) | (next & 0x3f);
+    }
+
+    uint32_t samples;
+    if (size_code == 1) {
+        samples = 192;
+    } else if (size_code <= 5) {
+        samples = 576 << (size_code - 2);
+    } else if (size_code == 6) {
+        header[length] = byteAt(offset + length);
+        samples = header[length++] + 1;
+    } else if (size_code == 7) {
+        header[length] = byteAt(offset + length);
+        header[length + 1] = byteAt(offset + length + 1);
+        samples = ((header[length] << 8) | header[length + 1]) + 1;
+        length += 2;
+    } else {
+        samples = 256 << (size_code - 8);
+    }
+    uint8_t rate_bytes = rate_code == 12 ? 1 : (rate_code == 13 || rate_code == 14) ? 2 : 0;
+    for (uint8_t i = 0; i < rate_bytes; i++) {
+        header[length] = byteAt(offset + length);
+        length++;
+    }
+
+    /* CRC-8 with polynomial x^8 + x^2 + x + 1 over the whole header */
+    uint8_t crc = 0;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= header[i];
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    if (crc != byteAt(offset + length)) {
+        return false;
+    }
+
+    /* Fixed block size streams number their frames, variable ones number their samples */
+    bool variable = header[1] & 1;
+    uint64_t first = variable ? number : number * (block_size ? block_size : samples);
+    if (first > UINT32_MAX) {
+        return false;
+    }
+    *sample = first;
+    *frame_samples = samples;
+    return true;
+}
+
+/****************************************************
+ *
+ * Index cache
+ *
+ ****************************************************/
+
+void
+Audio::SeekIndex::loadPoints(const std::string& db_path, const std::string& filename, uint32_t size, cached_t* cached)
+{
+    Card_Manager::get_handle()->index_mutex().lock();
+    sqlite3* db;
+    if (sqlite3_open_v2(db_path.c_str(), &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+        sqlite3_close(db);
+        Card_Manager::get_handle()->index_mutex().unlock();
+        return;
+    }
+
+    /* The table won't exist until the first index in this directory is stored */
+    sqlite3_stmt* statement;
+    if (sqlite3_prepare_v2(db, "SELECT samples, points FROM seek_index WHERE filename = ? AND size = ?", -1, &statement, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(statement, 1, filename.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_int64(statement, 2, size);
+        if (sqlite3_step(statement) == SQLITE_ROW) {
+            const point_t* blob = (const point_t*) sqlite3_column_blob(statement, 1);
+            size_t count = sqlite3_column_bytes(statement, 1) / sizeof(point_t);
+            if (blob && count > 0) {
+                cached->points.assign(blob, blob + count);
+                cached->samples = sqlite3_column_int64(statement, 0);
+            }
+        }
+        sqlite3_finalize(statement);
+    }
+    sqlite3_close(db);
+    Card_Manager::get_handle()->index_mutex().unlock();
+}
+
+/* The cached index covers the whole file, so it takes over from whatever the scan has found so far */
+void
+Audio::SeekIndex::adopt()
+{
+    if (!cached || !cached->done.load(std::memory_order_acquire)) {
+        return;
+    }
+    if (!cached->points.empty()) {
+        points.swap(cached->points);
+        if (cached->samples > 0) {
+            total_samples = cached->samples;
+        }
+        scanning = false;
+        log_i("Loaded %d seek points for %s", points.size(), filename.c_str());
+    }
+    cached.reset();
+}
+
+void
+Audio::SeekIndex::storePoints(const std::string& db_path, const std::string& filename, uint32_t size, uint64_t samples, const std::vector<point_t>& points)
+{
+    Card_Manager::get_handle()->index_mutex().lock();
+    sqlite3* db;
+    if (sqlite3_open_v2(db_path.c_str(), &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK) {
+        log_e("Failed to open database file: %s", db_path.c_str());
+        sqlite3_close(db);
+        Card_Manager::get_handle()->index_mutex().unlock();
+        return;
+    }
+
+    const char* sql = "CREATE TABLE IF NOT EXISTS seek_index (filename TEXT PRIMARY KEY, size INTEGER, samples INTEGER, points BLOB)";
+    if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK) {
+        log_e("Failed to create seek index table");
+        log_e("Error: %s", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        Card_Manager::get_handle()->index_mutex().unlock();
+        return;
+    }
+
+    sqlite3_stmt* statement;
+    sql = "INSERT OR REPLACE INTO seek_index (filename, size, samples, points) VALUES (?, ?, ?, ?)";
+    if (sqlite3_prepare_v2(db, sql, -1, &statement, NULL) != SQLITE_OK) {
+        log_e("Failed to prepare SQL statement");
+        log_e("SQL: %s", sql);
+        log_e("Error: %s", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        Card_Manager::get_handle()->index_mutex().unlock();
+        return;
+    }
+    sqlite3_bind_text(statement, 1, filename.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(statement, 2, size);
+    sqlite3_bind_int64(statement, 3, samples);
+    sqlite3_bind_blob(statement, 4, points.data(), points.size() * sizeof(point_t), SQLITE_STATIC);
+    if (sqlite3_step(statement) != SQLITE_DONE) {
+        log_e("Failed to store seek index for %s", filename.c_str());
+        log_e("Error: %s", sqlite3_errmsg(db));
+    } else {
+        log_i("Stored %d seek points for %s", points.size(), filename.c_str());
+    }
+    sqlite3_finalize(statement);
+    sqlite3_close(db);
+    Card_Manager::get_handle()->index_mutex().unlock();
+}
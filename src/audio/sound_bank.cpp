@@ -0,0 +1,195 @@
+/**
+ * @file sound_bank.cpp
+ *
+ * @brief Short sounds decoded once into PCM and mixed over the output.
+ * Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <AudioTools.h>
+#include <AudioTools/AudioCodecs/CodecMP3Helix.h>
+#include <audio/sound_bank.h>
+
+Audio::SoundBank::Capture::~Capture()
+{
+    heap_caps_free(data);
+}
+
+size_t
+Audio::SoundBank::Capture::write(const uint8_t* data, size_t length)
+{
+    if (this->length + length > capacity) {
+        size_t grown = capacity ? capacity * 2 : 1024 * 16;
+        while (grown < this->length + length) {
+            grown *= 2;
+        }
+        uint8_t* moved = (uint8_t*) heap_caps_realloc(this->data, grown, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!moved) {
+            failed = true;
+            return length;
+        }
+        this->data = moved;
+        capacity = grown;
+    }
+    memcpy(this->data + this->length, data, length);
+    this->length += length;
+    return length;
+}
+
+void
+Audio::SoundBank::begin(Print& output, uint32_t sample_rate, uint8_t channels)
+{
+    this->output = &output;
+    this->sample_rate = sample_rate;
+    this->channels = channels > SOUND_BANK_MAX_CHANNELS ? SOUND_BANK_MAX_CHANNELS : channels;
+}
+
+void
+Audio::SoundBank::setOutputRate(uint32_t sample_rate)
+{
+    step = ((uint64_t) this->sample_rate << 16) / sample_rate;
+}
+
+bool
+Audio::SoundBank::add(uint8_t id, const uint8_t* mp3, size_t length)
+{
+    if (id >= SOUND_BANK_MAX_SOUNDS || sounds[id].samples) {
+        return false;
+    }
+
+    /* Decode the whole sound up front, the decoder only lives as long as this call */
+    Capture capture;
+    audio_tools::MP3DecoderHelix* decoder = new audio_tools::MP3DecoderHelix();
+    decoder->setOutput(capture);
+    decoder->begin();
+    for (size_t offset = 0; offset < length; offset += SOUND_BANK_DECODE_CHUNK) {
+        size_t chunk = length - offset < SOUND_BANK_DECODE_CHUNK ? length - offset : SOUND_BANK_DECODE_CHUNK;
+        decoder->write(mp3 + offset, chunk);
+    }
+    decoder->end();
+    audio_tools::AudioInfo info = decoder->audioInfo();
+    delete decoder;
+
+    if (capture.failed || info.sample_rate == 0 || info.channels == 0 || capture.length == 0) {
+        log_e("Sound %d could not be decoded", id);
+        return false;
+    }
+
+    /* Mix down to mono and resample to the bank's rate, linear interpolation is plenty for menu sounds */
+    const int16_t* source = (const int16_t*) capture.data;
+    uint32_t source_frames = capture.length / (info.channels * sizeof(int16_t));
+    uint32_t frames = ((uint64_t) source_frames * sample_rate) / info.sample_rate;
+    int16_t* samples = (int16_t*) heap_caps_malloc(frames * sizeof(int16_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!samples) {
+        log_e("Not enough memory for sound %d", id);
+        return false;
+    }
+    uint64_t step = ((uint64_t) info.sample_rate << 16) / sample_rate;
+    for (uint32_t frame = 0; frame < frames; frame++) {
+        uint64_t at = frame * step;
+        uint32_t index = at >> 16;
+        int32_t fraction = at & 0xFFFF;
+        int32_t a = 0;
+        int32_t b = 0;
+        uint32_t next = index + 1 < source_frames ? index + 1 : index;
+        for (uint8_t channel = 0; channel < info.channels; channel++) {
+            a += source[index * info.channels + channel];
+            b += source[next * info.channels + channel];
+        }
+        a /= info.channels;
+        b /= info.channels;
+        samples[frame] = (int16_t) (a + (((b - a) * fraction) >> 16));
+    }
+
+    sounds[id].samples = samples;
+    sounds[id].frames = frames;
+    log_i("Sound %d: %d frames at %d Hz, %d bytes", id, frames, sample_rate, frames * sizeof(int16_t));
+    return true;
+}
+
+void
+Audio::SoundBank::play(uint8_t id, int16_t gain)
+{
+    if (id >= SOUND_BANK_MAX_SOUNDS) {
+        return;
+    }
+    gain_request.store(gain);
+    sound_request.store(id + 1);
+}
+
+size_t
+Audio::SoundBank::write(const uint8_t* data, size_t length)
+{
+    if (!output) {
+        return length;
+    }
+
+    uint8_t request = sound_request.exchange(0);
+    if (request) {
+        current = sounds[request - 1].samples ? &sounds[request - 1] : nullptr;
+        position = 0;
+        fraction = 0;
+        gain = gain_request.load();
+    }
+    if (!current) {
+        return output->write(data, length);
+    }
+
+    /* Add the sound to as many whole frames as there are, anything left over goes out as it is */
+    const size_t frame_bytes = channels * sizeof(int16_t);
+    size_t written = 0;
+    while (current && length - written >= frame_bytes) {
+        size_t frames = (length - written) / frame_bytes;
+        if (frames > SOUND_BANK_MIX_FRAMES) {
+            frames = SOUND_BANK_MIX_FRAMES;
+        }
+
+        /* Stops at the frame the sound runs out on, the rest of the block goes out untouched */
+        memcpy(mixed_samples, data + written, frames * frame_bytes);
+        size_t frame = 0;
+        for (; frame < frames && position < current->frames; frame++) {
+            int32_t a = current->samples[position];
+            int32_t b = position + 1 < current->frames ? current->samples[position + 1] : a;
+            int32_t overlay = ((a + (((b - a) * (int32_t) (fraction >> 1)) >> 15)) * gain) >> 15;
+            for (uint8_t channel = 0; channel < channels; channel++) {
+                size_t i = frame * channels + channel;
+                int32_t sample = mixed_samples[i] + overlay;
+                if (sample > INT16_MAX) {
+                    sample = INT16_MAX;
+                } else if (sample < INT16_MIN) {
+                    sample = INT16_MIN;
+                }
+                mixed_samples[i] = (int16_t) sample;
+            }
+            fraction += step;
+            position += fraction >> 16;
+            fraction &= 0xFFFF;
+        }
+        written += output->write((const uint8_t*) mixed_samples, frame * frame_bytes);
+
+        if (position >= current->frames) {
+            current = nullptr;
+        }
+    }
+    if (written < length) {
+        written += output->write(data + written, length - written);
+    }
+    return written;
+}
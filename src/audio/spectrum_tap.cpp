@@ -0,0 +1,175 @@
+/**
+ * @file spectrum_tap.cpp
+ *
+ * @brief Decimated mono tap off the output, and the FFT that turns it into
+ * octave band levels.  Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <audio/spectrum_tap.h>
+
+/* First bin of each band and the end of the last.  A bin is SPECTRUM_TAP_RATE / SPECTRUM_FFT_SIZE wide, about
+43 Hz, so the bands are centred from about 64 Hz up to 4 kHz.  Bin 0 is DC and is left out. */
+static constexpr uint16_t band_edges[] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+static_assert(sizeof(band_edges) / sizeof(band_edges[0]) == SPECTRUM_BANDS + 1, "One edge per band and one to close the last");
+static_assert(band_edges[SPECTRUM_BANDS] == SPECTRUM_FFT_SIZE / 2, "The bands run up to half the FFT size");
+static_assert((SPECTRUM_BOTTOM_HZ * SPECTRUM_FFT_SIZE + SPECTRUM_TAP_RATE / 2) / SPECTRUM_TAP_RATE == band_edges[0], "The first bin starts at the bottom of the lowest band");
+
+void
+Audio::SpectrumTap::begin(uint32_t sample_rate, uint8_t channels)
+{
+    this->channels = channels > SPECTRUM_MAX_CHANNELS ? SPECTRUM_MAX_CHANNELS : channels;
+    setSampleRate(sample_rate);
+    memset(history, 0, sizeof(history));
+
+    float power = 0;
+    for (uint16_t i = 0; i < SPECTRUM_FFT_SIZE; i++) {
+        window[i] = 0.5f - 0.5f * cosf(2 * (float) PI * i / SPECTRUM_FFT_SIZE);
+        power += window[i] * window[i];
+    }
+    for (uint16_t i = 0; i < SPECTRUM_FFT_SIZE / 2; i++) {
+        cosines[i] = cosf(2 * (float) PI * i / SPECTRUM_FFT_SIZE);
+        sines[i] = sinf(2 * (float) PI * i / SPECTRUM_FFT_SIZE);
+    }
+
+    /* By Parseval, a sine of amplitude A puts N * sum(w^2) * A^2 / 4 into the positive bins */
+    full_scale = SPECTRUM_FFT_SIZE * power * 32767.0f * 32767.0f / 4;
+}
+
+void
+Audio::SpectrumTap::setSampleRate(uint32_t sample_rate)
+{
+    decimation = (sample_rate + SPECTRUM_TAP_RATE / 2) / SPECTRUM_TAP_RATE;
+    if (decimation == 0) {
+        decimation = 1;
+    }
+    pending = 0;
+    memset(integrators, 0, sizeof(integrators));
+    memset(combs, 0, sizeof(combs));
+}
+
+size_t
+Audio::SpectrumTap::write(const uint8_t* data, size_t length)
+{
+    const size_t frame_bytes = channels * sizeof(int16_t);
+    const size_t frames = length / frame_bytes;
+    uint32_t position = written.load(std::memory_order_relaxed);
+    for (size_t f = 0; f < frames; f++) {
+        int16_t frame[SPECTRUM_MAX_CHANNELS];
+        memcpy(frame, data + f * frame_bytes, frame_bytes);
+        int32_t mono = 0;
+        for (uint8_t channel = 0; channel < channels; channel++) {
+            mono += frame[channel];
+        }
+        integrators[0] += (uint32_t) mono;
+        integrators[1] += integrators[0];
+
+        /* Two moving averages in a row, which keeps treble from folding down into the top octaves
+        about twice as well as one would */
+        if (++pending == decimation) {
+            uint32_t first = integrators[1] - combs[0];
+            combs[0] = integrators[1];
+            uint32_t second = first - combs[1];
+            combs[1] = first;
+            history[position++ & (SPECTRUM_TAP_HISTORY - 1)] = (int16_t) ((int32_t) second / (int32_t) (channels * decimation * decimation));
+            pending = 0;
+        }
+    }
+    written.store(position, std::memory_order_release);
+    return length;
+}
+
+bool
+Audio::SpectrumTap::analyze(float* levels)
+{
+    /* The audio task may have moved on while we copied, in which case the oldest samples could be newer than
+    the rest.  There's plenty of ring behind the window, so that only happens if this task was held up. */
+    uint32_t end = 0;
+    bool copied = false;
+    for (uint8_t attempt = 0; attempt < 3 && !copied; attempt++) {
+        end = written.load(std::memory_order_acquire);
+        if (end == analyzed) {
+            return false;
+        }
+        for (uint16_t i = 0; i < SPECTRUM_FFT_SIZE; i++) {
+            real[i] = history[(end - SPECTRUM_FFT_SIZE + i) & (SPECTRUM_TAP_HISTORY - 1)];
+        }
+        copied = written.load(std::memory_order_acquire) - end <= SPECTRUM_TAP_HISTORY - SPECTRUM_FFT_SIZE;
+    }
+    if (!copied) {
+        return false;
+    }
+    analyzed = end;
+
+    for (uint16_t i = 0; i < SPECTRUM_FFT_SIZE; i++) {
+        real[i] *= window[i];
+        imaginary[i] = 0;
+    }
+    transform();
+
+    for (uint8_t band = 0; band < SPECTRUM_BANDS; band++) {
+        float power = 0;
+        for (uint16_t bin = band_edges[band]; bin < band_edges[band + 1]; bin++) {
+            power += real[bin] * real[bin] + imaginary[bin] * imaginary[bin];
+        }
+        levels[band] = 10 * log10f(power / full_scale + 1e-12f);
+    }
+    return true;
+}
+
+/* Iterative decimation in time, with the twiddles from the tables worked out in begin() */
+void
+Audio::SpectrumTap::transform()
+{
+    for (uint16_t i = 1, j = 0; i < SPECTRUM_FFT_SIZE; i++) {
+        uint16_t bit = SPECTRUM_FFT_SIZE >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j |= bit;
+        if (i < j) {
+            float swap = real[i];
+            real[i] = real[j];
+            real[j] = swap;
+            swap = imaginary[i];
+            imaginary[i] = imaginary[j];
+            imaginary[j] = swap;
+        }
+    }
+
+    for (uint16_t size = 2; size <= SPECTRUM_FFT_SIZE; size <<= 1) {
+        const uint16_t half = size >> 1;
+        const uint16_t stride = SPECTRUM_FFT_SIZE / size;
+        for (uint16_t start = 0; start < SPECTRUM_FFT_SIZE; start += size) {
+            for (uint16_t k = 0; k < half; k++) {
+                const float c = cosines[k * stride];
+                const float s = sines[k * stride];
+                const uint16_t a = start + k;
+                const uint16_t b = a + half;
+                const float re = real[b] * c + imaginary[b] * s;
+                const float im = imaginary[b] * c - real[b] * s;
+                real[b] = real[a] - re;
+                imaginary[b] = imaginary[a] - im;
+                real[a] += re;
+                imaginary[a] += im;
+            }
+        }
+    }
+}
@@ -0,0 +1,70 @@
+/**
+ * @file splicer.cpp
+ *
+ * @brief Switches the audio task from one deck to the next exactly where the
+ * next track starts in the audio buffer. Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <audio/splicer.h>
+
+void
+Audio::Splicer::begin(Resampler* resamplers, finish_t finish)
+{
+    this->resamplers = resamplers;
+    this->finish = finish;
+}
+
+void
+Audio::Splicer::arm(size_t at, uint8_t deck, audio_tools::AudioDecoder* decoder)
+{
+    this->at.store(at);
+    this->deck.store(deck);
+    this->decoder.store(decoder);
+    pending.store(true, std::memory_order_release);
+}
+
+bool
+Audio::Splicer::cut(size_t read_position, size_t* length, uint8_t* deck, audio_tools::AudioDecoder** decoder)
+{
+    if (!pending.load(std::memory_order_acquire)) {
+        return false;
+    }
+
+    /* Positions run freely, so this holds across the wrap of size_t as well */
+    size_t to_splice = at.load() - read_position;
+    if (to_splice > 0) {
+        if (*length > to_splice) {
+            *length = to_splice;
+        }
+        return false;
+    }
+
+    /* Everything of the old track has gone into its decoder, so flush the frame it held back and the filter's tail */
+    if (finish) {
+        finish(*deck, *decoder);
+    }
+    resamplers[*deck].flush();
+
+    *deck = this->deck.load();
+    *decoder = this->decoder.load();
+    resamplers[*deck].setSource(*decoder);
+    pending.store(false, std::memory_order_release);
+    return true;
+}
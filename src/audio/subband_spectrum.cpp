@@ -0,0 +1,173 @@
+/**
+ * @file subband_spectrum.cpp
+ *
+ * @brief Octave band levels read out of the MP3 decoder's own filterbank, so MP3
+ * playback needs no FFT.  Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <audio/subband_spectrum.h>
+
+#if SPECTRUM_MP3_SUBBANDS
+#include <libhelix-mp3/coder.h>
+
+void
+Audio::SubbandSpectrum::capture(uint8_t deck, HMP3Decoder helix, const int16_t* pcm, size_t samples)
+{
+    if (deck != this->deck) {
+        return;
+    }
+    MP3DecInfo* info = (MP3DecInfo*) helix;
+    if (!info || !info->HuffmanInfoPS || info->nChans < 1 || info->nChans > MAX_NCHAN || info->samprate <= 0) {
+        return;
+    }
+    HuffmanInfo* huffman = (HuffmanInfo*) info->HuffmanInfoPS;
+
+    /* A line is a 576th of the way to Nyquist, about 38 Hz at 44.1 kHz.  Line 0 is left out, like the FFT's DC bin. */
+    if (info->samprate != sample_rate) {
+        sample_rate = info->samprate;
+        for (uint8_t band = 0; band <= SPECTRUM_BANDS; band++) {
+            uint32_t line = ((uint32_t) (SPECTRUM_BOTTOM_HZ << band) * 2 * SUBBAND_SPECTRUM_LINES + sample_rate / 2) / sample_rate;
+            edges[band] = line < 1 ? 1 : line > SUBBAND_SPECTRUM_LINES ? SUBBAND_SPECTRUM_LINES : line;
+        }
+    }
+
+    /* The buffer holds the last granule decoded, the second of an MPEG-1 frame, and nothing past
+    the last non-zero line is guaranteed to have been cleared */
+    float band_energy[SPECTRUM_BANDS] = {};
+    float total_energy = 0;
+    for (int channel = 0; channel < info->nChans; channel++) {
+        const int* lines = huffman->huffDecBuf[channel];
+        int bound = huffman->nonZeroBound[channel];
+        if (bound > SUBBAND_SPECTRUM_LINES) {
+            bound = SUBBAND_SPECTRUM_LINES;
+        }
+        uint8_t band = 0;
+        for (int line = 1; line < bound; line++) {
+            float energy = (float) lines[line] * (float) lines[line];
+            total_energy += energy;
+            while (band < SPECTRUM_BANDS && line >= edges[band + 1]) {
+                band++;
+            }
+            if (band < SPECTRUM_BANDS && line >= edges[band]) {
+                band_energy[band] += energy;
+            }
+        }
+    }
+
+    /* Power of the same granule as it came out, from the last granule's worth of the frame */
+    size_t channels = info->nChans;
+    size_t frames = samples / channels;
+    if (frames > SUBBAND_SPECTRUM_LINES) {
+        pcm += (frames - SUBBAND_SPECTRUM_LINES) * channels;
+        frames = SUBBAND_SPECTRUM_LINES;
+    }
+    if (frames == 0) {
+        return;
+    }
+    float pcm_energy = 0;
+    for (size_t i = 0; i < frames * channels; i++) {
+        pcm_energy += (float) pcm[i] * pcm[i];
+    }
+
+    /* A full scale sine has a mean square of 32767^2 / 2 on every channel */
+    float scale = total_energy > 0 ? pcm_energy / (total_energy * frames * channels * 32767.0f * 32767.0f / 2) : 0;
+    float* levels = sets[back];
+    for (uint8_t band = 0; band < SPECTRUM_BANDS; band++) {
+        levels[band] = 10 * log10f(band_energy[band] * scale + 1e-12f);
+    }
+    back = middle.exchange(back | SUBBAND_FRESH) & ~SUBBAND_FRESH;
+    captured_at.store(millis());
+    captured.store(true);
+}
+
+Audio::SubbandMp3Decoder::SubbandMp3Decoder()
+{
+    helix.setReference(this);
+    helix.setDataCallback(decoded);
+}
+
+void
+Audio::SubbandMp3Decoder::setOutput(Print& output)
+{
+    audio_tools::AudioDecoder::setOutput(output);
+    pcm_output = &output;
+}
+
+bool
+Audio::SubbandMp3Decoder::begin()
+{
+    format = audio_tools::AudioInfo();
+    active = helix.begin();
+    return active;
+}
+
+void
+Audio::SubbandMp3Decoder::end()
+{
+    helix.end();
+    active = false;
+}
+
+void
+Audio::SubbandMp3Decoder::flush()
+{
+    helix.flush();
+}
+
+size_t
+Audio::SubbandMp3Decoder::write(const uint8_t* data, size_t length)
+{
+    return active ? helix.write(data, length) : 0;
+}
+
+void
+Audio::SubbandMp3Decoder::decoded(MP3FrameInfo& info, short* pcm, size_t samples, void* ref)
+{
+    SubbandMp3Decoder* decoder = (SubbandMp3Decoder*) ref;
+    decoder->format.sample_rate = info.samprate;
+    decoder->format.channels = info.nChans;
+    decoder->format.bits_per_sample = info.bitsPerSample;
+
+    /* The lines the spectrum reads are only there until the next frame is decoded */
+    if (decoder->spectrum) {
+        decoder->spectrum->capture(decoder->deck, decoder->helix.handle(), pcm, samples);
+    }
+    if (decoder->pcm_output) {
+        decoder->pcm_output->write((const uint8_t*) pcm, samples * sizeof(short));
+    }
+}
+#endif
+
+bool
+Audio::SubbandSpectrum::analyze(float* levels)
+{
+    if (!(middle.load() & SUBBAND_FRESH)) {
+        return false;
+    }
+    front = middle.exchange(front) & ~SUBBAND_FRESH;
+    memcpy(levels, sets[front], sizeof(sets[front]));
+    return true;
+}
+
+bool
+Audio::SubbandSpectrum::isActive()
+{
+    return captured.load() && millis() - captured_at.load() < SUBBAND_SPECTRUM_TIMEOUT_MS;
+}
@@ -0,0 +1,679 @@
+/**
+ * @file tag_reader.cpp
+ *
+ * @brief Reads the title, artist, album, genre and year out of ID3, FLAC and
+ * Ogg tags once when a file is loaded. Part of the audio library.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <audio/tag_reader.h>
+#include <card_manager.h>
+#include <system.h>
+
+static uint32_t
+read_be(const uint8_t* data, uint8_t bytes)
+{
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < bytes; i++) {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+
+static uint32_t
+read_le32(const uint8_t* data)
+{
+    return ((uint32_t) data[3] << 24) | ((uint32_t) data[2] << 16) | ((uint32_t) data[1] << 8) | data[0];
+}
+
+/* ID3v2 sizes use seven bits per byte so they can't be mistaken for an MPEG sync */
+static uint32_t
+read_synchsafe(const uint8_t* data)
+{
+    return ((uint32_t) (data[0] & 0x7F) << 21) | ((uint32_t) (data[1] & 0x7F) << 14) | ((uint32_t) (data[2] & 0x7F) << 7) | (data[3] & 0x7F);
+}
+
+static bool
+key_is(const char* key, size_t length, const char* name)
+{
+    return strlen(name) == length && strncasecmp(key, name, length) == 0;
+}
+
+bool
+Audio::TagReader::read(const char* path, uint8_t type, tags_t* tags)
+{
+    this->tags = tags;
+    clear(tags);
+
+    Card_Manager::get_handle()->mutex().lock();
+    if (!file.open(path, O_RDONLY)) {
+        Card_Manager::get_handle()->mutex().unlock();
+        return false;
+    }
+    size = file.size();
+    switch (type) {
+        case FILETYPE_MP3:
+            parseID3v2(0);
+            parseID3v1();
+            break;
+        case FILETYPE_FLAC:
+            /* Some taggers put an ID3v2 tag in front of the stream as well */
+            parseFLAC(parseID3v2(0));
+            break;
+        case FILETYPE_OGG:
+            parseOgg();
+            break;
+    }
+    file.close();
+    Card_Manager::get_handle()->mutex().unlock();
+    return true;
+}
+
+void
+Audio::TagReader::clear(tags_t* tags)
+{
+    tags->title[0] = '\0';
+    tags->artist[0] = '\0';
+    tags->album[0] = '\0';
+    tags->genre[0] = '\0';
+    tags->year[0] = '\0';
+    tags->gain_db = NAN;
+    tags->peak = 0;
+}
+
+bool
+Audio::TagReader::readAt(uint32_t offset, uint8_t* data, size_t length)
+{
+    return file.seek(offset) && file.read(data, length) == (int) length;
+}
+
+/****************************************************
+ *
+ * ID3
+ *
+ ****************************************************/
+
+uint32_t
+Audio::TagReader::parseID3v2(uint32_t offset)
+{
+    uint8_t header[10];
+    if (!readAt(offset, header, sizeof(header)) || memcmp(header, "ID3", 3) != 0) {
+        return offset;
+    }
+    uint8_t version = header[3];
+    uint8_t flags = header[5];
+    uint32_t frames_end = offset + 10 + read_synchsafe(header + 6);
+    uint32_t end = frames_end + (version == 4 && (flags & 0x10) ? 10 : 0); /* Footer */
+
+    /* v2.2 defined a compression flag without a scheme, and a v2.3 tag unsynchronised as a whole has its
+    frame sizes shifted by the escape bytes, so neither can be walked frame by frame.  The ID3v1 tag is
+    still read if there is one. */
+    if (version < 2 || version > 4 || (version == 2 && (flags & 0x40)) || (version == 3 && (flags & 0x80))) {
+        log_w("Skipping ID3v2.%d tag with flags %d", version, flags);
+        return end;
+    }
+
+    /* Skip the extended header, v2.3 doesn't count the size field itself */
+    uint32_t position = offset + 10;
+    if (version > 2 && (flags & 0x40)) {
+        uint8_t extended[4];
+        if (!readAt(position, extended, sizeof(extended))) {
+            return end;
+        }
+        position += version == 3 ? 4 + read_be(extended, 4) : read_synchsafe(extended);
+    }
+
+    const uint8_t header_length = version == 2 ? 6 : 10;
+    while (position + header_length <= frames_end) {
+        uint8_t frame[10];
+        if (!readAt(position, frame, header_length) || frame[0] == '\0') {
+            break; /* Padding */
+        }
+        char id[5] = { 0 };
+        memcpy(id, frame, version == 2 ? 3 : 4);
+        uint32_t length;
+        uint16_t frame_flags = 0;
+        if (version == 2) {
+            length = read_be(frame + 3, 3);
+        } else {
+            length = version == 3 ? read_be(frame + 4, 4) : read_synchsafe(frame + 4);
+            frame_flags = (frame[8] << 8) | frame[9];
+        }
+        uint32_t data = position + header_length;
+        position = data + length;
+        if (position > frames_end) {
+            break;
+        }
+
+        /* Only text frames are wanted, everything else, cover art included, is stepped over */
+        if (id[0] != 'T') {
+            continue;
+        }
+        bool unsynchronised = false;
+        uint8_t prefix = 0; /* Group id and data length ahead of the text */
+        if (version == 3) {
+            if (frame_flags & 0xC0) {
+                continue; /* Compressed or encrypted */
+            }
+            prefix = frame_flags & 0x20 ? 1 : 0;
+        } else if (version == 4) {
+            if (frame_flags & 0x0C) {
+                continue;
+            }
+            prefix = (frame_flags & 0x40 ? 1 : 0) + (frame_flags & 0x01 ? 4 : 0);
+            unsynchronised = (flags & 0x80) || (frame_flags & 0x02);
+        }
+        if (length <= prefix) {
+            continue;
+        }
+        length -= prefix;
+        if (length > TAG_FRAME_MAX) {
+            length = TAG_FRAME_MAX; /* Far more than a field holds, the rest would be cut off anyway */
+        }
+        if (!readAt(data + prefix, buffer, length)) {
+            break;
+        }
+
+        /* Undo the unsynchronisation, which put a zero after every 0xFF */
+        if (unsynchronised) {
+            size_t out = 0;
+            for (size_t i = 0; i < length; i++) {
+                buffer[out++] = buffer[i];
+                if (buffer[i] == 0xFF && i + 1 < length && buffer[i + 1] == 0x00) {
+                    i++;
+                }
+            }
+            length = out;
+        }
+        parseID3Frame(id, buffer, length);
+    }
+    return end;
+}
+
+void
+Audio::TagReader::parseID3Frame(const char* id, uint8_t* data, size_t length)
+{
+    if (!strcmp(id, "TXXX") || !strcmp(id, "TXX")) {
+        parseUserText(data, length);
+        return;
+    }
+
+    char* field = nullptr;
+    if (!strcmp(id, "TIT2") || !strcmp(id, "TT2")) {
+        field = tags->title;
+    } else if (!strcmp(id, "TPE1") || !strcmp(id, "TP1")) {
+        field = tags->artist;
+    } else if (!strcmp(id, "TALB") || !strcmp(id, "TAL")) {
+        field = tags->album;
+    } else if (!strcmp(id, "TCON") || !strcmp(id, "TCO")) {
+        field = tags->genre;
+    } else if (!strcmp(id, "TYER") || !strcmp(id, "TYE") || !strcmp(id, "TDRC")) {
+        field = tags->year;
+    }
+    if (!field || field[0] != '\0' || length < 2) {
+        return;
+    }
+
+    /* The first byte is the encoding.  v2.4 separates multiple values with a terminator, which
+    the conversions stop at, so only the first is kept. */
+    char text[TAG_FIELD_SIZE];
+    size_t text_length = decodeText(data[0], data + 1, length - 1, text, sizeof(text));
+
+    /* Genres may be an ID3v1 genre number, on its own or as "(17)", optionally followed by a refinement */
+    if (field == tags->genre) {
+        const char* name = nullptr;
+        char* end = text;
+        if (text[0] == '(' && text[1] != '(') {
+            if (!strncmp(text, "(RX)", 4)) {
+                name = "Remix";
+            } else if (!strncmp(text, "(CR)", 4)) {
+                name = "Cover";
+            } else {
+                uint32_t genre = strtoul(text + 1, nullptr, 10);
+                name = genreName(genre < 256 ? genre : 255);
+            }
+            end = strchr(text, ')');
+            if (end && end[1] != '\0') {
+                name = end + 1;
+            }
+        } else if (text[0] >= '0' && text[0] <= '9') {
+            uint32_t genre = strtoul(text, &end, 10);
+            if (*end == '\0') {
+                name = genreName(genre < 256 ? genre : 255);
+            }
+        }
+        if (name) {
+            setField(field, name, strlen(name));
+            return;
+        }
+    }
+
+    /* A v2.4 recording time is a timestamp, the year is the first four digits */
+    if (field == tags->year && text_length > 4) {
+        text_length = 4;
+    }
+    setField(field, text, text_length);
+}
+
+void
+Audio::TagReader::parseUserText(uint8_t* data, size_t length)
+{
+    if (length < 2) {
+        return;
+    }
+
+    /* The description ends at a terminator as wide as the encoding's characters */
+    bool wide = data[0] == 1 || data[0] == 2;
+    size_t end = 1;
+    while (end + (wide ? 1 : 0) < length && (data[end] != 0 || (wide && data[end + 1] != 0))) {
+        end += wide ? 2 : 1;
+    }
+    size_t start = end + (wide ? 2 : 1);
+    if (start >= length) {
+        return;
+    }
+
+    char key[32];
+    char value[32];
+    size_t key_length = decodeText(data[0], data + 1, end - 1, key, sizeof(key));
+    size_t value_length = decodeText(data[0], data + start, length - start, value, sizeof(value));
+    parseGain(key, key_length, value, value_length);
+}
+
+void
+Audio::TagReader::parseID3v1()
+{
+    if (size < 128 || !readAt(size - 128, buffer, 128) || memcmp(buffer, "TAG", 3) != 0) {
+        return;
+    }
+    char text[TAG_FIELD_SIZE];
+    setField(tags->title, text, latin1ToUTF8(buffer + 3, 30, text, sizeof(text)));
+    setField(tags->artist, text, latin1ToUTF8(buffer + 33, 30, text, sizeof(text)));
+    setField(tags->album, text, latin1ToUTF8(buffer + 63, 30, text, sizeof(text)));
+    setField(tags->year, text, latin1ToUTF8(buffer + 93, 4, text, sizeof(text)));
+    const char* genre = genreName(buffer[127]);
+    if (genre) {
+        setField(tags->genre, genre, strlen(genre));
+    }
+}
+
+/* The ID3v1 genres, with the Winamp additions that every tagger since has understood */
+const char*
+Audio::TagReader::genreName(uint8_t genre)
+{
+    static const char* const genres[] = {
+        "Blues", "Classic Rock", "Country", "Dance", "Disco", "Funk", "Grunge", "Hip-Hop", "Jazz", "Metal",
+        "New Age", "Oldies", "Other", "Pop", "R&B", "Rap", "Reggae", "Rock", "Techno", "Industrial",
+        "Alternative", "Ska", "Death Metal", "Pranks", "Soundtrack", "Euro-Techno", "Ambient", "Trip-Hop", "Vocal", "Jazz+Funk",
+        "Fusion", "Trance", "Classical", "Instrumental", "Acid", "House", "Game", "Sound Clip", "Gospel", "Noise",
+        "Alternative Rock", "Bass", "Soul", "Punk", "Space", "Meditative", "Instrumental Pop", "Instrumental Rock", "Ethnic", "Gothic",
+        "Darkwave", "Techno-Industrial", "Electronic", "Pop-Folk", "Eurodance", "Dream", "Southern Rock", "Comedy", "Cult", "Gangsta",
+        "Top 40", "Christian Rap", "Pop/Funk", "Jungle", "Native American", "Cabaret", "New Wave", "Psychedelic", "Rave", "Showtunes",
+        "Trailer", "Lo-Fi", "Tribal", "Acid Punk", "Acid Jazz", "Polka", "Retro", "Musical", "Rock & Roll", "Hard Rock",
+        "Folk", "Folk-Rock", "National Folk", "Swing", "Fast Fusion", "Bebop", "Latin", "Revival", "Celtic", "Bluegrass",
+        "Avantgarde", "Gothic Rock", "Progressive Rock", "Psychedelic Rock", "Symphonic Rock", "Slow Rock", "Big Band", "Chorus", "Easy Listening", "Acoustic",
+        "Humour", "Speech", "Chanson", "Opera", "Chamber Music", "Sonata", "Symphony", "Booty Bass", "Primus", "Porn Groove",
+        "Satire", "Slow Jam", "Club", "Tango", "Samba", "Folklore", "Ballad", "Power Ballad", "Rhythmic Soul", "Freestyle",
+        "Duet", "Punk Rock", "Drum Solo", "A Cappella", "Euro-House", "Dance Hall", "Goa", "Drum & Bass", "Club-House", "Hardcore",
+        "Terror", "Indie", "BritPop", "Afro-Punk", "Polsk Punk", "Beat", "Christian Gangsta Rap", "Heavy Metal", "Black Metal", "Crossover",
+        "Contemporary Christian", "Christian Rock", "Merengue", "Salsa", "Thrash Metal", "Anime", "JPop", "Synthpop",
+    };
+    if (genre >= sizeof(genres) / sizeof(genres[0])) {
+        return nullptr;
+    }
+    return genres[genre];
+}
+
+/****************************************************
+ *
+ * Vorbis comments
+ *
+ ****************************************************/
+
+bool
+Audio::TagReader::parseFLAC(uint32_t offset)
+{
+    uint8_t block[4];
+    if (!readAt(offset, block, sizeof(block)) || memcmp(block, "fLaC", 4) != 0) {
+        return false;
+    }
+    uint32_t position = offset + 4;
+    bool last = false;
+    while (!last && readAt(position, block, sizeof(block))) {
+        last = block[0] & 0x80;
+        uint8_t type = block[0] & 0x7F;
+        uint32_t length = read_be(block + 1, 3);
+        if (type == 4) {
+            ogg = false;
+            span_offset = position + 4;
+            span_left = length;
+            last_span = true;
+            parseComments();
+            return true;
+        }
+        if (type == 127) {
+            break; /* Invalid */
+        }
+        position += 4 + length;
+    }
+    return false;
+}
+
+bool
+Audio::TagReader::parseOgg()
+{
+    /* The identification header is alone on the first page and the comment header starts the second */
+    uint8_t header[27];
+    if (!readAt(0, header, sizeof(header)) || memcmp(header, "OggS", 4) != 0 || !readAt(27, buffer, header[26])) {
+        return false;
+    }
+    uint32_t body = 27 + header[26];
+    for (uint8_t i = 0; i < header[26]; i++) {
+        body += buffer[i];
+    }
+    ogg = true;
+    page_offset = body;
+    span_left = 0;
+    last_span = false;
+
+    uint8_t magic[8];
+    if (readComments(magic, 7) != 7) {
+        return false;
+    }
+    if (memcmp(magic, "\x03vorbis", 7) == 0 || (memcmp(magic, "OpusTag", 7) == 0 && readComments(magic + 7, 1) == 1 && magic[7] == 's')) {
+        parseComments();
+        return true;
+    }
+    return false;
+}
+
+void
+Audio::TagReader::parseComments()
+{
+    /* Vendor string, then the number of comments, each a length and a KEY=value string */
+    uint8_t value[4];
+    if (readComments(value, 4) != 4 || !skipComments(read_le32(value)) || readComments(value, 4) != 4) {
+        return;
+    }
+    uint32_t count = read_le32(value);
+    for (uint32_t i = 0; i < count; i++) {
+        if (tags->title[0] && tags->artist[0] && tags->album[0] && tags->genre[0] && tags->year[0] && !isnan(tags->gain_db) && tags->peak > 0) {
+            return;
+        }
+        if (readComments(value, 4) != 4) {
+            return;
+        }
+        uint32_t length = read_le32(value);
+        uint32_t head = length > TAG_FRAME_MAX ? TAG_FRAME_MAX : length;
+        if (readComments(buffer, head) != head || !skipComments(length - head)) {
+            return;
+        }
+        parseComment((char*) buffer, head);
+    }
+}
+
+void
+Audio::TagReader::parseComment(char* comment, size_t length)
+{
+    char* equals = (char*) memchr(comment, '=', length);
+    if (!equals) {
+        return;
+    }
+    size_t key_length = equals - comment;
+    const char* value = equals + 1;
+    size_t value_length = length - key_length - 1;
+
+    if (key_is(comment, key_length, "TITLE")) {
+        setField(tags->title, value, value_length);
+    } else if (key_is(comment, key_length, "ARTIST")) {
+        setField(tags->artist, value, value_length);
+    } else if (key_is(comment, key_length, "ALBUM")) {
+        setField(tags->album, value, value_length);
+    } else if (key_is(comment, key_length, "GENRE")) {
+        setField(tags->genre, value, value_length);
+    } else if (key_is(comment, key_length, "DATE")) {
+        setField(tags->year, value, value_length > 4 ? 4 : value_length);
+    } else {
+        parseGain(comment, key_length, value, value_length);
+    }
+}
+
+/* ReplayGain values are text, "-6.20 dB" for a gain and "0.988" for a peak.  Opus keeps its own
+R128_TRACK_GAIN, a whole number of 1/256 dB against -23 LUFS, so it's moved up by the 5 dB between
+that and the ReplayGain reference. */
+void
+Audio::TagReader::parseGain(const char* key, size_t key_length, const char* value, size_t value_length)
+{
+    char text[16];
+    if (value_length > sizeof(text) - 1) {
+        value_length = sizeof(text) - 1;
+    }
+    memcpy(text, value, value_length);
+    text[value_length] = '\0';
+
+    char* end;
+    if (key_is(key, key_length, "REPLAYGAIN_TRACK_GAIN") && isnan(tags->gain_db)) {
+        float gain = strtof(text, &end);
+        if (end != text) {
+            tags->gain_db = gain;
+        }
+    } else if (key_is(key, key_length, "REPLAYGAIN_TRACK_PEAK") && tags->peak == 0) {
+        float peak = strtof(text, &end);
+        if (end != text && peak > 0) {
+            tags->peak = peak;
+        }
+    } else if (key_is(key, key_length, "R128_TRACK_GAIN") && isnan(tags->gain_db)) {
+        long gain = strtol(text, &end, 10);
+        if (end != text) {
+            tags->gain_db = gain / 256.0f + 5;
+        }
+    }
+}
+
+/* Moves on to the next run of the comment packet.  An Ogg packet is split into segments of up to 255
+bytes, and a segment shorter than that ends the packet.  Otherwise it carries on into the next page. */
+bool
+Audio::TagReader::nextSpan()
+{
+    if (!ogg || last_span) {
+        return false;
+    }
+    uint8_t header[27];
+    uint8_t table[255];
+    if (!readAt(page_offset, header, sizeof(header)) || memcmp(header, "OggS", 4) != 0 || !readAt(page_offset + 27, table, header[26])) {
+        return false;
+    }
+    uint32_t body = page_offset + 27 + header[26];
+    uint32_t length = 0;
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < header[26]; i++) {
+        total += table[i];
+        if (!last_span) {
+            length += table[i];
+            last_span = table[i] < 255;
+        }
+    }
+    span_offset = body;
+    span_left = length;
+    page_offset = body + total;
+    return true;
+}
+
+size_t
+Audio::TagReader::readComments(uint8_t* data, size_t length)
+{
+    size_t done = 0;
+    while (done < length) {
+        if (span_left == 0 && !nextSpan()) {
+            break;
+        }
+        uint32_t chunk = length - done < span_left ? length - done : span_left;
+        if (chunk && !readAt(span_offset, data + done, chunk)) {
+            break;
+        }
+        span_offset += chunk;
+        span_left -= chunk;
+        done += chunk;
+    }
+    return done;
+}
+
+bool
+Audio::TagReader::skipComments(uint32_t length)
+{
+    while (length > 0) {
+        if (span_left == 0 && !nextSpan()) {
+            return false;
+        }
+        uint32_t chunk = length < span_left ? length : span_left;
+        span_offset += chunk;
+        span_left -= chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+/****************************************************
+ *
+ * Text
+ *
+ ****************************************************/
+
+void
+Audio::TagReader::setField(char* field, const char* value, size_t length)
+{
+    if (field[0] != '\0') {
+        return;
+    }
+
+    /* Keep to whole characters, and drop the padding ID3v1 leaves at the end */
+    if (length > TAG_FIELD_SIZE - 1) {
+        length = TAG_FIELD_SIZE - 1;
+        while (length > 0 && ((uint8_t) value[length] & 0xC0) == 0x80) {
+            length--;
+        }
+    }
+    while (length > 0 && (value[length - 1] == ' ' || value[length - 1] == '\0')) {
+        length--;
+    }
+    memcpy(field, value, length);
+    field[length] = '\0';
+}
+
+size_t
+Audio::TagReader::decodeText(uint8_t encoding, const uint8_t* text, size_t length, char* out, size_t size)
+{
+    switch (encoding) {
+        case 0: /* ISO-8859-1 */
+            return latin1ToUTF8(text, length, out, size);
+        case 1: /* UTF-16 with a byte order mark */
+            if (length >= 2 && text[0] == 0xFE && text[1] == 0xFF) {
+                return utf16ToUTF8(text + 2, length - 2, true, out, size);
+            } else if (length >= 2 && text[0] == 0xFF && text[1] == 0xFE) {
+                return utf16ToUTF8(text + 2, length - 2, false, out, size);
+            }
+            return utf16ToUTF8(text, length, false, out, size);
+        case 2: /* UTF-16BE */
+            return utf16ToUTF8(text, length, true, out, size);
+        case 3: /* UTF-8 */
+        {
+            size_t out_length = strnlen((const char*) text, length);
+            if (out_length > size - 1) {
+                out_length = size - 1;
+            }
+            memcpy(out, text, out_length);
+            out[out_length] = '\0';
+            return out_length;
+        }
+        default:
+            out[0] = '\0';
+            return 0;
+    }
+}
+
+size_t
+Audio::TagReader::latin1ToUTF8(const uint8_t* text, size_t length, char* out, size_t size)
+{
+    size_t written = 0;
+    for (size_t i = 0; i < length && text[i] != 0; i++) {
+        if (text[i] < 0x80) {
+            if (written + 1 >= size) {
+                break;
+            }
+            out[written++] = text[i];
+        } else {
+            if (written + 2 >= size) {
+                break;
+            }
+            out[written++] = 0xC0 | (text[i] >> 6);
+            out[written++] = 0x80 | (text[i] & 0x3F);
+        }
+    }
+    out[written] = '\0';
+    return written;
+}
+
+size_t
+Audio::TagReader::utf16ToUTF8(const uint8_t* text, size_t length, bool big_endian, char* out, size_t size)
+{
+    size_t written = 0;
+    for (size_t i = 0; i + 1 < length; i += 2) {
+        uint32_t code = big_endian ? (text[i] << 8) | text[i + 1] : (text[i + 1] << 8) | text[i];
+        if (code == 0) {
+            break;
+        }
+
+        /* Characters outside the basic plane come as a pair of surrogates */
+        if (code >= 0xD800 && code < 0xDC00 && i + 3 < length) {
+            uint32_t low = big_endian ? (text[i + 2] << 8) | text[i + 3] : (text[i + 3] << 8) | text[i + 2];
+            if (low >= 0xDC00 && low < 0xE000) {
+                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                i += 2;
+            }
+        }
+
+        uint8_t bytes = code < 0x80 ? 1 : code < 0x800 ? 2 : code < 0x10000 ? 3 : 4;
+        if (written + bytes >= size) {
+            break;
+        }
+        switch (bytes) {
+            case 1:
+                out[written++] = code;
+                break;
+            case 2:
+                out[written++] = 0xC0 | (code >> 6);
+                out[written++] = 0x80 | (code & 0x3F);
+                break;
+            case 3:
+                out[written++] = 0xE0 | (code >> 12);
+                out[written++] = 0x80 | ((code >> 6) & 0x3F);
+                out[written++] = 0x80 | (code & 0x3F);
+                break;
+            case 4:
+                out[written++] = 0xF0 | (code >> 18);
+                out[written++] = 0x80 | ((code >> 12) & 0x3F);
+                out[written++] = 0x80 | ((code >> 6) & 0x3F);
+                out[written++] = 0x80 | (code & 0x3F);
+                break;
+        }
+    }
+    out[written] = '\0';
+    return written;
+}
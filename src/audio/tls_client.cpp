@@ -0,0 +1,329 @@
+/**
+ * @file tls_client.cpp
+ *
+ * @brief TLS client that keeps sessions to resume, so reconnecting to a
+ * host skips the full handshake.  Part of the audio library.
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <audio/tls_client.h>
+#include <mbedtls/net_sockets.h>
+
+Audio::TlsClient::TlsClient(Client& transport)
+  : transport(transport)
+{
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&drbg);
+    mbedtls_ssl_config_init(&config);
+    mbedtls_x509_crt_init(&ca_chain);
+    mbedtls_ssl_init(&ssl);
+    for (uint8_t i = 0; i < TLS_SESSION_CACHE_SIZE; i++) {
+        sessions[i].host[0] = '\0';
+        mbedtls_ssl_session_init(&sessions[i].session);
+    }
+}
+
+Audio::TlsClient::~TlsClient()
+{
+    stop();
+    for (uint8_t i = 0; i < TLS_SESSION_CACHE_SIZE; i++) {
+        mbedtls_ssl_session_free(&sessions[i].session);
+    }
+    mbedtls_ssl_free(&ssl);
+    mbedtls_x509_crt_free(&ca_chain);
+    mbedtls_ssl_config_free(&config);
+    mbedtls_ctr_drbg_free(&drbg);
+    mbedtls_entropy_free(&entropy);
+}
+
+bool
+Audio::TlsClient::setCACert(const char* pem)
+{
+    /* A bundle can hold a certificate or two mbedtls doesn't understand.  A positive result counts those, and
+    means the rest parsed. */
+    int result = mbedtls_x509_crt_parse(&ca_chain, (const unsigned char*) pem, strlen(pem) + 1);
+    if (result < 0) {
+        log_e("Couldn't parse the root certificates: -0x%04x", -result);
+        return false;
+    }
+    if (result > 0) {
+        log_w("Skipped %d root certificates that couldn't be parsed", result);
+    }
+    ca_loaded = true;
+    return true;
+}
+
+bool
+Audio::TlsClient::setup()
+{
+    if (ready) {
+        return true;
+    }
+    const char* personalisation = "media-player";
+    int result = mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy, (const unsigned char*) personalisation, strlen(personalisation));
+    if (result == 0) {
+        result = mbedtls_ssl_config_defaults(&config, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+    }
+    if (result != 0) {
+        log_e("Couldn't set up TLS: -0x%04x", -result);
+        return false;
+    }
+
+    /* Without roots the chain is still checked, so we can tell a full handshake from a resumed one, but it
+    doesn't have to pass */
+    mbedtls_ssl_conf_rng(&config, mbedtls_ctr_drbg_random, &drbg);
+    mbedtls_ssl_conf_verify(&config, verify, this);
+    if (ca_loaded) {
+        mbedtls_ssl_conf_ca_chain(&config, &ca_chain, nullptr);
+        mbedtls_ssl_conf_authmode(&config, MBEDTLS_SSL_VERIFY_REQUIRED);
+    } else {
+        mbedtls_ssl_conf_authmode(&config, MBEDTLS_SSL_VERIFY_OPTIONAL);
+    }
+
+    /* The context, and its record buffers, are kept and reset for each connection */
+    result = mbedtls_ssl_setup(&ssl, &config);
+    if (result != 0) {
+        log_e("Couldn't set up TLS: -0x%04x", -result);
+        return false;
+    }
+    mbedtls_ssl_set_bio(&ssl, &transport, send, receive, nullptr);
+    ready = true;
+    return true;
+}
+
+int
+Audio::TlsClient::connect(IPAddress ip, uint16_t port)
+{
+    /* An address will do for the session key, though the server can't be checked against it */
+    return connect(ip.toString().c_str(), port);
+}
+
+int
+Audio::TlsClient::connect(const char* host, uint16_t port)
+{
+    stop();
+    if (!setup() || !transport.connect(host, port)) {
+        return 0;
+    }
+    mbedtls_ssl_session_reset(&ssl);
+    mbedtls_ssl_set_hostname(&ssl, host);
+
+    /* A session that can't be set is left out, and we do the full handshake */
+    session_entry_t* entry = find(host, port);
+    if (entry && mbedtls_ssl_set_session(&ssl, &entry->session) != 0) {
+        entry = nullptr;
+    }
+
+    verified = false;
+    uint32_t started = millis();
+    int result;
+    while ((result = mbedtls_ssl_handshake(&ssl)) != 0) {
+        if ((result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE) || millis() - started > TLS_HANDSHAKE_TIMEOUT_MS) {
+            log_e("TLS handshake with %s failed: -0x%04x", host, -result);
+            if (entry) {
+                entry->host[0] = '\0';
+            }
+            transport.stop();
+            return 0;
+        }
+        delay(1);
+    }
+
+    stats.handshakes++;
+    stats.handshake_ms = millis() - started;
+    bool resumed = entry && !verified;
+    if (resumed) {
+        stats.resumed++;
+    }
+    log_i("TLS %s with %s in %lu ms", resumed ? "session resumed" : "handshake", host, (unsigned long) stats.handshake_ms);
+    keep(host, port);
+    open = true;
+    return 1;
+}
+
+Audio::TlsClient::session_entry_t*
+Audio::TlsClient::find(const char* host, uint16_t port)
+{
+    for (uint8_t i = 0; i < TLS_SESSION_CACHE_SIZE; i++) {
+        if (sessions[i].host[0] && sessions[i].port == port && strcmp(sessions[i].host, host) == 0) {
+            return &sessions[i];
+        }
+    }
+    return nullptr;
+}
+
+void
+Audio::TlsClient::keep(const char* host, uint16_t port)
+{
+    if (strlen(host) >= TLS_HOST_MAX) {
+        return;
+    }
+
+    /* The host's own entry is updated, otherwise an empty one or the one used longest ago is taken */
+    session_entry_t* entry = find(host, port);
+    for (uint8_t i = 0; !entry && i < TLS_SESSION_CACHE_SIZE; i++) {
+        if (!sessions[i].host[0]) {
+            entry = &sessions[i];
+        }
+    }
+    for (uint8_t i = 0; !entry && i < TLS_SESSION_CACHE_SIZE; i++) {
+        if (i == 0 || sessions[i].used_at < entry->used_at) {
+            entry = &sessions[i];
+        }
+    }
+
+    mbedtls_ssl_session_free(&entry->session);
+    mbedtls_ssl_session_init(&entry->session);
+    if (mbedtls_ssl_get_session(&ssl, &entry->session) != 0) {
+        entry->host[0] = '\0';
+        return;
+    }
+    strlcpy(entry->host, host, sizeof(entry->host));
+    entry->port = port;
+    entry->used_at = millis();
+}
+
+int
+Audio::TlsClient::send(void* client, const unsigned char* data, size_t length)
+{
+    Client* transport = (Client*) client;
+    if (!transport->connected()) {
+        return MBEDTLS_ERR_NET_CONN_RESET;
+    }
+    size_t written = transport->write(data, length);
+    return written > 0 ? (int) written : MBEDTLS_ERR_SSL_WANT_WRITE;
+}
+
+int
+Audio::TlsClient::receive(void* client, unsigned char* data, size_t length)
+{
+    Client* transport = (Client*) client;
+    int available = transport->available();
+    if (available <= 0) {
+        return transport->connected() ? MBEDTLS_ERR_SSL_WANT_READ : 0;
+    }
+    int read_bytes = transport->read(data, length < (size_t) available ? length : available);
+    return read_bytes > 0 ? read_bytes : MBEDTLS_ERR_SSL_WANT_READ;
+}
+
+int
+Audio::TlsClient::verify(void* client, mbedtls_x509_crt*, int, uint32_t*)
+{
+    ((TlsClient*) client)->verified = true;
+    return 0;
+}
+
+int
+Audio::TlsClient::fill()
+{
+    if (!open) {
+        return 0;
+    }
+    if (mbedtls_ssl_get_bytes_avail(&ssl) == 0 && transport.available() > 0) {
+        int result = mbedtls_ssl_read(&ssl, nullptr, 0);
+        if (result < 0 && result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            /* The server closed the connection, whatever was decrypted before that can still be read */
+            open = mbedtls_ssl_get_bytes_avail(&ssl) > 0;
+            if (!open) {
+                transport.stop();
+            }
+        }
+    }
+    return mbedtls_ssl_get_bytes_avail(&ssl);
+}
+
+size_t
+Audio::TlsClient::write(const uint8_t* data, size_t length)
+{
+    size_t written = 0;
+    while (open && written < length) {
+        int result = mbedtls_ssl_write(&ssl, data + written, length - written);
+        if (result > 0) {
+            written += result;
+        } else if (result == MBEDTLS_ERR_SSL_WANT_READ || result == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            delay(1);
+        } else {
+            log_e("TLS write failed: -0x%04x", -result);
+            stop();
+        }
+    }
+    return written;
+}
+
+int
+Audio::TlsClient::available()
+{
+    return fill() + (peeked >= 0 ? 1 : 0);
+}
+
+int
+Audio::TlsClient::read()
+{
+    uint8_t data;
+    return read(&data, 1) == 1 ? data : -1;
+}
+
+int
+Audio::TlsClient::read(uint8_t* data, size_t length)
+{
+    if (length == 0) {
+        return 0;
+    }
+    size_t read_bytes = 0;
+    if (peeked >= 0) {
+        data[read_bytes++] = (uint8_t) peeked;
+        peeked = -1;
+    }
+    if (read_bytes < length && fill() > 0) {
+        int result = mbedtls_ssl_read(&ssl, data + read_bytes, length - read_bytes);
+        if (result > 0) {
+            read_bytes += result;
+        }
+    }
+    return read_bytes > 0 ? (int) read_bytes : -1;
+}
+
+int
+Audio::TlsClient::peek()
+{
+    if (peeked < 0) {
+        uint8_t data;
+        if (fill() > 0 && mbedtls_ssl_read(&ssl, &data, 1) == 1) {
+            peeked = data;
+        }
+    }
+    return peeked;
+}
+
+void
+Audio::TlsClient::stop()
+{
+    if (open) {
+        mbedtls_ssl_close_notify(&ssl);
+    }
+    open = false;
+    peeked = -1;
+    transport.stop();
+}
+
+uint8_t
+Audio::TlsClient::connected()
+{
+    return open && (transport.connected() || available() > 0);
+}
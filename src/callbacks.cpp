@@ -32,13 +32,9 @@
 void
 onWifiDisconnected(WiFiEvent_t event, WiFiEventInfo_t info)
 {
-    if (Transport::get_handle()->getStatus() == TRANSPORT_PLAYING && Transport::get_handle()->getLoadedMedia().source == REMOTE_FILE) {
-        Transport::get_handle()->stop();
-    }
-    if (playlistEngine->isEnabled() && playlistEngine->isPlaying()) {
-        playlistEngine->stop();
-    }
-    log_e("WiFi disconnected! Stopping network streams!");
+    /* A stream plays on from its buffer while the transport reconnects, and stops by itself if it can't */
+    Transport::get_handle()->networkLost();
+    log_e("WiFi disconnected!");
 }
 
 void
@@ -59,9 +55,8 @@ onWifiGotIP(WiFiEvent_t event, WiFiEventInfo_t info)
 void
 onWifiLostIP(WiFiEvent_t event, WiFiEventInfo_t info)
 {
-    if (Transport::get_handle()->getStatus() == TRANSPORT_PLAYING && Transport::get_handle()->getLoadedMedia().source == REMOTE_FILE)
-        Transport::get_handle()->stop();
-    log_e("WiFi disconnected! Stopping network streams!");
+    Transport::get_handle()->networkLost();
+    log_e("WiFi lost its IP address!");
 }
 
 void
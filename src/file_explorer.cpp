@@ -135,8 +135,20 @@ File_Explorer::fill_dir_stack(MediaData& mediadata)
     }
 }
 
+/* The gain scan and the seek point cache write to the index as well.  The scan is stopped, since the rows it's
+working through may be about to go, and both are kept out until the index has been checked or rebuilt. */
 File_Explorer::error_t
 File_Explorer::generate_index(MediaData& mediadata, std::function<void(uint32_t, uint32_t)> status_callback)
+{
+    Transport::get_handle()->getLoudnessScanner()->cancel();
+    Card_Manager::get_handle()->index_mutex().lock();
+    error_t error = write_index(mediadata, status_callback);
+    Card_Manager::get_handle()->index_mutex().unlock();
+    return error;
+}
+
+File_Explorer::error_t
+File_Explorer::write_index(MediaData& mediadata, std::function<void(uint32_t, uint32_t)> status_callback)
 {
     DIR* _dir_handle = opendir(mediadata.getPath());
     if (!_dir_handle || mediadata.type != FILETYPE_DIR || mediadata.loaded == false) {
@@ -206,7 +218,9 @@ File_Explorer::generate_index(MediaData& mediadata, std::function<void(uint32_t,
         log_i("Checksums match, no need to regenerate database");
         log_i("Checksum: %s", checksum_str);
         log_i("DB Checksum: %s", db_checksum);
+        upgrade_db(sqlite_db);
         sqlite3_close(sqlite_db);
+        Transport::get_handle()->getLoudnessScanner()->scan(path.c_str());
         return ERROR_NONE;
     } else {
         log_i("Checksums do not match, regenerating database");
@@ -317,6 +331,7 @@ File_Explorer::generate_index(MediaData& mediadata, std::function<void(uint32_t,
     sqlite3_close(sqlite_db);
     log_i("Computed checksum: %s", checksum_str);
     log_i("Wrote %d files to database", id);
+    Transport::get_handle()->getLoudnessScanner()->scan(path.c_str());
     return ERROR_NONE;
 }
 
@@ -336,7 +351,7 @@ File_Explorer::create_db(sqlite3* db)
     }
 
     sql[0] = '\0';
-    strcpy(sql, "CREATE TABLE IF NOT EXISTS files (id INTEGER PRIMARY KEY, filename TEXT, path TEXT, type INTEGER)");
+    strcpy(sql, "CREATE TABLE IF NOT EXISTS files (id INTEGER PRIMARY KEY, filename TEXT, path TEXT, type INTEGER, gain REAL)");
     if (sqlite3_exec(db, sql, NULL, NULL, &error_message) != SQLITE_OK) {
         log_e("Failed to create table 'files'");
         log_e("SQL: %s", sql);
@@ -369,6 +384,28 @@ File_Explorer::create_db(sqlite3* db)
     return ERROR_NONE;
 }
 
+/* Indexes made before the gain column was added get it, empty, so the loudness scanner can fill it in */
+File_Explorer::error_t
+File_Explorer::upgrade_db(sqlite3* db)
+{
+    sqlite3_stmt* statement;
+    if (sqlite3_prepare_v2(db, "SELECT gain FROM files LIMIT 0", -1, &statement, NULL) == SQLITE_OK) {
+        sqlite3_finalize(statement);
+        return ERROR_NONE;
+    }
+
+    char* error_message = NULL;
+    const char* sql = "ALTER TABLE files ADD COLUMN gain REAL";
+    if (sqlite3_exec(db, sql, NULL, NULL, &error_message) != SQLITE_OK) {
+        log_e("Failed to execute SQL statement");
+        log_e("SQL: %s", sql);
+        log_e("Error: %s", error_message);
+        sqlite3_free(error_message);
+        return ERROR_FAILURE;
+    }
+    return ERROR_NONE;
+}
+
 File_Explorer::error_t
 File_Explorer::get_list(std::vector<MediaData>* data, uint32_t index, uint32_t count)
 {
@@ -44,7 +44,6 @@
 #include <system.h>
 #include <transport.h>
 #include <ui/common.h>
-#include <ui_sounds.h>
 #include <vfs.h>
 #include <callbacks.h>
 
@@ -79,7 +78,7 @@ checkButtons()
             if (selection != UI::UI_EXIT) {
                 playlistEngine->setCurrentTrack(selection);
                 bool wasPlaying = false;
-                if (Transport::get_handle()->getStatus() == TRANSPORT_PLAYING) {
+                if (Transport::get_handle()->getStatus() == TRANSPORT_PLAYING || Transport::get_handle()->getStatus() == TRANSPORT_BUFFERING) {
                     Transport::get_handle()->stop();
                     wasPlaying = true;
                 }
@@ -110,7 +109,7 @@ checkButtons()
     }
 
     if (Buttons::get_handle()->getButtonEvent(BUTTON_PLAY, SHORTPRESS)) {
-        if (Transport::get_handle()->getStatus() == TRANSPORT_PLAYING) {
+        if (Transport::get_handle()->getStatus() == TRANSPORT_PLAYING || Transport::get_handle()->getStatus() == TRANSPORT_BUFFERING) {
             Transport::get_handle()->pause();
             if (playlistEngine->isEnabled()) {
                 playlistEngine->stop();
@@ -131,7 +130,7 @@ checkButtons()
         }
     }
     if (Buttons::get_handle()->getButtonEvent(BUTTON_STOP, SHORTPRESS)) {
-        if (Transport::get_handle()->getStatus() == TRANSPORT_PLAYING || Transport::get_handle()->getStatus() == TRANSPORT_PAUSED) {
+        if (Transport::get_handle()->getStatus() == TRANSPORT_PLAYING || Transport::get_handle()->getStatus() == TRANSPORT_BUFFERING || Transport::get_handle()->getStatus() == TRANSPORT_PAUSED) {
             Transport::get_handle()->stop();
             if (playlistEngine->isEnabled()) {
                 playlistEngine->stop();
@@ -149,7 +148,7 @@ checkButtons()
             if (playlistEngine->available()) {
                 notify->show("Loading next...", 200, false);
                 playlistEngine->next();
-                if (Transport::get_handle()->getStatus() == TRANSPORT_PLAYING) {
+                if (Transport::get_handle()->getStatus() == TRANSPORT_PLAYING || Transport::get_handle()->getStatus() == TRANSPORT_BUFFERING) {
                     Transport::get_handle()->stop();
                     Transport::get_handle()->load(playlistEngine->getCurrentTrack());
                     Transport::get_handle()->play();
@@ -177,7 +176,7 @@ checkButtons()
             if (playlistEngine->getCurrentTrackIndex() > 0) {
                 notify->show("Loading previous...", 200, false);
                 playlistEngine->previous();
-                if (Transport::get_handle()->getStatus() == TRANSPORT_PLAYING) {
+                if (Transport::get_handle()->getStatus() == TRANSPORT_PLAYING || Transport::get_handle()->getStatus() == TRANSPORT_BUFFERING) {
                     Transport::get_handle()->stop();
                     Transport::get_handle()->load(playlistEngine->getCurrentTrack());
                     Transport::get_handle()->play();
@@ -211,7 +210,7 @@ checkButtons()
     }
 
     if (Buttons::get_handle()->getButtonEvent(BUTTON_MENU, LONGPRESS)) {
-        Transport::get_handle()->playUIsound(folder_open, folder_open_len);
+        Transport::get_handle()->playUIsound(UI_SOUND_FOLDER_OPEN);
         mainMenu();
     }
 
@@ -273,6 +272,8 @@ setup()
                                         std::function<bool()>(std::bind(&Transport::play, Transport::get_handle())),
                                         std::function<void()>(std::bind(&Transport::stop, Transport::get_handle())),
                                         std::function<uint8_t()>(std::bind(&Transport::getStatus, Transport::get_handle())));
+    Transport::get_handle()->setPlaylistCallbacks(std::function<MediaData()>(std::bind(&PlaylistEngine::peekNext, playlistEngine)),
+                                                   std::function<void()>(std::bind(&PlaylistEngine::advance, playlistEngine)));
     notify = new UI::SystemMessage();
     Transport::get_handle()->begin();
     Config_Manager::get_handle()->begin();
@@ -298,7 +299,7 @@ setup()
         }
     },
                             "TaskLoop",
-                            8192,
+                            12288, /* SQLite needs the headroom when the transport caches a seek index */
                             NULL,
                             1,
                             NULL,
@@ -328,7 +328,7 @@ dhcpToggleMenu()
     selection = (items) dhcpToggleMenu.get(menu, SIZE);
 
     if (selection == ENABLE) {
-        Transport::get_handle()->playUIsound(load_item, load_item_len);
+        Transport::get_handle()->playUIsound(UI_SOUND_LOAD_ITEM);
         Config_Manager::get_handle()->enableDHCP();
         notify.show("DHCP enabled!", 2000, false);
         log_i("DHCP enabled!");
@@ -372,27 +372,27 @@ networkMenu()
 
             case SEARCH:
 
-                Transport::get_handle()->playUIsound(folder_open, folder_open_len);
+                Transport::get_handle()->playUIsound(UI_SOUND_FOLDER_OPEN);
                 log_i("Starting SSID scanner");
                 ssidScanner();
                 break;
 
             case SSID:
 
-                Transport::get_handle()->playUIsound(folder_open, folder_open_len);
+                Transport::get_handle()->playUIsound(UI_SOUND_FOLDER_OPEN);
                 log_i("Current SSID: %s", Config_Manager::get_handle()->getWifiSSID().c_str());
                 Config_Manager::get_handle()->setWifiSSID(textInput.get("SSID:", Config_Manager::get_handle()->getWifiSSID(), 255, UI::INPUT_FORMAT_TEXT));
                 break;
 
             case PASSWORD:
 
-                Transport::get_handle()->playUIsound(folder_open, folder_open_len);
+                Transport::get_handle()->playUIsound(UI_SOUND_FOLDER_OPEN);
                 Config_Manager::get_handle()->setWifiPassword(textInput.get("Password:", Config_Manager::get_handle()->getWifiPassword(), 255, UI::INPUT_FORMAT_PASSWORD));
                 break;
 
             case IP_ADDRESS:
 
-                Transport::get_handle()->playUIsound(folder_open, folder_open_len);
+                Transport::get_handle()->playUIsound(UI_SOUND_FOLDER_OPEN);
                 log_i("Current IP: %s", WiFi.localIP().toString().c_str());
 
                 if (Config_Manager::get_handle()->isDHCPEnabled()) {
@@ -407,7 +407,7 @@ networkMenu()
 
             case NETMASK:
 
-                Transport::get_handle()->playUIsound(folder_open, folder_open_len);
+                Transport::get_handle()->playUIsound(UI_SOUND_FOLDER_OPEN);
                 log_i("Current netmask: %s", WiFi.subnetMask().toString().c_str());
 
                 if (Config_Manager::get_handle()->isDHCPEnabled()) {
@@ -423,7 +423,7 @@ networkMenu()
 
             case GATEWAY:
 
-                Transport::get_handle()->playUIsound(folder_open, folder_open_len);
+                Transport::get_handle()->playUIsound(UI_SOUND_FOLDER_OPEN);
                 log_i("Current gateway: %s", WiFi.gatewayIP().toString().c_str());
 
                 if (Config_Manager::get_handle()->isDHCPEnabled()) {
@@ -439,7 +439,7 @@ networkMenu()
 
             case DNS:
 
-                Transport::get_handle()->playUIsound(folder_open, folder_open_len);
+                Transport::get_handle()->playUIsound(UI_SOUND_FOLDER_OPEN);
                 log_i("Current DNS: %s", WiFi.dnsIP().toString().c_str());
 
                 if (Config_Manager::get_handle()->isDHCPEnabled()) {
@@ -454,7 +454,7 @@ networkMenu()
                 break;
 
             case NTP_CONFIG:
-                Transport::get_handle()->playUIsound(folder_open, folder_open_len);
+                Transport::get_handle()->playUIsound(UI_SOUND_FOLDER_OPEN);
                 ntpConfigMenu();
                 break;
 
@@ -784,6 +784,12 @@ audioMenu()
                                                   std::bind(&Transport::systemVolumeDown, Transport::get_handle()),
                                                   Transport::get_handle()->getMinSystemVolume(),
                                                   Transport::get_handle()->getMaxSystemVolume());
+    UI::ValueSelector selector_crossfade = UI::ValueSelector("Crossfade",
+                                                     std::bind(&Transport::getCrossfade, Transport::get_handle()),
+                                                     std::bind(&Transport::crossfadeUp, Transport::get_handle()),
+                                                     std::bind(&Transport::crossfadeDown, Transport::get_handle()),
+                                                     Transport::get_handle()->getMinCrossfade(),
+                                                     Transport::get_handle()->getMaxCrossfade());
 
     UI::SystemMessage notify;
     items selection;
@@ -808,6 +814,10 @@ audioMenu()
                 selector_sysvol.get();
                 break;
 
+            case CROSSFADE:
+                selector_crossfade.get();
+                break;
+
             default:
                 return;
                 break;
@@ -819,7 +829,7 @@ audioMenu()
 void
 ssidScanner()
 {
-    if (playlistEngine->isEnabled() && Transport::get_handle()->getStatus() == TRANSPORT_PLAYING && Transport::get_handle()->getLoadedMedia().source == REMOTE_FILE) {
+    if (playlistEngine->isEnabled() && (Transport::get_handle()->getStatus() == TRANSPORT_PLAYING || Transport::get_handle()->getStatus() == TRANSPORT_BUFFERING) && Transport::get_handle()->getLoadedMedia().source == REMOTE_FILE) {
         Transport::get_handle()->stop();
         playlistEngine->stop();
     }
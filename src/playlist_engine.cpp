@@ -246,6 +246,23 @@ PlaylistEngine::getCurrentTrack()
     return getTrack(currentTrack);
 }
 
+MediaData
+PlaylistEngine::peekNext()
+{
+    if (!enabled || !playing || trackList.size() == 0 || currentTrack >= trackList.size() - 1) {
+        return { "", "", "", FILETYPE_UNKNOWN, 0, NO_SOURCE_LOADED, false };
+    }
+    return getTrack(currentTrack + 1);
+}
+
+void
+PlaylistEngine::advance()
+{
+    if (trackList.size() > 0 && currentTrack < trackList.size() - 1) {
+        currentTrack++;
+    }
+}
+
 bool
 PlaylistEngine::next()
 {
@@ -66,6 +66,7 @@ Config_Manager::begin()
         preferences->putInt("eq_bass", 50);
         preferences->putInt("eq_mid", 50);
         preferences->putInt("eq_treble", 50);
+        preferences->putInt("crossfade", 0);
         preferences->putInt("zipcode", 0);
         preferences->putBool("scrnsvr_enabled", false);
         preferences->putInt("scrnsvr_timeout", 30);
@@ -106,6 +107,7 @@ Config_Manager::begin()
     this->eq_bass = preferences->getInt("eq_bass");
     this->eq_mid = preferences->getInt("eq_mid");
     this->eq_treble = preferences->getInt("eq_treble");
+    this->crossfade = preferences->getInt("crossfade", 0);
     this->system_volume = preferences->getInt("system_volume");
     this->zipcode = preferences->getInt("zipcode");
     this->screensaver_enabled = preferences->getBool("scrnsvr_enabled");
@@ -136,6 +138,7 @@ Config_Manager::begin()
     Transport::get_handle()->eq->setBass(this->eq_bass);
     Transport::get_handle()->eq->setMid(this->eq_mid);
     Transport::get_handle()->eq->setTreble(this->eq_treble);
+    Transport::get_handle()->setCrossfade(this->crossfade);
 
     /* Start the screensaver */
     if (this->screensaver_enabled) {
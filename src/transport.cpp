@@ -23,12 +23,20 @@
  */
 
 #include <transport.h>
+#include <ui_sounds.h>
 
 Transport* Transport::_handle = nullptr;
 
 Transport::Transport()
-  : ringBuffer(AUDIO_BUFFER_SIZE)
+  : fade_buffer(AUDIO_BUFFER_SIZE)
+  , ringBuffer(AUDIO_BUFFER_SIZE)
+  , network_buffer(NETWORK_BUFFER_SIZE, NETWORK_BUFFER_PREROLL)
 {
+    ringBuffer.setWatermarks(AUDIO_BUFFER_LOW_WATER, AUDIO_BUFFER_HIGH_WATER);
+    fade_buffer.setWatermarks(AUDIO_BUFFER_LOW_WATER, AUDIO_BUFFER_HIGH_WATER);
+
+    /* The network buffer refills as soon as there's room for a chunk, the connection decides how fast it arrives */
+    network_buffer.setWatermarks(network_buffer.size() - AUDIO_BUFFER_WRITE_CHUNK, AUDIO_BUFFER_HIGH_WATER);
 }
 
 void
@@ -38,14 +46,22 @@ Transport::begin()
     if (!loadedMedia) {
         loadedMedia = new MediaData();
     }
+    if (!nextMedia) {
+        nextMedia = new MediaData();
+    }
+
+    /* Start the SD card prefetchers, one per deck */
+    for (uint8_t i = 0; i < TRANSPORT_DECKS; i++) {
+        prefetchers[i].begin();
+    }
 
     /* Configure the I2S output */
     log_i("Configuring I2S output");
     I2SConfig i2s_config = I2SConfig(TX_MODE);
-    i2s_config.sample_rate = 44100;
+    i2s_config.sample_rate = AUDIO_OUTPUT_RATE;
     i2s_config.bits_per_sample = 16;
     i2s_config.channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT;
-    i2s_config.channels = 2;
+    i2s_config.channels = AUDIO_OUTPUT_CHANNELS;
     i2s_config.buffer_count = 6;
     i2s_config.buffer_size = 512;
     i2s_config.auto_clear = true;
@@ -55,62 +71,87 @@ Transport::begin()
     out_i2s.begin(i2s_config);
     log_i("I2S configuration: sample rate: %d, bits per sample: %d, channels: %d", i2s_config.sample_rate, i2s_config.bits_per_sample, i2s_config.channels);
 
-    /* Initialize the volume stream */
-    log_i("Initializing volume stream");
-    volume_stream.setOutput(out_i2s);
-    volume_stream.setVolume(0.0);
-    volume_stream.begin();
+    /* Decode the UI sounds into PCM once, they're mixed in between the output stage and I2S */
+    log_i("Loading UI sounds");
+    sound_bank.begin(out_i2s, i2s_config.sample_rate, i2s_config.channels);
+    sound_bank.add(UI_SOUND_CLICK, click, click_len);
+    sound_bank.add(UI_SOUND_FOLDER_CLOSE, folder_close, folder_close_len);
+    sound_bank.add(UI_SOUND_FOLDER_OPEN, folder_open, folder_open_len);
+    sound_bank.add(UI_SOUND_LOAD_ITEM, load_item, load_item_len);
+    sound_bank.add(UI_SOUND_SELECT_ITEM, select_item, select_item_len);
 
     /* Initialize the equalizer */
     log_i("Initializing equalizer");
     if (!eq) {
-        eq = new EqualizerController(volume_stream);
+        eq = new EqualizerController();
     }
+    eq->begin(i2s_config.sample_rate);
 
-    /* Configure decoder objects */
+    /* EQ, volume and limiter are applied in one pass on the way out */
+    log_i("Starting output stage");
+    output_stage.begin(sound_bank, eq, i2s_config.channels);
+    output_stage.setVolume(0.0);
+
+    /* Configure decoder objects, each deck's decoders feed their own side of the crossfade mixer through a resampler */
+    log_i("Starting crossfade mixer");
+    mixer.begin(output_stage, i2s_config.sample_rate, i2s_config.channels);
     log_i("Creating decoder objects");
-    mp3_decoder.setOutput(output);
-    flac_decoder.setOutput(output);
-    wav_decoder.setOutput(output);
-    opus_decoder.setOutput(output);
-    mp3_decoder.begin();
-    flac_decoder.begin();
-    wav_decoder.begin();
-    opus_decoder.begin();
-
-    /* Configure the FFT */
-    log_i("Configuring FFT");
-    auto tcfg = fft.defaultConfig();
-    tcfg.copyFrom(i2s_config);
-    tcfg.length = 512;
-
-    /* Start the FFT */
-    log_i("Starting FFT");
-    fft.begin(tcfg);
-    fft.reset();
-
-    log_i("Configuring stream mirror");
-    output.add(*eq);
-    output.add(fft);
-
-    log_i("Starting stream mirror");
-    output.begin();
+    for (uint8_t i = 0; i < TRANSPORT_DECKS; i++) {
+        resamplers[i].begin(mixer.input(i), i2s_config.sample_rate, i2s_config.channels);
+        resamplers[i].onRateChange([this, i](uint32_t sample_rate) { followRate(i, sample_rate); });
+        decoder_pools[i].begin(resamplers[i]);
+#if !OUTPUT_STAGE_METER
+        decoder_pools[i].setSpectrum(&subband_spectrum, i);
+#endif
+    }
+    splicer.begin(resamplers, [this](uint8_t deck, audio_tools::AudioDecoder* decoder) { decoder_pools[deck].finish(decoder); });
+
+#if OUTPUT_STAGE_METER
+    /* The meter is all the status screen shows, so nothing feeds the spectrum */
+    log_i("Starting level meter");
+    level_meter.begin(i2s_config.channels);
+    output_stage.setMeter(&level_meter);
 
     log_i("Creating spectrum analyzer object");
-    spectrumAnalyzer = new SpectrumAnalyzer(&fft, SPECTRUM_ANALYZER_NUM_BANDS, SPECTRUM_ANALYZER_PEAK_DECAY_MS, SPECTRUM_ANALYZER_PEAK_DECAY_RATE_MS);
+    spectrumAnalyzer = new SpectrumAnalyzer(nullptr, SPECTRUM_ANALYZER_NUM_BANDS, SPECTRUM_ANALYZER_PEAK_DECAY_MS, SPECTRUM_ANALYZER_PEAK_DECAY_RATE_MS);
+#else
+    /* The audio task only decimates into the tap, the FFT runs on this core from Transport::loop() */
+    log_i("Starting spectrum tap");
+    spectrum_tap.begin(i2s_config.sample_rate, i2s_config.channels);
+    output_stage.setTap(&spectrum_tap);
+
+    log_i("Creating spectrum analyzer object");
+    spectrumAnalyzer = new SpectrumAnalyzer(&spectrum_tap, SPECTRUM_ANALYZER_NUM_BANDS, SPECTRUM_ANALYZER_PEAK_DECAY_MS, SPECTRUM_ANALYZER_PEAK_DECAY_RATE_MS);
+#endif
 
     log_i("Starting spectrum analyzer");
     spectrumAnalyzer->begin();
     spectrumAnalyzer->clear();
-    fft.reset();
-
-    metadata_output.setCallback(Transport::metadataCallback);
-    // metadata_output.begin();
 
-    // url_stream.setMetadataCallback(Transport::metadataCallback);
-    url_stream.setWaitForData(false);
+    log_i("Starting loudness scanner");
+    loudness_scanner.begin();
+
+    http_source.getStream().setWaitForData(false);
+    http_source.onTitle([this](const char* title) {
+        strlcpy(stream_title, title, sizeof(stream_title));
+        stream_title_at = network_buffer.writePosition();
+        stream_title_pending = true;
+    });
+
+    /* Playback starts once the network buffer reaches the pre-roll level.  A reconnect leaves the status
+    alone, playback carries on from the buffer while it's made.  The result only counts if we're still
+    connecting, the user may have stopped while the worker was busy. */
+    network_worker.onOpened([this](bool opened) {
+        if (connect_retry.load()) {
+            stream_state.store(opened ? STREAM_CONNECTED : STREAM_RETRY_WAIT);
+        } else {
+            transport_status connecting = TRANSPORT_CONNECTING;
+            status.compare_exchange_strong(connecting, opened ? TRANSPORT_BUFFERING : TRANSPORT_STOPPED);
+        }
+    });
+    log_i("Starting network worker");
+    network_worker.begin();
     status = TRANSPORT_IDLE;
-
 }
 
 void
@@ -118,31 +159,131 @@ Transport::audio_writer(Transport* _transport)
 {
     /* Loop forever, waiting for data to be available on the ring buffer */
     log_i("Audio task started, reporting from core %d", xPortGetCoreID());
+    _transport->audio_task = xTaskGetCurrentTaskHandle();
     _transport->spectrumAnalyzer->clear();
+    _transport->ringBuffer.setConsumerTask(xTaskGetCurrentTaskHandle());
+    _transport->fade_buffer.setConsumerTask(xTaskGetCurrentTaskHandle());
+    _transport->network_buffer.setConsumerTask(xTaskGetCurrentTaskHandle());
     const uint16_t chunksize = AUDIO_BUFFER_READ_CHUNK;
+    uint32_t starved_since = millis();
+    bool starved = true;
     while (true) {
-        if (_transport->ringBuffer.available()) {
+        /* The main loop has started a crossfade into the next track, which runs until it completes */
+        if (_transport->fade_request.exchange(false)) {
+            _transport->startMix();
+        }
+        if (_transport->mixer.isFading()) {
+            _transport->mixStep();
+            continue;
+        }
+
+        Audio::RingBuffer* buffer = _transport->source.load();
+
+        /* Sleep until the main loop fills the buffer to the high water mark or flushes the end of
+        a stream.  While there is data, the blocking write into I2S is what paces this loop. */
+        if (!_transport->isReadable(buffer) && !_transport->sound_bank.isPlaying()) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(_transport->output_idle.load() ? AUDIO_IDLE_MAX_WAIT_MS : AUDIO_CONSUMER_MAX_WAIT_MS));
+            buffer = _transport->source.load();
+        }
+
+        if (_transport->isReadable(buffer)) {
+            starved = false;
+            if (_transport->output_idle.load()) {
+                _transport->output_idle.store(false);
+                _transport->mixer.rampUp(AUDIO_FADE_IN_MS);
+            }
 
-            uint16_t bytes_available = _transport->ringBuffer.available();
+            /* Decode straight out of the ring, the span stops at the end of the buffer and
+            the next pass picks up the rest from the start */
+            const uint8_t* data;
+            size_t bytes_available = buffer->readSpan(&data);
             if (bytes_available > chunksize) {
                 bytes_available = chunksize;
             }
-            uint8_t data[bytes_available];
-            _transport->mutex.lock();
-            _transport->ringBuffer.readArray(data, bytes_available);
-            _transport->mutex.unlock();
-            _transport->mp3_decoder.write(data, bytes_available);
-        }
-        if (!_transport->ringBuffer.available()) {
-            /* If nothing is available, send chunks of silence to the stream to
-            keep the DAC alive and prevent pops and glitches */
-            uint8_t silence[chunksize];
-            memset(silence, 0, chunksize);
-            _transport->output.write(silence, chunksize);
+
+            /* Pick up a new stream requested by play() or a seek.  The old decoder is left for the main loop to
+            restart, so the new stream can't inherit its state even when it's the same decoder again. */
+            if (_transport->decoder_switch.exchange(false)) {
+                for (Audio::DecoderPool& pool : _transport->decoder_pools) {
+                    pool.retire(_transport->decoder);
+                }
+                _transport->decoder = _transport->decoder_pools[_transport->pending_deck.load()].get(_transport->pending_type.load());
+                _transport->resamplers[_transport->pending_deck.load()].setSource(_transport->decoder);
+                _transport->mixer.setActive(_transport->pending_deck.load());
+                _transport->subband_spectrum.setDeck(_transport->pending_deck.load());
+
+                /* The position counts from wherever play() or the seek started the stream */
+                _transport->position_base[_transport->pending_deck.load()] = _transport->pending_position.load();
+                _transport->mixer.resetDelivered(_transport->pending_deck.load());
+
+                /* A seek clears the buffer along with the switch, in which case what we're holding is stale */
+                if (buffer->available() == 0) {
+                    continue;
+                }
+            }
+
+            /* Stop short of the start of the next track, and once we're there carry straight on with the next
+            deck's decoder, which is already primed */
+            uint8_t playing_deck = _transport->pending_deck.load();
+            if (_transport->splicer.cut(buffer->readPosition(), &bytes_available, &playing_deck, &_transport->decoder)) {
+                _transport->pending_deck.store(playing_deck);
+                _transport->mixer.setActive(playing_deck);
+                _transport->subband_spectrum.setDeck(playing_deck);
+                _transport->position_base[playing_deck] = 0;
+                _transport->mixer.resetDelivered(playing_deck);
+            }
+
+            /* Streams of unknown type are identified from their first bytes.  MP3 is the
+            fallback since its decoder will resync on its own if we guessed wrong. */
+            if (!_transport->decoder) {
+                uint8_t header[DECODER_DETECT_BYTES];
+                size_t header_length = buffer->peek(header, DECODER_DETECT_BYTES);
+                uint8_t type = Audio::DecoderPool::detect(header, header_length);
+                if (type == FILETYPE_UNKNOWN) {
+                    type = FILETYPE_MP3;
+                }
+                log_i("Detected stream type: %d", type);
+                _transport->stream_type.store(type);
+                _transport->decoder = _transport->decoder_pools[_transport->pending_deck.load()].get(type);
+                _transport->resamplers[_transport->pending_deck.load()].setSource(_transport->decoder);
+            }
+
+            /* A decoder retired by the switch is restarted by the main loop before it takes anything new */
+            if (!_transport->decoder_pools[_transport->pending_deck.load()].isReady(_transport->decoder)) {
+                vTaskDelay(1);
+                continue;
+            }
+            _transport->decoder->write(data, bytes_available);
+            buffer->commitRead(bytes_available);
+            _transport->updatePosition();
+        } else {
+            /* Nothing to play.  The DMA buffers keep playing out what they hold and the driver
+            clears them once they run dry, so there's no need to feed silence down the chain. */
+            if (!starved) {
+                starved = true;
+                starved_since = millis();
+            }
+            if (_transport->sound_bank.isPlaying()) {
+                static const uint8_t silence[AUDIO_IDLE_CHUNK] = { 0 };
+                _transport->sound_bank.write(silence, sizeof(silence));
+            } else if (!_transport->output_idle.load() && millis() - starved_since >= AUDIO_IDLE_AFTER_MS) {
+                _transport->output_idle.store(true);
+            }
         }
+    }
+}
+
+/* Called from the audio task only, since available() services pending clears on the consumer side */
+bool
+Transport::isReadable(Audio::RingBuffer* buffer)
+{
+    size_t filled = buffer->available();
 
-        vTaskDelay(10 / portTICK_PERIOD_MS);
+    /* The network buffer is held back while it fills to the pre-roll level */
+    if (buffer == &network_buffer && !network_buffer.isReleased()) {
+        return false;
     }
+    return filled > 0;
 }
 
 uint8_t
@@ -154,11 +295,27 @@ Transport::getStatus()
 void
 Transport::resetMetadata()
 {
-    loadedAlbum[0] = '\0';
-    loadedArtist[0] = '\0';
-    loadedTitle[0] = '\0';
-    loadedGenre[0] = '\0';
-    loadedYear[0] = '\0';
+    Audio::TagReader::clear(&loaded_tags);
+}
+
+float
+Transport::trackGain(MediaData& media, const Audio::tags_t& tags)
+{
+    float gain_db = Audio::LoudnessScanner::fromTags(tags);
+    if (isnan(gain_db) && !Audio::LoudnessScanner::lookup(media.path.c_str(), media.filename.c_str(), &gain_db)) {
+        gain_db = 0;
+    }
+    return gain_db;
+}
+
+void
+Transport::openSeekIndex(uint8_t index, MediaData& media)
+{
+    std::function<void()> load;
+    seek_indexes[index].open(media.getPath(), media.path.c_str(), media.filename.c_str(), media.type, &load);
+    if (load) {
+        loudness_scanner.defer(load);
+    }
 }
 
 MediaData
@@ -179,17 +336,15 @@ Transport::load(MediaData media)
         if (media.type != FILETYPE_M3U) {
             switch (media.source) {
                 case LOCAL_FILE:
-                    if (_file_descriptor) {
-                        close(_file_descriptor);
-                    }
-                    _file_descriptor = open(media.getPath(), O_RDONLY);
-                    bytes_read = 0;
-                    if (_file_descriptor) {
+                    cancelNext();
+                    if (prefetchers[deck].open(media.getPath())) {
+                        openSeekIndex(deck, media);
+                        duration = seek_indexes[deck].getDuration();
                         *loadedMedia = media;
                         status = TRANSPORT_STOPPED;
-                        resetMetadata();
+                        Audio::TagReader().read(media.getPath(), media.type, &loaded_tags);
+                        mixer.setGain(deck, trackGain(media, loaded_tags));
                         clearPlayTime();
-                        resetMetadata();
                         log_i("Loaded file: %s", media.filename.c_str());
                         return true;
                     } else {
@@ -198,8 +353,16 @@ Transport::load(MediaData media)
                     }
                     break;
                 case REMOTE_FILE:
+                    cancelNext();
+                    prefetchers[deck].close();
+                    seek_indexes[deck].close();
+                    duration = 0;
                     *loadedMedia = media;
                     resetMetadata();
+                    resume_offset = 0;
+                    stream_type.store(FILETYPE_UNKNOWN);
+                    stream_rate = 0;
+                    mixer.setGain(deck, 0);
                     clearPlayTime();
                     status = TRANSPORT_STOPPED;
                     return true;
@@ -213,44 +376,93 @@ Transport::load(MediaData media)
 bool
 Transport::play()
 {
-    /* Clear the buffer */
-    mutex.lock();
+    /* Clear the buffers and pick the one this source plays from */
     ringBuffer.clear();
-    mutex.unlock();
+    fade_buffer.clear();
+    network_buffer.clear();
+    if (loadedMedia->source == REMOTE_FILE) {
+        network_buffer.reset();
+        source.store(&network_buffer);
+        stream_title_pending = false;
+    } else {
+        source.store(play_buffer);
+    }
 
-    playingUISound = false;
-    volume_stream.setVolume((float) volume / TRANSPORT_MAX_VOLUME);
+    output_stage.setVolume((float) volume / TRANSPORT_MAX_VOLUME);
 
-    if (loadedMedia->loaded && loadedMedia->source == LOCAL_FILE && _file_descriptor) {
+    /* Whatever was buffered when we paused has just been thrown away, so pick up from the play position */
+    uint32_t position = status == TRANSPORT_PAUSED ? play_position.load() : 0;
+    if (position > 0 && loadedMedia->source == LOCAL_FILE && seek_indexes[deck].isSeekable()) {
+        seek_ms.store(position);
+        seek_pending.store(true);
+    }
+
+    /* A remote file picks up from the byte the audio task had reached if the server takes ranges.  Only the MP3
+    decoder finds its own way in from the middle of a stream, so anything else starts the file over.  A radio
+    stream carries on from wherever the station has got to. */
+    uint32_t offset = 0;
+    if (loadedMedia->source == REMOTE_FILE) {
+        if (position > 0 && resume_offset > 0 && stream_type.load() == FILETYPE_MP3) {
+            offset = resume_offset;
+        } else if (http_source.getLength() > 0) {
+            position = 0;
+        }
+        resume_offset = 0;
+    }
+
+    /* Remote streams don't carry a usable type, so those are detected by the audio task unless we're resuming */
+    uint8_t type = loadedMedia->source == LOCAL_FILE ? loadedMedia->type : offset > 0 ? FILETYPE_MP3 : FILETYPE_UNKNOWN;
+    selectDecoder(type, position);
+
+    if (loadedMedia->loaded && loadedMedia->source == LOCAL_FILE && prefetchers[deck].isOpen()) {
         status = TRANSPORT_PLAYING;
         log_i("Playing file: %s", loadedMedia->filename.c_str());
         return true;
     }
 
     else if (loadedMedia->loaded && loadedMedia->source == REMOTE_FILE && WiFi.status() == WL_CONNECTED) {
-        if (connection_task != nullptr) {
-            connection_task->remove();
-            delete connection_task;
-            connection_task = nullptr;
-        }
-        connection_task = new Task("connection_task", 8192, 1, 1);
-        connection_task->begin([this] {
-            url_stream.end();
-            log_i("Connecting to stream: %s", loadedMedia->url.c_str());
-            if (url_stream.begin(loadedMedia->url.c_str())) {
-                status = TRANSPORT_PLAYING;
-            } else {
-                log_e("Error connecting to stream: %s", loadedMedia->url.c_str());
-                status = TRANSPORT_STOPPED;
-                url_stream.end();
-            }
-            connection_task->remove();
-        });
-        status = TRANSPORT_CONNECTING;
+        connect(offset, position);
     }
     return false;
 }
 
+void
+Transport::connect(uint32_t offset, uint32_t position_ms, bool retry)
+{
+    /* Whatever the stream sends from the offset goes in wherever the network buffer is written next.  A retry
+    carries on with the rate measurement, the bytes either side of the gap are from the same file. */
+    stream_base_offset = offset;
+    stream_base_position = network_buffer.writePosition();
+    if (!retry) {
+        endOutage();
+        network_lost.store(false);
+        stream_opened_ms = position_ms;
+        stream_marked = false;
+    }
+
+    connect_retry.store(retry);
+    if (!retry) {
+        status = TRANSPORT_CONNECTING;
+    }
+    network_worker.open(loadedMedia->url.c_str(), offset);
+}
+
+/* Offset in the remote file of the next byte the audio task will read */
+uint32_t
+Transport::streamOffset()
+{
+    if (!http_source.isSeekable()) {
+        return 0;
+    }
+    return stream_base_offset + (uint32_t) (network_buffer.readPosition() - stream_base_position);
+}
+
+uint32_t
+Transport::streamWriteOffset()
+{
+    return stream_base_offset + (uint32_t) (network_buffer.writePosition() - stream_base_position);
+}
+
 void
 Transport::pause()
 {
@@ -258,12 +470,9 @@ Transport::pause()
     spectrumAnalyzer->clear();
     log_i("Paused");
     if (loadedMedia->source == REMOTE_FILE) {
-        url_stream.end();
-    }
-    if (connection_task) {
-        connection_task->remove();
-        delete connection_task;
-        connection_task = nullptr;
+        resume_offset = streamOffset();
+        network_worker.close();
+        endOutage();
     }
 }
 
@@ -271,24 +480,43 @@ void
 Transport::stop()
 {
 
-    if (status == TRANSPORT_PLAYING || status == TRANSPORT_PAUSED || status == TRANSPORT_IDLE) {
+    /* Stopping while connecting cancels the open, the worker drops the result of a command that's been replaced */
+    if (status == TRANSPORT_PLAYING || status == TRANSPORT_BUFFERING || status == TRANSPORT_PAUSED || status == TRANSPORT_IDLE ||
+        status == TRANSPORT_CONNECTING) {
 
         status = TRANSPORT_STOPPED;
-        bytes_read = 0;
+        seek_pending.store(false);
+        seek_header_length = 0;
+
+        /* The next track was in the buffer but hadn't started, so put the current one back on the playing deck */
+        splicer.cancel();
+        if (awaiting_splice) {
+            awaiting_splice = false;
+            prefetchers[deck].close();
+            deck = (deck + 1) % TRANSPORT_DECKS;
+            prefetchers[deck].open(loadedMedia->getPath());
+        }
+
+        /* Same for a crossfade that hadn't finished, the outgoing deck is still open */
+        if (fading) {
+            fading = false;
+            fade_request.store(false);
+            fade_source.store(nullptr);
+            prefetchers[deck].close();
+            deck = fade_out_deck;
+            play_buffer = fade_out_buffer;
+        }
         if (loadedMedia->source == LOCAL_FILE) {
-            lseek(_file_descriptor, 0, SEEK_SET);
+            prefetchers[deck].seek(0);
         }
         log_i("Stopped");
         clearPlayTime();
         spectrumAnalyzer->clear();
         if (loadedMedia->source == REMOTE_FILE) {
             clearPlayTime();
-            url_stream.end();
-        }
-        if (connection_task) {
-            connection_task->remove();
-            delete connection_task;
-            connection_task = nullptr;
+            resume_offset = 0;
+            network_worker.close();
+            endOutage();
         }
     }
 }
@@ -299,11 +527,442 @@ Transport::eject()
     stop();
     resetMetadata();
     *loadedMedia = MediaData();
-    close(_file_descriptor);
-    _file_descriptor = -1;
+    cancelNext();
+    prefetchers[deck].close();
+    seek_indexes[deck].close();
+    duration = 0;
     status = TRANSPORT_IDLE;
 }
 
+bool
+Transport::seek(uint32_t seconds)
+{
+    /* A remote file needs a server that takes ranges, a decoder that can start anywhere and a measured byte rate */
+    if (loadedMedia->source == REMOTE_FILE) {
+        if (!http_source.isSeekable() || stream_type.load() != FILETYPE_MP3 || stream_rate == 0) {
+            return false;
+        }
+    } else if (!seek_indexes[deck].isSeekable()) {
+        return false;
+    }
+    seek_ms.store(seconds * 1000);
+    seek_pending.store(true, std::memory_order_release);
+    return true;
+}
+
+/* Called from Transport::loop(), which owns the prefetchers and the writing side of the audio buffer */
+void
+Transport::applySeek()
+{
+    uint32_t ms = seek_ms.load();
+    if (loadedMedia->source == REMOTE_FILE) {
+        seekStream(ms);
+        return;
+    }
+    if (!prefetchers[deck].isOpen()) {
+        return;
+    }
+
+    /* The next track is already in the buffers, let it take over first */
+    if (awaiting_splice || fading) {
+        log_w("Can't seek while changing tracks");
+        return;
+    }
+
+    uint32_t offset;
+    uint32_t actual_ms;
+    if (!seek_indexes[deck].locate(ms, &offset, &actual_ms)) {
+        log_w("Can't seek to %d ms in %s", ms, loadedMedia->filename.c_str());
+        return;
+    }
+
+    play_buffer->clear();
+    prefetchers[deck].seek(offset);
+    seek_header_length = seek_indexes[deck].header(seek_header, sizeof(seek_header), offset);
+    selectDecoder(loadedMedia->type, actual_ms);
+    play_position.store(actual_ms);
+    log_i("Seeked to %d ms at offset %d in %s", actual_ms, offset, loadedMedia->filename.c_str());
+}
+
+/* There's no index for a remote file, so the offset is worked out from where the stream is now at the rate it's
+been playing, which is exact for constant bitrate MP3.  The stream is reopened there and buffers up again. */
+void
+Transport::seekStream(uint32_t ms)
+{
+    uint32_t now_ms = play_position.load();
+    uint32_t now_offset = streamOffset();
+    if (!now_offset || stream_rate == 0 || (status != TRANSPORT_PLAYING && status != TRANSPORT_BUFFERING)) {
+        return;
+    }
+    int64_t offset = now_offset + (int64_t) (((int64_t) ms - now_ms) * stream_rate / 1000);
+    if (offset < 0) {
+        offset = 0;
+    }
+    if (http_source.getLength() > 0 && offset >= http_source.getLength()) {
+        log_w("Can't seek to %d ms, past the end of the stream", ms);
+        return;
+    }
+
+    network_buffer.clear();
+    network_buffer.reset();
+    stream_title_pending = false;
+    selectDecoder(FILETYPE_MP3, ms);
+    play_position.store(ms);
+    connect((uint32_t) offset, ms);
+    log_i("Seeking stream to %d ms at offset %d", ms, (uint32_t) offset);
+}
+
+/* Marks the stream once it's been playing a moment, and measures the byte rate from there */
+void
+Transport::measureStreamRate()
+{
+    uint32_t ms = play_position.load();
+    uint32_t offset = streamOffset();
+    if (!offset || ms < stream_opened_ms + STREAM_RATE_MARK_MS) {
+        return;
+    }
+    if (!stream_marked) {
+        stream_mark_ms = ms;
+        stream_mark_offset = offset;
+        stream_marked = true;
+    } else if (ms - stream_mark_ms >= STREAM_RATE_MEASURE_MS && offset > stream_mark_offset) {
+        stream_rate = (float) (offset - stream_mark_offset) * 1000 / (ms - stream_mark_ms);
+    }
+}
+
+void
+Transport::selectDecoder(uint8_t type, uint32_t position_ms)
+{
+    /* The encoder delay is only where we expect it at the top of the file, after a seek the padding stays in */
+    if (position_ms == 0) {
+        resamplers[deck].setTrim(seek_indexes[deck].getTrimStart(), seek_indexes[deck].getTrimLength());
+    } else {
+        resamplers[deck].setTrim(0, 0);
+    }
+    pending_type.store(type);
+    pending_position.store(position_ms);
+    pending_deck.store(deck);
+    decoder_switch.store(true);
+}
+
+/****************************************************
+ *
+ * Gapless playback
+ *
+ ****************************************************/
+
+void
+Transport::setPlaylistCallbacks(std::function<MediaData()> peekNext, std::function<void()> advance)
+{
+    peekNextCallback = peekNext;
+    advanceCallback = advance;
+}
+
+/* Opens the next playlist track on the idle deck and primes its decoder */
+void
+Transport::preloadNext()
+{
+    next_checked = true;
+    if (!peekNextCallback) {
+        return;
+    }
+
+    /* Network streams can't be spliced, those still go through the playlist engine once we stop */
+    MediaData media = peekNextCallback();
+    uint8_t idle = (deck + 1) % TRANSPORT_DECKS;
+    if (!media.loaded || media.source != LOCAL_FILE || !decoder_pools[idle].get(media.type)) {
+        return;
+    }
+    if (!prefetchers[idle].open(media.getPath())) {
+        log_e("Error preloading file: %s", media.filename.c_str());
+        return;
+    }
+
+    *nextMedia = media;
+    openSeekIndex(idle, media);
+    Audio::TagReader().read(media.getPath(), media.type, &next_tags);
+    mixer.setGain(idle, trackGain(media, next_tags));
+    resamplers[idle].setTrim(seek_indexes[idle].getTrimStart(), seek_indexes[idle].getTrimLength());
+    decoder_pools[idle].recycle();
+    decoder_pools[idle].rearm(decoder_pools[idle].get(media.type));
+    next_loaded = true;
+    log_i("Preloaded next file: %s", media.filename.c_str());
+}
+
+/* Called once every byte of the current file is in the audio buffer.  The next file's bytes follow
+straight on, and the audio task switches decoders when it reaches them. */
+void
+Transport::spliceNext()
+{
+    uint8_t idle = (deck + 1) % TRANSPORT_DECKS;
+    splicer.arm(play_buffer->writePosition(), idle, decoder_pools[idle].get(nextMedia->type));
+
+    prefetchers[deck].close();
+    deck = idle;
+    next_loaded = false;
+    next_checked = false;
+    awaiting_splice = true;
+    log_i("Spliced %s onto %s", nextMedia->filename.c_str(), loadedMedia->filename.c_str());
+}
+
+void
+Transport::commitSplice()
+{
+    awaiting_splice = false;
+    decoder_pools[(deck + 1) % TRANSPORT_DECKS].recycle();
+    *loadedMedia = *nextMedia;
+    loaded_tags = next_tags;
+    duration = seek_indexes[deck].getDuration();
+    if (advanceCallback) {
+        advanceCallback();
+    }
+    log_i("Playing file: %s", loadedMedia->filename.c_str());
+}
+
+/* Drops the preloaded track, along with any splice or fade the audio task hasn't finished */
+void
+Transport::cancelNext()
+{
+    splicer.cancel();
+    awaiting_splice = false;
+    if (fading) {
+        fading = false;
+        fade_request.store(false);
+        fade_source.store(nullptr);
+        prefetchers[fade_out_deck].close();
+    }
+    if (next_loaded) {
+        prefetchers[(deck + 1) % TRANSPORT_DECKS].close();
+    }
+    next_loaded = false;
+    next_checked = false;
+}
+
+/****************************************************
+ *
+ * Crossfade
+ *
+ ****************************************************/
+
+void
+Transport::crossfadeUp()
+{
+    if (crossfade < TRANSPORT_MAX_CROSSFADE) {
+        crossfade++;
+        Config_Manager::get_handle()->setCrossfade(crossfade);
+    }
+}
+
+void
+Transport::crossfadeDown()
+{
+    if (crossfade > TRANSPORT_MIN_CROSSFADE) {
+        crossfade--;
+        Config_Manager::get_handle()->setCrossfade(crossfade);
+    }
+}
+
+uint8_t
+Transport::getCrossfade()
+{
+    return crossfade;
+}
+
+void
+Transport::setCrossfade(uint8_t seconds)
+{
+    if (seconds > TRANSPORT_MAX_CROSSFADE) {
+        seconds = TRANSPORT_MAX_CROSSFADE;
+    }
+    crossfade = seconds;
+    Config_Manager::get_handle()->setCrossfade(crossfade);
+}
+
+uint8_t
+Transport::getMinCrossfade()
+{
+    return TRANSPORT_MIN_CROSSFADE;
+}
+
+uint8_t
+Transport::getMaxCrossfade()
+{
+    return TRANSPORT_MAX_CROSSFADE;
+}
+
+uint32_t
+Transport::remainingMs()
+{
+    uint32_t position = play_position.load();
+    uint32_t length = seek_indexes[deck].getDuration();
+    if (length) {
+        return length > position ? length - position : 0;
+    }
+
+    /* The headers don't say, so work out the byte rate from what has actually been played */
+    Audio::Prefetcher& prefetcher = prefetchers[deck];
+    size_t buffered = play_buffer->fill();
+    if (position < 2000 || prefetcher.position() <= buffered) {
+        return UINT32_MAX;
+    }
+    uint32_t byte_rate = ((uint64_t) (prefetcher.position() - buffered) * 1000) / position;
+    if (byte_rate == 0) {
+        return UINT32_MAX;
+    }
+    return ((uint64_t) (prefetcher.size() - prefetcher.position() + buffered) * 1000) / byte_rate;
+}
+
+/* Called once the current track is down to the length of the fade.  The outgoing deck keeps its buffer and
+the incoming one takes the other, so both can be fed until the outgoing file runs out. */
+void
+Transport::startFade()
+{
+    uint8_t idle = (deck + 1) % TRANSPORT_DECKS;
+    Audio::RingBuffer* incoming = play_buffer == &ringBuffer ? &fade_buffer : &ringBuffer;
+    incoming->clear();
+
+    fade_out_deck = deck;
+    fade_out_buffer = play_buffer;
+    fade_out_done = false;
+    outgoing_ended.store(false);
+    fade_complete.store(false);
+
+    deck = idle;
+    play_buffer = incoming;
+    next_loaded = false;
+    next_checked = false;
+    fading = true;
+
+    fade_deck.store(idle);
+    fade_type.store(nextMedia->type);
+    fade_ms.store(crossfade * 1000);
+    fade_source.store(incoming);
+    fade_request.store(true, std::memory_order_release);
+    log_i("Crossfading %s into %s", loadedMedia->filename.c_str(), nextMedia->filename.c_str());
+}
+
+void
+Transport::commitFade()
+{
+    fading = false;
+    prefetchers[fade_out_deck].close();
+    decoder_pools[fade_out_deck].recycle();
+    *loadedMedia = *nextMedia;
+    loaded_tags = next_tags;
+    duration = seek_indexes[deck].getDuration();
+    if (advanceCallback) {
+        advanceCallback();
+    }
+    log_i("Playing file: %s", loadedMedia->filename.c_str());
+}
+
+size_t
+Transport::decodeFrom(Audio::RingBuffer* buffer, audio_tools::AudioDecoder* decoder, size_t length)
+{
+    const uint8_t* data;
+    size_t count = buffer->readSpan(&data);
+    if (count > length) {
+        count = length;
+    }
+    if (count > 0) {
+        decoder->write(data, count);
+        buffer->commitRead(count);
+    }
+    return count;
+}
+
+/* Audio task */
+void
+Transport::startMix()
+{
+    if (!fade_source.load()) {
+        return;
+    }
+    uint8_t incoming = fade_deck.load();
+    position_base[incoming] = 0;
+    mixer.resetDelivered(incoming);
+    fade_decoder = decoder_pools[incoming].get(fade_type.load());
+    resamplers[incoming].setSource(fade_decoder);
+    if (fade_decoder && mixer.start(incoming, fade_ms.load())) {
+        return;
+    }
+
+    /* Without the mixer FIFOs there's nothing to fade with, so cut straight over */
+    log_w("Crossfade unavailable, cutting to the next track");
+    mixer.setActive(incoming);
+    completeMix(fade_source.load());
+}
+
+/* Audio task.  Decodes a little of each track into the mixer and mixes out what it can. */
+void
+Transport::mixStep()
+{
+    Audio::RingBuffer* outgoing = source.load();
+    Audio::RingBuffer* incoming = fade_source.load();
+
+    /* stop(), load() or play() got in first.  The incoming decoder has had the start of its track. */
+    if (!incoming || decoder_switch.load()) {
+        mixer.abort();
+        decoder_pools[fade_deck.load()].retire(fade_decoder);
+        fade_decoder = nullptr;
+        return;
+    }
+
+    /* Only decoding is charged to the fade, writing the mix out blocks on I2S */
+    uint32_t start = micros();
+    bool decoded = false;
+    if (!mixer.isOutgoingDone()) {
+        if (outgoing->available()) {
+            if (mixer.room(mixer.getActive()) >= CROSSFADE_DECODE_ROOM) {
+                decoded |= decodeFrom(outgoing, decoder, CROSSFADE_DECODE_CHUNK) > 0;
+            }
+        } else if (outgoing_ended.load()) {
+            decoder_pools[pending_deck.load()].finish(decoder);
+            resamplers[pending_deck.load()].flush();
+            mixer.endOutgoing();
+        }
+    }
+    if (mixer.room(fade_deck.load()) >= CROSSFADE_DECODE_ROOM && incoming->available()) {
+        decoded |= decodeFrom(incoming, fade_decoder, CROSSFADE_DECODE_CHUNK) > 0;
+    }
+    mixer.account(micros() - start);
+
+    /* The mixer also stops fading when it cuts over for running out of time */
+    bool completed = mixer.mix() || !mixer.isFading();
+    if (completed) {
+        completeMix(incoming);
+    }
+    updatePosition();
+    if (!completed && !decoded) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(AUDIO_CONSUMER_MAX_WAIT_MS));
+    }
+}
+
+/* Audio task.  The incoming track is now the only one playing. */
+void
+Transport::completeMix(Audio::RingBuffer* incoming)
+{
+    Audio::RingBuffer* outgoing = source.load();
+    if (!incoming) {
+        return;
+    }
+
+    /* The mixer has already let go of the outgoing input, so whatever this flushes goes nowhere.  A decoder that
+    ran out before the end of the fade was finished then, and may be restarting now. */
+    if (decoder_pools[pending_deck.load()].isReady(decoder)) {
+        decoder_pools[pending_deck.load()].finish(decoder);
+    }
+    resamplers[pending_deck.load()].flush();
+    decoder = fade_decoder;
+    fade_decoder = nullptr;
+    pending_deck.store(fade_deck.load());
+    subband_spectrum.setDeck(fade_deck.load());
+    source.store(incoming);
+    fade_source.store(nullptr);
+    outgoing->clear();
+    fade_complete.store(true, std::memory_order_release);
+}
+
 /****************************************************
  *
  * Play system sounds
@@ -311,16 +970,13 @@ Transport::eject()
  ****************************************************/
 
 void
-Transport::playUIsound(const unsigned char* uiSound, size_t length)
+Transport::playUIsound(ui_sound sound)
 {
-    if (status == TRANSPORT_STOPPED || status == TRANSPORT_PAUSED || status == TRANSPORT_IDLE || playingUISound) {
-        /* Clear the buffer */
-        mutex.lock();
-        ringBuffer.clear();
-        mutex.unlock();
-        memory_stream.setValue(uiSound, length);
-        playingUISound = true;
-        volume_stream.setVolume((float) system_volume / TRANSPORT_MAX_SYSTEM_VOLUME);
+    sound_bank.play(sound, (int16_t) (((int32_t) system_volume * INT16_MAX) / TRANSPORT_MAX_SYSTEM_VOLUME));
+
+    /* Wake the audio task in case it's idle */
+    if (audio_task) {
+        xTaskNotifyGive(audio_task);
     }
 }
 
@@ -338,9 +994,7 @@ Transport::volumeUp()
 
         /* Convert the 1-100 volume to a 0-1 float */
         float vol = (float) volume / TRANSPORT_MAX_VOLUME;
-        if (!playingUISound) {
-            volume_stream.setVolume(vol);
-        }
+        output_stage.setVolume(vol);
         Config_Manager::get_handle()->setVolume(volume);
     }
 }
@@ -353,9 +1007,7 @@ Transport::volumeDown()
 
         /* Convert the 1-100 volume to a 0-1 float */
         float vol = (float) volume / TRANSPORT_MAX_VOLUME;
-        if (!playingUISound) {
-            volume_stream.setVolume(vol);
-        }
+        output_stage.setVolume(vol);
         Config_Manager::get_handle()->setVolume(volume);
     }
 }
@@ -373,9 +1025,7 @@ Transport::setVolume(uint8_t volume)
 
     /* Convert the 1-100 volume to a 0-1 float */
     float vol = (float) volume / TRANSPORT_MAX_VOLUME;
-    if (!playingUISound) {
-        volume_stream.setVolume(vol);
-    }
+    output_stage.setVolume(vol);
     Config_Manager::get_handle()->setVolume(volume);
 }
 
@@ -440,16 +1090,79 @@ Transport::systemVolumeDown()
  *
  ****************************************************/
 
-size_t
+uint32_t
 Transport::getPlayTime()
 {
-    return playTime;
+    /* Whatever is left in the buffers still plays out after a stop */
+    if (status == TRANSPORT_STOPPED || status == TRANSPORT_IDLE || status == TRANSPORT_CONNECTING) {
+        return 0;
+    }
+    return play_position.load();
 }
 
 void
 Transport::clearPlayTime()
 {
-    playTime = 0;
+    play_position.store(0);
+}
+
+uint32_t
+Transport::getDuration()
+{
+    return duration;
+}
+
+/* Audio task */
+void
+Transport::updatePosition()
+{
+    /* Until the switch is picked up, the decoder is still the one from before a seek */
+    if (!decoder || decoder_switch.load()) {
+        return;
+    }
+
+    /* What the mixer counts has been through the resampler, so it's in the output's format */
+    uint8_t active = mixer.getActive();
+    uint64_t frames = mixer.getDelivered(active) / (AUDIO_OUTPUT_CHANNELS * sizeof(int16_t));
+    play_position.store(position_base[active] + (uint32_t) ((frames * 1000) / output_rate.load()));
+}
+
+/****************************************************
+ *
+ * Sample rate
+ *
+ ****************************************************/
+
+/* Audio task, from inside the decoder's write before any of the new samples go through.  A track playing on its
+own takes the output to its rate, one being faded in is resampled to whatever the output is already running at. */
+void
+Transport::followRate(uint8_t index, uint32_t sample_rate)
+{
+#if !AUDIO_RESAMPLE
+    if (index == mixer.getActive() && !mixer.isFading() && sample_rate != output_rate.load()) {
+        setOutputRate(sample_rate);
+    }
+#endif
+}
+
+/* Audio task.  Whatever is still in the DMA buffers plays out at the new rate, which is a few milliseconds of the
+last track at most.  The EQ is redesigned by Transport::loop(), which is the task that sets its bands. */
+void
+Transport::setOutputRate(uint32_t sample_rate)
+{
+    audio_tools::AudioInfo info = out_i2s.audioInfo();
+    info.sample_rate = sample_rate;
+    out_i2s.setAudioInfo(info);
+    sound_bank.setOutputRate(sample_rate);
+#if !OUTPUT_STAGE_METER
+    spectrum_tap.setSampleRate(sample_rate);
+#endif
+    mixer.setSampleRate(sample_rate);
+    for (uint8_t i = 0; i < TRANSPORT_DECKS; i++) {
+        resamplers[i].setOutputRate(sample_rate);
+    }
+    output_rate.store(sample_rate);
+    log_i("Output sample rate changed to %d Hz", sample_rate);
 }
 
 /****************************************************
@@ -461,123 +1174,316 @@ Transport::clearPlayTime()
 void
 Transport::loop()
 {
-    if (spectrumAnalyzer && SpectrumAnalyzerUpdateTimer.check(spectrum_analyzer_refresh_interval)) {
-        spectrumAnalyzer->update();
+    /* Restart whatever decoders the audio task has finished with, it waits on any it needs again */
+    for (Audio::DecoderPool& pool : decoder_pools) {
+        pool.recycle();
     }
 
-    if (status == TRANSPORT_PLAYING) {
-
-        vTaskDelay(10 / portTICK_PERIOD_MS);
+#if !OUTPUT_STAGE_METER
+    if (spectrumAnalyzer && SpectrumAnalyzerUpdateTimer.check(SPECTRUM_ANALYZER_UPDATE_INTERVAL_MS)) {
+        /* The sources get nothing while the output is idle, so drop the bars once rather than keep reading them */
+        if (output_idle.load()) {
+            if (!spectrum_idle) {
+                spectrumAnalyzer->clear();
+                spectrum_idle = true;
+            }
+        } else {
+            spectrum_idle = false;
 
-        if (playTimeUpdateTimer.check(1000)) {
-            playTime++;
+            /* MP3 brings its own band levels out of the decoder, anything else goes through the FFT */
+            spectrumAnalyzer->setSource(subband_spectrum.isActive() ? (Audio::SpectrumSource*) &subband_spectrum : &spectrum_tap);
+            spectrumAnalyzer->update();
         }
-        struct stat st;
-        int32_t _bytes_available = 0;
+    }
+#endif
+
+    /* The audio task has moved the output to another rate.  The menus change the bands from the Arduino loop
+    task at the same time, the EQ's control mutex keeps the two from publishing over each other. */
+    if (eq && eq_rate != output_rate.load()) {
+        eq_rate = output_rate.load();
+        eq->begin(eq_rate);
+    }
+
+    ringBuffer.setProducerTask(xTaskGetCurrentTaskHandle());
+    network_buffer.setProducerTask(xTaskGetCurrentTaskHandle());
+    for (uint8_t i = 0; i < TRANSPORT_DECKS; i++) {
+        prefetchers[i].setReaderTask(xTaskGetCurrentTaskHandle());
+    }
+
+    if (seek_pending.exchange(false)) {
+        applySeek();
+    }
+
+    if (status == TRANSPORT_PLAYING || status == TRANSPORT_BUFFERING) {
         switch (loadedMedia->source) {
 
-            case LOCAL_FILE:
+            case LOCAL_FILE: {
+                /* The audio task has reached the track we spliced or faded into, so that's what is playing now */
+                if (awaiting_splice && !splicer.isPending()) {
+                    commitSplice();
+                }
+                if (fading && fade_complete.exchange(false)) {
+                    commitFade();
+                }
 
-                /* If the audio buffer has space, write the next AUDIO_BUFFER_CHUNK_SIZE
-                bytes of the file to the buffer */
+                Audio::Prefetcher& prefetcher = prefetchers[deck];
 
-                fstat(_file_descriptor, &st);
-                _bytes_available = st.st_size - bytes_read;
-                if (ringBuffer.availableForWrite() > AUDIO_BUFFER_WRITE_CHUNK && _bytes_available) {
-                    uint16_t chunkSize = 0;
-                    if (_bytes_available < AUDIO_BUFFER_WRITE_CHUNK) {
-                        chunkSize = _bytes_available;
-                    } else {
-                        chunkSize = AUDIO_BUFFER_WRITE_CHUNK;
-                    }
+                /* After a seek, the stream header goes in ahead of anything from the new position */
+                if (seek_header_length > 0 && play_buffer->availableForWrite() >= seek_header_length) {
+                    play_buffer->write(seek_header, seek_header_length);
+                    seek_header_length = 0;
+                }
+                if (seek_header_length == 0) {
+                    fillFrom(deck, play_buffer);
+                }
 
-                    uint8_t data[chunkSize];
-                    uint32_t _bytes = read(_file_descriptor, data, chunkSize);
+                /* A cached index that has come in since the file was loaded can make its length exact.  The deck
+                only holds the loaded file once a splice or a fade has gone over to it. */
+                if (!awaiting_splice && !fading) {
+                    duration = seek_indexes[deck].getDuration();
+                }
 
-                    if (_bytes < 0) {
-                        log_e("Error reading file %s", loadedMedia->filename.c_str());
-                        stop();
-                        break;
+                /* Keep the outgoing track coming until it runs out, the audio task fades it against silence from there */
+                if (fading && !fade_out_done) {
+                    Audio::Prefetcher& outgoing = prefetchers[fade_out_deck];
+                    fillFrom(fade_out_deck, fade_out_buffer);
+                    if (outgoing.eof() || outgoing.error()) {
+                        fade_out_done = true;
+                        outgoing_ended.store(true);
+                        fade_out_buffer->flush();
                     }
-                    bytes_read += _bytes;
-                    /* Write the data to the metadata output stream.  There's a bug in the metadata
-                    library that causes it to crash.  Might be a memory leak or null pointer dereference.
-                    For now, the workaround I've found is to call begin() and end() on the metadata_output
-                    object before and after writing data on each pass of the main loop to make sure any
-                    objects this library creates are properly initialized and destroyed. */
-                    metadata_output.begin();
-                    metadata_output.write(data, chunkSize);
-                    metadata_output.end();
-
-                    mutex.lock();
-                    ringBuffer.writeArray(data, chunkSize);
-                    mutex.unlock();
                 }
 
-                /* If the file has finished playing, stop the playback */
-                if (_bytes_available <= 0) {
-                    log_i("End of file %s", loadedMedia->filename.c_str());
+                if (prefetcher.error()) {
+                    log_e("Error reading file %s", loadedMedia->filename.c_str());
                     stop();
+                    break;
+                }
+
+                /* Open the next track while there's still plenty of this one left to play.  Only one
+                splice or fade can be in flight at a time. */
+                uint32_t remaining = remainingMs();
+                if (!next_checked && !awaiting_splice && !fading) {
+                    if (prefetcher.size() - prefetcher.position() < GAPLESS_PRELOAD_BYTES || remaining <= crossfade * 1000 + CROSSFADE_PRELOAD_MARGIN_MS) {
+                        preloadNext();
+                    }
+                }
+                if (status != TRANSPORT_PLAYING || awaiting_splice || fading) {
+                    break;
+                }
+
+                /* Fade into the next track once this one is down to the length of the fade.  If the play
+                rate isn't known yet, the end of the file is spliced instead. */
+                if (next_loaded && crossfade > 0 && remaining <= crossfade * 1000) {
+                    startFade();
+                }
+
+                /* If the file has finished playing, either follow straight on with the next track or hand
+                the tail to the audio task and stop the playback */
+                else if (prefetcher.eof()) {
+                    if (next_loaded) {
+                        spliceNext();
+                    } else {
+                        log_i("End of file %s", loadedMedia->filename.c_str());
+                        play_buffer->flush();
+                        stop();
+                    }
                 }
                 break;
+            }
 
             case REMOTE_FILE:
-                /* If the stream has finished playing, stop the playback */
-                if (!url_stream.available()) {
-                    log_i("No data available");
+                /* While the stream is down, the audio task plays on from the buffer */
+                if (network_lost.exchange(false)) {
+                    beginOutage("network lost");
+                }
+                if (in_outage && !updateReconnect()) {
+                    updateBuffering();
+                    break;
+                }
+
+                /* Once the whole of a file is in the buffer, let it play out and stop.  Nothing more is coming,
+                so it mustn't be held back waiting for the pre-roll. */
+                if (http_source.getLength() > 0 && streamWriteOffset() >= http_source.getLength()) {
+                    network_buffer.finish();
+                    if (status == TRANSPORT_BUFFERING) {
+                        status = TRANSPORT_PLAYING;
+                    } else if (network_buffer.fill() == 0) {
+                        log_i("End of stream %s", loadedMedia->url.c_str());
+                        stop();
+                    }
+                    break;
+                }
+
+                /* A stream that goes quiet has dropped */
+                if (!http_source.available()) {
                     if (connection_timeout_timer.check(CONNECTION_TIMEOUT_MS)) {
-                        log_e("Connection timeout");
                         connection_timeout_timer.reset();
-                        stop();
+                        beginOutage("no data");
                         break;
                     }
-                    break;
                 } else {
                     connection_timeout_timer.reset();
                 }
-                /* If the audio buffer has space, write the next AUDIO_BUFFER_CHUNK_SIZE
-                bytes of the stream to the buffer */
-                if (ringBuffer.availableForWrite() > AUDIO_BUFFER_WRITE_CHUNK) {
-                    uint16_t chunkSize = url_stream.available();
-                    if (chunkSize > AUDIO_BUFFER_WRITE_CHUNK) {
-                        chunkSize = AUDIO_BUFFER_WRITE_CHUNK;
-                    }
-                    uint8_t data[chunkSize];
-                    uint16_t read_bytes = url_stream.readBytes(data, chunkSize);
-                    mutex.lock();
-                    ringBuffer.writeArray(data, read_bytes);
-                    mutex.unlock();
+                /* While the network buffer has at least AUDIO_BUFFER_WRITE_CHUNK bytes free,
+                read whatever the stream has straight into the free space of the buffer */
+                while (network_buffer.availableForWrite() > AUDIO_BUFFER_WRITE_CHUNK && http_source.available() > 0) {
+                    uint8_t* data;
+                    size_t chunkSize = network_buffer.writeSpan(&data);
+                    size_t read_bytes = http_source.read(data, chunkSize);
+                    network_buffer.commitWrite(read_bytes);
+                }
+                updateBuffering();
+                if (status == TRANSPORT_PLAYING && http_source.isSeekable()) {
+                    measureStreamRate();
+                }
+
+                /* The audio task has got to where the last title came in */
+                if (stream_title_pending && (ptrdiff_t) (network_buffer.readPosition() - stream_title_at) >= 0) {
+                    stream_title_pending = false;
+                    showStreamTitle();
                 }
                 break;
         }
     }
 
-    if (playingUISound) {
+    /* Nothing more to do until the audio task drains the buffer to the low water mark.  The wait is
+    bounded since the other system services run from this same task. */
+    if (status == TRANSPORT_PLAYING || status == TRANSPORT_BUFFERING) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(AUDIO_PRODUCER_MAX_WAIT_MS));
+    }
+}
 
-        vTaskDelay(10 / portTICK_PERIOD_MS);
+/* While the buffer has at least AUDIO_BUFFER_WRITE_CHUNK bytes free, copy prefetched blocks
+of the file straight into the free space of the buffer */
+void
+Transport::fillFrom(uint8_t from_deck, Audio::RingBuffer* buffer)
+{
+    Audio::Prefetcher& prefetcher = prefetchers[from_deck];
+    while (buffer->availableForWrite() > AUDIO_BUFFER_WRITE_CHUNK && !prefetcher.eof()) {
+        uint8_t* data;
+        size_t chunkSize = buffer->writeSpan(&data);
+        size_t _bytes = prefetcher.read(data, chunkSize);
+
+        /* The prefetch task is behind, it will wake us when the next block is ready */
+        if (_bytes == 0) {
+            buffer->commitWrite(0);
+            break;
+        }
+        /* The first time a file without a seek table plays, its frames are indexed on the way past */
+        seek_indexes[from_deck].observe(data, _bytes, prefetcher.position() - _bytes);
 
-        /* If the audio buffer has space, write the next AUDIO_BUFFER_CHUNK_SIZE bytes of the sound to the buffer */
-        if (ringBuffer.availableForWrite() > AUDIO_BUFFER_WRITE_CHUNK && memory_stream.available()) {
-            uint16_t chunkSize = 0;
-            if (memory_stream.available() < AUDIO_BUFFER_WRITE_CHUNK) {
-                chunkSize = memory_stream.available();
-            } else {
-                chunkSize = AUDIO_BUFFER_WRITE_CHUNK;
-            }
-            uint8_t data[chunkSize];
-            for (int i = 0; i < chunkSize; i++) {
-                data[i] = memory_stream.read();
-            }
-            mutex.lock();
-            ringBuffer.writeArray(data, chunkSize);
-            mutex.unlock();
+        buffer->commitWrite(_bytes);
+    }
+    if (prefetcher.eof()) {
+        /* Storing a new index is SQLite work on the card, which is left to the scan task */
+        std::function<void()> store;
+        seek_indexes[from_deck].finish(&store);
+        if (store) {
+            loudness_scanner.defer(store);
         }
+    }
+}
 
-        /* If the sound has finished playing, stop the sound */
-        if (!memory_stream.available()) {
-            playingUISound = false;
-            memory_stream.clear();
+/* Stations mostly send "Artist - Title", which is split across the two fields when it's there */
+void
+Transport::showStreamTitle()
+{
+    const char* separator = strstr(stream_title, " - ");
+    if (separator) {
+        size_t length = separator - stream_title;
+        strlcpy(loaded_tags.artist, stream_title, length + 1 < sizeof(loaded_tags.artist) ? length + 1 : sizeof(loaded_tags.artist));
+        strlcpy(loaded_tags.title, separator + 3, sizeof(loaded_tags.title));
+    } else {
+        loaded_tags.artist[0] = '\0';
+        strlcpy(loaded_tags.title, stream_title, sizeof(loaded_tags.title));
+    }
+}
+
+/****************************************************
+ *
+ * Reconnecting
+ *
+ ****************************************************/
+
+void
+Transport::beginOutage(const char* reason)
+{
+    if (in_outage) {
+        return;
+    }
+    log_w("Stream dropped (%s), playing on from %d buffered bytes while reconnecting", reason, network_buffer.fill());
+    network_worker.close();
+    in_outage = true;
+    outage_started = millis();
+    retry_delay_ms = STREAM_RETRY_MIN_MS;
+    retry_at = outage_started + retry_delay_ms;
+    stream_state.store(STREAM_RETRY_WAIT);
+    stream_stats.outages++;
+}
+
+bool
+Transport::updateReconnect()
+{
+    uint8_t state = stream_state.load();
+    uint32_t now = millis();
+    if (state == STREAM_CONNECTED) {
+        uint32_t outage_ms = now - outage_started;
+        stream_stats.last_outage_ms = outage_ms;
+        stream_stats.total_outage_ms += outage_ms;
+        if (outage_ms > stream_stats.longest_outage_ms) {
+            stream_stats.longest_outage_ms = outage_ms;
         }
+        in_outage = false;
+        connection_timeout_timer.reset();
+        log_i("Stream back after %d ms", outage_ms);
+        return true;
+    }
+    if (now - outage_started >= STREAM_OUTAGE_MAX_MS) {
+        log_e("Stream still down after %d ms, giving up", now - outage_started);
+        stop();
+        return false;
+    }
+    if (state == STREAM_RETRYING || (int32_t) (now - retry_at) < 0) {
+        return false;
+    }
+
+    /* The wait doubles whether or not there's a network to try on */
+    retry_delay_ms = retry_delay_ms * 2 < STREAM_RETRY_MAX_MS ? retry_delay_ms * 2 : STREAM_RETRY_MAX_MS;
+    retry_at = now + retry_delay_ms;
+    if (WiFi.status() != WL_CONNECTED) {
+        return false;
+    }
+
+    /* A file carries on from the next byte the buffer needs, by range or by skipping up to it.  A radio
+    stream has moved on while we were away, so there's nothing to do but rejoin it. */
+    uint32_t offset = http_source.getLength() > 0 ? streamWriteOffset() : 0;
+    log_i("Reconnecting to stream at offset %d, attempt %d", offset, stream_stats.reconnects + 1);
+    stream_stats.reconnects++;
+    stream_state.store(STREAM_RETRYING);
+    connect(offset, play_position.load(), true);
+    return false;
+}
+
+void
+Transport::endOutage()
+{
+    in_outage = false;
+    stream_state.store(STREAM_CONNECTED);
+}
+
+/* Keeps the transport status in step with the network buffer.  The buffer keeps filling while
+we're buffering, the audio task just isn't allowed to drain it. */
+void
+Transport::updateBuffering()
+{
+    bool released = network_buffer.update();
+    if (released && status == TRANSPORT_BUFFERING) {
+        log_i("Buffered %d bytes, playing stream", network_buffer.fill());
+        status = TRANSPORT_PLAYING;
+    } else if (!released && status == TRANSPORT_PLAYING) {
+        log_w("Stream underrun, buffering");
+        status = TRANSPORT_BUFFERING;
     }
 }
 
@@ -595,7 +1501,7 @@ std::string
 Transport::getLoadedArtist()
 {
     if (loadedMedia->loaded) {
-        return (std::string) loadedArtist;
+        return (std::string) loaded_tags.artist;
     } else {
         return "";
     }
@@ -605,7 +1511,7 @@ std::string
 Transport::getLoadedAlbum()
 {
     if (loadedMedia->loaded) {
-        return (std::string) loadedAlbum;
+        return (std::string) loaded_tags.album;
     } else {
         return "";
     }
@@ -615,7 +1521,7 @@ std::string
 Transport::getLoadedTitle()
 {
     if (loadedMedia->loaded) {
-        return (std::string) loadedTitle;
+        return (std::string) loaded_tags.title;
     } else {
         return "";
     }
@@ -625,7 +1531,17 @@ std::string
 Transport::getLoadedGenre()
 {
     if (loadedMedia->loaded) {
-        return (std::string) loadedGenre;
+        return (std::string) loaded_tags.genre;
+    } else {
+        return "";
+    }
+}
+
+std::string
+Transport::getLoadedYear()
+{
+    if (loadedMedia->loaded) {
+        return (std::string) loaded_tags.year;
     } else {
         return "";
     }
@@ -647,8 +1563,8 @@ Transport::getLoadedURL()
  *
  ****************************************************/
 
-Transport::SpectrumAnalyzer::SpectrumAnalyzer(AudioRealFFT* fft, uint16_t bands, uint16_t decayTime_ms, uint16_t decayRate_ms)
-  : _fft(fft)
+Transport::SpectrumAnalyzer::SpectrumAnalyzer(Audio::SpectrumSource* source, uint16_t bands, uint16_t decayTime_ms, uint16_t decayRate_ms)
+  : _source(source)
   , _bands(bands)
   , _decayTime_ms(decayTime_ms)
   , _decayRate_ms(decayRate_ms)
@@ -680,44 +1596,32 @@ Transport::SpectrumAnalyzer::~SpectrumAnalyzer()
     delete[] peakVisibilityFlag;
 }
 
-/* Read the fft data and update the current and peak values */
+/* Read the newest band levels from the source and update the current and peak values */
 void
 Transport::SpectrumAnalyzer::update()
 {
-    /* Reset the values array */
-    memset(values, 0, sizeof(values) * _bands);
-
-    /* Calculate the total number of FFT bins */
-    size_t totalBins = _fft->size();
-
-    if (totalBins > 0) {
-
-        /* Calculate the number of bins per band */
-        size_t binsPerBand = totalBins / _bands;
-
-        /* Loop through each band and calculate the average value */
-        for (size_t i = 0; i < _bands; i++) {
-            /* Calculate the start and end bins for the current band */
-            size_t startBin = i * binsPerBand;
-            size_t endBin = (i + 1) * binsPerBand;
-
-            /* Calculate the average value for the current band */
-            for (size_t j = startBin; j < endBin; j++) {
-                values[i] += _fft->magnitude(j);
-            }
+    /* Nothing new from the source, the bars stay where they are */
+    float levels[SPECTRUM_BANDS];
+    if (_bands > SPECTRUM_BANDS || !_source->analyze(levels)) {
+        decayPeaks();
+        return;
+    }
 
-            values[i] /= binsPerBand;
-        }
+    /* Map the floor to an empty bar and full scale to a full one */
+    for (size_t i = 0; i < _bands; i++) {
+        float value = (levels[i] - SPECTRUM_ANALYZER_FLOOR_DB) * SPECTRUM_ANALYZER_FULL_SCALE / -SPECTRUM_ANALYZER_FLOOR_DB;
+        levels[i] = value > 0 ? value : 0;
+    }
 
-        /* Apply a bit of a smoothing effect to the values */
-        for (size_t i = 0; i < _bands; i++) {
-            values[i] = (values[i] + values[i - 1] + values[i + 1]) / 3;
-        }
+    /* Apply a bit of a smoothing effect to the values, the end bands only have one neighbour */
+    for (size_t i = 0; i < _bands; i++) {
+        float below = levels[i > 0 ? i - 1 : i];
+        float above = levels[i + 1 < _bands ? i + 1 : i];
+        values[i] = (below + levels[i] + above) / 3;
     }
 
     /* Now we will apply a simple decay to the peak values to enhance the visual effect */
     decayPeaks();
-
 }
 
 void
@@ -736,7 +1640,7 @@ Transport::SpectrumAnalyzer::clear()
 void
 Transport::SpectrumAnalyzer::clearValues()
 {
-    memset(values, 0, sizeof(values) * _bands);
+    memset(values, 0, sizeof(float) * _bands);
 }
 
 float
@@ -814,12 +1718,11 @@ Transport::SpectrumAnalyzer::decayPeaks()
  *
  ****************************************************/
 
-// FIXME: cast to float before division
 void
 Transport::EqualizerController::setBass(uint8_t bass)
 {
     _bass = bass;
-    cfg.gain_low = (float) bass / TRANSPORT_MAX_BASS;
+    setBand(BAND_BASS, BAND_LOW_SHELF, TRANSPORT_BASS_CENTER_FREQ, toGain(bass, TRANSPORT_MAX_BASS));
     Config_Manager::get_handle()->setBass(bass);
 }
 
@@ -827,7 +1730,7 @@ void
 Transport::EqualizerController::setMid(uint8_t mid)
 {
     _mid = mid;
-    cfg.gain_medium = (float) mid / TRANSPORT_MAX_MID;
+    setBand(BAND_MID, BAND_PEAK, TRANSPORT_MID_CENTER_FREQ, toGain(mid, TRANSPORT_MAX_MID));
     Config_Manager::get_handle()->setMid(mid);
 }
 
@@ -835,43 +1738,6 @@ void
 Transport::EqualizerController::setTreble(uint8_t treble)
 {
     _treble = treble;
-    cfg.gain_high = (float) treble / TRANSPORT_MAX_TREBLE;
+    setBand(BAND_TREBLE, BAND_HIGH_SHELF, TRANSPORT_TREBLE_CENTER_FREQ, toGain(treble, TRANSPORT_MAX_TREBLE));
     Config_Manager::get_handle()->setTreble(treble);
 }
-
-/****************************************************
- *
- * Metadata callback
- *
- ****************************************************/
-char Transport::loadedAlbum[255];
-char Transport::loadedArtist[255];
-char Transport::loadedTitle[255];
-char Transport::loadedGenre[255];
-char Transport::loadedYear[255];
-
-void
-Transport::metadataCallback(MetaDataType info, const char* str, int len)
-{
-    log_i("Metadata callback: %d, %s, %d", info, str, len);
-    if (len && info && str) {
-        if (len > 254) {
-            len = 254;
-        }
-        switch (info) {
-            case Title:
-                strncpy(loadedTitle, str, len);
-                /* Check for a null terminator and add one if it's not there */
-                break;
-            case Artist:
-                strncpy(loadedArtist, str, len);
-                break;
-            case Album:
-                strncpy(loadedAlbum, str, len);
-                break;
-            case Genre:
-                strncpy(loadedGenre, str, len);
-                break;
-        }
-    }
-}
\ No newline at end of file
@@ -64,7 +64,7 @@ UI::FileBrowser::refresh()
 MediaData
 UI::FileBrowser::get()
 {
-    Transport::get_handle()->playUIsound(folder_open, folder_open_len);
+    Transport::get_handle()->playUIsound(UI_SOUND_FOLDER_OPEN);
     
     if (file_explorer == nullptr) {
         file_explorer = new File_Explorer();
@@ -90,7 +90,7 @@ UI::FileBrowser::get()
         } else {
             MediaData selectedFile = file_explorer->get_file(selection);
             if (selectedFile.type == FILETYPE_DIR) {
-                Transport::get_handle()->playUIsound(folder_open, folder_open_len);
+                Transport::get_handle()->playUIsound(UI_SOUND_FOLDER_OPEN);
                 if (file_explorer->open_dir(selectedFile, _status_callback) == File_Explorer::ERROR_NONE) {
                     positionHistory.push_back(listSelection.get_position());
                     listSelection.reset_position();
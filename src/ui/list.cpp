@@ -53,25 +53,25 @@ UI::ListSelection::_get()
             cursorDown();
 
         if (Buttons::get_handle()->getButtonEvent(BUTTON_PLAY, SHORTPRESS)) {
-            Transport::get_handle()->playUIsound(load_item, load_item_len);
+            Transport::get_handle()->playUIsound(UI_SOUND_LOAD_ITEM);
             _refresh = true;
             return current_position.index;
         }
 
         if (Buttons::get_handle()->getButtonEvent(BUTTON_EXIT, SHORTPRESS)) {
-            Transport::get_handle()->playUIsound(folder_close, folder_close_len);
+            Transport::get_handle()->playUIsound(UI_SOUND_FOLDER_CLOSE);
             _refresh = true;
             return UI_EXIT;
         }
 
         if (Buttons::get_handle()->getButtonEvent(BUTTON_STOP, SHORTPRESS)) {
-            Transport::get_handle()->playUIsound(folder_close, folder_close_len);
+            Transport::get_handle()->playUIsound(UI_SOUND_FOLDER_CLOSE);
             _refresh = true;
             return UI_BACK;
         }
 
         if (Buttons::get_handle()->getButtonEvent(BUTTON_MENU, SHORTPRESS)) {
-            Transport::get_handle()->playUIsound(folder_open, folder_close_len);
+            Transport::get_handle()->playUIsound(UI_SOUND_FOLDER_OPEN);
             _refresh = true;
             if (_callback) {
                 this->_callback();
@@ -272,7 +272,7 @@ UI::ListSelection::cursorUp()
     if (current_position.cursor > 0) {
         current_position.cursor--;
         current_position.index--;
-        Transport::get_handle()->playUIsound(click, click_len);
+        Transport::get_handle()->playUIsound(UI_SOUND_CLICK);
     }
 
     else if (current_position.cursor == 0 && current_position.page > 1) {
@@ -280,7 +280,7 @@ UI::ListSelection::cursorUp()
         current_position.cursor = MAX_TEXT_LINES - 1;
         current_position.index--;
         _refresh = true;
-        Transport::get_handle()->playUIsound(click, click_len);
+        Transport::get_handle()->playUIsound(UI_SOUND_CLICK);
     }
 }
 
@@ -290,7 +290,7 @@ UI::ListSelection::cursorDown()
     if (current_position.cursor < MAX_TEXT_LINES - 1 && current_position.page <= numPages() && current_position.index < numItems - 1) {
         current_position.cursor++;
         current_position.index++;
-        Transport::get_handle()->playUIsound(click, click_len);
+        Transport::get_handle()->playUIsound(UI_SOUND_CLICK);
     }
 
     else if (current_position.cursor == MAX_TEXT_LINES - 1 && current_position.page < numPages()) {
@@ -298,7 +298,7 @@ UI::ListSelection::cursorDown()
         current_position.cursor = 0;
         current_position.index++;
         _refresh = true;
-        Transport::get_handle()->playUIsound(click, click_len);
+        Transport::get_handle()->playUIsound(UI_SOUND_CLICK);
     }
 }
 
@@ -40,6 +40,11 @@ UI::SpectrumAnalyzer::SpectrumAnalyzer()
 void
 UI::SpectrumAnalyzer::draw(uint16_t x, uint16_t y, uint16_t width, uint16_t height)
 {
+#if OUTPUT_STAGE_METER
+    drawMeter(x, y, width, height);
+    return;
+#endif
+
     if (_updateTimer.check(refresh_interval)) {
         Transport::get_handle()->spectrumAnalyzer->getVals(_currentVal, _peak);
     }
@@ -70,4 +75,55 @@ UI::SpectrumAnalyzer::draw(uint16_t x, uint16_t y, uint16_t width, uint16_t heig
             }
         }
     }
-}
\ No newline at end of file
+}
+
+/* One bar per channel, across the width the spectrum would take, with the peak as a tick past the end */
+void
+UI::SpectrumAnalyzer::drawMeter(uint16_t x, uint16_t y, uint16_t width, uint16_t height)
+{
+    if (_updateTimer.check(refresh_interval)) {
+        Audio::LevelMeter::levels_t levels;
+        bool fresh = Transport::get_handle()->getLevels(levels);
+        if (fresh) {
+            meter_channels = levels.channels;
+        }
+        for (uint8_t channel = 0; channel < meter_channels; channel++) {
+            meter_rms[channel] -= meter_fall_db;
+            if (fresh && levels.rms[channel] > meter_rms[channel]) {
+                meter_rms[channel] = levels.rms[channel];
+            }
+            if (fresh && levels.peak[channel] >= meter_peak[channel]) {
+                meter_peak[channel] = levels.peak[channel];
+                meter_peak_time[channel] = millis();
+            } else if (millis() - meter_peak_time[channel] > SPECTRUM_ANALYZER_PEAK_DECAY_MS) {
+                meter_peak[channel] -= meter_fall_db;
+            }
+            if (meter_rms[channel] < SPECTRUM_ANALYZER_FLOOR_DB) {
+                meter_rms[channel] = SPECTRUM_ANALYZER_FLOOR_DB;
+            }
+            if (meter_peak[channel] < SPECTRUM_ANALYZER_FLOOR_DB) {
+                meter_peak[channel] = SPECTRUM_ANALYZER_FLOOR_DB;
+            }
+        }
+    }
+
+    /* A mono source shows the same level on both bars */
+    const uint16_t span = 2 * bands * (width + 1);
+    const uint16_t bar = (height - 1) / 2;
+    for (uint8_t row = 0; row < 2; row++) {
+        uint8_t channel = row < meter_channels ? row : 0;
+        uint16_t top = y + row * (bar + 1);
+        uint16_t rms = (meter_rms[channel] - SPECTRUM_ANALYZER_FLOOR_DB) * span / -SPECTRUM_ANALYZER_FLOOR_DB;
+        uint16_t peak = (meter_peak[channel] - SPECTRUM_ANALYZER_FLOOR_DB) * span / -SPECTRUM_ANALYZER_FLOOR_DB;
+        if (rms > span) {
+            rms = span;
+        }
+        if (peak > span) {
+            peak = span;
+        }
+        display->fillRect(x, top, rms, bar, WHITE);
+        if (peak > 0) {
+            display->drawFastVLine(x + peak - 1, top, bar, WHITE);
+        }
+    }
+}
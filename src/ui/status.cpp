@@ -57,6 +57,11 @@ UI::StatusScreen::StatusScreen()
     marquee_connectStatus->addText("Connecting.");
     marquee_connectStatus->addText("Connecting..");
     marquee_connectStatus->addText("Connecting...");
+    marquee_bufferStatus = new Marquee("Buffering");
+    marquee_bufferStatus->setSwitchInterval(150);
+    marquee_bufferStatus->addText("Buffering.");
+    marquee_bufferStatus->addText("Buffering..");
+    marquee_bufferStatus->addText("Buffering...");
 
     /* Set up the spectrum analyzer */
     spectrumAnalyzer = new SpectrumAnalyzer();
@@ -82,12 +87,15 @@ UI::StatusScreen::draw()
     }
 
     // Display the filename or info of the currently loaded media
-    if (Transport::get_handle()->getStatus() != TRANSPORT_IDLE && Transport::get_handle()->getStatus() != TRANSPORT_CONNECTING) {
+    if (Transport::get_handle()->getStatus() != TRANSPORT_IDLE && Transport::get_handle()->getStatus() != TRANSPORT_CONNECTING && Transport::get_handle()->getStatus() != TRANSPORT_BUFFERING) {
         marquee_mediainfo->draw(0, 24);
     } 
     else if (Transport::get_handle()->getStatus() == TRANSPORT_CONNECTING) {
         marquee_connectStatus->draw(0, 24);
     }
+    else if (Transport::get_handle()->getStatus() == TRANSPORT_BUFFERING) {
+        marquee_bufferStatus->draw(0, 24);
+    }
     else {
         // Display the current system time and date
         marquee_datetime->draw(0, 24);
@@ -124,13 +132,25 @@ UI::StatusScreen::draw()
         spectrumAnalyzer->draw(27, 2, 2, 9);
     }
 
-    // Draw the play time
-    uint32_t playTime = Transport::get_handle()->getPlayTime();
-    uint8_t hours = playTime / 3600;
-    uint8_t minutes = (playTime % 3600) / 60;
-    uint8_t seconds = playTime % 60;
-
+    // Draw the play time, followed by the length of the file when its headers give one
     display->setCursor(23, 14);
+    printTime(Transport::get_handle()->getPlayTime() / 1000);
+    uint32_t duration = Transport::get_handle()->getDuration();
+    if (duration > 0 && Transport::get_handle()->getStatus() != TRANSPORT_IDLE) {
+        display->print("/");
+        printTime(duration / 1000);
+    }
+
+    display->display();
+}
+
+void
+UI::StatusScreen::printTime(uint32_t time)
+{
+    uint8_t hours = time / 3600;
+    uint8_t minutes = (time % 3600) / 60;
+    uint8_t seconds = time % 60;
+
     if (hours < 10)
         display->print("0");
     display->print(hours);
@@ -142,6 +162,4 @@ UI::StatusScreen::draw()
     if (seconds < 10)
         display->print("0");
     display->print(seconds);
-
-    display->display();
-}
\ No newline at end of file
+}
@@ -65,17 +65,17 @@ UI::ValueSelector::get()
     while (true) {
 
         if (Buttons::get_handle()->getButtonEvent(BUTTON_EXIT, SHORTPRESS)) {
-            Transport::get_handle()->playUIsound(folder_close, folder_close_len);
+            Transport::get_handle()->playUIsound(UI_SOUND_FOLDER_CLOSE);
             return UI_EXIT;
         }
 
         if (Buttons::get_handle()->getButtonEvent(BUTTON_STOP, SHORTPRESS)) {
-            Transport::get_handle()->playUIsound(folder_close, folder_close_len);
+            Transport::get_handle()->playUIsound(UI_SOUND_FOLDER_CLOSE);
             return UI_EXIT;
         }
 
         if (Buttons::get_handle()->getButtonEvent(BUTTON_PLAY, SHORTPRESS)) {
-            Transport::get_handle()->playUIsound(folder_close, folder_close_len);
+            Transport::get_handle()->playUIsound(UI_SOUND_FOLDER_CLOSE);
             return _value;
         }
 
@@ -116,7 +116,7 @@ UI::ValueSelector::inc()
         if (_value < _maxVal)
             _value += _step;
     }
-    Transport::get_handle()->playUIsound(click, click_len);
+    Transport::get_handle()->playUIsound(UI_SOUND_CLICK);
     exitTimer.reset();
 }
 
@@ -130,7 +130,7 @@ UI::ValueSelector::dec()
         if (_value > _minVal)
             _value -= _step;
     }
-    Transport::get_handle()->playUIsound(click, click_len);
+    Transport::get_handle()->playUIsound(UI_SOUND_CLICK);
     exitTimer.reset();
 }
 
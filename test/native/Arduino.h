@@ -0,0 +1,158 @@
+/**
+ * @file Arduino.h
+ *
+ * @brief Host stand-in for the parts of the Arduino core that the modules under test use.  Part of
+ * the native tests.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef native_arduino_h
+#define native_arduino_h
+
+/* The C headers, as the core's Arduino.h has them, so isnan() and the rest are in the global namespace */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <esp_heap_caps.h> /* The core's Arduino.h brings it in by way of esp32-hal.h */
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#define PI 3.1415926535897932384626433832795
+
+/* Warnings and errors go to stderr so a failing test shows why, the chatter is left out */
+#define log_e(format, ...) fprintf(stderr, "[E] " format "\n", ##__VA_ARGS__)
+#define log_w(format, ...) fprintf(stderr, "[W] " format "\n", ##__VA_ARGS__)
+#define log_i(format, ...) ((void) 0)
+#define log_d(format, ...) ((void) 0)
+
+inline unsigned long
+millis()
+{
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline unsigned long
+micros()
+{
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline void
+delay(uint32_t ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+#if !defined(__GLIBC__) || !__GLIBC_PREREQ(2, 38)
+inline size_t
+strlcpy(char* destination, const char* source, size_t size)
+{
+    size_t length = strlen(source);
+    if (size > 0) {
+        size_t copied = length < size - 1 ? length : size - 1;
+        memcpy(destination, source, copied);
+        destination[copied] = '\0';
+    }
+    return length;
+}
+#endif
+
+class String : public std::string
+{
+  public:
+    using std::string::string;
+    String(const std::string& string)
+      : std::string(string)
+    {
+    }
+};
+
+class IPAddress
+{
+  public:
+    IPAddress() = default;
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+      : bytes{ a, b, c, d }
+    {
+    }
+    uint8_t operator[](int index) const { return bytes[index]; }
+    bool operator==(const IPAddress& other) const { return memcmp(bytes, other.bytes, sizeof(bytes)) == 0; }
+    bool operator!=(const IPAddress& other) const { return !(*this == other); }
+    String toString() const
+    {
+        char text[16];
+        snprintf(text, sizeof(text), "%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
+        return String(text);
+    }
+
+  private:
+    uint8_t bytes[4] = {};
+};
+
+class Print
+{
+  public:
+    virtual ~Print() = default;
+    virtual size_t write(uint8_t data) = 0;
+    virtual size_t write(const uint8_t* data, size_t length)
+    {
+        size_t written = 0;
+        while (written < length && write(data[written])) {
+            written++;
+        }
+        return written;
+    }
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+};
+
+class Stream : public Print
+{
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual size_t readBytes(uint8_t* data, size_t length)
+    {
+        size_t count = 0;
+        while (count < length) {
+            int c = read();
+            if (c < 0) {
+                break;
+            }
+            data[count++] = (uint8_t) c;
+        }
+        return count;
+    }
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+
+  protected:
+    unsigned long _timeout = 1000;
+};
+
+#endif
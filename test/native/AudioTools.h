@@ -0,0 +1,211 @@
+/**
+ * @file AudioTools.h
+ *
+ * @brief The parts of arduino-audio-tools the modules under test use: the audio format, the
+ * decoder interface and URLStream.  Part of the native tests.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef native_audiotools_h
+#define native_audiotools_h
+
+#include <Arduino.h>
+#include <Client.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace audio_tools {
+
+struct AudioInfo
+{
+    int sample_rate = 0;
+    int channels = 0;
+    int bits_per_sample = 16;
+};
+
+/* Decoders write what they decode to the output they're given, and report the format of it through audioInfo() */
+class AudioDecoder : public Print
+{
+  public:
+    virtual void setOutput(Print& output) { this->output = &output; }
+    virtual AudioInfo audioInfo() { return info; }
+    virtual bool begin() { return true; }
+    virtual void end() {}
+    virtual operator bool() { return true; }
+    size_t write(uint8_t data) override { return write(&data, 1); }
+    size_t write(const uint8_t* data, size_t length) override = 0;
+
+  protected:
+    Print* output = nullptr;
+    AudioInfo info;
+};
+
+/* A GET over HTTP/1.1 on the client it's given, which it connects unless it's connected already.  The body is read
+straight from the client, up to the Content-Length if the reply has one. */
+class URLStream : public Stream
+{
+  public:
+    void setClient(Client& client) { this->client = &client; }
+    void setWaitForData(bool wait) { (void) wait; } /* Reads never wait here */
+
+    /* A header of the same name replaces the one set before */
+    void addRequestHeader(const char* name, const char* value)
+    {
+        for (auto& header : request_headers) {
+            if (strcasecmp(header.first.c_str(), name) == 0) {
+                header.second = value;
+                return;
+            }
+        }
+        request_headers.push_back({ name, value });
+    }
+
+    /* Returns true for a 2xx reply */
+    bool begin(const char* url)
+    {
+        reply_headers.clear();
+        status = 0;
+        left = -1;
+        if (!client) {
+            return false;
+        }
+        std::string address = url;
+        size_t scheme = address.find("://");
+        bool secure = address.compare(0, scheme, "https") == 0;
+        std::string rest = scheme == std::string::npos ? address : address.substr(scheme + 3);
+        size_t slash = rest.find('/');
+        std::string host = rest.substr(0, slash);
+        std::string path = slash == std::string::npos ? "/" : rest.substr(slash);
+        uint16_t port = secure ? 443 : 80;
+        size_t colon = host.find(':');
+        if (colon != std::string::npos) {
+            port = atoi(host.c_str() + colon + 1);
+            host.resize(colon);
+        }
+        if (!client->connected() && !client->connect(host.c_str(), port)) {
+            return false;
+        }
+
+        std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + host + "\r\n";
+        for (auto& header : request_headers) {
+            request += header.first + ": " + header.second + "\r\n";
+        }
+        request += "\r\n";
+        if (client->write((const uint8_t*) request.data(), request.size()) != request.size()) {
+            return false;
+        }
+
+        /* The status line and headers, a byte at a time so none of the body is taken with them */
+        std::string head;
+        uint32_t start = millis();
+        while (head.find("\r\n\r\n") == std::string::npos) {
+            int c = client->read();
+            if (c >= 0) {
+                head += (char) c;
+            } else if (!client->connected() || millis() - start > _timeout * 5) {
+                return false;
+            }
+        }
+        size_t space = head.find(' ');
+        status = space == std::string::npos ? 0 : atoi(head.c_str() + space + 1);
+        size_t line = head.find("\r\n");
+        while (line + 4 <= head.size()) {
+            size_t next = head.find("\r\n", line + 2);
+            std::string text = head.substr(line + 2, next - line - 2);
+            size_t separator = text.find(':');
+            if (separator != std::string::npos) {
+                size_t value = text.find_first_not_of(' ', separator + 1);
+                reply_headers.push_back({ text.substr(0, separator), value == std::string::npos ? "" : text.substr(value) });
+            }
+            line = next;
+        }
+        const char* content_length = getReplyHeader("Content-Length");
+        left = content_length ? atol(content_length) : -1;
+        return status >= 200 && status < 300;
+    }
+
+    void end()
+    {
+        if (client) {
+            client->stop();
+        }
+        reply_headers.clear();
+        status = 0;
+        left = -1;
+    }
+
+    /* Names are matched without regard to case */
+    const char* getReplyHeader(const char* name)
+    {
+        for (auto& header : reply_headers) {
+            if (strcasecmp(header.first.c_str(), name) == 0) {
+                return header.second.c_str();
+            }
+        }
+        return nullptr;
+    }
+
+    int available() override
+    {
+        if (!client || status == 0) {
+            return 0;
+        }
+        long ready = client->available();
+        return left >= 0 && left < ready ? left : ready;
+    }
+    size_t readBytes(uint8_t* data, size_t length) override
+    {
+        size_t ready = available();
+        if (length > ready) {
+            length = ready;
+        }
+        int got = length ? client->read(data, length) : 0;
+        if (got <= 0) {
+            return 0;
+        }
+        if (left >= 0) {
+            left -= got;
+        }
+        return got;
+    }
+    int read() override
+    {
+        uint8_t data;
+        return readBytes(&data, 1) == 1 ? data : -1;
+    }
+    int peek() override { return available() ? client->peek() : -1; }
+    size_t write(uint8_t data) override
+    {
+        (void) data;
+        return 0;
+    }
+
+  private:
+    Client* client = nullptr;
+    std::vector<std::pair<std::string, std::string>> request_headers;
+    std::vector<std::pair<std::string, std::string>> reply_headers;
+    int status = 0;
+    long left = -1; /* Bytes of the body still to come, -1 without a Content-Length */
+};
+
+} // namespace audio_tools
+
+#endif
@@ -0,0 +1,44 @@
+/**
+ * @file Mutex.h
+ *
+ * @brief Host stand-in for the audio tools mutex.  Part of the native tests.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef native_mutex_h
+#define native_mutex_h
+
+#include <mutex>
+
+namespace audio_tools {
+
+class Mutex
+{
+  public:
+    void lock() { mutex.lock(); }
+    void unlock() { mutex.unlock(); }
+
+  private:
+    std::mutex mutex;
+};
+
+} // namespace audio_tools
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ * @file SdFat.h
+ *
+ * @brief Host stand-in for the SdFat file class, over stdio.  Part of the native tests.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef native_sdfat_h
+#define native_sdfat_h
+
+#include <Arduino.h>
+#include <fcntl.h>
+
+/* Read only, which is all the modules under test ask for */
+class FsFile
+{
+  public:
+    ~FsFile() { close(); }
+
+    bool open(const char* path, int flags = O_RDONLY)
+    {
+        close();
+        if ((flags & O_ACCMODE) != O_RDONLY) {
+            return false;
+        }
+        file = fopen(path, "rb");
+        return file != nullptr;
+    }
+    bool close()
+    {
+        if (file) {
+            fclose(file);
+            file = nullptr;
+        }
+        return true;
+    }
+    bool isOpen() { return file != nullptr; }
+    uint64_t size()
+    {
+        if (!file) {
+            return 0;
+        }
+        long position = ftell(file);
+        fseek(file, 0, SEEK_END);
+        long end = ftell(file);
+        fseek(file, position, SEEK_SET);
+        return end;
+    }
+    uint64_t position() { return file ? ftell(file) : 0; }
+    bool seek(uint64_t position) { return file && position <= size() && fseek(file, position, SEEK_SET) == 0; }
+    int read(void* data, size_t length) { return file ? (int) fread(data, 1, length, file) : -1; }
+    int read()
+    {
+        uint8_t byte;
+        return read(&byte, 1) == 1 ? byte : -1;
+    }
+    operator bool() { return isOpen(); }
+
+  private:
+    FILE* file = nullptr;
+};
+
+#endif
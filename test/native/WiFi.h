@@ -0,0 +1,173 @@
+/**
+ * @file WiFi.h
+ *
+ * @brief WiFiClient over a host socket, and the lookup from WiFi.  Part of the native tests.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef native_wifi_h
+#define native_wifi_h
+
+#include <Client.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+class WiFiClass
+{
+  public:
+    /* Returns 1 with the first IPv4 address of the host, as the core's lookup does */
+    int hostByName(const char* host, IPAddress& ip)
+    {
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        addrinfo* result = nullptr;
+        if (getaddrinfo(host, nullptr, &hints, &result) != 0 || !result) {
+            return 0;
+        }
+        const uint8_t* address = (const uint8_t*) &((sockaddr_in*) result->ai_addr)->sin_addr;
+        ip = IPAddress(address[0], address[1], address[2], address[3]);
+        freeaddrinfo(result);
+        return 1;
+    }
+};
+
+inline WiFiClass WiFi;
+
+/* The same connect() overloads as the ESP32 core's WiFiClient.  Reads never wait, like the lwIP one. */
+class WiFiClient : public Client
+{
+  public:
+    ~WiFiClient() { stop(); }
+
+    int connect(IPAddress ip, uint16_t port) override { return connect(ip, port, _timeout); }
+    int connect(const char* host, uint16_t port) override { return connect(host, port, _timeout); }
+    virtual int connect(const char* host, uint16_t port, int32_t timeout_ms)
+    {
+        IPAddress ip;
+        if (!WiFi.hostByName(host, ip)) {
+            return 0;
+        }
+        return connect(ip, port, timeout_ms);
+    }
+    virtual int connect(IPAddress ip, uint16_t port, int32_t timeout_ms)
+    {
+        stop();
+        socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (socket_fd < 0) {
+            return 0;
+        }
+        timeval timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+        setsockopt(socket_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        int one = 1;
+        setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        uint8_t* bytes = (uint8_t*) &address.sin_addr;
+        for (int i = 0; i < 4; i++) {
+            bytes[i] = ip[i];
+        }
+        if (::connect(socket_fd, (sockaddr*) &address, sizeof(address)) != 0) {
+            stop();
+            return 0;
+        }
+        return 1;
+    }
+    int setTimeout(uint32_t seconds)
+    {
+        _timeout = seconds * 1000;
+        return 0;
+    }
+
+    size_t write(uint8_t data) override { return write(&data, 1); }
+    size_t write(const uint8_t* data, size_t length) override
+    {
+        size_t sent = 0;
+        while (socket_fd >= 0 && sent < length) {
+            ssize_t result = send(socket_fd, data + sent, length - sent, MSG_NOSIGNAL);
+            if (result <= 0) {
+                break;
+            }
+            sent += result;
+        }
+        return sent;
+    }
+    int available() override
+    {
+        int count = 0;
+        if (socket_fd < 0 || ioctl(socket_fd, FIONREAD, &count) != 0) {
+            return 0;
+        }
+        return count;
+    }
+    int read() override
+    {
+        uint8_t data;
+        return read(&data, 1) == 1 ? data : -1;
+    }
+    int read(uint8_t* data, size_t length) override
+    {
+        if (socket_fd < 0) {
+            return -1;
+        }
+        ssize_t result = recv(socket_fd, data, length, MSG_DONTWAIT);
+        return result > 0 ? (int) result : -1;
+    }
+    size_t readBytes(uint8_t* data, size_t length) override
+    {
+        int result = read(data, length);
+        return result > 0 ? result : 0;
+    }
+    int peek() override
+    {
+        uint8_t data;
+        return socket_fd >= 0 && recv(socket_fd, &data, 1, MSG_PEEK | MSG_DONTWAIT) == 1 ? data : -1;
+    }
+    void flush() override {}
+    void stop() override
+    {
+        if (socket_fd >= 0) {
+            close(socket_fd);
+            socket_fd = -1;
+        }
+    }
+    /* Connected while there's data left to read or the other end hasn't closed */
+    uint8_t connected() override
+    {
+        if (socket_fd < 0) {
+            return 0;
+        }
+        uint8_t data;
+        ssize_t result = recv(socket_fd, &data, 1, MSG_PEEK | MSG_DONTWAIT);
+        return result > 0 || (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+    }
+    operator bool() override { return connected(); }
+
+  private:
+    int socket_fd = -1;
+};
+
+#endif
@@ -0,0 +1,40 @@
+/**
+ * @file byte_pattern.h
+ *
+ * @brief The bytes the stand-in servers send for a file or a stream, so a test can check each one
+ * it reads.  Part of the native tests.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef native_byte_pattern_h
+#define native_byte_pattern_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The byte at a position, a pattern that doesn't repeat on any power of two, so a byte read at the wrong offset or
+anything else left in the data shows */
+inline uint8_t
+pattern(size_t position)
+{
+    return (position * 7 + position / 251) & 0xff;
+}
+
+#endif
@@ -0,0 +1,57 @@
+/**
+ * @file esp_heap_caps.h
+ *
+ * @brief The capability based allocator, over malloc().  Part of the native tests.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef native_esp_heap_caps_h
+#define native_esp_heap_caps_h
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MALLOC_CAP_8BIT     (1 << 2)
+#define MALLOC_CAP_DMA      (1 << 3)
+#define MALLOC_CAP_SPIRAM   (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+/* There's one kind of memory on the host, the capabilities are ignored */
+inline void*
+heap_caps_malloc(size_t size, uint32_t caps)
+{
+    (void) caps;
+    return malloc(size);
+}
+
+inline void*
+heap_caps_calloc(size_t count, size_t size, uint32_t caps)
+{
+    (void) caps;
+    return calloc(count, size);
+}
+
+inline void
+heap_caps_free(void* data)
+{
+    free(data);
+}
+
+#endif
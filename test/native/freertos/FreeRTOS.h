@@ -0,0 +1,40 @@
+/**
+ * @file FreeRTOS.h
+ *
+ * @brief The FreeRTOS types and macros the modules under test use.  Part of the native tests.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef native_freertos_h
+#define native_freertos_h
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+
+#define pdFALSE        ((BaseType_t) 0)
+#define pdTRUE         ((BaseType_t) 1)
+#define pdPASS         pdTRUE
+#define portMAX_DELAY  ((TickType_t) 0xffffffffUL)
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms))
+
+#endif
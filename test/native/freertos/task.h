@@ -0,0 +1,62 @@
+/**
+ * @file task.h
+ *
+ * @brief Task handles and notifications, over std::thread.  Part of the native tests.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef native_freertos_task_h
+#define native_freertos_task_h
+
+#include <freertos/FreeRTOS.h>
+
+#include <chrono>
+#include <thread>
+
+/* A task is a thread, its handle just has to be something that isn't null */
+typedef void* TaskHandle_t;
+
+inline TaskHandle_t
+xTaskGetCurrentTaskHandle()
+{
+    static thread_local char task;
+    return &task;
+}
+
+/* The tests poll rather than sleep on notifications, so giving one has nothing to wake */
+inline void
+xTaskNotifyGive(TaskHandle_t task)
+{
+    (void) task;
+}
+
+inline void
+vTaskDelay(TickType_t ticks)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+inline void
+taskYIELD()
+{
+    std::this_thread::yield();
+}
+
+#endif
@@ -0,0 +1,209 @@
+/**
+ * @file http_stand_in.h
+ *
+ * @brief A small HTTP server on the loopback interface for the network tests to talk to, with the
+ * replies left to each test.  Part of the native tests.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef native_http_stand_in_h
+#define native_http_stand_in_h
+
+#include <Arduino.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+/* One connection at a time, which is all the player ever has open to a server */
+class HttpStandIn
+{
+  public:
+    struct request_t
+    {
+        std::string method;
+        std::string path;
+        std::map<std::string, std::string> headers; /* Names in lower case */
+
+        const char* header(const char* name) const
+        {
+            auto found = headers.find(name);
+            return found == headers.end() ? nullptr : found->second.c_str();
+        }
+    };
+
+    /* The test's side of a connection, to send the reply on */
+    class Connection
+    {
+      public:
+        explicit Connection(int socket_fd)
+          : socket_fd(socket_fd)
+        {
+        }
+        bool send(const void* data, size_t length)
+        {
+            const uint8_t* bytes = (const uint8_t*) data;
+            while (length > 0) {
+                ssize_t sent = ::send(socket_fd, bytes, length, MSG_NOSIGNAL);
+                if (sent <= 0) {
+                    return false;
+                }
+                bytes += sent;
+                length -= sent;
+            }
+            return true;
+        }
+        bool send(const std::string& text) { return send(text.data(), text.size()); }
+
+      private:
+        int socket_fd;
+    };
+
+    /* Called for each request.  Returns true to keep the connection open for another one. */
+    typedef std::function<bool(Connection& connection, const request_t& request)> handler_t;
+
+    ~HttpStandIn() { end(); }
+
+    /* Listens on an ephemeral port of 127.0.0.1.  Returns false if the socket couldn't be set up. */
+    bool begin(handler_t handler)
+    {
+        this->handler = handler;
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        if (listen_fd < 0 || bind(listen_fd, (sockaddr*) &address, sizeof(address)) != 0 || listen(listen_fd, 4) != 0 ||
+            getsockname(listen_fd, (sockaddr*) &address, &length) != 0) {
+            end();
+            return false;
+        }
+        _port = ntohs(address.sin_port);
+        running = true;
+        server = std::thread([this]() { serve(); });
+        return true;
+    }
+
+    void end()
+    {
+        running = false;
+        if (server.joinable()) {
+            server.join();
+        }
+        if (listen_fd >= 0) {
+            close(listen_fd);
+            listen_fd = -1;
+        }
+    }
+
+    uint16_t port() { return _port; }
+    uint32_t connections() { return _connections; }
+    uint32_t requests() { return _requests; }
+
+  private:
+    void serve()
+    {
+        while (running) {
+            pollfd listener = { listen_fd, POLLIN, 0 };
+            if (poll(&listener, 1, 50) <= 0) {
+                continue;
+            }
+            int socket_fd = accept(listen_fd, nullptr, nullptr);
+            if (socket_fd < 0) {
+                continue;
+            }
+            _connections++;
+            Connection connection(socket_fd);
+            std::string pending;
+            request_t request;
+            while (running && readRequest(socket_fd, pending, request)) {
+                _requests++;
+                if (!handler(connection, request)) {
+                    break;
+                }
+            }
+            close(socket_fd);
+        }
+    }
+
+    /* Reads up to the blank line that ends the headers, which is all a GET has */
+    bool readRequest(int socket_fd, std::string& pending, request_t& request)
+    {
+        size_t end;
+        while ((end = pending.find("\r\n\r\n")) == std::string::npos) {
+            pollfd client = { socket_fd, POLLIN, 0 };
+            if (!running) {
+                return false;
+            }
+            if (poll(&client, 1, 50) <= 0) {
+                continue;
+            }
+            char data[1024];
+            ssize_t received = recv(socket_fd, data, sizeof(data), 0);
+            if (received <= 0) {
+                return false;
+            }
+            pending.append(data, received);
+        }
+        std::string head = pending.substr(0, end);
+        pending.erase(0, end + 4);
+
+        request = request_t();
+        size_t line_end = head.find("\r\n");
+        std::string line = head.substr(0, line_end);
+        size_t space = line.find(' ');
+        request.method = line.substr(0, space);
+        request.path = line.substr(space + 1, line.find(' ', space + 1) - space - 1);
+        while (line_end != std::string::npos) {
+            size_t start = line_end + 2;
+            line_end = head.find("\r\n", start);
+            line = head.substr(start, line_end == std::string::npos ? std::string::npos : line_end - start);
+            size_t colon = line.find(':');
+            if (colon == std::string::npos) {
+                continue;
+            }
+            std::string name = line.substr(0, colon);
+            for (char& c : name) {
+                c = tolower(c);
+            }
+            size_t value = line.find_first_not_of(' ', colon + 1);
+            request.headers[name] = value == std::string::npos ? "" : line.substr(value);
+        }
+        return true;
+    }
+
+    handler_t handler;
+    int listen_fd = -1;
+    uint16_t _port = 0;
+    std::atomic<bool> running{ false };
+    std::atomic<uint32_t> _connections{ 0 };
+    std::atomic<uint32_t> _requests{ 0 };
+    std::thread server;
+};
+
+#endif
@@ -0,0 +1,72 @@
+/**
+ * @file native.h
+ *
+ * @brief Included ahead of every file of the native tests, in place of the firmware headers that
+ * pull in the whole player.  Part of the native tests.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef native_h
+#define native_h
+
+#ifdef __cplusplus
+
+/* card_manager.h and system.h bring in the transport, the UI and the rest of the firmware.  Defining their guards
+here keeps them out, and the little the modules under test need from them is declared below instead. */
+#define card_manager_h
+#define system_h
+
+#include <AudioTools/Concurrency/Mutex.h>
+#include <SdFat.h> /* card_manager.h brings it in, and the modules reading the card count on it */
+
+/* Has to match the enum in system.h */
+enum file_type
+{
+    FILETYPE_MP3,
+    FILETYPE_WAV,
+    FILETYPE_FLAC,
+    FILETYPE_OGG,
+    FILETYPE_M3U,
+    FILETYPE_DIR,
+    FILETYPE_TEXT,
+    FILETYPE_UNKNOWN
+};
+
+/* There's no card to share, just the two mutexes the modules take around it */
+class Card_Manager
+{
+  public:
+    audio_tools::Mutex& mutex() { return _mutex; }
+    audio_tools::Mutex& index_mutex() { return _index_mutex; }
+
+    static Card_Manager* get_handle()
+    {
+        static Card_Manager handle;
+        return &handle;
+    }
+
+  private:
+    audio_tools::Mutex _mutex;
+    audio_tools::Mutex _index_mutex;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,359 @@
+/**
+ * @file test_main.cpp
+ *
+ * @brief Plays two WAV files back to back through the audio buffer and the splicer, the way the
+ * transport does at a gapless track change, and checks every frame of both comes out with no
+ * silence in between.  Part of the native tests.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <audio/resampler.h>
+#include <audio/ring_buffer.h>
+#include <audio/splicer.h>
+#include <random>
+#include <vector>
+#include <unity.h>
+
+#define WAV_HEADER_BYTES   44
+#define WAV_HOLD_BACK      1152 /* Frames the test decoder keeps back, like an MP3 decoder waiting on the next sync word */
+#define FEED_CHUNK_MAX     700  /* Bytes written to and read from the buffer at a time, picked at random up to this */
+#define TEST_BUFFER_SIZE   4096 /* Small enough that the buffer wraps many times over a track */
+
+/* Builds a 16 bit PCM WAV file.  Sample i of channel c is base + i % 2000, negated on the right, so no sample
+is ever 0 and a dropped, repeated or reordered frame shows up. */
+static std::vector<uint8_t>
+makeWAV(uint32_t sample_rate, uint16_t channels, uint32_t frames, int16_t base, uint32_t silent_start = 0, uint32_t silent_end = 0)
+{
+    uint32_t total = silent_start + frames + silent_end;
+    uint32_t data_size = total * channels * sizeof(int16_t);
+    std::vector<uint8_t> wav(WAV_HEADER_BYTES + data_size);
+    auto put32 = [&](size_t at, uint32_t value) {
+        for (int i = 0; i < 4; i++) {
+            wav[at + i] = value >> (8 * i);
+        }
+    };
+    memcpy(&wav[0], "RIFF", 4);
+    put32(4, 36 + data_size);
+    memcpy(&wav[8], "WAVEfmt ", 8);
+    put32(16, 16);
+    put32(20, 1 | (channels << 16));
+    put32(24, sample_rate);
+    put32(28, sample_rate * channels * sizeof(int16_t));
+    put32(32, (channels * sizeof(int16_t)) | (16 << 16));
+    memcpy(&wav[36], "data", 4);
+    put32(40, data_size);
+
+    int16_t* samples = (int16_t*) &wav[WAV_HEADER_BYTES];
+    for (uint32_t i = 0; i < frames; i++) {
+        for (uint16_t channel = 0; channel < channels; channel++) {
+            int16_t value = base + i % 2000;
+            samples[(silent_start + i) * channels + channel] = channel ? -value : value;
+        }
+    }
+    return wav;
+}
+
+/* Just enough of a WAV decoder: parses the header, then passes the PCM through, holding back up to
+WAV_HOLD_BACK frames until more arrives or it's flushed.  After the header it's all data, so a decoder that
+isn't restarted between files plays the next file's header as audio. */
+class TestWAVDecoder : public audio_tools::AudioDecoder
+{
+  public:
+    bool begin() override
+    {
+        header_length = 0;
+        held.clear();
+        info = audio_tools::AudioInfo();
+        return true;
+    }
+    void end() override { begin(); }
+    void flush() override
+    {
+        if (!held.empty()) {
+            output->write(held.data(), held.size());
+            held.clear();
+        }
+    }
+    size_t write(const uint8_t* data, size_t length) override
+    {
+        size_t used = 0;
+        while (header_length < WAV_HEADER_BYTES && used < length) {
+            header[header_length++] = data[used++];
+            if (header_length == WAV_HEADER_BYTES) {
+                info.channels = header[22] | header[23] << 8;
+                info.sample_rate = header[24] | header[25] << 8 | header[26] << 16 | header[27] << 24;
+                info.bits_per_sample = header[34] | header[35] << 8;
+            }
+        }
+        held.insert(held.end(), data + used, data + length);
+        size_t hold = WAV_HOLD_BACK * info.channels * sizeof(int16_t);
+        if (held.size() > hold) {
+            size_t out = held.size() - hold;
+            output->write(held.data(), out);
+            held.erase(held.begin(), held.begin() + out);
+        }
+        return length;
+    }
+
+  private:
+    uint8_t header[WAV_HEADER_BYTES];
+    size_t header_length = 0;
+    std::vector<uint8_t> held;
+};
+
+/* Stands in for the mixer, keeping every byte written to it */
+class Sink : public Print
+{
+  public:
+    size_t write(uint8_t data) override { return write(&data, 1); }
+    size_t write(const uint8_t* data, size_t length) override
+    {
+        bytes.insert(bytes.end(), data, data + length);
+        return length;
+    }
+    int availableForWrite() override { return 1 << 20; }
+    size_t frames() { return bytes.size() / (2 * sizeof(int16_t)); }
+    int16_t sample(size_t frame, int channel)
+    {
+        int16_t value;
+        memcpy(&value, &bytes[(frame * 2 + channel) * sizeof(int16_t)], sizeof(value));
+        return value;
+    }
+    size_t silent()
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < bytes.size() / sizeof(int16_t); i++) {
+            count += sample(i / 2, i % 2) == 0;
+        }
+        return count;
+    }
+    std::vector<uint8_t> bytes;
+};
+
+static TestWAVDecoder decoders[2];
+static Audio::Resampler resamplers[2];
+static Audio::Splicer splicer;
+static std::vector<audio_tools::AudioDecoder*> finished;
+static std::minstd_rand random_chunks;
+
+static size_t
+chunk(size_t left)
+{
+    size_t length = 1 + random_chunks() % FEED_CHUNK_MAX;
+    return length < left ? length : left;
+}
+
+/* Plays the first track on deck 0 and splices straight into the second on deck 1.  The main loop side writes the
+first track into the buffer, arms the splice where it ends as spliceNext() does and writes the second behind it.
+The audio task side decodes whatever the buffer holds through the splicer.  The two take turns in random sized
+pieces, so the splice lands anywhere in a read.  With arm false, the splice is cancelled before it's reached.
+Returns the deck playing at the end. */
+static uint8_t
+play(const std::vector<uint8_t>& first, const std::vector<uint8_t>& second, bool arm = true)
+{
+    std::vector<uint8_t> stream = first;
+    stream.insert(stream.end(), second.begin(), second.end());
+    Audio::RingBuffer buffer(TEST_BUFFER_SIZE);
+
+    /* The next deck's decoder was primed by preloadNext(), and the current one started by selectDecoder() */
+    decoders[1].begin();
+    uint8_t deck = 0;
+    audio_tools::AudioDecoder* decoder = &decoders[0];
+    resamplers[0].setSource(decoder);
+
+    size_t written = 0;
+    bool armed = false;
+    while (buffer.readPosition() < stream.size()) {
+        /* Main loop side, only the first track goes in until the splice is armed */
+        if (written == first.size() && !armed) {
+            splicer.arm(buffer.writePosition(), 1, &decoders[1]);
+            if (!arm) {
+                splicer.cancel();
+            }
+            armed = true;
+        }
+        size_t limit = armed ? stream.size() : first.size();
+        written += buffer.write(&stream[written], chunk(limit - written));
+
+        /* Audio task side */
+        const uint8_t* data;
+        size_t length = buffer.readSpan(&data);
+        if (length > 0) {
+            length = chunk(length);
+            splicer.cut(buffer.readPosition(), &length, &deck, &decoder);
+            decoder->write(data, length);
+            buffer.commitRead(length);
+        }
+    }
+
+    /* The end of the second track, then the main loop restarts the decoder the splice finished with */
+    decoder->flush();
+    resamplers[deck].flush();
+    for (audio_tools::AudioDecoder* retired : finished) {
+        retired->end();
+        retired->begin();
+    }
+    finished.clear();
+    return deck;
+}
+
+static Sink sink;
+
+void
+setUp()
+{
+    random_chunks.seed(7);
+    sink.bytes.clear();
+    for (int i = 0; i < 2; i++) {
+        decoders[i].setOutput(resamplers[i]);
+        decoders[i].begin();
+        resamplers[i].begin(sink, 44100);
+    }
+    splicer.begin(resamplers, [](uint8_t deck, audio_tools::AudioDecoder* decoder) {
+        TEST_ASSERT_EQUAL_PTR(&decoders[deck], decoder);
+        decoder->flush();
+        finished.push_back(decoder);
+    });
+}
+
+void
+tearDown()
+{
+}
+
+/* Two WAV files at the output rate come out back to back, every frame exactly as it went in and none added */
+void
+test_splice_is_sample_exact()
+{
+    std::vector<uint8_t> first = makeWAV(44100, 2, 10000, 1000);
+    std::vector<uint8_t> second = makeWAV(44100, 2, 7000, 5000);
+    TEST_ASSERT_EQUAL(1, play(first, second));
+    TEST_ASSERT_FALSE(splicer.isPending());
+
+    TEST_ASSERT_EQUAL(17000, sink.frames());
+    TEST_ASSERT_EQUAL(0, sink.silent());
+    TEST_ASSERT_EQUAL_MEMORY(&first[WAV_HEADER_BYTES], &sink.bytes[0], first.size() - WAV_HEADER_BYTES);
+    TEST_ASSERT_EQUAL_MEMORY(&second[WAV_HEADER_BYTES], &sink.bytes[first.size() - WAV_HEADER_BYTES], second.size() - WAV_HEADER_BYTES);
+}
+
+/* A mono track spliced into a stereo one, the mono frames are copied to both channels */
+void
+test_splice_mono_into_stereo()
+{
+    play(makeWAV(44100, 1, 3000, 1000), makeWAV(44100, 2, 3000, 5000));
+
+    TEST_ASSERT_EQUAL(6000, sink.frames());
+    TEST_ASSERT_EQUAL(0, sink.silent());
+    TEST_ASSERT_EQUAL(1000 + 2999 % 2000, sink.sample(2999, 1));
+    TEST_ASSERT_EQUAL(5000, sink.sample(3000, 0));
+}
+
+/* The first track is resampled from 48 kHz, the filter is flushed at the splice so its tail isn't lost and the next
+track comes in straight after it */
+void
+test_splice_out_of_resampled_track()
+{
+    play(makeWAV(48000, 2, 9600, 1000), makeWAV(44100, 2, 4410, 5000));
+
+    TEST_ASSERT_EQUAL(0, sink.silent());
+    size_t resampled = sink.frames() - 4410;
+    TEST_ASSERT_TRUE(resampled >= 8820 - 2 && resampled <= 8820 + 2);
+    TEST_ASSERT_EQUAL(5000, sink.sample(resampled, 0));
+    TEST_ASSERT_EQUAL(-5000, sink.sample(resampled, 1));
+}
+
+/* The deck that was spliced out of gets the track after next.  Restarted, its decoder parses the new header rather
+than playing it, and there's still nothing of the old track left in it. */
+void
+test_deck_reused_after_restart()
+{
+    std::vector<uint8_t> first = makeWAV(44100, 2, 2000, 1000);
+    std::vector<uint8_t> second = makeWAV(44100, 2, 2000, 5000);
+    std::vector<uint8_t> third = makeWAV(44100, 2, 2000, 9000);
+    play(first, second);
+    sink.bytes.clear();
+    play(third, second);
+
+    TEST_ASSERT_EQUAL(4000, sink.frames());
+    TEST_ASSERT_EQUAL_MEMORY(&third[WAV_HEADER_BYTES], &sink.bytes[0], third.size() - WAV_HEADER_BYTES);
+}
+
+/* Encoder delay and padding around both tracks, as the LAME header gives them for an MP3.  With the trim set before
+each stream starts, the silence is cut and the tracks join with no gap. */
+void
+test_trim_removes_delay_and_padding()
+{
+    const uint32_t delay = 1105; /* A 1152 frame Xing frame isn't counted here, it's just more to skip */
+    const uint32_t padding = 931;
+    std::vector<uint8_t> first = makeWAV(44100, 2, 10000, 1000, delay, padding);
+    std::vector<uint8_t> second = makeWAV(44100, 2, 7000, 5000, delay, padding);
+
+    resamplers[0].setTrim(delay, 10000);
+    resamplers[1].setTrim(delay, 7000);
+    play(first, second);
+
+    TEST_ASSERT_EQUAL(17000, sink.frames());
+    TEST_ASSERT_EQUAL(0, sink.silent());
+    TEST_ASSERT_EQUAL(1000, sink.sample(0, 0));
+    TEST_ASSERT_EQUAL(5000, sink.sample(10000, 0));
+
+    /* The trim is only for the stream it was set ahead of */
+    sink.bytes.clear();
+    play(first, second);
+    TEST_ASSERT_EQUAL(10000 + 7000 + 2 * (delay + padding), sink.frames());
+}
+
+/* A mono track trimmed, the trim counts frames whatever the channel count */
+void
+test_trim_mono()
+{
+    resamplers[0].setTrim(500, 3000);
+    resamplers[1].setTrim(0, 0);
+    play(makeWAV(44100, 1, 3000, 1000, 500, 700), makeWAV(44100, 2, 1000, 5000));
+
+    TEST_ASSERT_EQUAL(4000, sink.frames());
+    TEST_ASSERT_EQUAL(0, sink.silent());
+}
+
+/* A splice cancelled by stop() before it's reached leaves the old decoder to play on, header and all */
+void
+test_cancelled_splice()
+{
+    std::vector<uint8_t> first = makeWAV(44100, 2, 3000, 1000);
+    std::vector<uint8_t> second = makeWAV(44100, 2, 3000, 5000);
+
+    TEST_ASSERT_EQUAL(0, play(first, second, false));
+    TEST_ASSERT_EQUAL(6000 + WAV_HEADER_BYTES / (2 * sizeof(int16_t)), sink.frames());
+    TEST_ASSERT_EQUAL_MEMORY(&second[0], &sink.bytes[first.size() - WAV_HEADER_BYTES], WAV_HEADER_BYTES);
+}
+
+int
+main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_splice_is_sample_exact);
+    RUN_TEST(test_splice_mono_into_stereo);
+    RUN_TEST(test_splice_out_of_resampled_track);
+    RUN_TEST(test_deck_reused_after_restart);
+    RUN_TEST(test_trim_removes_delay_and_padding);
+    RUN_TEST(test_trim_mono);
+    RUN_TEST(test_cancelled_splice);
+    return UNITY_END();
+}
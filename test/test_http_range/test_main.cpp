@@ -0,0 +1,251 @@
+/**
+ * @file test_main.cpp
+ *
+ * @brief Opens a file on a local stand-in server through HttpSource at various offsets, with the
+ * server taking ranges and ignoring them, and checks every byte read is the one at that
+ * offset.  Part of the native tests.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <audio/http_source.h>
+#include <byte_pattern.h>
+#include <http_stand_in.h>
+#include <random>
+#include <string>
+#include <vector>
+#include <unity.h>
+
+#define FILE_SIZE    200000
+#define READ_WAIT_MS 5000 /* Longest a read of the file may take before the test gives up on it */
+
+/* Sends the file from the given offset to the end, in pieces so a client that hangs up part way stops it */
+static bool
+sendFile(HttpStandIn::Connection& connection, size_t from)
+{
+    uint8_t data[4096];
+    for (size_t position = from; position < FILE_SIZE;) {
+        size_t length = FILE_SIZE - position < sizeof(data) ? FILE_SIZE - position : sizeof(data);
+        for (size_t i = 0; i < length; i++) {
+            data[i] = pattern(position + i);
+        }
+        if (!connection.send(data, length)) {
+            return false;
+        }
+        position += length;
+    }
+    return true;
+}
+
+/* /ranged takes ranges, /plain ignores them, /unknown takes them without knowing the total, /live is a radio stream that
+answers a range anyway */
+static bool
+reply(HttpStandIn::Connection& connection, const HttpStandIn::request_t& request)
+{
+    size_t from = 0;
+    const char* range = request.header("range");
+    if (range) {
+        sscanf(range, "bytes=%zu-", &from);
+    }
+
+    if (request.path == "/ranged" || request.path == "/unknown") {
+        if (from >= FILE_SIZE) {
+            connection.send("HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */" + std::to_string(FILE_SIZE) + "\r\nContent-Length: 0\r\n\r\n");
+            return true;
+        }
+        std::string head = "HTTP/1.1 206 Partial Content\r\nContent-Type: audio/mpeg\r\n";
+        if (request.path == "/ranged") {
+            head += "Content-Range: bytes " + std::to_string(from) + "-" + std::to_string(FILE_SIZE - 1) + "/" + std::to_string(FILE_SIZE) + "\r\n";
+            head += "Content-Length: " + std::to_string(FILE_SIZE - from) + "\r\n\r\n";
+        } else {
+            head += "Content-Range: bytes " + std::to_string(from) + "-" + std::to_string(FILE_SIZE - 1) + "/*\r\nConnection: close\r\n\r\n";
+        }
+        return connection.send(head) && sendFile(connection, from) && request.path == "/ranged";
+    }
+    if (request.path == "/plain") {
+        return connection.send("HTTP/1.1 200 OK\r\nContent-Type: audio/mpeg\r\nContent-Length: " + std::to_string(FILE_SIZE) + "\r\n\r\n") &&
+               sendFile(connection, 0);
+    }
+    if (request.path == "/live") {
+        connection.send("HTTP/1.1 206 Partial Content\r\nContent-Type: audio/mpeg\r\nContent-Range: bytes 0-/*\r\nicy-metaint: 16000\r\n"
+                        "Connection: close\r\n\r\n");
+        return false;
+    }
+    connection.send("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+    return true;
+}
+
+static HttpStandIn server;
+static Audio::HttpSource* source;
+
+static std::string
+url(const char* path)
+{
+    return "http://127.0.0.1:" + std::to_string(server.port()) + path;
+}
+
+/* Reads until the offset reaches the end or the given byte count has come, checking every byte against the file.
+read() never waits, so this polls the way the audio task does.  Returns the bytes read. */
+static size_t
+readAndCheck(size_t count)
+{
+    std::minstd_rand random(8);
+    uint8_t data[8192];
+    size_t total = 0;
+    uint32_t start = millis();
+    while (total < count && source->getOffset() < FILE_SIZE && millis() - start < READ_WAIT_MS) {
+        size_t wanted = 1 + random() % sizeof(data);
+        if (wanted > count - total) {
+            wanted = count - total;
+        }
+        size_t got = source->read(data, wanted);
+        if (got == 0) {
+            delay(1);
+            continue;
+        }
+        uint32_t offset = source->getOffset() - got;
+        for (size_t i = 0; i < got; i++) {
+            if (data[i] != pattern(offset + i)) {
+                TEST_FAIL_MESSAGE("Read a byte that isn't the file's at that offset");
+            }
+        }
+        total += got;
+    }
+    return total;
+}
+
+void
+setUp()
+{
+    source = new Audio::HttpSource();
+}
+
+void
+tearDown()
+{
+    source->close();
+    delete source;
+}
+
+/* Paused part way, the file picks up again at the byte after the last one read */
+void
+test_resume_after_pause()
+{
+    TEST_ASSERT_TRUE(source->open(url("/ranged").c_str(), 0));
+    TEST_ASSERT_TRUE(source->isSeekable());
+    TEST_ASSERT_EQUAL(FILE_SIZE, source->getLength());
+    TEST_ASSERT_EQUAL(50000, readAndCheck(50000));
+    source->close();
+
+    TEST_ASSERT_TRUE(source->open(url("/ranged").c_str(), 50000));
+    TEST_ASSERT_TRUE(source->isSeekable());
+    TEST_ASSERT_EQUAL(50000, source->getOffset());
+    TEST_ASSERT_EQUAL(FILE_SIZE, source->getLength());
+    TEST_ASSERT_EQUAL(FILE_SIZE - 50000, readAndCheck(FILE_SIZE));
+}
+
+/* A file read to the end leaves its connection open, and the next open goes out on it */
+void
+test_kept_connection()
+{
+    TEST_ASSERT_TRUE(source->open(url("/ranged").c_str(), 150000));
+    TEST_ASSERT_EQUAL(FILE_SIZE - 150000, readAndCheck(FILE_SIZE));
+    source->close();
+
+    uint32_t connections = server.connections();
+    TEST_ASSERT_TRUE(source->open(url("/ranged").c_str(), 100000));
+    TEST_ASSERT_EQUAL(1, source->getStats().reused);
+    TEST_ASSERT_EQUAL(connections, server.connections());
+    TEST_ASSERT_EQUAL(100000, source->getOffset());
+    TEST_ASSERT_EQUAL(4000, readAndCheck(4000));
+}
+
+/* Opened anywhere in the file, the first byte read is the one at that offset */
+void
+test_seek_offsets()
+{
+    static const uint32_t offsets[] = { 12345, 99999, 150000, 0, FILE_SIZE - 1 };
+    for (uint32_t offset : offsets) {
+        TEST_ASSERT_TRUE(source->open(url("/ranged").c_str(), offset));
+        TEST_ASSERT_EQUAL(offset, source->getOffset());
+        size_t wanted = FILE_SIZE - offset < 4000 ? FILE_SIZE - offset : 4000;
+        TEST_ASSERT_EQUAL(wanted, readAndCheck(wanted));
+        source->close();
+    }
+
+    /* Only the last of those was read to the end, the rest of each other reply was still coming */
+    TEST_ASSERT_EQUAL(0, source->getStats().reused);
+}
+
+/* A server that ignores the range sends the whole file, and the bytes ahead of the offset are dropped */
+void
+test_range_ignored()
+{
+    TEST_ASSERT_TRUE(source->open(url("/plain").c_str(), 12345));
+    TEST_ASSERT_FALSE(source->isSeekable());
+    TEST_ASSERT_EQUAL(FILE_SIZE, source->getLength());
+    TEST_ASSERT_EQUAL(FILE_SIZE - 12345, readAndCheck(FILE_SIZE));
+    TEST_ASSERT_EQUAL(FILE_SIZE, source->getOffset());
+}
+
+/* A Content-Range with no total still takes ranges, the length is just unknown */
+void
+test_range_without_total()
+{
+    TEST_ASSERT_TRUE(source->open(url("/unknown").c_str(), 1000));
+    TEST_ASSERT_TRUE(source->isSeekable());
+    TEST_ASSERT_EQUAL(1000, source->getOffset());
+    TEST_ASSERT_EQUAL(0, source->getLength());
+    TEST_ASSERT_EQUAL(5000, readAndCheck(5000));
+}
+
+/* Nothing to open at or past the end */
+void
+test_range_past_end()
+{
+    TEST_ASSERT_FALSE(source->open(url("/ranged").c_str(), FILE_SIZE));
+}
+
+/* ICY metadata makes it a live stream, which is never reopened at an offset even if the server answered the range */
+void
+test_live_stream()
+{
+    TEST_ASSERT_TRUE(source->open(url("/live").c_str(), 0));
+    TEST_ASSERT_FALSE(source->isSeekable());
+}
+
+int
+main()
+{
+    bool started = server.begin(reply);
+
+    UNITY_BEGIN();
+    if (started) {
+        RUN_TEST(test_resume_after_pause);
+        RUN_TEST(test_kept_connection);
+        RUN_TEST(test_seek_offsets);
+        RUN_TEST(test_range_ignored);
+        RUN_TEST(test_range_without_total);
+        RUN_TEST(test_range_past_end);
+        RUN_TEST(test_live_stream);
+    }
+    int failures = UNITY_END();
+    server.end();
+    return started ? failures : 1;
+}
@@ -0,0 +1,234 @@
+/**
+ * @file test_main.cpp
+ *
+ * @brief Replays an Icecast stream with metadata from a local stand-in server, and checks the
+ * IcyDemuxer hands over all of the audio and none of the blocks, with each title ahead of
+ * the audio after it.  Part of the native tests.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <WiFi.h>
+#include <audio/icy_demuxer.h>
+#include <byte_pattern.h>
+#include <http_stand_in.h>
+#include <random>
+#include <string>
+#include <vector>
+#include <unity.h>
+
+#define ICY_METAINT      16000
+#define ICY_INTERVALS    8    /* Full intervals of audio sent, each followed by a block */
+#define ICY_TAIL         1234 /* Audio after the last block, short of another interval */
+#define REPLAY_PAUSE_MS  5    /* Between the pieces of a block */
+#define REPLAY_WAIT_MS   5000 /* Longest a replay may take before the test gives up on it */
+
+/* The block sent after each interval, as a server would: most are empty, the title only comes when it changes */
+static std::string
+block(int interval)
+{
+    switch (interval) {
+        case 0:
+            return "StreamTitle='First Artist - First Song';StreamUrl='';";
+        case 2:
+            return "StreamTitle='Guns N' Roses - Sweet Child O' Mine';";
+        case 3:
+            return "StreamTitle='';"; /* Between tracks */
+        case 4: {
+            std::string title = "StreamTitle='" + std::string(ICY_METADATA_MAX - 20, 'x') + "';";
+            return title;
+        }
+        case 5:
+            return "StreamUrl='http://example.com/';";
+        case 6:
+            return "StreamTitle='Last Artist - Last Song';";
+        default:
+            return "";
+    }
+}
+
+/* Sends the audio in bursts of random size, and each block in three pieces with a pause after the length byte and
+another part way through the text, so the demuxer has to pick a block up where it left off */
+static bool
+replay(HttpStandIn::Connection& connection, bool metadata)
+{
+    std::minstd_rand random(5);
+    size_t position = 0;
+    for (int interval = 0; interval <= ICY_INTERVALS; interval++) {
+        std::string audio;
+        size_t length = interval < ICY_INTERVALS ? ICY_METAINT : ICY_TAIL;
+        for (size_t i = 0; i < length; i++) {
+            audio += (char) pattern(position++);
+        }
+        for (size_t sent = 0; sent < audio.size();) {
+            size_t burst = 1 + random() % 3000;
+            if (burst > audio.size() - sent) {
+                burst = audio.size() - sent;
+            }
+            if (!connection.send(audio.data() + sent, burst)) {
+                return false;
+            }
+            sent += burst;
+        }
+        if (!metadata || interval == ICY_INTERVALS) {
+            continue;
+        }
+
+        std::string text = block(interval);
+        size_t units = (text.size() + 15) / 16;
+        text.resize(units * 16, '\0');
+        uint8_t length_byte = units;
+        size_t half = text.size() / 2;
+        delay(REPLAY_PAUSE_MS);
+        connection.send(&length_byte, 1);
+        delay(REPLAY_PAUSE_MS);
+        connection.send(text.data(), half);
+        delay(REPLAY_PAUSE_MS);
+        connection.send(text.data() + half, text.size() - half);
+    }
+    return false;
+}
+
+static HttpStandIn server;
+
+struct title_t
+{
+    std::string title;
+    size_t at; /* Bytes of audio handed over before the title came out */
+};
+
+/* Requests the stream, reads the reply's headers a byte at a time, then reads the body through the demuxer in
+reads of random size until the server closes */
+static void
+listen(bool ask_for_metadata, std::vector<uint8_t>& audio, std::vector<title_t>& titles)
+{
+    WiFiClient client;
+    TEST_ASSERT_TRUE(client.connect(IPAddress(127, 0, 0, 1), server.port()));
+    std::string request = "GET /stream HTTP/1.0\r\nHost: 127.0.0.1\r\n";
+    if (ask_for_metadata) {
+        request += "Icy-MetaData: 1\r\n";
+    }
+    request += "\r\n";
+    client.write((const uint8_t*) request.data(), request.size());
+
+    std::string headers;
+    uint32_t start = millis();
+    while (headers.find("\r\n\r\n") == std::string::npos && millis() - start < REPLAY_WAIT_MS) {
+        int c = client.read();
+        if (c >= 0) {
+            headers += (char) c;
+        }
+    }
+    uint32_t metaint = 0;
+    size_t found = headers.find("icy-metaint:");
+    if (found != std::string::npos) {
+        metaint = atoi(headers.c_str() + found + 12);
+    }
+
+    Audio::IcyDemuxer icy;
+    icy.begin(metaint);
+    icy.onTitle([&](const char* title) { titles.push_back({ title, audio.size() }); });
+    std::minstd_rand random(6);
+    uint8_t data[4096];
+    while ((client.connected() || client.available()) && millis() - start < REPLAY_WAIT_MS) {
+        size_t got = icy.read(client, data, 1 + random() % sizeof(data));
+        audio.insert(audio.end(), data, data + got);
+    }
+    client.stop();
+}
+
+void
+setUp()
+{
+}
+
+void
+tearDown()
+{
+}
+
+/* Every byte of audio comes through in order with no part of a block in it, and each title comes out ahead of the
+audio that follows its block */
+void
+test_replay_with_metadata()
+{
+    std::vector<uint8_t> audio;
+    std::vector<title_t> titles;
+    listen(true, audio, titles);
+
+    TEST_ASSERT_EQUAL(ICY_INTERVALS * ICY_METAINT + ICY_TAIL, audio.size());
+    for (size_t i = 0; i < audio.size(); i++) {
+        if (audio[i] != pattern(i)) {
+            TEST_FAIL_MESSAGE("The audio doesn't match what was sent");
+        }
+    }
+
+    /* The empty title and the block without one don't reach the callback */
+    TEST_ASSERT_EQUAL(4, titles.size());
+    TEST_ASSERT_EQUAL_STRING("First Artist - First Song", titles[0].title.c_str());
+    TEST_ASSERT_EQUAL(1 * ICY_METAINT, titles[0].at);
+    TEST_ASSERT_EQUAL_STRING("Guns N' Roses - Sweet Child O' Mine", titles[1].title.c_str());
+    TEST_ASSERT_EQUAL(3 * ICY_METAINT, titles[1].at);
+    TEST_ASSERT_EQUAL(ICY_METADATA_MAX - 20, titles[2].title.size());
+    TEST_ASSERT_EQUAL(5 * ICY_METAINT, titles[2].at);
+    TEST_ASSERT_EQUAL_STRING("Last Artist - Last Song", titles[3].title.c_str());
+    TEST_ASSERT_EQUAL(7 * ICY_METAINT, titles[3].at);
+}
+
+/* Without an interval in the reply the whole body is audio */
+void
+test_replay_without_metadata()
+{
+    std::vector<uint8_t> audio;
+    std::vector<title_t> titles;
+    listen(false, audio, titles);
+
+    TEST_ASSERT_EQUAL(ICY_INTERVALS * ICY_METAINT + ICY_TAIL, audio.size());
+    TEST_ASSERT_EQUAL(0, titles.size());
+    for (size_t i = 0; i < audio.size(); i++) {
+        if (audio[i] != pattern(i)) {
+            TEST_FAIL_MESSAGE("The audio doesn't match what was sent");
+        }
+    }
+}
+
+int
+main()
+{
+    /* Sends icy-metaint only to a client that asked for metadata, as Icecast and SHOUTcast do */
+    bool started = server.begin([](HttpStandIn::Connection& connection, const HttpStandIn::request_t& request) {
+        bool metadata = request.header("icy-metadata") && atoi(request.header("icy-metadata")) == 1;
+        std::string reply = "ICY 200 OK\r\ncontent-type: audio/mpeg\r\nicy-name: Stand-in Radio\r\n";
+        if (metadata) {
+            reply += "icy-metaint: " + std::to_string(ICY_METAINT) + "\r\n";
+        }
+        reply += "\r\n";
+        connection.send(reply);
+        return replay(connection, metadata);
+    });
+
+    UNITY_BEGIN();
+    if (started) {
+        RUN_TEST(test_replay_with_metadata);
+        RUN_TEST(test_replay_without_metadata);
+    }
+    int failures = UNITY_END();
+    server.end();
+    return started ? failures : 1;
+}
@@ -0,0 +1,357 @@
+/**
+ * @file test_main.cpp
+ *
+ * @brief Checks the fixed point EQ cascade against the same filters in double precision, and times
+ * it per stereo frame.  Part of the native tests.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <audio/parametric_eq.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <unity.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define TEST_RATE            44100
+#define TEST_FRAMES          (TEST_RATE * 2)
+#define BENCHMARK_FRAMES     (TEST_RATE * 10)
+#define REFERENCE_MIN_SNR_DB 80 /* The cascade against double precision, ahead of the rounding to 16 bits */
+
+using Audio::ParametricEQ;
+
+struct band_setting_t
+{
+    ParametricEQ::band_type_t type;
+    float frequency;
+    float gain_db;
+    float q;
+};
+
+/* Every band in use, a mix of cuts and boosts with the low shelf where the rounding is hardest on fixed point */
+static const band_setting_t full_set[EQ_MAX_BANDS] = {
+    { ParametricEQ::BAND_LOW_SHELF, 40, 6, 0.707f },   { ParametricEQ::BAND_PEAK, 80, -4, 1.0f },
+    { ParametricEQ::BAND_PEAK, 160, 3, 1.4f },         { ParametricEQ::BAND_PEAK, 320, -2, 0.7f },
+    { ParametricEQ::BAND_PEAK, 640, 5, 2.0f },         { ParametricEQ::BAND_PEAK, 1250, -6, 1.0f },
+    { ParametricEQ::BAND_PEAK, 2500, 4, 0.5f },        { ParametricEQ::BAND_PEAK, 5000, -3, 3.0f },
+    { ParametricEQ::BAND_PEAK, 10000, 2, 1.0f },       { ParametricEQ::BAND_HIGH_SHELF, 14000, -5, 0.707f },
+};
+
+static ParametricEQ eq;
+
+static void
+setAll(const band_setting_t* bands, uint8_t count)
+{
+    for (uint8_t band = 0; band < EQ_MAX_BANDS; band++) {
+        if (band < count) {
+            eq.setBand(band, bands[band].type, bands[band].frequency, bands[band].gain_db, bands[band].q);
+        } else {
+            eq.setBand(band, ParametricEQ::BAND_OFF, 1000, 0);
+        }
+    }
+}
+
+/* The same cookbook filters in double precision, straight from the settings with nothing rounded */
+class ReferenceEQ
+{
+  public:
+    ReferenceEQ(const band_setting_t* bands, uint8_t count, double sample_rate)
+    {
+        for (uint8_t band = 0; band < count; band++) {
+            const band_setting_t& setting = bands[band];
+            double A = pow(10.0, setting.gain_db / 40.0);
+            double w0 = 2 * M_PI * setting.frequency / sample_rate;
+            double cos_w0 = cos(w0);
+            double alpha = sin(w0) / (2 * setting.q);
+            double shelf = 2 * sqrt(A) * alpha;
+            double b0, b1, b2, a0, a1, a2;
+            switch (setting.type) {
+                case ParametricEQ::BAND_LOW_SHELF:
+                    b0 = A * ((A + 1) - (A - 1) * cos_w0 + shelf);
+                    b1 = 2 * A * ((A - 1) - (A + 1) * cos_w0);
+                    b2 = A * ((A + 1) - (A - 1) * cos_w0 - shelf);
+                    a0 = (A + 1) + (A - 1) * cos_w0 + shelf;
+                    a1 = -2 * ((A - 1) + (A + 1) * cos_w0);
+                    a2 = (A + 1) + (A - 1) * cos_w0 - shelf;
+                    break;
+                case ParametricEQ::BAND_HIGH_SHELF:
+                    b0 = A * ((A + 1) + (A - 1) * cos_w0 + shelf);
+                    b1 = -2 * A * ((A - 1) + (A + 1) * cos_w0);
+                    b2 = A * ((A + 1) + (A - 1) * cos_w0 - shelf);
+                    a0 = (A + 1) - (A - 1) * cos_w0 + shelf;
+                    a1 = 2 * ((A - 1) - (A + 1) * cos_w0);
+                    a2 = (A + 1) - (A - 1) * cos_w0 - shelf;
+                    break;
+                default:
+                    b0 = 1 + alpha * A;
+                    b1 = -2 * cos_w0;
+                    b2 = 1 - alpha * A;
+                    a0 = 1 + alpha / A;
+                    a1 = -2 * cos_w0;
+                    a2 = 1 - alpha / A;
+                    break;
+            }
+            rows.push_back({ b0 / a0, b1 / a0, b2 / a0, a1 / a0, a2 / a0, 0, 0, 0, 0 });
+        }
+    }
+
+    double run(double x)
+    {
+        for (row_t& r : rows) {
+            double y = r.b0 * x + r.b1 * r.x1 + r.b2 * r.x2 - r.a1 * r.y1 - r.a2 * r.y2;
+            r.x2 = r.x1;
+            r.x1 = x;
+            r.y2 = r.y1;
+            r.y1 = y;
+            x = y;
+        }
+        return x;
+    }
+
+  private:
+    struct row_t
+    {
+        double b0, b1, b2, a1, a2;
+        double x1, x2, y1, y2;
+    };
+    std::vector<row_t> rows;
+};
+
+/* Music-like test signal: a few tones spread over the bands plus noise, peaking around -6 dBFS */
+static std::vector<int16_t>
+makeSignal(size_t frames)
+{
+    std::minstd_rand random(11);
+    std::vector<int16_t> signal(frames);
+    for (size_t i = 0; i < frames; i++) {
+        double t = (double) i / TEST_RATE;
+        double value = 0.2 * sin(2 * M_PI * 55 * t) + 0.1 * sin(2 * M_PI * 700 * t) + 0.05 * sin(2 * M_PI * 6100 * t);
+        value += 0.1 * ((double) random() / random.max() - 0.5);
+        signal[i] = (int16_t) lround(value * 32767);
+    }
+    return signal;
+}
+
+/* A sample through the output stage's EQ path: attenuated by the headroom, run, and rounded back to 16 bits */
+static int16_t
+process(const ParametricEQ::coefficients_t& set, int32_t (*state)[EQ_STATE_SIZE], int16_t in)
+{
+    int32_t sample = (in * set.headroom) >> (15 - EQ_SIGNAL_SHIFT);
+    sample = ParametricEQ::run(set, state, sample);
+    sample = (sample + (1 << (EQ_SIGNAL_SHIFT - 1))) >> EQ_SIGNAL_SHIFT;
+    return (int16_t) (sample > 32767 ? 32767 : sample < -32768 ? -32768 : sample);
+}
+
+/* Level of a tone after the EQ, in dB against the input */
+static double
+toneGain(double frequency)
+{
+    const ParametricEQ::coefficients_t& set = eq.acquire();
+    int32_t(*state)[EQ_STATE_SIZE] = eq.getState(0);
+    double in_energy = 0, out_energy = 0;
+    for (size_t i = 0; i < TEST_FRAMES; i++) {
+        int16_t in = (int16_t) lround(8000 * sin(2 * M_PI * frequency * i / TEST_RATE));
+        int16_t out = process(set, state, in);
+        /* Skip the first half while the filters settle */
+        if (i >= TEST_FRAMES / 2) {
+            in_energy += (double) in * in;
+            out_energy += (double) out * out;
+        }
+    }
+    return 10 * log10(out_energy / in_energy) + 20 * log10(32768.0 / set.headroom);
+}
+
+void
+setUp()
+{
+    eq.begin(TEST_RATE);
+    setAll(nullptr, 0);
+    eq.setEnabled(true);
+    eq.acquire();
+    memset(eq.getState(0), 0, sizeof(int32_t[EQ_MAX_BANDS][EQ_STATE_SIZE]));
+}
+
+void
+tearDown()
+{
+}
+
+/* Every band of the full set against the double precision cascade, on a signal spread across all of them.  The low
+shelf at 40 Hz is the hard one, without the rounding error carried over it only manages about 63 dB. */
+void
+test_matches_double_reference()
+{
+    setAll(full_set, EQ_MAX_BANDS);
+    const ParametricEQ::coefficients_t& set = eq.acquire();
+    TEST_ASSERT_EQUAL(EQ_MAX_BANDS, set.count);
+
+    ReferenceEQ reference(full_set, EQ_MAX_BANDS, TEST_RATE);
+    std::vector<int16_t> signal = makeSignal(TEST_FRAMES);
+    int32_t(*state)[EQ_STATE_SIZE] = eq.getState(0);
+    double signal_energy = 0, error_energy = 0, rounded_energy = 0;
+    for (size_t i = 0; i < signal.size(); i++) {
+        double expected = reference.run(signal[i] * (set.headroom / 32768.0));
+        int32_t sample = ParametricEQ::run(set, state, (signal[i] * set.headroom) >> (15 - EQ_SIGNAL_SHIFT));
+        double error = (double) sample / (1 << EQ_SIGNAL_SHIFT) - expected;
+        double rounded = lround(expected) - expected;
+        signal_energy += expected * expected;
+        error_energy += error * error;
+        rounded_energy += rounded * rounded;
+    }
+    double snr = 10 * log10(signal_energy / error_energy);
+
+    char message[120];
+    snprintf(message, sizeof(message), "Against the double precision cascade: %.1f dB SNR, rounding to 16 bits alone is %.1f dB", snr,
+             10 * log10(signal_energy / rounded_energy));
+    TEST_MESSAGE(message);
+    TEST_ASSERT_TRUE(snr >= REFERENCE_MIN_SNR_DB);
+}
+
+/* A band does what it says at its own frequency, and leaves the far end of the spectrum alone */
+void
+test_band_gains()
+{
+    eq.setBand(0, ParametricEQ::BAND_PEAK, 1000, 6, 1.0f);
+    TEST_ASSERT_FLOAT_WITHIN(0.05, 6.0, toneGain(1000));
+    TEST_ASSERT_FLOAT_WITHIN(0.05, 0.0, toneGain(15000));
+
+    eq.setBand(0, ParametricEQ::BAND_LOW_SHELF, 100, -9, 0.707f);
+    TEST_ASSERT_FLOAT_WITHIN(0.1, -9.0, toneGain(20));
+    TEST_ASSERT_FLOAT_WITHIN(0.1, 0.0, toneGain(5000));
+
+    eq.setBand(0, ParametricEQ::BAND_HIGH_SHELF, 8000, 12, 0.707f);
+    TEST_ASSERT_FLOAT_WITHIN(0.1, 12.0, toneGain(18000));
+    TEST_ASSERT_FLOAT_WITHIN(0.1, 0.0, toneGain(100));
+}
+
+/* A boost is taken out of the input first, so a full scale tone at the boosted frequency comes back without clipping */
+void
+test_headroom_stops_clipping()
+{
+    eq.setBand(0, ParametricEQ::BAND_PEAK, 1000, EQ_MAX_GAIN_DB, 1.0f);
+    const ParametricEQ::coefficients_t& set = eq.acquire();
+    int32_t(*state)[EQ_STATE_SIZE] = eq.getState(0);
+    int16_t peak = 0;
+    for (size_t i = 0; i < TEST_FRAMES; i++) {
+        int16_t out = process(set, state, (int16_t) lround(32767 * sin(2 * M_PI * 1000 * i / TEST_RATE)));
+        peak = abs(out) > peak ? abs(out) : peak;
+    }
+    TEST_ASSERT_TRUE(peak < 32767);
+    TEST_ASSERT_TRUE(peak > 32000);
+}
+
+/* Flat bands and a disabled EQ leave nothing in the cascade, so the output stage skips it */
+void
+test_flat_is_empty()
+{
+    eq.setBand(3, ParametricEQ::BAND_PEAK, 1000, 0, 1.0f);
+    TEST_ASSERT_EQUAL(0, eq.acquire().count);
+    eq.setBand(3, ParametricEQ::BAND_PEAK, 1000, 3, 1.0f);
+    TEST_ASSERT_EQUAL(1, eq.acquire().count);
+    eq.setEnabled(false);
+    TEST_ASSERT_EQUAL(0, eq.acquire().count);
+}
+
+/* A band that stays in the cascade keeps its state when another one changes, so the change doesn't click */
+void
+test_state_carried_across_changes()
+{
+    eq.setBand(2, ParametricEQ::BAND_PEAK, 500, 4, 1.0f);
+    eq.setBand(5, ParametricEQ::BAND_PEAK, 4000, -4, 1.0f);
+    const ParametricEQ::coefficients_t* set = &eq.acquire();
+    int32_t(*state)[EQ_STATE_SIZE] = eq.getState(0);
+    for (size_t i = 0; i < 1000; i++) {
+        process(*set, state, (int16_t) lround(10000 * sin(2 * M_PI * 500 * i / TEST_RATE)));
+    }
+    int32_t band5[EQ_STATE_SIZE];
+    memcpy(band5, state[1], sizeof(band5));
+
+    /* Band 1 comes in ahead of both, so band 5 moves down a row and band 1 starts from rest */
+    eq.setBand(1, ParametricEQ::BAND_PEAK, 200, 2, 1.0f);
+    set = &eq.acquire();
+    TEST_ASSERT_EQUAL(3, set->count);
+    TEST_ASSERT_EQUAL(5, set->bands[2]);
+    TEST_ASSERT_EQUAL_MEMORY(band5, state[2], sizeof(band5));
+    TEST_ASSERT_EQUAL(0, state[0][0]);
+    TEST_ASSERT_EQUAL(0, state[0][2]);
+}
+
+/* Stereo through the full set of bands the way OutputStage::process() runs it, a channel at a time over a block.
+Reported in cycles per stereo frame where there's a cycle counter, otherwise in nanoseconds. */
+void
+test_benchmark()
+{
+    setAll(full_set, EQ_MAX_BANDS);
+    const ParametricEQ::coefficients_t& set = eq.acquire();
+    std::vector<int16_t> mono = makeSignal(BENCHMARK_FRAMES);
+    std::vector<int16_t> samples(BENCHMARK_FRAMES * 2);
+    for (size_t i = 0; i < mono.size(); i++) {
+        samples[i * 2] = mono[i];
+        samples[i * 2 + 1] = -mono[i];
+    }
+
+    const size_t block = 256;
+    int64_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t cycles = __rdtsc();
+#endif
+    for (size_t offset = 0; offset < BENCHMARK_FRAMES; offset += block) {
+        for (uint8_t channel = 0; channel < 2; channel++) {
+            int32_t(*state)[EQ_STATE_SIZE] = eq.getState(channel);
+            for (size_t i = offset * 2 + channel; i < (offset + block) * 2; i += 2) {
+                samples[i] = process(set, state, samples[i]);
+            }
+        }
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    cycles = __rdtsc() - cycles;
+#endif
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    for (int16_t sample : samples) {
+        checksum += sample;
+    }
+
+    char message[120];
+#if defined(__x86_64__) || defined(__i386__)
+    snprintf(message, sizeof(message), "%d bands: %.1f cycles, %.1f ns per stereo frame (checksum %lld)", EQ_MAX_BANDS,
+             (double) cycles / BENCHMARK_FRAMES, ns / BENCHMARK_FRAMES, (long long) checksum);
+#else
+    snprintf(message, sizeof(message), "%d bands: %.1f ns per stereo frame (checksum %lld)", EQ_MAX_BANDS, ns / BENCHMARK_FRAMES,
+             (long long) checksum);
+#endif
+    TEST_MESSAGE(message);
+}
+
+int
+main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_matches_double_reference);
+    RUN_TEST(test_band_gains);
+    RUN_TEST(test_headroom_stops_clipping);
+    RUN_TEST(test_flat_is_empty);
+    RUN_TEST(test_state_carried_across_changes);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,254 @@
+/**
+ * @file test_main.cpp
+ *
+ * @brief Checks the Resampler against ideal tones across the usual pairs of rates, and times it per
+ * output frame.  Part of the native tests.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <audio/resampler.h>
+#include <chrono>
+#include <vector>
+#include <unity.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define TEST_SECONDS      1
+#define BENCHMARK_SECONDS 10
+#define TONE_MIN_SNR_DB   70 /* A tone well inside the passband, against the ideal one at the output rate */
+#define ALIAS_SKIRT_MAX_DB    -50 /* A tone just above the output's Nyquist frequency, after going down in rate */
+#define ALIAS_STOPBAND_MAX_DB -65 /* One well above it */
+
+/* Stands in for the mixer, keeping every byte written to it.  Writes needn't end on a sample. */
+class Sink : public Print
+{
+  public:
+    size_t write(uint8_t data) override { return write(&data, 1); }
+    size_t write(const uint8_t* data, size_t length) override
+    {
+        bytes.insert(bytes.end(), data, data + length);
+        return length;
+    }
+    int availableForWrite() override { return 1 << 20; }
+    size_t frames() { return bytes.size() / (2 * sizeof(int16_t)); }
+    int16_t sample(size_t frame, int channel)
+    {
+        int16_t value;
+        memcpy(&value, &bytes[(frame * 2 + channel) * sizeof(int16_t)], sizeof(value));
+        return value;
+    }
+    std::vector<uint8_t> bytes;
+};
+
+static Sink sink;
+static Audio::Resampler resampler;
+
+/* Stereo at the given rate, the right channel a quarter cycle behind the left */
+static std::vector<int16_t>
+makeTone(uint32_t sample_rate, double frequency, double seconds, double amplitude = 16000)
+{
+    size_t frames = (size_t) (sample_rate * seconds);
+    std::vector<int16_t> tone(frames * 2);
+    for (size_t i = 0; i < frames; i++) {
+        double angle = 2 * M_PI * frequency * i / sample_rate;
+        tone[i * 2] = (int16_t) lround(amplitude * sin(angle));
+        tone[i * 2 + 1] = (int16_t) lround(amplitude * cos(angle));
+    }
+    return tone;
+}
+
+/* Writes the stream in the odd sized pieces a decoder hands over, then flushes the filter */
+static void
+convert(uint32_t input_rate, uint32_t output_rate, const std::vector<int16_t>& input)
+{
+    sink.bytes.clear();
+    resampler.begin(sink, output_rate);
+    resampler.setSource(nullptr);
+    resampler.setInputFormat(input_rate, 2);
+    const uint8_t* data = (const uint8_t*) input.data();
+    size_t length = input.size() * sizeof(int16_t);
+    for (size_t position = 0; position < length;) {
+        size_t piece = length - position < 1153 ? length - position : 1153;
+        resampler.write(data + position, piece);
+        position += piece;
+    }
+    resampler.flush();
+}
+
+/* The output against the ideal tone at the output rate, leaving out the ends where the window runs off the stream */
+static double
+toneSNR(uint32_t output_rate, double frequency, double amplitude = 16000)
+{
+    const size_t edge = RESAMPLER_TAPS * 4;
+    size_t frames = sink.frames();
+    double signal = 0, error = 0;
+    for (size_t i = edge; i + edge < frames; i++) {
+        double angle = 2 * M_PI * frequency * i / output_rate;
+        double expected[2] = { amplitude * sin(angle), amplitude * cos(angle) };
+        for (int channel = 0; channel < 2; channel++) {
+            double difference = sink.sample(i, channel) - expected[channel];
+            signal += expected[channel] * expected[channel];
+            error += difference * difference;
+        }
+    }
+    return 10 * log10(signal / error);
+}
+
+void
+setUp()
+{
+}
+
+void
+tearDown()
+{
+}
+
+/* The common pairs up and down, with a 1 kHz tone that should come through untouched and on time */
+void
+test_tone_through_rate_pairs()
+{
+    static const uint32_t pairs[][2] = { { 48000, 44100 }, { 44100, 48000 }, { 22050, 44100 }, { 96000, 44100 }, { 32000, 48000 }, { 8000, 44100 } };
+    for (const auto& pair : pairs) {
+        convert(pair[0], pair[1], makeTone(pair[0], 1000, TEST_SECONDS));
+        size_t expected = (size_t) ((uint64_t) pair[0] * TEST_SECONDS * pair[1] / pair[0]);
+        size_t frames = sink.frames();
+        double snr = toneSNR(pair[1], 1000);
+
+        char message[100];
+        snprintf(message, sizeof(message), "%u to %u Hz: %zu frames, %.1f dB SNR", pair[0], pair[1], frames, snr);
+        TEST_MESSAGE(message);
+        TEST_ASSERT_TRUE_MESSAGE(frames + 1 >= expected && frames <= expected + 1, message);
+        TEST_ASSERT_TRUE_MESSAGE(snr >= TONE_MIN_SNR_DB, message);
+    }
+}
+
+/* Level of the left channel against a full amplitude tone, leaving out the ends */
+static double
+level(double amplitude)
+{
+    const size_t edge = RESAMPLER_TAPS * 4;
+    size_t frames = sink.frames();
+    double energy = 0;
+    for (size_t i = edge; i + edge < frames; i++) {
+        energy += (double) sink.sample(i, 0) * sink.sample(i, 0);
+    }
+    return 10 * log10(energy / (frames - 2 * edge) / (amplitude * amplitude / 2));
+}
+
+/* Going down in rate, a tone the output can't carry is filtered out rather than folded back down.  Just past the
+output's Nyquist frequency it's still in the skirt of the filter, further up it's in the stopband. */
+void
+test_no_aliasing_going_down()
+{
+    convert(48000, 44100, makeTone(48000, 23000, TEST_SECONDS));
+    double skirt = level(16000);
+    convert(96000, 44100, makeTone(96000, 30000, TEST_SECONDS));
+    double stopband = level(16000);
+
+    char message[100];
+    snprintf(message, sizeof(message), "23 kHz from 48 kHz: %.1f dB, 30 kHz from 96 kHz: %.1f dB", skirt, stopband);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_TRUE(skirt <= ALIAS_SKIRT_MAX_DB);
+    TEST_ASSERT_TRUE(stopband <= ALIAS_STOPBAND_MAX_DB);
+}
+
+/* Matching formats are a straight copy */
+void
+test_pass_through()
+{
+    std::vector<int16_t> tone = makeTone(44100, 1000, 0.1);
+    convert(44100, 44100, tone);
+    TEST_ASSERT_EQUAL(tone.size() * sizeof(int16_t), sink.bytes.size());
+    TEST_ASSERT_EQUAL_MEMORY(tone.data(), sink.bytes.data(), sink.bytes.size());
+}
+
+/* A full scale square wave overshoots at every edge, which has to be clipped rather than wrapped round */
+void
+test_full_scale_clips()
+{
+    const size_t period = 100;
+    std::vector<int16_t> square(48000 * 2);
+    for (size_t i = 0; i < square.size(); i++) {
+        square[i] = (i / 2) % period < period / 2 ? INT16_MAX : INT16_MIN;
+    }
+    convert(48000, 44100, square);
+    size_t clipped = 0;
+    for (size_t i = 0; i < sink.frames(); i++) {
+        /* Away from the edges every sample is near the top or bottom of the range, on the side the input is */
+        double position = fmod(i * 48000.0 / 44100, period);
+        if (position > 5 && position < period / 2 - 5) {
+            TEST_ASSERT_TRUE(sink.sample(i, 0) > 30000);
+        } else if (position > period / 2 + 5 && position < period - 5) {
+            TEST_ASSERT_TRUE(sink.sample(i, 0) < -30000);
+        }
+        clipped += sink.sample(i, 0) == INT16_MAX || sink.sample(i, 0) == INT16_MIN;
+    }
+    TEST_ASSERT_GREATER_THAN(0, clipped);
+}
+
+/* Stereo through the filter, reported per output frame in cycles where there's a cycle counter and in nanoseconds */
+static void
+benchmark(uint32_t input_rate, uint32_t output_rate)
+{
+    std::vector<int16_t> tone = makeTone(input_rate, 1000, BENCHMARK_SECONDS);
+    auto start = std::chrono::steady_clock::now();
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t cycles = __rdtsc();
+#endif
+    convert(input_rate, output_rate, tone);
+#if defined(__x86_64__) || defined(__i386__)
+    cycles = __rdtsc() - cycles;
+#endif
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    size_t frames = sink.frames();
+
+    char message[120];
+#if defined(__x86_64__) || defined(__i386__)
+    snprintf(message, sizeof(message), "%u to %u Hz: %.1f cycles, %.1f ns per stereo frame out, %.0fx real time", input_rate, output_rate,
+             (double) cycles / frames, ns / frames, BENCHMARK_SECONDS * 1e9 / ns);
+#else
+    snprintf(message, sizeof(message), "%u to %u Hz: %.1f ns per stereo frame out, %.0fx real time", input_rate, output_rate, ns / frames,
+             BENCHMARK_SECONDS * 1e9 / ns);
+#endif
+    TEST_MESSAGE(message);
+}
+
+void
+test_benchmark()
+{
+    benchmark(48000, 44100);
+    benchmark(44100, 48000);
+    benchmark(22050, 44100);
+}
+
+int
+main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_tone_through_rate_pairs);
+    RUN_TEST(test_no_aliasing_going_down);
+    RUN_TEST(test_pass_through);
+    RUN_TEST(test_full_scale_clips);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,244 @@
+/**
+ * @file test_main.cpp
+ *
+ * @brief Runs a producer and a consumer thread against the RingBuffer, checking byte order across
+ * the wrap and that nothing from before a clear comes out after it.  Part of the native
+ * tests.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <atomic>
+#include <audio/ring_buffer.h>
+#include <random>
+#include <thread>
+#include <unity.h>
+
+#define STRESS_BYTES  (8 * 1024 * 1024) /* Pushed through the buffer by the ordering test */
+#define STRESS_CLEARS 2000              /* Clears made by the clear test */
+
+void
+setUp()
+{
+}
+
+void
+tearDown()
+{
+}
+
+/* The byte the producer writes at a given stream position, a prime period so it never lines up with the size */
+static uint8_t
+pattern(size_t position)
+{
+    return position % 251;
+}
+
+/* One thread writes a counting pattern, mixing write() with writeSpan(), and the other reads it back with a mix of
+read(), readSpan() and peek(), each in lengths that keep landing across the wrap.  Every byte has to come out once,
+in order. */
+void
+test_order_across_threads()
+{
+    Audio::RingBuffer ring(4096);
+    TEST_ASSERT_TRUE(ring.isValid());
+    std::atomic<size_t> bad{ 0 };
+
+    std::thread producer([&]() {
+        std::minstd_rand random(1);
+        uint8_t data[1500];
+        size_t position = 0;
+        while (position < STRESS_BYTES) {
+            size_t length = 1 + random() % sizeof(data);
+            if (length > STRESS_BYTES - position) {
+                length = STRESS_BYTES - position;
+            }
+            if (random() & 1) {
+                for (size_t i = 0; i < length; i++) {
+                    data[i] = pattern(position + i);
+                }
+                position += ring.write(data, length);
+            } else {
+                uint8_t* span;
+                size_t span_length = ring.writeSpan(&span);
+                if (span_length > length) {
+                    span_length = length;
+                }
+                for (size_t i = 0; i < span_length; i++) {
+                    span[i] = pattern(position + i);
+                }
+                ring.commitWrite(span_length);
+                position += span_length;
+            }
+            std::this_thread::yield();
+        }
+    });
+
+    std::minstd_rand random(2);
+    uint8_t data[1500];
+    size_t position = 0;
+    while (position < STRESS_BYTES) {
+        size_t length = 1 + random() % sizeof(data);
+        size_t got;
+        switch (random() % 3) {
+            case 0:
+                got = ring.read(data, length);
+                break;
+            case 1: {
+                const uint8_t* span;
+                got = ring.readSpan(&span);
+                if (got > length) {
+                    got = length;
+                }
+                memcpy(data, span, got);
+                ring.commitRead(got);
+                break;
+            }
+            default: {
+                /* peek() has to agree with what a read() straight after it returns */
+                uint8_t peeked[sizeof(data)];
+                size_t peeked_length = ring.peek(peeked, length);
+                got = ring.read(data, peeked_length);
+                if (got != peeked_length || memcmp(peeked, data, got) != 0) {
+                    bad++;
+                }
+                break;
+            }
+        }
+        for (size_t i = 0; i < got; i++) {
+            if (data[i] != pattern(position + i)) {
+                bad++;
+            }
+        }
+        position += got;
+        TEST_ASSERT_EQUAL(position, ring.readPosition());
+        std::this_thread::yield();
+    }
+    producer.join();
+
+    TEST_ASSERT_EQUAL(0, bad.load());
+    TEST_ASSERT_EQUAL(STRESS_BYTES, ring.writePosition());
+    TEST_ASSERT_EQUAL(0, ring.available());
+}
+
+/* The producer fills every span with the number of the stream it's on, read after the span is taken.  The reader
+keeps clearing the buffer, moving to the next stream just before each clear.  Once it sees the clear go through, any
+byte from an older stream is one that slipped past it. */
+void
+test_no_stale_bytes_after_clear()
+{
+    Audio::RingBuffer ring(1024);
+    std::atomic<uint8_t> stream{ 0 };
+    std::atomic<bool> done{ false };
+
+    std::thread producer([&]() {
+        std::minstd_rand random(3);
+        while (!done.load()) {
+            uint8_t* span;
+            size_t length = ring.writeSpan(&span);
+            uint8_t value = stream.load();
+            size_t wanted = 1 + random() % 300;
+            if (length > wanted) {
+                length = wanted;
+            }
+            for (size_t i = 0; i < length; i++) {
+                span[i] = value;
+                /* Give the reader a chance to clear in the middle of the span */
+                if (i % 64 == 0) {
+                    std::this_thread::yield();
+                }
+            }
+            ring.commitWrite(length);
+            std::this_thread::yield();
+        }
+    });
+
+    std::minstd_rand random(4);
+    size_t stale = 0;
+    size_t serviced = 0;
+    uint8_t floor = 0; /* The oldest stream that may still come out */
+    uint8_t pending = 0;
+    bool clearing = false;
+    uint8_t data[256];
+
+    for (int clears = 0; clears < STRESS_CLEARS;) {
+        if (!clearing && random() % 4 == 0) {
+            pending = stream.load() + 1;
+            stream.store(pending);
+            ring.clear();
+            clearing = true;
+            clears++;
+        }
+        /* Writes are refused until the clear is serviced.  Once they aren't, everything read is from after it. */
+        if (clearing && ring.availableForWrite() > 0) {
+            floor = pending;
+            clearing = false;
+            serviced++;
+        }
+        size_t got = ring.read(data, 1 + random() % sizeof(data));
+        for (size_t i = 0; i < got; i++) {
+            if ((uint8_t) (data[i] - floor) > 128) {
+                stale++;
+            }
+        }
+        std::this_thread::yield();
+    }
+    done.store(true);
+    producer.join();
+
+    TEST_ASSERT_EQUAL(0, stale);
+    TEST_ASSERT_GREATER_THAN(0, serviced);
+}
+
+/* A clear lands between writeSpan() and commitWrite(), that span must not come out */
+void
+test_clear_drops_span_in_flight()
+{
+    Audio::RingBuffer ring(256);
+    uint8_t data[16] = { 1, 2, 3 };
+    TEST_ASSERT_EQUAL(3, ring.write(data, 3));
+
+    uint8_t* span;
+    size_t length = ring.writeSpan(&span);
+    TEST_ASSERT_GREATER_THAN(16, length);
+    memset(span, 0xee, 16);
+    ring.clear();
+
+    /* Writes are refused from the clear on, but the consumer holds off dropping anything until the span is in */
+    TEST_ASSERT_EQUAL(0, ring.availableForWrite());
+    TEST_ASSERT_EQUAL(3, ring.available());
+    ring.commitWrite(16);
+    TEST_ASSERT_EQUAL(0, ring.available());
+    TEST_ASSERT_EQUAL(ring.writePosition(), ring.readPosition());
+
+    data[0] = 9;
+    TEST_ASSERT_EQUAL(1, ring.write(data, 1));
+    TEST_ASSERT_EQUAL(1, ring.read(data, sizeof(data)));
+    TEST_ASSERT_EQUAL(9, data[0]);
+}
+
+int
+main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_order_across_threads);
+    RUN_TEST(test_no_stale_bytes_after_clear);
+    RUN_TEST(test_clear_drops_span_in_flight);
+    return UNITY_END();
+}
@@ -0,0 +1,199 @@
+/**
+ * @file test_main.cpp
+ *
+ * @brief Reads the tags of a corpus of small files, one for each tag format and text encoding the
+ * TagReader handles.  Part of the native tests.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <audio/tag_reader.h>
+#include <system.h>
+#include <string>
+#include <unity.h>
+
+/* The corpus sits next to this file, built by hand so each one holds a known set of tags */
+static std::string
+corpus(const char* name)
+{
+    std::string path = __FILE__;
+    return path.substr(0, path.find_last_of('/') + 1) + "corpus/" + name;
+}
+
+static Audio::TagReader reader;
+static Audio::tags_t tags;
+
+static void
+read(const char* name, uint8_t type)
+{
+    TEST_ASSERT_TRUE_MESSAGE(reader.read(corpus(name).c_str(), type, &tags), name);
+}
+
+void
+setUp()
+{
+    Audio::TagReader::clear(&tags);
+}
+
+void
+tearDown()
+{
+}
+
+void
+test_id3v23_latin1()
+{
+    read("id3v23_latin1.mp3", FILETYPE_MP3);
+    TEST_ASSERT_EQUAL_STRING("Café del Mar", tags.title);
+    TEST_ASSERT_EQUAL_STRING("Energy 52", tags.artist);
+    TEST_ASSERT_EQUAL_STRING("Trance Classics", tags.album);
+    TEST_ASSERT_EQUAL_STRING("Trance", tags.genre);
+    TEST_ASSERT_EQUAL_STRING("1993", tags.year);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, -6.2, tags.gain_db);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 0.988, tags.peak);
+}
+
+void
+test_id3v24_utf8()
+{
+    read("id3v24_utf8.mp3", FILETYPE_MP3);
+    TEST_ASSERT_EQUAL_STRING("Ünïcödé ☃", tags.title);
+    TEST_ASSERT_EQUAL_STRING("First Artist", tags.artist);
+    TEST_ASSERT_EQUAL_STRING("Album", tags.album);
+    TEST_ASSERT_EQUAL_STRING("Electronic", tags.genre);
+    TEST_ASSERT_EQUAL_STRING("2021", tags.year);
+    TEST_ASSERT_FLOAT_IS_NAN(tags.gain_db);
+    TEST_ASSERT_EQUAL_FLOAT(0, tags.peak);
+}
+
+void
+test_id3v23_utf16()
+{
+    read("id3v23_utf16.mp3", FILETYPE_MP3);
+    TEST_ASSERT_EQUAL_STRING("Grüße", tags.title);
+    TEST_ASSERT_EQUAL_STRING("Björk 𝄞", tags.artist);
+    TEST_ASSERT_EQUAL_STRING("Homogenic", tags.album);
+}
+
+void
+test_id3v22()
+{
+    read("id3v22.mp3", FILETYPE_MP3);
+    TEST_ASSERT_EQUAL_STRING("Old Tag", tags.title);
+    TEST_ASSERT_EQUAL_STRING("Old Artist", tags.artist);
+    TEST_ASSERT_EQUAL_STRING("Old Album", tags.album);
+    TEST_ASSERT_EQUAL_STRING("Synthpop", tags.genre);
+    TEST_ASSERT_EQUAL_STRING("1998", tags.year);
+}
+
+void
+test_id3v24_unsync()
+{
+    read("id3v24_unsync.mp3", FILETYPE_MP3);
+    TEST_ASSERT_EQUAL_STRING("Naïveÿ", tags.title);
+    TEST_ASSERT_EQUAL_STRING("Unsync", tags.artist);
+}
+
+void
+test_id3v1()
+{
+    read("id3v1.mp3", FILETYPE_MP3);
+    TEST_ASSERT_EQUAL_STRING("Summertime", tags.title);
+    TEST_ASSERT_EQUAL_STRING("Ella Fitzgerald", tags.artist);
+    TEST_ASSERT_EQUAL_STRING("Porgy and Bess", tags.album);
+    TEST_ASSERT_EQUAL_STRING("Jazz", tags.genre);
+    TEST_ASSERT_EQUAL_STRING("1957", tags.year);
+}
+
+void
+test_id3v1_fills_gaps()
+{
+    read("id3v2_and_v1.mp3", FILETYPE_MP3);
+    TEST_ASSERT_EQUAL_STRING("From ID3v2", tags.title);
+    TEST_ASSERT_EQUAL_STRING("Artist From V1", tags.artist);
+    TEST_ASSERT_EQUAL_STRING("Album From V1", tags.album);
+    TEST_ASSERT_EQUAL_STRING("Rock", tags.genre);
+    TEST_ASSERT_EQUAL_STRING("2001", tags.year);
+}
+
+void
+test_flac_vorbis_comment()
+{
+    read("vorbis_comment.flac", FILETYPE_FLAC);
+    TEST_ASSERT_EQUAL_STRING("Clair de Lune", tags.title);
+    TEST_ASSERT_EQUAL_STRING("Claude Debussy", tags.artist);
+    TEST_ASSERT_EQUAL_STRING("Suite bergamasque", tags.album);
+    TEST_ASSERT_EQUAL_STRING("Classical", tags.genre);
+    TEST_ASSERT_EQUAL_STRING("1905", tags.year);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 1.5, tags.gain_db);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 0.5, tags.peak);
+}
+
+void
+test_flac_id3_ahead()
+{
+    read("id3_ahead.flac", FILETYPE_FLAC);
+    TEST_ASSERT_EQUAL_STRING("ID3 Title", tags.title);
+    TEST_ASSERT_EQUAL_STRING("Vorbis Artist", tags.artist);
+}
+
+void
+test_opus_tags()
+{
+    read("opus_tags.opus", FILETYPE_OGG);
+    TEST_ASSERT_EQUAL_STRING("Opus Title", tags.title);
+    TEST_ASSERT_EQUAL_STRING("Opus Artist", tags.artist);
+    /* R128 gain is Q7.8 against -23 LUFS, ReplayGain is against -18 */
+    TEST_ASSERT_FLOAT_WITHIN(0.001, -512 / 256.0 + 5, tags.gain_db);
+}
+
+void
+test_ogg_comments_across_pages()
+{
+    read("split_comments.ogg", FILETYPE_OGG);
+    TEST_ASSERT_EQUAL_STRING("Across Pages", tags.title);
+    TEST_ASSERT_EQUAL_STRING("Vorbis Artist", tags.artist);
+    TEST_ASSERT_EQUAL_STRING("Split Packet", tags.album);
+}
+
+void
+test_missing_file()
+{
+    TEST_ASSERT_FALSE(reader.read(corpus("missing.mp3").c_str(), FILETYPE_MP3, &tags));
+    TEST_ASSERT_EQUAL_STRING("", tags.title);
+}
+
+int
+main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_id3v23_latin1);
+    RUN_TEST(test_id3v24_utf8);
+    RUN_TEST(test_id3v23_utf16);
+    RUN_TEST(test_id3v22);
+    RUN_TEST(test_id3v24_unsync);
+    RUN_TEST(test_id3v1);
+    RUN_TEST(test_id3v1_fills_gaps);
+    RUN_TEST(test_flac_vorbis_comment);
+    RUN_TEST(test_flac_id3_ahead);
+    RUN_TEST(test_opus_tags);
+    RUN_TEST(test_ogg_comments_across_pages);
+    RUN_TEST(test_missing_file);
+    return UNITY_END();
+}
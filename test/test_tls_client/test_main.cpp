@@ -0,0 +1,285 @@
+/**
+ * @file test_main.cpp
+ *
+ * @brief Connects TlsClient to an openssl s_server on this machine again and again, and checks
+ * every connection after the first resumes its session.  Part of the native tests.
+ *
+ * @author Dan Copeland
+ *
+ * Licensed under GPL v3.0
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <WiFi.h>
+#include <audio/tls_client.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string>
+#include <sys/wait.h>
+#include <unity.h>
+
+#define TLS_CONNECTIONS  4    /* To the server in a row, all but the first should resume */
+#define SERVER_WAIT_MS   5000 /* Longest the server may take to start listening */
+#define REPLY_WAIT_MS    5000 /* Longest a reply may take before the test gives up on it */
+
+extern char** environ;
+
+/* Where the certificates are written, and the server run from them */
+static char directory[] = "/tmp/tls_client_XXXXXX";
+static uint16_t port;
+static pid_t server = -1;
+static std::string server_cert;
+static std::string other_cert;
+static bool serving;
+
+static std::string
+path(const char* name)
+{
+    return std::string(directory) + "/" + name;
+}
+
+static std::string
+readFile(const std::string& name)
+{
+    std::string text;
+    FILE* file = fopen(name.c_str(), "rb");
+    if (file) {
+        char data[4096];
+        size_t length;
+        while ((length = fread(data, 1, sizeof(data), file)) > 0) {
+            text.append(data, length);
+        }
+        fclose(file);
+    }
+    return text;
+}
+
+/* A self-signed P-256 certificate for localhost, which mbedtls can use as its own root */
+static bool
+makeCertificate(const char* name)
+{
+    std::string command = "openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes -days 1 -subj /CN=localhost"
+                          " -addext subjectAltName=DNS:localhost -keyout " +
+                          path(name) + ".key -out " + path(name) + ".pem >/dev/null 2>&1";
+    return system(command.c_str()) == 0;
+}
+
+/* A free port, as far as we can tell without holding on to it */
+static uint16_t
+freePort()
+{
+    int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    uint16_t found = 0;
+    if (bind(socket_fd, (sockaddr*) &address, sizeof(address)) == 0 && getsockname(socket_fd, (sockaddr*) &address, &length) == 0) {
+        found = ntohs(address.sin_port);
+    }
+    close(socket_fd);
+    return found;
+}
+
+/* Runs openssl s_server with its status page, which says on each connection whether the session was reused.  It
+keeps its own session cache and issues tickets, as a web server does, and a new one knows none of the old one's. */
+static bool
+startServer()
+{
+    std::string accept = std::to_string(port);
+    std::string cert = path("server.pem");
+    std::string key = path("server.key");
+    const char* argv[] = { "openssl", "s_server", "-quiet", "-www", "-accept", accept.c_str(), "-cert", cert.c_str(), "-key", key.c_str(), nullptr };
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+    int result = posix_spawnp(&server, "openssl", &actions, nullptr, (char* const*) argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (result != 0) {
+        server = -1;
+        return false;
+    }
+
+    /* Listening once a connection gets through, which the server takes as a failed handshake and forgets */
+    uint32_t start = millis();
+    while (millis() - start < SERVER_WAIT_MS) {
+        WiFiClient probe;
+        if (probe.connect(IPAddress(127, 0, 0, 1), port)) {
+            return true;
+        }
+        delay(20);
+    }
+    return false;
+}
+
+static void
+stopServer()
+{
+    if (server > 0) {
+        kill(server, SIGTERM);
+        waitpid(server, nullptr, 0);
+        server = -1;
+    }
+}
+
+/* The certificates, the port and the first server */
+static bool
+setUpServer()
+{
+    if (!mkdtemp(directory) || !makeCertificate("server") || !makeCertificate("other")) {
+        return false;
+    }
+    server_cert = readFile(path("server.pem"));
+    other_cert = readFile(path("other.pem"));
+    port = freePort();
+    return !server_cert.empty() && !other_cert.empty() && port != 0 && startServer();
+}
+
+static void
+tearDownServer()
+{
+    stopServer();
+    std::string command = "rm -rf " + std::string(directory);
+    system(command.c_str());
+}
+
+/* Connects, asks for the status page and reads it until the server closes.  Returns the page, empty if the
+connection failed. */
+static std::string
+fetch(Audio::TlsClient& client)
+{
+    if (!client.connect("localhost", port)) {
+        return "";
+    }
+    const char* request = "GET / HTTP/1.0\r\n\r\n";
+    client.write((const uint8_t*) request, strlen(request));
+
+    std::string page;
+    uint8_t data[1024];
+    uint32_t start = millis();
+    while (client.connected() && millis() - start < REPLY_WAIT_MS) {
+        int got = client.available() > 0 ? client.read(data, sizeof(data)) : 0;
+        if (got > 0) {
+            page.append((const char*) data, got);
+        } else {
+            delay(1);
+        }
+    }
+    client.stop();
+    return page;
+}
+
+void
+setUp()
+{
+    if (!serving) {
+        TEST_IGNORE_MESSAGE("Couldn't run openssl s_server");
+    }
+}
+
+void
+tearDown()
+{
+}
+
+/* The first connection does the full handshake and every later one resumes its session, as the server agrees */
+void
+test_resumption()
+{
+    WiFiClient transport;
+    Audio::TlsClient client(transport);
+    for (int i = 0; i < TLS_CONNECTIONS; i++) {
+        std::string page = fetch(client);
+        TEST_ASSERT_TRUE_MESSAGE(page.find("200 ok") != std::string::npos, "No status page from the server");
+        bool reused = page.find("Reused, ") != std::string::npos;
+        TEST_ASSERT_EQUAL(i > 0, reused);
+    }
+
+    Audio::TlsClient::stats_t stats = client.getStats();
+    TEST_ASSERT_EQUAL(TLS_CONNECTIONS, stats.handshakes);
+    TEST_ASSERT_EQUAL(TLS_CONNECTIONS - 1, stats.resumed);
+}
+
+/* With roots the server's certificate has to check out, and a resumed session still counts as checked */
+void
+test_resumption_with_roots()
+{
+    WiFiClient transport;
+    Audio::TlsClient client(transport);
+    TEST_ASSERT_TRUE(client.setCACert(server_cert.c_str()));
+    for (int i = 0; i < TLS_CONNECTIONS; i++) {
+        std::string page = fetch(client);
+        TEST_ASSERT_TRUE_MESSAGE(page.find("200 ok") != std::string::npos, "No status page from the server");
+        TEST_ASSERT_EQUAL(i > 0, page.find("Reused, ") != std::string::npos);
+    }
+
+    Audio::TlsClient::stats_t stats = client.getStats();
+    TEST_ASSERT_EQUAL(TLS_CONNECTIONS, stats.handshakes);
+    TEST_ASSERT_EQUAL(TLS_CONNECTIONS - 1, stats.resumed);
+}
+
+/* A server that has forgotten the session does the full handshake, which isn't counted as resumed, and the new
+session is the one kept */
+void
+test_session_forgotten()
+{
+    WiFiClient transport;
+    Audio::TlsClient client(transport);
+    TEST_ASSERT_TRUE(fetch(client).find("200 ok") != std::string::npos);
+
+    stopServer();
+    serving = startServer();
+    TEST_ASSERT_TRUE_MESSAGE(serving, "Couldn't restart openssl s_server");
+    std::string page = fetch(client);
+    TEST_ASSERT_TRUE(page.find("200 ok") != std::string::npos);
+    TEST_ASSERT_TRUE(page.find("Reused, ") == std::string::npos);
+    TEST_ASSERT_EQUAL(0, client.getStats().resumed);
+
+    page = fetch(client);
+    TEST_ASSERT_TRUE(page.find("Reused, ") != std::string::npos);
+    TEST_ASSERT_EQUAL(3, client.getStats().handshakes);
+    TEST_ASSERT_EQUAL(1, client.getStats().resumed);
+}
+
+/* A server the roots don't vouch for is turned away, and nothing is kept to resume */
+void
+test_unknown_server_rejected()
+{
+    WiFiClient transport;
+    Audio::TlsClient client(transport);
+    TEST_ASSERT_TRUE(client.setCACert(other_cert.c_str()));
+    TEST_ASSERT_EQUAL_STRING("", fetch(client).c_str());
+    TEST_ASSERT_EQUAL_STRING("", fetch(client).c_str());
+    TEST_ASSERT_EQUAL(0, client.getStats().handshakes);
+}
+
+int
+main()
+{
+    serving = setUpServer();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_resumption);
+    RUN_TEST(test_resumption_with_roots);
+    RUN_TEST(test_session_forgotten);
+    RUN_TEST(test_unknown_server_rejected);
+    int failures = UNITY_END();
+    tearDownServer();
+    return failures;
+}